@@ -10,7 +10,11 @@
  */
 
 #include <string.h>
+#ifdef ARDUINO
 #include <Arduino.h>
+#else
+#include <time.h>
+#endif
 #include "scheduler.h"
 
 /*
@@ -176,6 +180,7 @@ typedef struct {
     event_mask_t current_events;
     time_t last_scheduling;
     time_t next_scheduling;
+    scheduler_stats_t stats;
 } scheduler_t;
 
 /*
@@ -188,6 +193,8 @@ typedef scheduler_t * scheduler_ref_t;
  *  Scheduler Internal Helper Functions
  */
 
+#ifdef ARDUINO
+
 static inline time_t system_time(void)
 {
     return micros();
@@ -203,6 +210,22 @@ static inline void enabled_interrupts(void)
     interrupts();
 }
 
+#else /* Host shim, there are no interrupts to mask. */
+
+static inline time_t system_time(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (time_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static inline void disable_interrupts(void) {}
+
+static inline void enabled_interrupts(void) {}
+
+#endif /* ARDUINO */
+
 static bool micro_time_is_in_range(
     time_t check_time,
     time_t lower_bound,
@@ -636,6 +659,7 @@ static void scheduler_call_next(scheduler_ref_t scheduler)
 {
     scheduled_task_ref_t task;
     uint8_t exit_code;
+    time_t started, elapsed;
 
     if (scheduler->current_task)
     {
@@ -653,6 +677,7 @@ static void scheduler_call_next(scheduler_ref_t scheduler)
 
 
     scheduler->current_task = task;
+    started = system_time();
 
     /*
      * Call function based on type of task call.
@@ -673,6 +698,17 @@ static void scheduler_call_next(scheduler_ref_t scheduler)
 
     scheduler->current_task = NULL;
 
+    elapsed = system_time() - started;
+    scheduler->stats.tasks_run++;
+    if (exit_code == TASK_EXIT_FAILED)
+    {
+        scheduler->stats.tasks_failed++;
+    }
+    if ((uint32_t) elapsed > scheduler->stats.longest_task_us)
+    {
+        scheduler->stats.longest_task_us = (uint32_t) elapsed;
+    }
+
     /*
      * Determine what to do with leftover task schedule.
      *  Order of priority:
@@ -1446,6 +1482,19 @@ uint8_t scheduler_exit_code_of(task_id_t task_id)
     return exit_code;
 }
 
+void scheduler_read_stats(scheduler_stats_t * stats)
+{
+    if (!stats)
+    {
+        return;
+    }
+
+    disable_interrupts();
+    *stats = scheduler.stats;
+    memset(&scheduler.stats, 0, sizeof(scheduler_stats_t));
+    enabled_interrupts();
+}
+
 /*
  *  Scheduler Module Control Functions
  */
@@ -115,6 +115,16 @@ typedef int8_t task_id_t;
  */
 typedef uint16_t event_mask_t;
 
+/*
+ * Structure: scheduler_stats_t
+ *  Counters of the tasks run since they were last read.
+ */
+typedef struct {
+    uint32_t tasks_run;
+    uint32_t tasks_failed;
+    uint32_t longest_task_us;
+} scheduler_stats_t;
+
 /*
  * Typedef task_t
  *  Function pointer type of a valid task.
@@ -350,6 +360,15 @@ task_id_t scheduler_last_task_id(void);
  */
 uint8_t scheduler_exit_code_of(task_id_t task_id);
 
+/*
+ * Function: scheduler_read_stats
+ *  Copies the task counters, then starts them over.
+ *
+ * Parameters:
+ *  stats - Receives the counters since the last call.
+ */
+void scheduler_read_stats(scheduler_stats_t * stats);
+
 /*
  *  Scheduler Module Initialize and Loop
  */
@@ -0,0 +1,39 @@
+#!/bin/sh
+#
+#  Builds the stand-in tool, tools/standin_main.cpp, on the host.
+#  It links the sources of the native environment in platformio.ini,
+#  so it builds from the same modules as the host_* tests:
+#
+#      scripts/build_standin.sh [output]
+#
+#  The output defaults to .pio/standin.  Like the PlatformIO builds,
+#  gen/env_config.h is generated from .env first.
+#
+#  Copyright (c) 2018 Alex Dale
+#  See LICENSE for information.
+#
+
+set -e
+
+cd "$(dirname "$0")/.."
+OUTPUT="${1:-.pio/standin}"
+OBJECTS=".pio/standin.obj"
+INCLUDES="-Isrc -Igen -Ilib/scheduler"
+FLAGS="-O2 -Wall -pthread"
+
+mkdir -p gen "$OBJECTS" "$(dirname "$OUTPUT")"
+python3 scripts/auto_header.py -o gen/env_config.h .env
+
+SOURCES=$(sed -n '/^\[env:native\]/,/^\[/p' platformio.ini \
+    | sed -n 's/^src_filter *=//p' | grep -o '+<[^>]*>' | sed 's/^+<\(.*\)>$/\1/')
+
+for source in $SOURCES; do
+    case "$source" in
+        *.c) gcc $FLAGS $INCLUDES -c "src/$source" -o "$OBJECTS/$source.o" ;;
+        *) g++ $FLAGS $INCLUDES -c "src/$source" -o "$OBJECTS/$source.o" ;;
+    esac
+done
+gcc $FLAGS -Ilib/scheduler -c lib/scheduler/scheduler.c -o "$OBJECTS/scheduler.c.o"
+
+g++ $FLAGS $INCLUDES tools/standin_main.cpp "$OBJECTS"/*.o -lssl -lcrypto -o "$OUTPUT"
+echo "Built $OUTPUT"
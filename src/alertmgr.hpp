@@ -16,6 +16,8 @@
 
 #include "dlog.h"
 #include "konstants.h"
+#include "snapshot.h"
+#include "transport.h"
 #include "uuid.h"
 #include "utils.h"
 
@@ -45,8 +47,17 @@ extern kstring_t kAlertManagerEnabledActiveModeCancelling;
  *      void alert_flash(void);
  *
  *  Expected Messenger Interface
- *      void request_help()
- *      void cancel_help(uint32_t request_id)
+ *      void prepare_help(void)
+ *      void abandon_help(void)
+ *      transport_status_t request_help(uuid_ref_t request_id)
+ *      bool_t cancel_help(uuid_kref_t request_id)
+ *
+ *  A help request is sent in the background: request_help() starts
+ *  it, and is TRANSPORT_PENDING until it is over.
+ *
+ *  A new alert is given its request ID when the button is pushed,
+ *  a version 7 UUID, so alerts made offline are known and ordered
+ *  by when they were raised.  Every attempt reuses it.
  */
 template<class Indicator, class Messenger>
 class AlertManager {
@@ -144,6 +155,7 @@ class AlertManager {
     enabled_active_mode_t _stored_enabled_active_mode;
 
     uuid_t _request_id;
+    bool_t _attempted;
 
     /*
      *  Constructor
@@ -157,7 +169,8 @@ class AlertManager {
         _enabled_active_mode(ENABLED_ACTIVE_MODE_SENT),
         _stored_mode(MODE_DISABLED),
         _stored_enabled_mode(ENABLED_MODE_IDLE),
-        _stored_enabled_active_mode(ENABLED_ACTIVE_MODE_SENT)
+        _stored_enabled_active_mode(ENABLED_ACTIVE_MODE_SENT),
+        _attempted(false)
     {
         memset(_request_id, 0, sizeof(_request_id));
     }
@@ -428,6 +441,58 @@ public:
         return _request_id;
     }
 
+    /* Snapshot */
+
+    void save_snapshot(snapshot_t * snapshot)
+    {
+        if (!snapshot) return;
+        snapshot->mode = (uint8_t) _mode;
+        snapshot->enabled_mode = (uint8_t) _enabled_mode;
+        snapshot->enabled_active_mode = (uint8_t) _enabled_active_mode;
+        snapshot->stored_mode = (uint8_t) _stored_mode;
+        snapshot->stored_enabled_mode = (uint8_t) _stored_enabled_mode;
+        snapshot->stored_enabled_active_mode = (uint8_t) _stored_enabled_active_mode;
+        memcpy(snapshot->request_id, _request_id, sizeof(_request_id));
+    }
+
+    /*
+     *  Resumes the state held in a snapshot.  Only a disabled
+     *  manager can be resumed, and a snapshot of a disabled
+     *  manager is not resumed.  Indicators are driven as if the
+     *  state had been entered normally.
+     */
+    bool_t resume(snapshot_t const * snapshot)
+    {
+        if (!is_init() || !is_disabled()) return false;
+        if (!snapshot_is_valid(snapshot)) return false;
+        if (snapshot->mode == MODE_DISABLED
+            || snapshot->mode > MODE_DISCONNECTED
+            || snapshot->enabled_mode > ENABLED_MODE_ACTIVE
+            || snapshot->enabled_active_mode > ENABLED_ACTIVE_MODE_CANCELLING
+            || snapshot->stored_mode > MODE_DISCONNECTED
+            || snapshot->stored_enabled_mode > ENABLED_MODE_ACTIVE
+            || snapshot->stored_enabled_active_mode > ENABLED_ACTIVE_MODE_CANCELLING)
+        {
+            return false;
+        }
+
+        DLOG("Resuming Alert Manager from snapshot");
+        memcpy(_request_id, snapshot->request_id, sizeof(_request_id));
+        /* One being sent may have reached the platform before the reset. */
+        _attempted = !uuid_is_zero(_request_id);
+
+        /* Enter the snapshot's state through the stored state path. */
+        _stored_mode = (mode_t) snapshot->mode;
+        _stored_enabled_mode = (enabled_mode_t) snapshot->enabled_mode;
+        _stored_enabled_active_mode = (enabled_active_mode_t) snapshot->enabled_active_mode;
+        restore_state();
+
+        _stored_mode = (mode_t) snapshot->stored_mode;
+        _stored_enabled_mode = (enabled_mode_t) snapshot->stored_enabled_mode;
+        _stored_enabled_active_mode = (enabled_active_mode_t) snapshot->stored_enabled_active_mode;
+        return true;
+    }
+
     /* Event Triggers */
 
     void enable(void)
@@ -443,17 +508,42 @@ public:
         set_mode(MODE_DISABLED);
     }
 
+    void help_button_debouncing(void)
+    {
+        if (!is_idle()) return;
+        _messenger->prepare_help();
+    }
+
+    void help_button_rejected(void)
+    {
+        if (!is_idle()) return;
+        DLOG("Help Button Rejected Event");
+        _messenger->abandon_help();
+    }
+
     void help_button_push(void)
     {
         if (!is_idle()) return;
         DLOG("Help Button Pushed Event");
+        uuid_v7(_request_id);
+        _attempted = false;
         set_enabled_active_mode(ENABLED_ACTIVE_MODE_SENDING);
     }
 
+    /*
+     *  An alert still being sent can be cancelled by its ID, which
+     *  the platform may have without the device knowing.  One which
+     *  was never attempted has nothing to cancel.
+     */
     void reset_button_push(void)
     {
-        if (!is_sent() && !is_acknowledged()) return;
+        if (!is_sending() && !is_sent() && !is_acknowledged()) return;
         DLOG("Cancel Button Pushed Event");
+        if (is_sending() && !_attempted)
+        {
+            set_enabled_mode(ENABLED_MODE_IDLE);
+            return;
+        }
         set_enabled_active_mode(ENABLED_ACTIVE_MODE_CANCELLING);
     }
 
@@ -464,14 +554,24 @@ public:
         set_enabled_active_mode(ENABLED_ACTIVE_MODE_ACKNOWLEDGED);
     }
 
-    void try_send(void)
+    /*
+     *  Starts sending the alert, or takes the result of the attempt
+     *  in flight.  Returns false while it is still in flight.
+     */
+    bool_t try_send(void)
     {
-        if (!is_sending()) return;
+        transport_status_t status;
+
+        if (!is_sending()) return false;
         DLOG("Try Send Alert Event");
-        if (_messenger->request_help(_request_id))
+        _attempted = true;
+        status = _messenger->request_help(_request_id);
+        if (status == TRANSPORT_PENDING) return false;
+        if (status == TRANSPORT_DELIVERED)
         {
             set_enabled_active_mode(ENABLED_ACTIVE_MODE_SENT);
         }
+        return true;
     }
 
     void try_cancel(void)
@@ -513,6 +613,7 @@ public:
         _enabled_mode = ENABLED_MODE_NONE;
         _enabled_active_mode = ENABLED_ACTIVE_MODE_NONE;
         memset(_request_id, 0, sizeof(_request_id));
+        _attempted = false;
     }
 
     typedef Indicator indicator_t;
@@ -14,7 +14,8 @@
 BufStr::BufStr(char_t * buffer, uint16_t size, bool_t clear):
     _start(buffer),
     _size(size),
-    _length(0)
+    _length(0),
+    _overflow(false)
 {
     if (clear)
     {
@@ -30,8 +31,44 @@ BufStr::BufStr(char_t * buffer, uint16_t size, bool_t clear):
     }
 }
 
+/* What may still be written, terminator included; none once overflowed. */
+uint16_t BufStr::room(void)
+{
+    return (_start && !_overflow) ? _size - _length : 0;
+}
+
+/* Where the next push writes, or NULL, which the formatters take as no room. */
+string_t BufStr::end(void)
+{
+    return room() ? &_start[_length] : NULL;
+}
+
+/*
+ *  Takes what a formatter wrote at the end, if all `required` of it
+ *  fit, or drops what it cut and overflows.
+ */
+BufStr & BufStr::wrote(uint16_t required)
+{
+    uint16_t left = room();
+
+    if (required < left)
+    {
+        _length += required;
+    }
+    else
+    {
+        if (left)
+        {
+            _start[_length] = 0;
+        }
+        _overflow = true;
+    }
+    return *this;
+}
+
 bool_t BufStr::clear(void)
 {
+    _overflow = false;
     if (_start && _size)
     {
         memset(_start, 0, _size);
@@ -41,47 +78,186 @@ bool_t BufStr::clear(void)
     return false;
 }
 
+/* Pushes as much of the string as fits.  Returns whether all of it did. */
 bool_t BufStr::push_str(kstring_t s)
 {
-    char_t * ptr;
-    uint8_t i;
+    string_t out, last;
 
-    if (!_start || !s)
+    if (!s)
     {
         return false;
     }
-
-    if ((_length + 1) >= _size)
+    if (!room())
     {
+        _overflow = true;
         return false;
     }
-    ptr = &_start[_length];
 
-    for (i = 0; s[i] && (_length+1) < _size; i++)
+    out = &_start[_length];
+    last = &_start[_size - 1];
+    while (*s && out != last)
     {
-        *ptr++ = s[i];
-        _length++;
+        *out++ = *s++;
     }
-    *ptr = 0;
-    return !s[i];
+    *out = 0;
+    _length = (uint16_t) (out - _start);
+
+    if (*s)
+    {
+        _overflow = true;
+    }
+    return !*s;
 }
 
 bool_t BufStr::push_char(char_t c)
 {
-    if (!_start)
+    if (room() < 2)
     {
+        _overflow = true;
         return false;
     }
 
-    if ((_length + 1) >= _size)
+    _start[_length++] = c;
+    _start[_length] = 0;
+
+    return true;
+}
+
+/*
+ *  Pushes the string URL encoded, in place, as much as fits without
+ *  splitting an escape.  Returns whether all of it did.
+ */
+bool_t BufStr::push_urlencoded(kstring_t s, smlurl_mode_t mode)
+{
+    uint16_t left;
+
+    if (!s)
     {
         return false;
     }
 
-    _start[_length++] = c;
-    _start[_length] = 0;
+    left = room();
+    if (left)
+    {
+        _length += smlurlencpart(&_start[_length], &s, mode, left - 1);
+        _start[_length] = 0;
+    }
 
-    return true;
+    if (*s)
+    {
+        _overflow = true;
+    }
+    return !*s;
+}
+
+BufStr & BufStr::push_uint(uint32_t val)
+{
+    return wrote(smluintfmt(end(), val, room()));
+}
+
+BufStr & BufStr::push_int(int32_t val)
+{
+    return wrote(smlintfmt(end(), val, room()));
+}
+
+/* Upper case, zero padded to `width` digits, up to eight. */
+BufStr & BufStr::push_hex(uint32_t val, uint8_t width)
+{
+    return wrote(smlhexfmt(end(), val, width, room()));
+}
+
+/* A value counted in units of the last of `places` decimal places. */
+BufStr & BufStr::push_fixed(int32_t val, uint8_t places)
+{
+    return wrote(smlfixfmt(end(), val, places, room()));
+}
+
+/* The ID's text, in lower case. */
+BufStr & BufStr::push_uuid(uuid_kref_t uuid)
+{
+    if (!uuid)
+    {
+        return *this;
+    }
+
+    if (room() >= UUID_BUFFER_LENGTH)
+    {
+        uuid_from_binary(end(), uuid);
+    }
+    return wrote(UUID_BUFFER_LENGTH - 1);
+}
+
+/* Whether a character must be escaped in a JSON string. */
+static inline bool_t needs_escape(char_t c)
+{
+    return c == '"' || c == '\\' || (byte_t) c < 0x20;
+}
+
+/* The escape for a character that needs one, and its length. */
+static uint8_t json_escape(char_t c, char_t * escape)
+{
+    escape[0] = '\\';
+    switch (c)
+    {
+        case '"':  escape[1] = '"';  return 2;
+        case '\\': escape[1] = '\\'; return 2;
+        case '\b': escape[1] = 'b';  return 2;
+        case '\f': escape[1] = 'f';  return 2;
+        case '\n': escape[1] = 'n';  return 2;
+        case '\r': escape[1] = 'r';  return 2;
+        case '\t': escape[1] = 't';  return 2;
+        default:
+            memcpy(&escape[1], "u00", 3);
+            smlhexfmt(&escape[4], (byte_t) c, 2, 3);
+            return 6;
+    }
+}
+
+/*
+ *  Pushes the text escaped for the inside of a JSON string, without
+ *  its quotes, as much as fits without splitting an escape.
+ */
+BufStr & BufStr::push_escaped(kstring_t s)
+{
+    char_t escape[8];
+    string_t out, last;
+    uint8_t escaped;
+
+    if (!s)
+    {
+        return *this;
+    }
+    if (!room())
+    {
+        _overflow = _overflow || *s;
+        return *this;
+    }
+
+    /* The last byte is the terminator's. */
+    out = &_start[_length];
+    last = &_start[_size - 1];
+    for (; *s; s++)
+    {
+        if (!needs_escape(*s))
+        {
+            if (out == last) break;
+            *out++ = *s;
+            continue;
+        }
+
+        escaped = json_escape(*s, escape);
+        if (escaped > last - out) break;
+        memcpy(out, escape, escaped);
+        out += escaped;
+    }
+    *out = 0;
+    _length = (uint16_t) (out - _start);
+
+    if (*s)
+    {
+        _overflow = true;
+    }
+    return *this;
 }
 
 char_t * BufStr::buffer(void)
@@ -98,3 +274,8 @@ uint16_t BufStr::length(void)
 {
     return _length;
 }
+
+bool_t BufStr::overflowed(void)
+{
+    return _overflow;
+}
@@ -1,6 +1,17 @@
 /*
  *  Module: Buffer String
  *
+ *  Appends to a string in a buffer it is given, always terminated.
+ *  Numbers, IDs and escaped text are formatted straight into it, with
+ *  no buffer of their own and no heap.
+ *
+ *  The typed pushes return the string, so that they chain.  Numbers
+ *  and IDs go in whole or not at all, text as much as fits without
+ *  splitting an escape.  The first push that does not fit sets a flag
+ *  that stays until clear(), and every push after it writes nothing,
+ *  so the string is either complete or a clean prefix: check
+ *  overflowed() once, at the end.
+ *
  *  Author: Alex Dale @superoxigen
  *
  *  Copyright (c) 2018 Alex Dale
@@ -10,12 +21,19 @@
 #ifndef _BUFSTR_HPP_
 #define _BUFSTR_HPP_
 
+#include "smlstr.h"
 #include "utils.h"
+#include "uuid.h"
 
 class BufStr {
     char_t * _start;
     uint16_t _size;
     uint16_t _length;
+    bool_t _overflow;
+
+    uint16_t room(void);
+    string_t end(void);
+    BufStr & wrote(uint16_t required);
 
 public:
     BufStr(char_t * buffer, uint16_t size, bool_t clear=true);
@@ -23,10 +41,19 @@ public:
     bool_t clear(void);
     bool_t push_str(kstring_t s);
     bool_t push_char(char_t c);
+    bool_t push_urlencoded(kstring_t s, smlurl_mode_t mode);
+
+    BufStr & push_uint(uint32_t val);
+    BufStr & push_int(int32_t val);
+    BufStr & push_hex(uint32_t val, uint8_t width=0);
+    BufStr & push_fixed(int32_t val, uint8_t places);
+    BufStr & push_uuid(uuid_kref_t uuid);
+    BufStr & push_escaped(kstring_t s);
 
     char_t * buffer(void);
     uint16_t size(void);
     uint16_t length(void);
+    bool_t overflowed(void);
 };
 
 #endif /* _BUFSTR_HPP_ */
@@ -30,6 +30,7 @@ static bool_t time_between(time_ms_t early_time, time_ms_t test_time, time_ms_t
 Button::Button(Pin * pin):
     _pin(pin),
     _button_state(IDLE_STATE),
+    _rejected(false),
     _hc(0),
     _lc(0),
     _last_check(0),
@@ -43,6 +44,22 @@ bool_t Button::is_pressed(void)
     return true;
 }
 
+bool_t Button::is_debouncing(void) const
+{
+    return _button_state == READING_STATE;
+}
+
+/*
+ *  True once after the debouncing of a press ends without the
+ *  press being accepted.
+ */
+bool_t Button::is_rejected(void)
+{
+    if (!_rejected) return false;
+    _rejected = false;
+    return true;
+}
+
 void Button::loop(void)
 {
     time_ms_t now;
@@ -55,6 +72,7 @@ void Button::loop(void)
             /* Begin reading / debouncing process. */
             _hc = 1;
             _lc = 0;
+            _rejected = false;
             _button_state = READING_STATE;
             _last_check = micros();
             _next_check = _last_check + DEBOUNCE_DELAY_MS;
@@ -83,6 +101,7 @@ void Button::loop(void)
             else if (_lc >= CONSEC_READ)
             {
                 _button_state = IDLE_STATE;
+                _rejected = true;
             }
             else /* Still debouncing. */
             {
@@ -28,6 +28,7 @@ class Button {
     Pin * _pin;
 
     button_state_t _button_state;
+    bool_t _rejected;
     uint8_t _hc;
     uint8_t _lc;
     time_ms_t _last_check;
@@ -37,6 +38,8 @@ public:
     Button(Pin * pin);
 
     bool_t is_pressed(void);
+    bool_t is_debouncing(void) const;
+    bool_t is_rejected(void);
 
     void loop(void);
 };
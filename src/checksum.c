@@ -0,0 +1,36 @@
+/*
+ *  Module: Checksum
+ *
+ *  CRC-32 (IEEE 802.3) of the records kept in RTC memory.
+ *
+ *  Author: Alex Dale @superoxigen
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for information.
+ */
+
+#include "checksum.h"
+
+/* Nibble table, to keep flash usage small. */
+static uint32_t const kCrcTable[16] = {
+    0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC,
+    0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+    0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C,
+    0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+};
+
+uint32_t checksum_crc32(void const * data, uint16_t length)
+{
+    byte_t const * ptr;
+    uint16_t i;
+    uint32_t crc;
+
+    ptr = (byte_t const *) data;
+    crc = 0xFFFFFFFF;
+    for (i = 0; i < length; i++)
+    {
+        crc = kCrcTable[(crc ^ ptr[i]) & 0x0F] ^ (crc >> 4);
+        crc = kCrcTable[(crc ^ (ptr[i] >> 4)) & 0x0F] ^ (crc >> 4);
+    }
+    return ~crc;
+}
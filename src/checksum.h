@@ -0,0 +1,23 @@
+/*
+ *  Module: Checksum
+ *
+ *  CRC-32 (IEEE 802.3) of the records kept in RTC memory.
+ *
+ *  Author: Alex Dale @superoxigen
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for information.
+ */
+
+#ifndef _CHECKSUM_H_
+#define _CHECKSUM_H_
+
+#include "utils.h"
+
+START_C_SECTION
+
+uint32_t checksum_crc32(void const * data, uint16_t length);
+
+END_C_SECTION
+
+#endif /* _CHECKSUM_H_ */
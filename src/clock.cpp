@@ -0,0 +1,184 @@
+/*
+ *  Module: Clock
+ *
+ *  Monotonic time since boot.  Uses the Arduino timers on the
+ *  device and the monotonic clock on the host.
+ *
+ *  Author: Alex Dale @superoxigen
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for information.
+ */
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#include <sys/time.h>
+#else
+#include <time.h>
+#endif
+
+#include "clock.h"
+
+/* SNTP's time is taken once it is past this, 2020-01-01; before, it has not synced. */
+#define CLOCK_UNIX_FLOOR_S      1577836800UL
+
+#define CLOCK_NTP_SERVER        "pool.ntp.org"
+#define CLOCK_NTP_FALLBACK      "time.nist.gov"
+
+#ifdef ARDUINO
+
+C_FUNCTION time_ms_t clock_millis(void)
+{
+    return millis();
+}
+
+C_FUNCTION time_us_t clock_micros(void)
+{
+    return micros();
+}
+
+C_FUNCTION void clock_delay(uint16_t ms)
+{
+    delay(ms);
+}
+
+static uint64_t s_unix_offset = 0;
+static bool_t s_unix_set = false;
+static bool_t s_unix_sntp = false;
+
+static uint32_t s_last_millis = 0;
+static uint32_t s_millis_wraps = 0;
+
+/*
+ *  millis() widened to 64 bits, counting each time it wraps, every
+ *  49.7 days.  It must be read at least that often, as heartbeats do.
+ */
+static uint64_t millis64(void)
+{
+    uint32_t now = millis();
+
+    if (now < s_last_millis) s_millis_wraps++;
+    s_last_millis = now;
+    return ((uint64_t) s_millis_wraps << 32) | now;
+}
+
+/* SNTP's time, if it has synced. */
+static bool_t read_sntp(uint64_t * now)
+{
+    struct timeval tv;
+
+    if (gettimeofday(&tv, NULL) || (uint32_t) tv.tv_sec < CLOCK_UNIX_FLOOR_S) return false;
+    *now = tv.tv_sec * 1000ULL + tv.tv_usec / 1000;
+    return true;
+}
+
+/*
+ *  Once SNTP has synced, its time is read every time, as it keeps it
+ *  in step.  Otherwise it counts on from when it was set.
+ */
+C_FUNCTION uint64_t clock_unix_millis(void)
+{
+    uint64_t now;
+
+    if ((s_unix_sntp || !s_unix_set) && read_sntp(&now))
+    {
+        s_unix_set = s_unix_sntp = true;
+        s_unix_offset = now - millis64();
+        return now;
+    }
+    return s_unix_offset + millis64();
+}
+
+C_FUNCTION bool_t clock_unix_is_set(void)
+{
+    if (!s_unix_set) clock_unix_millis();
+    return s_unix_set;
+}
+
+C_FUNCTION void clock_set_unix_millis(uint64_t now)
+{
+    s_unix_set = now != 0;
+    s_unix_sntp = false;
+    s_unix_offset = s_unix_set ? now - millis64() : 0;
+}
+
+/* In UTC.  The stack syncs in the background; read_sntp() picks it up. */
+C_FUNCTION void clock_sync_start(void)
+{
+    configTime(0, 0, CLOCK_NTP_SERVER, CLOCK_NTP_FALLBACK);
+}
+
+#else /* POSIX */
+
+static bool_t s_virtual = false;
+static uint64_t s_virtual_us = 0;
+static int64_t s_unix_adjust = 0;
+static bool_t s_unix_set = true;
+
+C_FUNCTION time_ms_t clock_millis(void)
+{
+    struct timespec ts;
+    if (s_virtual) return (time_ms_t) (s_virtual_us / 1000);
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (time_ms_t) (ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000);
+}
+
+C_FUNCTION time_us_t clock_micros(void)
+{
+    struct timespec ts;
+    if (s_virtual) return (time_us_t) s_virtual_us;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (time_us_t) (ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000);
+}
+
+C_FUNCTION void clock_delay(uint16_t ms)
+{
+    struct timespec ts;
+    if (s_virtual)
+    {
+        s_virtual_us += ms * 1000ULL;
+        return;
+    }
+    ts.tv_sec = ms / 1000;
+    ts.tv_nsec = (ms % 1000) * 1000000L;
+    nanosleep(&ts, NULL);
+}
+
+static uint64_t real_unix_millis(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+C_FUNCTION uint64_t clock_unix_millis(void)
+{
+    return real_unix_millis() + s_unix_adjust;
+}
+
+C_FUNCTION bool_t clock_unix_is_set(void)
+{
+    return s_unix_set;
+}
+
+/* Moves the host's time, as a device would be told it, for tests. */
+C_FUNCTION void clock_set_unix_millis(uint64_t now)
+{
+    s_unix_set = now != 0;
+    s_unix_adjust = s_unix_set ? (int64_t) (now - real_unix_millis()) : 0;
+}
+
+/* The host's clock is already set. */
+C_FUNCTION void clock_sync_start(void) {}
+
+/* Starts from where the monotonic clock is. */
+C_FUNCTION void clock_set_virtual(bool_t on)
+{
+    if (on && !s_virtual)
+    {
+        s_virtual_us = clock_millis() * 1000ULL;
+    }
+    s_virtual = on;
+}
+
+#endif /* ARDUINO */
@@ -0,0 +1,53 @@
+/*
+ *  Module: Clock
+ *
+ *  Monotonic time since boot.  Uses the Arduino timers on the
+ *  device and the monotonic clock on the host.
+ *
+ *  Author: Alex Dale @superoxigen
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for information.
+ */
+
+#ifndef _CLOCK_H_
+#define _CLOCK_H_
+
+#include "utils.h"
+
+/* Time elapsed since `since`, correct across overflow. */
+#define CLOCK_ELAPSED(now, since) ((uint32_t) ((now) - (since)))
+
+START_C_SECTION
+
+time_ms_t clock_millis(void);
+time_us_t clock_micros(void);
+
+/*
+ *  Milliseconds since the Unix epoch.  The device has no wall clock,
+ *  so it counts from boot until it is told the time, by SNTP once
+ *  clock_sync_start() has been called on a network, or by
+ *  clock_set_unix_millis(); clock_unix_is_set() says whether it has
+ *  been.  The host reads its real time clock.  Only ever for
+ *  stamping, not for waiting.  Setting a time of 0 forgets it.
+ */
+uint64_t clock_unix_millis(void);
+bool_t clock_unix_is_set(void);
+void clock_set_unix_millis(uint64_t now);
+void clock_sync_start(void);
+
+/* Waits, letting the network stack run on the device. */
+void clock_delay(uint16_t ms);
+
+#ifndef ARDUINO
+/*
+ *  Host only: stops the clock, so it moves only by clock_delay(),
+ *  and at once.  Lets a test run minutes of an emulated network in
+ *  no time.  Turning it off goes back to the monotonic clock.
+ */
+void clock_set_virtual(bool_t on);
+#endif
+
+END_C_SECTION
+
+#endif /* _CLOCK_H_ */
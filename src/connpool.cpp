@@ -0,0 +1,248 @@
+/*
+ *  Module: Connection Pool
+ *
+ *  A small pool of kept-alive TCP connections, keyed by host,
+ *  port and TLS settings.  Idle connections are health checked
+ *  before they are handed out and closed once they have idled too
+ *  long.
+ *
+ *  Author: Alex Dale @superoxigen
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for information.
+ */
+
+/* Standard Library */
+#include <string.h>
+
+/* Project Library */
+#include "clock.h"
+#include "dlog.h"
+#include "resolver.hpp"
+
+/* Self Header */
+#include "connpool.hpp"
+
+ConnPool ConnPool::s_instance;
+
+ConnPool::ConnPool():
+    _reused(0),
+    _opened(0)
+{
+    uint8_t i;
+    for (i = 0; i < CONNPOOL_SIZE; i++)
+    {
+        _entries[i].host = NULL;
+        _entries[i].port = 0;
+        _entries[i].tls = NULL;
+        _entries[i].last_used = 0;
+        _entries[i].in_use = false;
+    }
+}
+
+ConnPool * ConnPool::get_instance(void)
+{
+    return &s_instance;
+}
+
+/*
+ *  Returns a connection to the host, reusing a healthy idle one
+ *  when possible.  Returns NULL if no connection could be made
+ *  within the timeout, 0 for the default.  With TLS settings, the
+ *  connection is secured, and only ever reused for the same ones.
+ *  The connection must be given back with release().
+ */
+NetConn * ConnPool::acquire(
+    kstring_t host, uint16_t port, bool_t * reused, uint16_t timeout_ms,
+    netconn_tls_t const * tls)
+{
+    entry_t * entry;
+    net_addr_t address;
+
+    if (reused) *reused = false;
+    if (!host) return NULL;
+
+    entry = find_idle(host, port, tls);
+    if (entry)
+    {
+        entry->in_use = true;
+        _reused++;
+        if (reused) *reused = true;
+        return &entry->conn;
+    }
+
+    entry = find_free();
+    if (!entry)
+    {
+        DLOG_WARN("Connection pool exhausted");
+        return NULL;
+    }
+
+    if (!Resolver::get_instance()->resolve(host, &address))
+    {
+        DLOG_WARN2("Failed to resolve", host);
+        close_entry(entry);
+        return NULL;
+    }
+
+    if (!entry->conn.connect(address, port, timeout_ms, tls))
+    {
+        /* The cached address may have moved. */
+        DLOG_WARN2("Failed to connect to", host);
+        Resolver::get_instance()->invalidate(host);
+        close_entry(entry);
+        return NULL;
+    }
+
+    _opened++;
+    entry->host = host;
+    entry->port = port;
+    entry->tls = tls;
+    entry->in_use = true;
+    return &entry->conn;
+}
+
+/*
+ *  Gives back a connection from acquire().  It is kept for reuse
+ *  only if `keep_alive` is set and it is still connected.
+ */
+void ConnPool::release(NetConn * conn, bool_t keep_alive)
+{
+    uint8_t i;
+
+    for (i = 0; i < CONNPOOL_SIZE; i++)
+    {
+        if (&_entries[i].conn != conn) continue;
+
+        _entries[i].in_use = false;
+        _entries[i].last_used = clock_millis();
+        if (!keep_alive || !conn->connected())
+        {
+            close_entry(&_entries[i]);
+        }
+        return;
+    }
+}
+
+/* Whether acquire() would reuse a connection to the host. */
+bool_t ConnPool::has_idle(kstring_t host, uint16_t port, netconn_tls_t const * tls)
+{
+    if (!host) return false;
+    return find_idle(host, port, tls) != NULL;
+}
+
+/* Opens an idle connection to the host ahead of a request. */
+bool_t ConnPool::warm(kstring_t host, uint16_t port, netconn_tls_t const * tls)
+{
+    NetConn * conn;
+    bool_t reused;
+
+    conn = acquire(host, port, &reused, 0, tls);
+    if (!conn) return false;
+    if (reused) _reused--;
+    release(conn, true);
+    return true;
+}
+
+/* Closes idle connections to the host. */
+void ConnPool::drop(kstring_t host, uint16_t port)
+{
+    uint8_t i;
+
+    if (!host) return;
+
+    for (i = 0; i < CONNPOOL_SIZE; i++)
+    {
+        if (_entries[i].in_use || !_entries[i].host) continue;
+        if (_entries[i].port != port || strcmp(_entries[i].host, host)) continue;
+        close_entry(&_entries[i]);
+    }
+}
+
+/* Closes idle connections which are past the idle timeout. */
+void ConnPool::expire(void)
+{
+    time_ms_t now;
+    uint8_t i;
+
+    now = clock_millis();
+    for (i = 0; i < CONNPOOL_SIZE; i++)
+    {
+        if (_entries[i].in_use || !_entries[i].host) continue;
+        if (CLOCK_ELAPSED(now, _entries[i].last_used) >= CONNPOOL_IDLE_TIMEOUT_MS)
+        {
+            close_entry(&_entries[i]);
+        }
+    }
+}
+
+uint32_t ConnPool::reused_count(void) const
+{
+    return _reused;
+}
+
+uint32_t ConnPool::opened_count(void) const
+{
+    return _opened;
+}
+
+/* Private Methods */
+
+ConnPool::entry_t * ConnPool::find_idle(kstring_t host, uint16_t port, netconn_tls_t const * tls)
+{
+    uint8_t i;
+
+    expire();
+    for (i = 0; i < CONNPOOL_SIZE; i++)
+    {
+        if (_entries[i].in_use || !_entries[i].host) continue;
+        if (_entries[i].port != port || _entries[i].tls != tls) continue;
+        if (strcmp(_entries[i].host, host)) continue;
+        if (is_healthy(&_entries[i])) return &_entries[i];
+        close_entry(&_entries[i]);
+    }
+    return NULL;
+}
+
+/* An unused slot, or else the least recently used idle one. */
+ConnPool::entry_t * ConnPool::find_free(void)
+{
+    entry_t * oldest;
+    uint8_t i;
+
+    oldest = NULL;
+    for (i = 0; i < CONNPOOL_SIZE; i++)
+    {
+        if (_entries[i].in_use) continue;
+        if (!_entries[i].host) return &_entries[i];
+        if (!oldest || CLOCK_ELAPSED(_entries[i].last_used, oldest->last_used) > INT32_MAX)
+        {
+            oldest = &_entries[i];
+        }
+    }
+
+    if (oldest)
+    {
+        close_entry(oldest);
+    }
+    return oldest;
+}
+
+/*
+ *  An idle connection is healthy if the server has not closed it
+ *  and has not sent anything since the last response.
+ */
+bool_t ConnPool::is_healthy(entry_t * entry)
+{
+    if (!entry->conn.connected()) return false;
+    return entry->conn.available() == 0;
+}
+
+void ConnPool::close_entry(entry_t * entry)
+{
+    entry->conn.stop();
+    entry->host = NULL;
+    entry->port = 0;
+    entry->tls = NULL;
+    entry->in_use = false;
+}
@@ -0,0 +1,72 @@
+/*
+ *  Module: Connection Pool
+ *
+ *  A small pool of kept-alive TCP connections, keyed by host,
+ *  port and TLS settings.  Idle connections are health checked
+ *  before they are handed out and closed once they have idled too
+ *  long.
+ *
+ *  Author: Alex Dale @superoxigen
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for information.
+ */
+
+#ifndef _CONNPOOL_HPP_
+#define _CONNPOOL_HPP_
+
+#include "netconn.hpp"
+#include "utils.h"
+
+#define CONNPOOL_SIZE               2
+
+/*
+ *  Idle connections older than this are closed.  Kept below the
+ *  common 5 second server keep-alive timeout so that connections
+ *  are rarely closed from under us.
+ */
+#define CONNPOOL_IDLE_TIMEOUT_MS    4000
+
+class ConnPool {
+    typedef struct {
+        NetConn conn;
+        kstring_t host;
+        uint16_t port;
+        netconn_tls_t const * tls;
+        time_ms_t last_used;
+        bool_t in_use;
+    } entry_t;
+
+    static ConnPool s_instance;
+
+    entry_t _entries[CONNPOOL_SIZE];
+
+    /* Statistics */
+    uint32_t _reused;
+    uint32_t _opened;
+
+    ConnPool();
+public:
+    static ConnPool * get_instance(void);
+
+    NetConn * acquire(
+        kstring_t host, uint16_t port, bool_t * reused=NULL, uint16_t timeout_ms=0,
+        netconn_tls_t const * tls=NULL);
+    void release(NetConn * conn, bool_t keep_alive);
+    bool_t has_idle(kstring_t host, uint16_t port, netconn_tls_t const * tls=NULL);
+
+    bool_t warm(kstring_t host, uint16_t port, netconn_tls_t const * tls=NULL);
+    void drop(kstring_t host, uint16_t port);
+    void expire(void);
+
+    uint32_t reused_count(void) const;
+    uint32_t opened_count(void) const;
+
+private:
+    entry_t * find_idle(kstring_t host, uint16_t port, netconn_tls_t const * tls);
+    entry_t * find_free(void);
+    bool_t is_healthy(entry_t * entry);
+    void close_entry(entry_t * entry);
+};
+
+#endif /* _CONNPOOL_HPP_ */
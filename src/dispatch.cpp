@@ -0,0 +1,471 @@
+/*
+ *  Module: Dispatch
+ *
+ *  The retry, failover and hedging of alerts, over any transport.
+ *
+ *  Author: Alex Dale @superoxigen
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for information.
+ */
+
+/* Standard Library */
+#include <string.h>
+
+/* Project Library */
+#include "dlog.h"
+#include "scheduler.h"
+
+/* Self Header */
+#include "dispatch.hpp"
+
+/* Time left until the deadline, 0 once it is past. */
+static uint32_t ms_until(time_ms_t when)
+{
+    uint32_t left = CLOCK_ELAPSED(when, clock_millis());
+    return (left > INT32_MAX) ? 0 : left;
+}
+
+Dispatcher::Dispatcher():
+    _count(0),
+    _endpoints(NULL),
+    _budget_ms(0),
+    _retry_min_ms(0),
+    _start(0),
+    _pending(false),
+    _state(DISPATCH_IDLE),
+    _event(0),
+    _first(false),
+    _index(0),
+    _tries(0),
+    _changed(false),
+    _status(TRANSPORT_UNAVAILABLE)
+{
+    memset(_transports, 0, sizeof(_transports));
+    memset(&_alert, 0, sizeof(_alert));
+    memset(&_attempt, 0, sizeof(_attempt));
+    memset(&_stats, 0, sizeof(_stats));
+}
+
+/*
+ *  Sets the endpoints the failover transports pick from, which may
+ *  be NULL for none, how long an alert may take from its first
+ *  attempt, and how much of that must be left to try again at once.
+ */
+void Dispatcher::init(Endpoints * endpoints, uint32_t budget_ms, uint32_t retry_min_ms)
+{
+    _endpoints = endpoints;
+    _budget_ms = budget_ms;
+    _retry_min_ms = retry_min_ms;
+}
+
+/* Adds a transport, tried after those already added. */
+bool_t Dispatcher::add(transport_t const * transport)
+{
+    if (!transport || !transport->start || !transport->result || !transport->cancel)
+    {
+        return false;
+    }
+    if (_count >= DISPATCH_TRANSPORTS_MAX)
+    {
+        DLOG_ERR2("No room for transport", transport->name);
+        return false;
+    }
+    _transports[_count++] = transport;
+    return true;
+}
+
+uint8_t Dispatcher::count(void) const
+{
+    return _count;
+}
+
+/* Whether a round was started and its result not yet collected. */
+bool_t Dispatcher::is_running(void) const
+{
+    return _state != DISPATCH_IDLE;
+}
+
+bool_t Dispatcher::is_pending(void) const
+{
+    return _pending;
+}
+
+/* When the budget of the alert being sent, or the last one, began. */
+time_ms_t Dispatcher::started(void) const
+{
+    return _start;
+}
+
+dispatch_stats_t const * Dispatcher::stats(void) const
+{
+    return &_stats;
+}
+
+/*
+ *  Starts a round of attempts at the alert, over each transport in
+ *  turn until one delivers it.  The fast ones are only tried on the
+ *  alert's first round; once they have gone unanswered, the rest are
+ *  tried until it is sent or its budget is spent.  It stays pending
+ *  until it is delivered, and a round after its budget is spent
+ *  starts a new one.  The event, if any, is triggered as the round
+ *  ends.  False if a round is already running.
+ */
+bool_t Dispatcher::start(transport_alert_t const * alert, event_mask_t event)
+{
+    if (!alert || is_running()) return false;
+
+    memcpy(&_alert, alert, sizeof(_alert));
+    _event = event;
+    _first = begin();
+    _index = 0;
+    _status = TRANSPORT_UNAVAILABLE;
+    _state = DISPATCH_NEXT;
+    return true;
+}
+
+/*
+ *  TRANSPORT_PENDING while the round is in flight.  Once it is over,
+ *  its status, which is collected once: the issue ID is set if the
+ *  alert was delivered, and the next round can start.
+ */
+transport_status_t Dispatcher::result(byte_t * issue_id)
+{
+    if (_state == DISPATCH_IDLE) return TRANSPORT_UNAVAILABLE;
+    if (_state != DISPATCH_DONE) return TRANSPORT_PENDING;
+
+    _state = DISPATCH_IDLE;
+    if (_status == TRANSPORT_DELIVERED && issue_id)
+    {
+        memcpy(issue_id, _alert.issue_id, UUID_BINARY_LENGTH);
+    }
+    return _status;
+}
+
+/* Abandons the round, and the alert.  Its event is not triggered. */
+void Dispatcher::cancel(void)
+{
+    transport_t const * transport;
+    uint8_t i;
+
+    if (_state == DISPATCH_WAIT)
+    {
+        transport = _transports[_index];
+        for (i = 0; i < 2; i++)
+        {
+            if (_attempt.handles[i] >= 0)
+            {
+                transport->cancel(transport->context, _attempt.handles[i]);
+            }
+        }
+    }
+    _state = DISPATCH_IDLE;
+    _pending = false;
+}
+
+/* Steps the round on as far as it goes without waiting. */
+void Dispatcher::poll(void)
+{
+    while (advance()) {}
+}
+
+/*
+ *  Sends the alert in one round, polling it until it is over, and
+ *  sets its issue ID if it was delivered.  This blocks; the device
+ *  starts the round and polls it from a task instead.
+ */
+transport_status_t Dispatcher::send_alert(transport_alert_t * alert)
+{
+    transport_status_t status;
+
+    if (!start(alert, 0)) return TRANSPORT_UNAVAILABLE;
+
+    for (;;)
+    {
+        poll();
+        status = result(alert->issue_id);
+        if (status != TRANSPORT_PENDING) return status;
+        clock_delay(DISPATCH_POLL_MS);
+    }
+}
+
+/*
+ *  Starts the alert's budget on its first round, and again on a round
+ *  once it is spent.  Returns whether this is the first.
+ */
+bool_t Dispatcher::begin(void)
+{
+    bool_t first = !_pending;
+
+    if (first || !ms_until(_start + _budget_ms))
+    {
+        _start = clock_millis();
+        _pending = true;
+    }
+    if (first)
+    {
+        _stats.alerts++;
+    }
+    return first;
+}
+
+/*
+ *  Steps the round on to its next state.  Returns true if it can go
+ *  on straight away, false if it has to wait or is over.
+ */
+bool_t Dispatcher::advance(void)
+{
+    transport_status_t status;
+
+    switch (_state)
+    {
+        case DISPATCH_NEXT:
+            if (!next_transport())
+            {
+                finish(_status);
+                return false;
+            }
+            _tries = 0;
+            _changed = false;
+            _state = DISPATCH_ATTEMPT;
+            return true;
+
+        case DISPATCH_ATTEMPT:
+            start_attempt();
+            return true;
+
+        case DISPATCH_WAIT:
+            status = poll_attempt();
+            if (status == TRANSPORT_PENDING) return false;
+            take_status(status);
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+/* Skips to the next transport the round tries.  False if there are no more. */
+bool_t Dispatcher::next_transport(void)
+{
+    while (_index < _count && (_transports[_index]->flags & TRANSPORT_FAST) && !_first)
+    {
+        _index++;
+    }
+    return _index < _count;
+}
+
+/*
+ *  Sends the alert to the best endpoint over the transport.  If it is
+ *  hedged, and the endpoint has not answered once it is slower than
+ *  it almost ever is, a copy goes to the next best, see poll_attempt().
+ */
+void Dispatcher::start_attempt(void)
+{
+    transport_t const * transport = _transports[_index];
+    attempt_t * attempt = &_attempt;
+    int8_t endpoint = pick();
+
+    attempt->deadline = deadline(transport->timeout_ms);
+    attempt->endpoints[0] = endpoint;
+    attempt->endpoints[1] = -1;
+    attempt->started[0] = clock_millis();
+    attempt->started[1] = attempt->started[0];
+    attempt->handles[0] = transport->start(
+        transport->context, endpoint, &_alert, attempt->deadline);
+    attempt->handles[1] = -1;
+    attempt->status = TRANSPORT_UNAVAILABLE;
+    if (attempt->handles[0] < 0)
+    {
+        take_status(TRANSPORT_UNAVAILABLE);
+        return;
+    }
+    _stats.attempts++;
+
+    attempt->hedge_after = (_endpoints && endpoint >= 0 && (transport->flags & TRANSPORT_HEDGED))
+        ? _endpoints->hedge_after_ms(endpoint) : 0;
+    _state = DISPATCH_WAIT;
+}
+
+/*
+ *  Polls the attempt and its hedge, and starts the hedge once it is
+ *  due.  The first to answer is taken and the other abandoned.  Both
+ *  carry the alert's ID, so the platform raises one issue even if
+ *  both arrive.  TRANSPORT_PENDING while either is in flight.
+ */
+transport_status_t Dispatcher::poll_attempt(void)
+{
+    transport_t const * transport = _transports[_index];
+    attempt_t * attempt = &_attempt;
+    transport_status_t status;
+    uint8_t i;
+
+    if (transport->poll)
+    {
+        transport->poll(transport->context);
+    }
+
+    for (i = 0; i < 2; i++)
+    {
+        if (attempt->handles[i] < 0) continue;
+        status = transport->result(transport->context, attempt->handles[i], _alert.issue_id);
+        if (status == TRANSPORT_PENDING) continue;
+
+        attempt->handles[i] = -1;
+        record(transport, attempt->endpoints[i], status, attempt->started[i]);
+        if (transport_is_answer(status))
+        {
+            if (attempt->handles[1 - i] >= 0)
+            {
+                if (transport->flags & TRANSPORT_FAILOVER)
+                {
+                    _endpoints->outrun(attempt->endpoints[1 - i],
+                        clock_millis() - attempt->started[1 - i]);
+                }
+                transport->cancel(transport->context, attempt->handles[1 - i]);
+                attempt->handles[1 - i] = -1;
+            }
+            if (i)
+            {
+                _stats.hedges_won++;
+                DLOG2("Hedged alert answered first", _endpoints->host(attempt->endpoints[i]));
+            }
+            return status;
+        }
+        attempt->status = status;
+    }
+
+    if (attempt->hedge_after && attempt->handles[0] >= 0
+        && clock_millis() - attempt->started[0] >= attempt->hedge_after)
+    {
+        attempt->hedge_after = 0;
+        attempt->endpoints[1] = pick(attempt->endpoints[0]);
+        if (attempt->endpoints[1] >= 0)
+        {
+            DLOG2("Hedging alert to", _endpoints->host(attempt->endpoints[1]));
+            attempt->started[1] = clock_millis();
+            attempt->handles[1] = transport->start(
+                transport->context, attempt->endpoints[1], &_alert, attempt->deadline);
+            if (attempt->handles[1] >= 0)
+            {
+                _stats.hedges++;
+            }
+        }
+    }
+
+    return (attempt->handles[0] >= 0 || attempt->handles[1] >= 0)
+        ? TRANSPORT_PENDING : attempt->status;
+}
+
+/*
+ *  Takes the status of an attempt.  A transport that fails over skips
+ *  an endpoint that fails for a while, so the alert is tried again on
+ *  the next best at once, once for each.  A timeout is tried again
+ *  while enough of the budget is left, even though the alert may yet
+ *  be handled: it carries its ID, so the platform raises its issue
+ *  once however many arrive.  An answer that changed how the
+ *  transport sends is tried again once.  Otherwise the round moves on
+ *  to the next transport, unless the alert was delivered or refused.
+ */
+void Dispatcher::take_status(transport_status_t status)
+{
+    transport_t const * transport = _transports[_index];
+    uint8_t hosts;
+
+    if (transport->flags & TRANSPORT_FAILOVER)
+    {
+        hosts = (_endpoints && _endpoints->count()) ? _endpoints->count() : 1;
+        if (status == TRANSPORT_RETRY && !_changed)
+        {
+            _changed = true;
+            _stats.retries++;
+            _state = DISPATCH_ATTEMPT;
+            return;
+        }
+        _tries++;
+        if ((status == TRANSPORT_TIMEOUT && retry_now())
+            || (transport_host_failed(status) && _tries < hosts && retry_now()))
+        {
+            _stats.retries++;
+            _state = DISPATCH_ATTEMPT;
+            return;
+        }
+    }
+
+    if (status == TRANSPORT_DELIVERED)
+    {
+        DLOG2("Alert delivered over", transport->name);
+        _pending = false;
+        _stats.delivered++;
+        _stats.by_transport[_index]++;
+        finish(status);
+        return;
+    }
+    if (status == TRANSPORT_REFUSED)
+    {
+        finish(status);
+        return;
+    }
+    if (status != TRANSPORT_UNAVAILABLE)
+    {
+        DLOG_WARN2("Alert not delivered over", transport->name);
+    }
+    _status = status;
+    _index++;
+    _state = DISPATCH_NEXT;
+}
+
+/* Ends the round with the status, and triggers its event. */
+void Dispatcher::finish(transport_status_t status)
+{
+    _status = status;
+    _state = DISPATCH_DONE;
+    if (_event)
+    {
+        scheduler_trigger_event(_event);
+    }
+}
+
+/* Counts the answer, or failure, against the endpoint, if the transport goes to it. */
+void Dispatcher::record(
+    transport_t const * transport, int8_t endpoint, transport_status_t status,
+    time_ms_t started)
+{
+    if (!_endpoints || endpoint < 0 || !(transport->flags & TRANSPORT_FAILOVER)) return;
+
+    if (transport_is_answer(status))
+    {
+        _endpoints->succeeded(endpoint, clock_millis() - started);
+    }
+    else if (transport_host_failed(status))
+    {
+        _endpoints->failed(endpoint);
+    }
+}
+
+/* The best endpoint but the one excluded, or -1 if there are none. */
+int8_t Dispatcher::pick(int8_t exclude) const
+{
+    return _endpoints ? _endpoints->pick(exclude) : -1;
+}
+
+/*
+ *  The deadline of the next attempt: no later than the transport's
+ *  timeout, and no later than the end of the alert's budget.
+ */
+time_ms_t Dispatcher::deadline(uint16_t timeout_ms) const
+{
+    uint32_t left = ms_until(_start + _budget_ms);
+
+    if (timeout_ms && timeout_ms < left)
+    {
+        left = timeout_ms;
+    }
+    return clock_millis() + left;
+}
+
+/* Whether enough of the budget is left to try again straight away. */
+bool_t Dispatcher::retry_now(void) const
+{
+    return ms_until(_start + _budget_ms) >= _retry_min_ms;
+}
@@ -0,0 +1,131 @@
+/*
+ *  Module: Dispatch
+ *
+ *  Gets an alert to the platform over its transports, in the order
+ *  they were added, within a latency budget.  The fast ones go first
+ *  and once; the rest retry timeouts, fail over between endpoints
+ *  and hedge slow attempts, as their flags say, until the alert is
+ *  delivered or the budget is spent.  See transport.h.
+ *
+ *  A round of attempts is started, then stepped by poll() from a
+ *  scheduler task, which never waits on a transport.  Its end is
+ *  signalled by an event, and its result collected once, as with
+ *  HTTPer's requests.
+ *
+ *  Nothing here touches the network, so the same policy runs over an
+ *  emulated one on the host, see fake_transport.hpp.
+ *
+ *  Author: Alex Dale @superoxigen
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for information.
+ */
+
+#ifndef _DISPATCH_HPP_
+#define _DISPATCH_HPP_
+
+#include "clock.h"
+#include "endpoints.hpp"
+#include "scheduler.h"
+#include "transport.h"
+#include "utils.h"
+
+#define DISPATCH_TRANSPORTS_MAX     4
+
+/* How often send_alert() polls an attempt and its hedge for an answer. */
+#define DISPATCH_POLL_MS            1
+#define DISPATCH_POLL_PERIOD_US     10000
+
+/* Triggered by the messengers as a round of attempts at an alert ends. */
+#define DISPATCH_EVENT_DONE         0x02
+
+typedef struct {
+    uint32_t alerts;
+    uint32_t delivered;
+    uint32_t attempts;
+    uint32_t retries;       /* Attempts after the first over a transport */
+    uint32_t hedges;
+    uint32_t hedges_won;
+    uint32_t by_transport[DISPATCH_TRANSPORTS_MAX];
+} dispatch_stats_t;
+
+class Dispatcher {
+    typedef enum {
+        DISPATCH_IDLE,
+        DISPATCH_NEXT,          /* On to the next transport of the round */
+        DISPATCH_ATTEMPT,       /* To start an attempt over the transport */
+        DISPATCH_WAIT,          /* The attempt, and maybe its hedge, in flight */
+        DISPATCH_DONE
+    } state_t;
+
+    /* An attempt and its hedge, in that order. */
+    typedef struct {
+        transport_handle_t handles[2];
+        int8_t endpoints[2];
+        time_ms_t started[2];
+        time_ms_t deadline;
+        uint32_t hedge_after;
+        transport_status_t status;  /* The last failure */
+    } attempt_t;
+
+    transport_t const * _transports[DISPATCH_TRANSPORTS_MAX];
+    uint8_t _count;
+    Endpoints * _endpoints;
+    uint32_t _budget_ms;
+    uint32_t _retry_min_ms;
+
+    /* The alert being sent, until it is delivered. */
+    time_ms_t _start;
+    bool_t _pending;
+
+    /* The round of attempts at it, see poll(). */
+    uint8_t _state;
+    transport_alert_t _alert;
+    event_mask_t _event;
+    bool_t _first;
+    uint8_t _index;             /* Of the transport being tried */
+    uint8_t _tries;
+    bool_t _changed;
+    attempt_t _attempt;
+    transport_status_t _status;
+
+    dispatch_stats_t _stats;
+
+public:
+    Dispatcher();
+
+    void init(Endpoints * endpoints, uint32_t budget_ms, uint32_t retry_min_ms);
+    bool_t add(transport_t const * transport);
+    uint8_t count(void) const;
+
+    bool_t start(transport_alert_t const * alert, event_mask_t event);
+    transport_status_t result(byte_t * issue_id);
+    void cancel(void);
+    void poll(void);
+    transport_status_t send_alert(transport_alert_t * alert);
+    bool_t is_running(void) const;
+    bool_t is_pending(void) const;
+    time_ms_t started(void) const;
+
+    dispatch_stats_t const * stats(void) const;
+
+private:
+    bool_t begin(void);
+    bool_t advance(void);
+    bool_t next_transport(void);
+    void start_attempt(void);
+    transport_status_t poll_attempt(void);
+    void take_status(transport_status_t status);
+    void finish(transport_status_t status);
+    void record(
+        transport_t const * transport, int8_t endpoint, transport_status_t status,
+        time_ms_t started);
+    int8_t pick(int8_t exclude=-1) const;
+    time_ms_t deadline(uint16_t timeout_ms) const;
+    bool_t retry_now(void) const;
+
+    Dispatcher(Dispatcher const &);
+    Dispatcher & operator=(Dispatcher const &);
+};
+
+#endif /* _DISPATCH_HPP_ */
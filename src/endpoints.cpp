@@ -0,0 +1,258 @@
+/*
+ *  Module: Endpoints
+ *
+ *  The platform hosts a request may go to, ranked by their round
+ *  trip times and failures.
+ *
+ *  Author: Alex Dale @superoxigen
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for information.
+ */
+
+/* Standard Library */
+#include <string.h>
+
+/* Project Library */
+#include "dlog.h"
+#include "smlstr.h"
+
+/* Self Header */
+#include "endpoints.hpp"
+
+Endpoints::Endpoints():
+    _count(0),
+    _hedge_ms(0)
+{
+    memset(_endpoints, 0, sizeof(_endpoints));
+}
+
+/*
+ *  Reads a comma separated list of hosts, each with an optional
+ *  port, as "a.example.com, b.example.com:8443".  Entries that are
+ *  too long, or have a bad port, are skipped.  Returns the number of
+ *  hosts kept, which replace any there were.
+ */
+uint8_t Endpoints::parse(kstring_t list)
+{
+    endpoint_t * endpoint;
+    char_t port[6];
+    kstring_t start, end, colon;
+    uint16_t length;
+    uint32_t value;
+
+    memset(_endpoints, 0, sizeof(_endpoints));
+    _count = 0;
+    if (!list) return 0;
+
+    start = list;
+    while (*start && _count < ENDPOINTS_MAX)
+    {
+        while (*start == ' ' || *start == ',') start++;
+        if (!*start) break;
+
+        end = start;
+        while (*end && *end != ',') end++;
+        while (end > start && end[-1] == ' ') end--;
+
+        colon = (kstring_t) memchr(start, ':', end - start);
+        length = (uint16_t) ((colon ? colon : end) - start);
+        endpoint = &_endpoints[_count];
+        value = 0;
+        if (colon)
+        {
+            if (end - colon - 1 < 1 || end - colon - 1 >= (int) sizeof(port))
+            {
+                value = UINT32_MAX;
+            }
+            else
+            {
+                memcpy(port, colon + 1, end - colon - 1);
+                port[end - colon - 1] = '\0';
+                value = smluintscan(port);
+                if (!value) value = UINT32_MAX;
+            }
+        }
+
+        if (length && length < ENDPOINTS_HOST_LENGTH && value <= UINT16_MAX)
+        {
+            memcpy(endpoint->host, start, length);
+            endpoint->host[length] = '\0';
+            endpoint->port = (uint16_t) value;
+            _count++;
+        }
+        else
+        {
+            DLOG_WARN2("Skipping bad endpoint", start);
+        }
+
+        start = end;
+        while (*start && *start != ',') start++;
+    }
+
+    return _count;
+}
+
+uint8_t Endpoints::count(void) const
+{
+    return _count;
+}
+
+kstring_t Endpoints::host(uint8_t index) const
+{
+    return (index < _count) ? _endpoints[index].host : NULL;
+}
+
+uint16_t Endpoints::port(uint8_t index, uint16_t default_port) const
+{
+    if (index >= _count || !_endpoints[index].port) return default_port;
+    return _endpoints[index].port;
+}
+
+endpoint_t const * Endpoints::get(uint8_t index) const
+{
+    return (index < _count) ? &_endpoints[index] : NULL;
+}
+
+/*
+ *  Returns the healthy host, other than the one excluded, expected
+ *  to answer soonest; hosts not yet timed go in list order.  If none
+ *  is healthy, a plain pick returns the host that comes back first,
+ *  as a request must go somewhere, but one that excludes a host, to
+ *  find a second, returns -1.
+ */
+int8_t Endpoints::pick(int8_t exclude) const
+{
+    int8_t best, soonest;
+    uint32_t best_ms, estimate;
+    uint8_t i;
+
+    best = -1;
+    soonest = -1;
+    best_ms = 0;
+    for (i = 0; i < _count; i++)
+    {
+        if ((int8_t) i == exclude) continue;
+
+        if (is_healthy(i))
+        {
+            estimate = estimate_ms(i);
+            if (best < 0 || estimate < best_ms)
+            {
+                best = (int8_t) i;
+                best_ms = estimate;
+            }
+        }
+        else if (soonest < 0 || (int32_t) (_endpoints[i].down_until
+            - _endpoints[soonest].down_until) < 0)
+        {
+            soonest = (int8_t) i;
+        }
+    }
+
+    if (best < 0 && exclude < 0) return soonest;
+    return best;
+}
+
+bool_t Endpoints::is_healthy(uint8_t index) const
+{
+    if (index >= _count) return false;
+    if (!_endpoints[index].failures) return true;
+    return (int32_t) (clock_millis() - _endpoints[index].down_until) >= 0;
+}
+
+/* Takes the host's answer in, and clears its failures. */
+void Endpoints::succeeded(uint8_t index, uint32_t rtt_ms)
+{
+    if (index >= _count) return;
+
+    sample_rtt(&_endpoints[index], rtt_ms);
+    _endpoints[index].failures = 0;
+    _endpoints[index].answered++;
+}
+
+/*
+ *  The host had not answered a request after the time given when a
+ *  copy sent elsewhere did.  Its round trip was at least that long,
+ *  so the estimate takes it in if it is slower than expected; a host
+ *  that has stalled is then passed over without being failed first.
+ */
+void Endpoints::outrun(uint8_t index, uint32_t elapsed_ms)
+{
+    if (index >= _count) return;
+    if (_endpoints[index].measured && elapsed_ms <= _endpoints[index].srtt_ms) return;
+
+    sample_rtt(&_endpoints[index], elapsed_ms);
+}
+
+/* Updates the estimate, as RFC 6298 does. */
+void Endpoints::sample_rtt(endpoint_t * endpoint, uint32_t rtt_ms)
+{
+    uint32_t delta;
+
+    if (!endpoint->measured)
+    {
+        endpoint->srtt_ms = rtt_ms;
+        endpoint->rttvar_ms = rtt_ms / 2;
+        endpoint->measured = true;
+    }
+    else
+    {
+        delta = (endpoint->srtt_ms > rtt_ms)
+            ? (endpoint->srtt_ms - rtt_ms) : (rtt_ms - endpoint->srtt_ms);
+        endpoint->rttvar_ms = ((3 * endpoint->rttvar_ms) + delta) / 4;
+        endpoint->srtt_ms = ((7 * endpoint->srtt_ms) + rtt_ms) / 8;
+    }
+}
+
+/* Skips the host for a while, twice as long as last time. */
+void Endpoints::failed(uint8_t index)
+{
+    endpoint_t * endpoint;
+    uint32_t backoff_ms;
+    uint8_t i;
+
+    if (index >= _count) return;
+    endpoint = &_endpoints[index];
+
+    if (endpoint->failures < UINT8_MAX) endpoint->failures++;
+    endpoint->failed++;
+
+    backoff_ms = ENDPOINTS_BACKOFF_MIN_MS;
+    for (i = 1; i < endpoint->failures && backoff_ms < ENDPOINTS_BACKOFF_MAX_MS; i++)
+    {
+        backoff_ms *= 2;
+    }
+    if (backoff_ms > ENDPOINTS_BACKOFF_MAX_MS) backoff_ms = ENDPOINTS_BACKOFF_MAX_MS;
+
+    endpoint->down_until = clock_millis() + backoff_ms;
+    DLOG_WARN2("Endpoint failed", endpoint->host);
+}
+
+/* Sets the least wait before a request is hedged, or 0 to never hedge. */
+void Endpoints::set_hedge(uint16_t hedge_ms)
+{
+    _hedge_ms = hedge_ms;
+}
+
+/*
+ *  How long a request to the host may go unanswered before a copy
+ *  is sent to another: longer than nearly all its answers take, and
+ *  never less than the least set.  Returns 0 if hedging is off.
+ */
+uint32_t Endpoints::hedge_after_ms(uint8_t index) const
+{
+    uint32_t after_ms;
+
+    if (!_hedge_ms || index >= _count) return 0;
+    if (!_endpoints[index].measured) return _hedge_ms;
+
+    after_ms = _endpoints[index].srtt_ms + (4 * _endpoints[index].rttvar_ms);
+    return (after_ms > _hedge_ms) ? after_ms : _hedge_ms;
+}
+
+uint32_t Endpoints::estimate_ms(uint8_t index) const
+{
+    if (!_endpoints[index].measured) return ENDPOINTS_RTT_UNKNOWN_MS;
+    return _endpoints[index].srtt_ms;
+}
@@ -0,0 +1,76 @@
+/*
+ *  Module: Endpoints
+ *
+ *  The platform hosts a request may go to, each with a rolling
+ *  estimate of its round trip time and a count of its failures in a
+ *  row.  Requests go to the fastest healthy host; one that fails is
+ *  left alone for a while, longer with each failure, so the next
+ *  request fails over at once instead of waiting on it again.
+ *
+ *  The estimate also says when a request has taken longer than its
+ *  host usually does, which is when it is worth hedging it with a
+ *  copy to the next best host.
+ *
+ *  Author: Alex Dale @superoxigen
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for information.
+ */
+
+#ifndef _ENDPOINTS_HPP_
+#define _ENDPOINTS_HPP_
+
+#include "clock.h"
+#include "utils.h"
+
+#define ENDPOINTS_MAX               4
+#define ENDPOINTS_HOST_LENGTH       64
+
+/* Assumed of a host not yet timed, so the list order decides. */
+#define ENDPOINTS_RTT_UNKNOWN_MS    1000
+
+/* A failed host is skipped for the least, doubled per failure in a row. */
+#define ENDPOINTS_BACKOFF_MIN_MS    1000
+#define ENDPOINTS_BACKOFF_MAX_MS    60000
+
+typedef struct {
+    char_t host[ENDPOINTS_HOST_LENGTH];
+    uint16_t port;          /* 0 for the scheme's default */
+    bool_t measured;
+    uint32_t srtt_ms;
+    uint32_t rttvar_ms;
+    uint8_t failures;       /* In a row */
+    time_ms_t down_until;
+    uint32_t answered;
+    uint32_t failed;
+} endpoint_t;
+
+class Endpoints {
+    endpoint_t _endpoints[ENDPOINTS_MAX];
+    uint8_t _count;
+    uint16_t _hedge_ms;
+
+public:
+    Endpoints();
+
+    uint8_t parse(kstring_t list);
+    uint8_t count(void) const;
+    kstring_t host(uint8_t index) const;
+    uint16_t port(uint8_t index, uint16_t default_port) const;
+    endpoint_t const * get(uint8_t index) const;
+
+    int8_t pick(int8_t exclude=-1) const;
+    bool_t is_healthy(uint8_t index) const;
+    void succeeded(uint8_t index, uint32_t rtt_ms);
+    void outrun(uint8_t index, uint32_t elapsed_ms);
+    void failed(uint8_t index);
+
+    void set_hedge(uint16_t hedge_ms);
+    uint32_t hedge_after_ms(uint8_t index) const;
+
+private:
+    void sample_rtt(endpoint_t * endpoint, uint32_t rtt_ms);
+    uint32_t estimate_ms(uint8_t index) const;
+};
+
+#endif /* _ENDPOINTS_HPP_ */
@@ -9,6 +9,12 @@
  *  See LICENSE for information.
  */
 
+#include <string.h>
+
+#include "scheduler.h"
+#include "transport.h"
+#include "uuid.h"
+
 #include "fake_messenger.hpp"
 
 
@@ -22,29 +28,69 @@ FakeMessenger * FakeMessenger::get_instance(void)
     return &s_instance;
 }
 
-bool_t FakeMessenger::request_help(uuid_ref_t request_id)
+void FakeMessenger::init(void)
 {
-    if (!request_id) return false;
+    if (_dispatcher.count()) return;
 
-    uuid_set_zero(request_id);
+    _dispatcher.init(NULL, FAKE_MESSENGER_BUDGET_MS, 0);
+    _dispatcher.add(transport_loopback());
+}
 
-    if (_sent) return false;
+void FakeMessenger::prepare_help(void) {}
 
-    _sent = true;
-    return true;
+void FakeMessenger::abandon_help(void) {}
+
+/* Started, then collected once dispatch_task() has run, as Messenger's. */
+transport_status_t FakeMessenger::request_help(uuid_ref_t request_id)
+{
+    transport_alert_t alert;
+    transport_status_t status;
+
+    if (!request_id) return TRANSPORT_UNAVAILABLE;
+
+    if (_sent) return TRANSPORT_UNAVAILABLE;
+
+    init();
+    if (!_dispatcher.is_running())
+    {
+        /* Gives the alert an ID, as Messenger does, unless it has one. */
+        if (uuid_is_zero(request_id))
+        {
+            uuid_v7(request_id);
+        }
+        memset(&alert, 0, sizeof(alert));
+        memcpy(alert.alert_id, request_id, UUID_BINARY_LENGTH);
+        if (!_dispatcher.start(&alert, DISPATCH_EVENT_DONE)) return TRANSPORT_UNAVAILABLE;
+    }
+
+    status = _dispatcher.result(request_id);
+    if (status == TRANSPORT_DELIVERED) _sent = true;
+    return status;
 }
 
 bool_t FakeMessenger::cancel_help(uuid_kref_t request_id)
 {
     if (!request_id) return false;
 
+    _dispatcher.cancel();
+
     if (!_sent) return false;
 
     _sent = false;
     return true;
 }
 
+uint8_t FakeMessenger::dispatch_task(void *)
+{
+    s_instance._dispatcher.poll();
+    return TASK_EXIT_OK;
+}
+
 bool_t FakeMessenger::test(void)
 {
     return true;
 }
+
+void FakeMessenger::prewarm(void)
+{
+}
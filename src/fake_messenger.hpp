@@ -1,7 +1,9 @@
 /*
  *  Module: Fake HTTP Messenger
  *
- *  Like the Messenger module, but does not use network.
+ *  Like the Messenger module, but does not use network: alerts go
+ *  over the loopback transport, delivered at once as the issue of
+ *  their own ID.
  *
  *  Author: Alex Dale @superoxigen
  *
@@ -12,22 +14,36 @@
 #ifndef _FAKE_MESSENGER_HPP_
 #define _FAKE_MESSENGER_HPP_
 
+#include "dispatch.hpp"
+#include "transport.h"
 #include "uuid.h"
 #include "utils.h"
 
+/* Only a loopback, so it never takes long. */
+#define FAKE_MESSENGER_BUDGET_MS    1000
+
 class FakeMessenger {
     static FakeMessenger s_instance;
 
+    Dispatcher _dispatcher;
     bool_t _sent;
 
     FakeMessenger();
 public:
     static FakeMessenger * get_instance(void);
 
-    bool_t request_help(uuid_ref_t request_id);
+    void init(void);
+
+    void prepare_help(void);
+    void abandon_help(void);
+
+    transport_status_t request_help(uuid_ref_t request_id);
     bool_t cancel_help(uuid_kref_t request_id);
+    static uint8_t dispatch_task(void * arg);
 
     bool_t test(void);
+
+    void prewarm(void);
 };
 
 #endif /* _FAKE_MESSENGER_HPP_ */
@@ -0,0 +1,197 @@
+/*
+ *  Module: Fake Transport
+ *
+ *  An emulated network, drawn from a seeded generator.
+ *
+ *  Author: Alex Dale @superoxigen
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for information.
+ */
+
+/* Standard Library */
+#include <math.h>
+#include <string.h>
+
+/* Self Header */
+#include "fake_transport.hpp"
+
+#define FAKE_PERMILLE       1000
+
+FakeTransport::FakeTransport(kstring_t name, uint8_t flags, uint16_t timeout_ms)
+{
+    memset(&_transport, 0, sizeof(_transport));
+    _transport.name = name;
+    _transport.flags = flags;
+    _transport.timeout_ms = timeout_ms;
+    _transport.start = start;
+    _transport.result = result;
+    _transport.cancel = cancel;
+    _transport.context = this;
+
+    memset(_profiles, 0, sizeof(_profiles));
+    memset(_attempts, 0, sizeof(_attempts));
+    memset(&_stats, 0, sizeof(_stats));
+    seed(1);
+}
+
+void FakeTransport::seed(uint32_t seed)
+{
+    _state = seed ? seed : 1;
+}
+
+/* Sets the endpoint's profile, or every endpoint's for -1. */
+void FakeTransport::set_profile(int8_t endpoint, fake_profile_t const * profile)
+{
+    uint8_t i;
+
+    if (!profile) return;
+
+    for (i = 0; i < ENDPOINTS_MAX; i++)
+    {
+        if (endpoint < 0 || endpoint == i)
+        {
+            _profiles[i] = *profile;
+        }
+    }
+}
+
+/* The endpoint's profile, to change as a run goes on.  Any but an endpoint is the first's. */
+fake_profile_t * FakeTransport::profile(int8_t endpoint)
+{
+    return &_profiles[(endpoint >= 0 && endpoint < ENDPOINTS_MAX) ? endpoint : 0];
+}
+
+transport_t const * FakeTransport::transport(void) const
+{
+    return &_transport;
+}
+
+fake_transport_stats_t const * FakeTransport::stats(void) const
+{
+    return &_stats;
+}
+
+/* Xorshift, which is plenty for drawing latencies. */
+uint32_t FakeTransport::random(void)
+{
+    _state ^= _state << 13;
+    _state ^= _state >> 17;
+    _state ^= _state << 5;
+    return _state;
+}
+
+uint32_t FakeTransport::draw_latency(fake_profile_t const * profile)
+{
+    uint32_t latency;
+    double uniform;
+
+    latency = profile->base_ms;
+    if (profile->spread_ms)
+    {
+        if (profile->distribution == FAKE_LATENCY_EXPONENTIAL)
+        {
+            /* In (0, 1], so the log is finite. */
+            uniform = ((random() >> 8) + 1) / 16777216.0;
+            latency += (uint32_t) (-log(uniform) * profile->spread_ms);
+        }
+        else
+        {
+            latency += random() % (profile->spread_ms + 1);
+        }
+    }
+    if (random() % FAKE_PERMILLE < profile->slow_permille)
+    {
+        latency += profile->slow_ms;
+    }
+    return latency;
+}
+
+/*
+ *  Draws the attempt's fate when it starts: refused at once if its
+ *  host is down, lost, or answered after a latency, with an error or
+ *  as the issue of the alert's own ID.
+ */
+transport_handle_t FakeTransport::start(
+    void * context, int8_t endpoint, transport_alert_t const * alert, time_ms_t deadline)
+{
+    FakeTransport * fake = (FakeTransport *) context;
+    fake_profile_t const * profile;
+    attempt_t * attempt;
+    uint8_t i;
+
+    for (i = 0; i < FAKE_TRANSPORT_SLOTS && fake->_attempts[i].used; i++) {}
+    if (i == FAKE_TRANSPORT_SLOTS) return -1;
+
+    profile = fake->profile(endpoint);
+    attempt = &fake->_attempts[i];
+    attempt->used = true;
+    attempt->answered = true;
+    attempt->due = clock_millis();
+    attempt->deadline = deadline;
+    memcpy(attempt->issue_id, alert->alert_id, UUID_BINARY_LENGTH);
+    fake->_stats.attempts[(endpoint >= 0 && endpoint < ENDPOINTS_MAX) ? endpoint : 0]++;
+
+    if (profile->down)
+    {
+        attempt->status = TRANSPORT_UNREACHABLE;
+        fake->_stats.refused++;
+    }
+    else if (fake->random() % FAKE_PERMILLE < profile->loss_permille)
+    {
+        attempt->answered = false;
+        fake->_stats.lost++;
+    }
+    else
+    {
+        attempt->due += fake->draw_latency(profile);
+        attempt->status = TRANSPORT_DELIVERED;
+        if (fake->random() % FAKE_PERMILLE < profile->error_permille)
+        {
+            attempt->status = TRANSPORT_SERVER_ERROR;
+            fake->_stats.errors++;
+        }
+    }
+    return (transport_handle_t) i;
+}
+
+transport_status_t FakeTransport::result(
+    void * context, transport_handle_t handle, byte_t * issue_id)
+{
+    FakeTransport * fake = (FakeTransport *) context;
+    attempt_t * attempt;
+    time_ms_t now;
+
+    if (handle < 0 || handle >= FAKE_TRANSPORT_SLOTS || !fake->_attempts[handle].used)
+    {
+        return TRANSPORT_UNAVAILABLE;
+    }
+
+    attempt = &fake->_attempts[handle];
+    now = clock_millis();
+    if (attempt->answered && (int32_t) (now - attempt->due) >= 0)
+    {
+        attempt->used = false;
+        if (attempt->status == TRANSPORT_DELIVERED)
+        {
+            memcpy(issue_id, attempt->issue_id, UUID_BINARY_LENGTH);
+        }
+        return attempt->status;
+    }
+    if ((int32_t) (now - attempt->deadline) >= 0)
+    {
+        attempt->used = false;
+        return TRANSPORT_TIMEOUT;
+    }
+    return TRANSPORT_PENDING;
+}
+
+void FakeTransport::cancel(void * context, transport_handle_t handle)
+{
+    FakeTransport * fake = (FakeTransport *) context;
+
+    if (handle < 0 || handle >= FAKE_TRANSPORT_SLOTS || !fake->_attempts[handle].used) return;
+
+    fake->_attempts[handle].used = false;
+    fake->_stats.cancelled++;
+}
@@ -0,0 +1,96 @@
+/*
+ *  Module: Fake Transport
+ *
+ *  An emulated network for the Dispatcher, to try its retry and
+ *  failover policy without one.  Each endpoint has a profile: how
+ *  long it takes to answer, drawn from a distribution with a slow
+ *  tail, and how often an alert to it is lost, so the attempt times
+ *  out, or answered with a server error.  A host that is down
+ *  refuses every attempt at once.
+ *
+ *  The draws come from a seeded generator, so a run repeats exactly.
+ *  Attempts are answered by the clock; with clock_set_virtual() on
+ *  the host, their latency passes as the Dispatcher polls them, so
+ *  hours of alerts run in moments.
+ *
+ *  Author: Alex Dale @superoxigen
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for information.
+ */
+
+#ifndef _FAKE_TRANSPORT_HPP_
+#define _FAKE_TRANSPORT_HPP_
+
+#include "clock.h"
+#include "endpoints.hpp"
+#include "transport.h"
+#include "utils.h"
+
+/* An attempt and its hedge. */
+#define FAKE_TRANSPORT_SLOTS        2
+
+typedef enum {
+    FAKE_LATENCY_UNIFORM,       /* From the base to the base and the spread */
+    FAKE_LATENCY_EXPONENTIAL    /* The base, and on average the spread more */
+} fake_latency_t;
+
+typedef struct {
+    uint8_t distribution;
+    uint32_t base_ms;
+    uint32_t spread_ms;
+    uint16_t slow_permille;     /* Of answers that take slow_ms longer */
+    uint32_t slow_ms;
+    uint16_t loss_permille;     /* Of alerts never answered */
+    uint16_t error_permille;    /* Of answers that are server errors */
+    bool_t down;
+} fake_profile_t;
+
+typedef struct {
+    uint32_t attempts[ENDPOINTS_MAX];
+    uint32_t lost;
+    uint32_t errors;
+    uint32_t refused;
+    uint32_t cancelled;
+} fake_transport_stats_t;
+
+class FakeTransport {
+    typedef struct {
+        bool_t used;
+        bool_t answered;        /* If not, it is lost */
+        transport_status_t status;
+        time_ms_t due;
+        time_ms_t deadline;
+        byte_t issue_id[UUID_BINARY_LENGTH];
+    } attempt_t;
+
+    transport_t _transport;
+    fake_profile_t _profiles[ENDPOINTS_MAX];
+    attempt_t _attempts[FAKE_TRANSPORT_SLOTS];
+    uint32_t _state;
+    fake_transport_stats_t _stats;
+
+public:
+    FakeTransport(kstring_t name, uint8_t flags, uint16_t timeout_ms);
+
+    void seed(uint32_t seed);
+    void set_profile(int8_t endpoint, fake_profile_t const * profile);
+    fake_profile_t * profile(int8_t endpoint);
+
+    transport_t const * transport(void) const;
+    fake_transport_stats_t const * stats(void) const;
+
+private:
+    uint32_t random(void);
+    uint32_t draw_latency(fake_profile_t const * profile);
+
+    static transport_handle_t start(
+        void * context, int8_t endpoint, transport_alert_t const * alert, time_ms_t deadline);
+    static transport_status_t result(void * context, transport_handle_t handle, byte_t * issue_id);
+    static void cancel(void * context, transport_handle_t handle);
+
+    FakeTransport(FakeTransport const &);
+    FakeTransport & operator=(FakeTransport const &);
+};
+
+#endif /* _FAKE_TRANSPORT_HPP_ */
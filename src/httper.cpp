@@ -12,29 +12,39 @@
 /* Standard Library */
 #include <string.h>
 
-/* 3rd Party Library */
-#include <ESP8266HTTPClient.h>
-
 /* Project Library */
+#include "clock.h"
+#include "connpool.hpp"
 #include "dlog.h"
 #include "smlstr.h"
 #include "konstants.h"
+#include "resolver.hpp"
 #include "wifi_driver.h"
 
 /* Self Header */
 #include "httper.hpp"
 
-#define URL_BUFFER_LENGTH 256
-#define PAYLOAD_BUFFER_LENGTH 1024
-#define PORT_BUFFER_LENGTH 8
+#define WRITE_BUFFER_LENGTH 128
+#define READ_BUFFER_LENGTH 128
+#define CREDENTIALS_BUFFER_LENGTH 96
+#define AUTH_BUFFER_LENGTH 136
 
 
 /* Konstants */
+static kstring_t kGet = "GET ";
+static kstring_t kPost = "POST ";
+static kstring_t kHttpVersion = " HTTP/1.1\r\n";
+static kstring_t kHost = "Host: ";
+static kstring_t kAuthorization = "Authorization";
+static kstring_t kBasic = "Basic ";
+static kstring_t kContentLength = "Content-Length: ";
 static kstring_t kAccept = "Accept";
 static kstring_t kContentType = "Content-Type";
 static kstring_t kApplicationJson = "application/json";
 static kstring_t kApplicationUrlEncode = "application/x-www-form-urlencoded";
-static kstring_t kHttp = "http://";
+
+/* Names for the logs, which are all that use them. */
+#ifdef DEBUG_LOGS
 
 static kstring_t http_code_to_string(int16_t http_code)
 {
@@ -64,6 +74,8 @@ static kstring_t http_code_to_string(int16_t http_code)
             return "Proxy Authentication Required";
         case HTTP_CODE_REQUEST_TIMEOUT:
             return "Request Timeout";
+        case HTTP_CODE_UNSUPPORTED_MEDIA_TYPE:
+            return "Unsupported Media Type";
         /* 500 series */
         case HTTP_CODE_INTERNAL_SERVER_ERROR:
             return "Internal Server Error";
@@ -76,13 +88,74 @@ static kstring_t http_code_to_string(int16_t http_code)
     }
 }
 
+static kstring_t phase_to_string(HTTPer::phase_t phase)
+{
+    switch (phase)
+    {
+        case HTTPer::PHASE_RESOLVE:
+            return "Resolve";
+        case HTTPer::PHASE_CONNECT:
+            return "Connect";
+        case HTTPer::PHASE_SEND:
+            return "Send";
+        case HTTPer::PHASE_RECEIVE:
+            return "Receive";
+        default:
+            return "None";
+    }
+}
+
+#endif /* DEBUG_LOGS */
+
+
+/* Copies the body into a NULL terminated buffer. */
+bool_t HTTPer::init_buffer_sink(buffer_sink_t * buffer_sink, char_t * buffer, uint16_t size)
+{
+    if (!buffer || !size) return false;
+    buffer_sink->buffer = buffer;
+    buffer_sink->size = size;
+    buffer_sink->length = 0;
+    buffer[0] = 0;
+    return true;
+}
+
+bool_t HTTPer::write_buffer_sink(void * context, byte_t const * data, uint16_t length)
+{
+    buffer_sink_t * buffer_sink = (buffer_sink_t *) context;
+
+    if ((buffer_sink->length + length) >= buffer_sink->size) return false;
+    memcpy(&buffer_sink->buffer[buffer_sink->length], data, length);
+    buffer_sink->length += length;
+    buffer_sink->buffer[buffer_sink->length] = 0;
+    return true;
+}
+
+HTTPer::async_t HTTPer::s_async[HTTPER_ASYNC_MAX];
+HTTPer::header_set_t HTTPer::s_device_headers;
+HTTPer::header_set_t HTTPer::s_get_headers;
+HTTPer::header_set_t HTTPer::s_post_headers;
+
+/* "Basic " and the base64 encoded credentials. */
+static char_t authorization[AUTH_BUFFER_LENGTH];
 
 HTTPer::HTTPer(kstring_t host, uint16_t port, kstring_t path):
     _host(host),
     _port(port),
-    _path(path)
+    _path(path),
+    _tls(NULL),
+    _body(NULL),
+    _body_length(0),
+    _body_type(NULL),
+    _typed_media_type(NULL),
+    _typed_sink(NULL),
+    _typed_context(NULL),
+    _n_header_sets(0),
+    _deadline(0),
+    _has_deadline(false),
+    _timeout_phase(PHASE_NONE)
 {
     memset(&_parameter_list, 0, sizeof(_parameter_list));
+    init_shared_headers();
 }
 
 bool_t HTTPer::push_parameter(kstring_t key, kstring_t value)
@@ -121,19 +194,133 @@ bool_t HTTPer::remove_parameter(kstring_t key)
     return true;
 }
 
+/*
+ *  Adds a set of headers to the request, after the shared ones.
+ *  The set is referred to, not copied, and must outlive the
+ *  request.
+ */
+bool_t HTTPer::add_headers(header_set_t const * headers)
+{
+    if (!headers || _n_header_sets >= HTTPER_HEADER_SET_MAX) return false;
+    _header_sets[_n_header_sets++] = headers;
+    return true;
+}
+
+bool_t HTTPer::push_header(header_set_t * headers, kstring_t name, kstring_t value)
+{
+    if (!headers || !name || !value) return false;
+    if (headers->n >= HTTPER_HEADER_MAX) return false;
+
+    headers->elems[headers->n].name = name;
+    headers->elems[headers->n].value = value;
+    headers->n++;
+    return true;
+}
+
+/*
+ *  Sends requests over TLS, to a server with the pinned key, rather
+ *  than in the clear.  The settings must outlive the HTTPer.
+ */
+void HTTPer::set_tls(netconn_tls_t const * tls)
+{
+    _tls = tls;
+}
+
+/*
+ *  Posts the body as it is, with its own Content-Type, rather than
+ *  the form parameters.  The body must outlive the HTTPer.
+ */
+void HTTPer::set_body(byte_t const * body, uint16_t length, kstring_t content_type)
+{
+    _body = body;
+    _body_length = body ? length : 0;
+    _body_type = content_type;
+}
+
+/*
+ *  Sends the body of responses of the media type to their own sink,
+ *  so that a request can take either of two encodings back.
+ */
+void HTTPer::set_typed_sink(kstring_t media_type, sink_t sink, void * context)
+{
+    _typed_media_type = media_type;
+    _typed_sink = sink;
+    _typed_context = context;
+}
+
+/*
+ *  Sets the time, by clock_millis(), by which each request must be
+ *  done.  Without one a request has HTTPER_TIMEOUT_MS from when it
+ *  is made.
+ */
+void HTTPer::set_deadline(time_ms_t deadline)
+{
+    _deadline = deadline;
+    _has_deadline = true;
+}
+
+void HTTPer::clear_deadline(void)
+{
+    _has_deadline = false;
+}
+
+/* The phase in which the last request timed out, if it did. */
+HTTPer::phase_t HTTPer::timeout_phase(void) const
+{
+    return _timeout_phase;
+}
+
+/* Milliseconds until the deadline, 0 once it has passed. */
+uint32_t HTTPer::time_left(time_ms_t deadline)
+{
+    uint32_t left = CLOCK_ELAPSED(deadline, clock_millis());
+
+    /* A deadline behind now wraps around to a huge time left. */
+    return (left > INT32_MAX) ? 0 : left;
+}
+
+/*
+ *  Opens a connection to the host ahead of a request, so the TCP
+ *  handshake overlaps with whatever comes before the request (such
+ *  as button debouncing).  The connection is kept in the pool.
+ */
+bool_t HTTPer::preconnect(kstring_t host, uint16_t port, netconn_tls_t const * tls)
+{
+    if (!wifi_driver_is_connected())
+    {
+        return false;
+    }
+
+    DLOG2("Pre-connecting to", host);
+    return ConnPool::get_instance()->warm(host, port, tls);
+}
+
+void HTTPer::drop_preconnect(kstring_t host, uint16_t port)
+{
+    DLOG2("Dropping pre-connection to", host);
+    ConnPool::get_instance()->drop(host, port);
+}
+
 HTTPer::status_t HTTPer::send_get(void)
 {
-    return send_get(NULL, 0);
+    return send_get((sink_t) NULL, NULL);
 }
 
 HTTPer::status_t HTTPer::send_get(char_t * payload, uint16_t payload_length)
 {
-    HTTPClient client;
-    String response_body;
-    char_t url_buffer[URL_BUFFER_LENGTH];
-    BufStr url(url_buffer, URL_BUFFER_LENGTH);
+    buffer_sink_t buffer_sink;
+
+    if (!init_buffer_sink(&buffer_sink, payload, payload_length))
+    {
+        return send_get();
+    }
+    return send_get(write_buffer_sink, &buffer_sink);
+}
+
+HTTPer::status_t HTTPer::send_get(sink_t sink, void * context)
+{
     int16_t http_code;
-    kstring_t http_code_str;
+    status_t status;
 
     /* Check for WiFi connection. */
     if (!wifi_driver_is_connected())
@@ -141,105 +328,397 @@ HTTPer::status_t HTTPer::send_get(char_t * payload, uint16_t payload_length)
         return STATUS_DISCONNECT;
     }
 
-    /*
-     * Prepare URL
-     */
-    DLOG("Preparing GET URL");
+    DLOG2("Sending GET request...", _path);
+    status = perform(false, NULL, 0, sink, context, &http_code);
 
-    if (!write_url(&url))
+    if (status != STATUS_OK)
     {
-        DLOG_ERR("Failed to prepare URL");
-        return STATUS_INTERNAL_ERROR;
+        DLOG_ERR2("HTTP request failed on GET", _path);
+        return status;
     }
 
-    /* Parameter component */
-    if (!write_query_parameters(&url))
+    DLOG2("GET", http_code_to_string(http_code));
+    return response_status(false, http_code);
+}
+
+HTTPer::status_t HTTPer::send_post(void)
+{
+    return send_post((sink_t) NULL, NULL);
+}
+
+HTTPer::status_t HTTPer::send_post(char_t * payload, uint16_t payload_length)
+{
+    buffer_sink_t buffer_sink;
+
+    if (!init_buffer_sink(&buffer_sink, payload, payload_length))
     {
-        DLOG_ERR("Could not write query parameters to URL");
-        return STATUS_INTERNAL_ERROR;
+        return send_post();
     }
+    return send_post(write_buffer_sink, &buffer_sink);
+}
+
+HTTPer::status_t HTTPer::send_post(sink_t sink, void * context)
+{
+    return post(NULL, 0, sink, context);
+}
+
+/*
+ *  Renders the request which send_post() would send, so that a
+ *  request which never changes can be built once and sent with
+ *  send_rendered_post().  Returns its length, or 0 if it does not
+ *  fit.
+ */
+uint16_t HTTPer::render_post(byte_t * request, uint16_t size)
+{
+    httpwire_writer_t writer;
 
-    DLOG2("Beginning HTTP Client", url.buffer());
+    /* The writer cannot flush, it fails once the buffer is full. */
+    httpwire_writer_init(&writer, request, size, refuse_flush, NULL);
+    render_request(&writer, true);
 
-    if (!client.begin(String(url.buffer())))
+    if (writer.failed)
     {
-        DLOG_ERR2("Failed to begin client with URL", url.buffer());
-        return STATUS_INTERNAL_ERROR;
+        DLOG_ERR2("Request does not fit buffer", _path);
+        return 0;
     }
+    return writer.length;
+}
 
-    /* Set Expected Conent Type */
-    client.addHeader(String(kAccept), String(kApplicationJson));
+/* The same for the request which send_get() would send. */
+uint16_t HTTPer::render_get(byte_t * request, uint16_t size)
+{
+    httpwire_writer_t writer;
 
-    /* Set Authorization of Device */
-    client.setAuthorization(kDeviceUser, kDevicePass);
+    httpwire_writer_init(&writer, request, size, refuse_flush, NULL);
+    render_request(&writer, false);
 
-    DLOG("Sending GET request...");
-    http_code = client.GET();
+    if (writer.failed)
+    {
+        DLOG_ERR2("Request does not fit buffer", _path);
+        return 0;
+    }
+    return writer.length;
+}
 
-    if (http_code < 0)
+HTTPer::status_t HTTPer::send_rendered_post(
+    byte_t const * request, uint16_t length, sink_t sink, void * context)
+{
+    if (!request || !length)
     {
-        DLOG_ERR2("HTTP client returned error on GET", _path);
+        DLOG_ERR("No rendered request");
         return STATUS_INTERNAL_ERROR;
     }
+    return post(request, length, sink, context);
+}
 
-    http_code_str = http_code_to_string(http_code);
-    DLOG2("GET", http_code_str);
+/*
+ *  Asynchronous Requests
+ *
+ *  A request is started and returns a handle straight away.  It
+ *  is then advanced through connecting, writing, waiting and
+ *  reading by poll(), run as a scheduler task, without blocking
+ *  on the response.  Once complete, its event is triggered and
+ *  async_result() gives its status, freeing the handle.  Up to
+ *  HTTPER_ASYNC_MAX requests can be in flight at once.
+ */
 
-    switch (http_code)
+HTTPer::handle_t HTTPer::start_get(sink_t sink, void * context, event_mask_t event)
+{
+    return start(false, NULL, 0, sink, context, event);
+}
+
+HTTPer::handle_t HTTPer::start_post(sink_t sink, void * context, event_mask_t event)
+{
+    return start(true, NULL, 0, sink, context, event);
+}
+
+/* The rendered request must be kept until the request completes. */
+HTTPer::handle_t HTTPer::start_rendered_post(
+    byte_t const * request, uint16_t length,
+    sink_t sink, void * context, event_mask_t event)
+{
+    if (!request || !length) return -1;
+    return start(true, request, length, sink, context, event);
+}
+
+/*
+ *  Returns STATUS_PENDING while the request is in flight.  Once it
+ *  has completed, returns its status and frees the handle.  If it
+ *  timed out, the phase it timed out in is given as well.
+ */
+HTTPer::status_t HTTPer::async_result(handle_t handle, phase_t * timeout_phase)
+{
+    async_t * async;
+    status_t status;
+
+    if (handle < 0 || handle >= HTTPER_ASYNC_MAX) return STATUS_INTERNAL_ERROR;
+    async = &s_async[handle];
+
+    switch (async->state)
     {
-        case HTTP_CODE_OK:
-            /* Parse Payload */
-            if (payload)
+        case ASYNC_IDLE:
+            return STATUS_INTERNAL_ERROR;
+        case ASYNC_DONE:
+            status = async->status;
+            if (timeout_phase) *timeout_phase = (phase_t) async->timeout_phase;
+            async->state = ASYNC_IDLE;
+            return status;
+        default:
+            return STATUS_PENDING;
+    }
+}
+
+/* Abandons a request, its event is not triggered. */
+void HTTPer::cancel(handle_t handle)
+{
+    async_t * async;
+
+    if (handle < 0 || handle >= HTTPER_ASYNC_MAX) return;
+    async = &s_async[handle];
+
+    if (async->conn)
+    {
+        ConnPool::get_instance()->release(async->conn, false);
+        async->conn = NULL;
+    }
+    async->state = ASYNC_IDLE;
+}
+
+/* Advances every request in flight as far as it can go for now. */
+void HTTPer::poll(void)
+{
+    uint8_t i;
+
+    for (i = 0; i < HTTPER_ASYNC_MAX; i++)
+    {
+        while (advance(&s_async[i]));
+    }
+}
+
+uint8_t HTTPer::poll_task(void * arg)
+{
+    poll();
+    return TASK_EXIT_OK;
+}
+
+/* Private Methods */
+
+HTTPer::handle_t HTTPer::start(
+    bool_t is_post, byte_t const * request, uint16_t length,
+    sink_t sink, void * context, event_mask_t event)
+{
+    httpwire_writer_t writer;
+    async_t * async;
+    handle_t handle;
+
+    for (handle = 0; handle < HTTPER_ASYNC_MAX; handle++)
+    {
+        if (s_async[handle].state == ASYNC_IDLE) break;
+    }
+    if (handle == HTTPER_ASYNC_MAX)
+    {
+        DLOG_ERR("Too many requests in flight");
+        return -1;
+    }
+    async = &s_async[handle];
+
+    /* Without a rendered request, it is rendered into the handle. */
+    if (!request)
+    {
+        httpwire_writer_init(&writer, async->buffer, HTTPER_ASYNC_REQUEST_LENGTH, refuse_flush, NULL);
+        render_request(&writer, is_post);
+        if (writer.failed)
+        {
+            DLOG_ERR2("Request does not fit buffer", _path);
+            return -1;
+        }
+        request = async->buffer;
+        length = writer.length;
+    }
+
+    async->is_post = is_post;
+    async->reused = false;
+    async->retried = false;
+    async->host = _host;
+    async->port = _port;
+    async->tls = _tls;
+    async->request = request;
+    async->length = length;
+    async->conn = NULL;
+    init_body_sink(&async->body_sink, sink, context, &async->parser);
+    async->event = event;
+    async->deadline = request_deadline();
+    async->timeout_phase = PHASE_NONE;
+    async->state = ASYNC_CONNECT;
+
+    if (!wifi_driver_is_connected())
+    {
+        finish_async(async, STATUS_DISCONNECT);
+    }
+
+    DLOG2("Started request", _path);
+    return handle;
+}
+
+/*
+ *  Steps a request on to its next state.  Returns true if it can
+ *  go on straight away, false if it has to wait.
+ */
+bool_t HTTPer::advance(async_t * async)
+{
+    status_t status;
+    phase_t phase;
+
+    switch (async->state)
+    {
+        case ASYNC_CONNECT:
+            status = connect(
+                async->host, async->port, async->tls, async->deadline,
+                &async->conn, &async->reused, &phase);
+            if (status == STATUS_TIMEOUT)
             {
-                response_body = client.getString();
-                DLOG2("Got data", response_body.c_str());
-                if (smlstrcpy(payload, response_body.c_str(), payload_length) >= payload_length)
-                {
-                    DLOG_ERR("Provided payload buffer is too small");
-                    return STATUS_PAYLOAD_TOO_SMALL;
-                }
-                return STATUS_OK;
+                time_out_async(async, phase);
+                return false;
             }
-            return STATUS_OK;
-        case HTTP_CODE_NO_CONTENT:
-            if (payload)
+            if (status != STATUS_OK)
             {
-                DLOG("No data, clearing buffer");
-                memset(payload, 0, payload_length);
+                finish_async(async, status);
+                return false;
             }
-            return STATUS_OK;
-        case HTTP_CODE_BAD_REQUEST:
-        case HTTP_CODE_METHOD_NOT_ALLOWED:
-            return STATUS_BAD_REQUEST;
-        case HTTP_CODE_UNAUTHORIZED:
-        case HTTP_CODE_FORBIDDEN:
-        case HTTP_CODE_PROXY_AUTHENTICATION_REQUIRED:
-        case HTTP_CODE_NETWORK_AUTHENTICATION_REQUIRED:
-            return STATUS_BAD_AUTH;
-        case HTTP_CODE_INTERNAL_SERVER_ERROR:
-        case HTTP_CODE_NOT_IMPLEMENTED:
-        case HTTP_CODE_REQUEST_TIMEOUT:
-            return STATUS_REMOTE_ERROR;
+            init_parser(&async->parser, &async->body_sink);
+            async->state = ASYNC_WRITE;
+            return true;
+
+        case ASYNC_WRITE:
+            if (async->conn->write(async->request, async->length) != (int16_t) async->length)
+            {
+                retry_async(async);
+                return true;
+            }
+            if (!time_left(async->deadline))
+            {
+                time_out_async(async, PHASE_SEND);
+                return false;
+            }
+            async->state = ASYNC_WAIT;
+            return true;
+
+        case ASYNC_WAIT:
+        case ASYNC_READ:
+            return read_async(async);
+
         default:
-            return STATUS_UNKNOWN;
+            return false;
     }
 }
 
-HTTPer::status_t HTTPer::send_post(void)
+/* Reads what has arrived of the response, without waiting for more. */
+bool_t HTTPer::read_async(async_t * async)
 {
-    return send_post(NULL, 0);
+    byte_t buffer[READ_BUFFER_LENGTH];
+    httpwire_status_t wire_status;
+    uint8_t reads;
+    int16_t n;
+
+    wire_status = HTTPWIRE_MORE;
+    for (reads = 0; reads < HTTPER_ASYNC_READS_PER_POLL; reads++)
+    {
+        n = async->conn->read(buffer, READ_BUFFER_LENGTH);
+        if (n <= 0) break;
+        async->state = ASYNC_READ;
+        wire_status = httpwire_feed(&async->parser, buffer, (uint16_t) n);
+        if (wire_status != HTTPWIRE_MORE) break;
+    }
+
+    if (wire_status == HTTPWIRE_MORE && n <= 0 && !async->conn->connected())
+    {
+        if (httpwire_is_idle(&async->parser))
+        {
+            retry_async(async);
+            return true;
+        }
+        wire_status = httpwire_finish(&async->parser);
+    }
+
+    switch (wire_status)
+    {
+        case HTTPWIRE_DONE:
+            finish_async(async, response_status(async->is_post, async->parser.code));
+            return false;
+        case HTTPWIRE_SINK_FULL:
+            DLOG_ERR("Response body sink is full");
+            finish_async(async, STATUS_PAYLOAD_TOO_SMALL);
+            return false;
+        case HTTPWIRE_ERROR:
+            DLOG_ERR("Malformed response");
+            finish_async(async, STATUS_INTERNAL_ERROR);
+            return false;
+        default:
+            break;
+    }
+
+    if (!time_left(async->deadline))
+    {
+        time_out_async(async, PHASE_RECEIVE);
+        return false;
+    }
+
+    /* Wait for more, letting other tasks run in the meantime. */
+    return false;
 }
 
-HTTPer::status_t HTTPer::send_post(char_t * payload, uint16_t payload_length)
+/*
+ *  A kept-alive connection may have been closed by the server just
+ *  as it was reused, the request is tried once more on a new one.
+ */
+void HTTPer::retry_async(async_t * async)
+{
+    ConnPool::get_instance()->release(async->conn, false);
+    async->conn = NULL;
+
+    if (!async->reused || async->retried)
+    {
+        finish_async(async, STATUS_DISCONNECT);
+        return;
+    }
+
+    DLOG_WARN("Kept-alive connection was closed, reconnecting");
+    async->retried = true;
+    async->state = ASYNC_CONNECT;
+}
+
+void HTTPer::finish_async(async_t * async, status_t status)
+{
+    if (async->conn)
+    {
+        ConnPool::get_instance()->release(
+            async->conn, status != STATUS_DISCONNECT && async->parser.keep_alive
+                && httpwire_status(&async->parser) == HTTPWIRE_DONE);
+        async->conn = NULL;
+    }
+
+    async->status = status;
+    async->state = ASYNC_DONE;
+    if (async->event)
+    {
+        scheduler_trigger_event(async->event);
+    }
+}
+
+void HTTPer::time_out_async(async_t * async, phase_t phase)
+{
+    DLOG_ERR2("Request timed out in phase", phase_to_string(phase));
+    async->timeout_phase = phase;
+    finish_async(async, STATUS_TIMEOUT);
+}
+
+
+/* Sends the rendered request, or renders it as it is sent. */
+HTTPer::status_t HTTPer::post(
+    byte_t const * request, uint16_t length, sink_t sink, void * context)
 {
-    HTTPClient client;
-    String response_body;
-    char_t url_buffer[URL_BUFFER_LENGTH];
-    char_t request_payload_buffer[PAYLOAD_BUFFER_LENGTH];
-    BufStr url(url_buffer, URL_BUFFER_LENGTH);
-    BufStr request_payload(request_payload_buffer, PAYLOAD_BUFFER_LENGTH);
     int16_t http_code;
-    kstring_t http_code_str;
+    status_t status;
 
     /* Check for WiFi connection. */
     if (!wifi_driver_is_connected())
@@ -247,73 +726,335 @@ HTTPer::status_t HTTPer::send_post(char_t * payload, uint16_t payload_length)
         return STATUS_DISCONNECT;
     }
 
-    /*
-     * Prepare URL
-     */
-    DLOG("Preparing POST URL");
+    DLOG2("Sending POST request...", _path);
+    status = perform(true, request, length, sink, context, &http_code);
 
-    if (!write_url(&url))
+    if (status != STATUS_OK)
     {
-        DLOG_ERR("Failed to prepare URL");
-        return STATUS_INTERNAL_ERROR;
+        DLOG_ERR2("HTTP request failed on POST", _path);
+        return status;
     }
 
-    /* Writing payload parameters */
-    if (!write_parameters(&request_payload))
+    DLOG2("POST", http_code_to_string(http_code));
+    return response_status(true, http_code);
+}
+
+/*
+ *  Sends the request over a pooled connection, either as rendered
+ *  or rendered on the way out.  The response body of a successful
+ *  request is handed to the sink as it is read.  A kept-alive
+ *  connection may have been closed by the server just as it was
+ *  reused, in which case the request is retried once on a new
+ *  connection.  The whole of it, retry included, must be done by
+ *  the deadline.
+ */
+HTTPer::status_t HTTPer::perform(
+    bool_t is_post, byte_t const * request, uint16_t length,
+    sink_t sink, void * context, int16_t * http_code)
+{
+    httpwire_parser_t parser;
+    body_sink_t body_sink;
+    ConnPool * pool;
+    NetConn * conn;
+    bool_t reused;
+    time_ms_t deadline;
+    status_t status;
+    phase_t phase;
+
+    pool = ConnPool::get_instance();
+    init_body_sink(&body_sink, sink, context, &parser);
+    deadline = request_deadline();
+    _timeout_phase = PHASE_NONE;
+
+    do
     {
-        DLOG_ERR("Could not write payload parameters to URL");
-        return STATUS_INTERNAL_ERROR;
+        status = connect(_host, _port, _tls, deadline, &conn, &reused, &phase);
+        if (status == STATUS_TIMEOUT) return timed_out(phase);
+        if (status != STATUS_OK) return status;
+
+        init_parser(&parser, &body_sink);
+
+        /* A write is not cut short, it is only found to have overrun. */
+        phase = PHASE_SEND;
+        if (!(request
+            ? conn->write(request, length) == (int16_t) length
+            : write_request(conn, is_post)))
+        {
+            status = STATUS_DISCONNECT;
+        }
+        else if (!time_left(deadline))
+        {
+            status = STATUS_TIMEOUT;
+        }
+        else
+        {
+            phase = PHASE_RECEIVE;
+            status = read_response(conn, &parser, deadline);
+        }
+
+        if (status == STATUS_OK)
+        {
+            *http_code = parser.code;
+            pool->release(conn, parser.keep_alive);
+            return STATUS_OK;
+        }
+
+        pool->release(conn, false);
+        if (status == STATUS_TIMEOUT) return timed_out(phase);
+        if (!reused || !httpwire_is_idle(&parser))
+        {
+            return status;
+        }
+
+        DLOG_WARN("Kept-alive connection was closed, reconnecting");
+    } while (true);
+}
+
+/*
+ *  Takes a kept-alive connection, or else resolves the host and
+ *  connects to it, securing the connection for HTTPS.  Neither may
+ *  take more than its share of what is left before the deadline.
+ *  Sets the phase it was in, for when it times out.
+ */
+HTTPer::status_t HTTPer::connect(
+    kstring_t host, uint16_t port, netconn_tls_t const * tls, time_ms_t deadline,
+    NetConn ** conn, bool_t * reused, phase_t * phase)
+{
+    ConnPool * pool;
+    net_addr_t address;
+    time_ms_t start;
+    uint16_t budget;
+    bool_t resolved;
+
+    pool = ConnPool::get_instance();
+    *conn = NULL;
+
+    /* A kept-alive connection needs neither a lookup nor a handshake. */
+    if (!pool->has_idle(host, port, tls))
+    {
+        *phase = PHASE_RESOLVE;
+        budget = phase_budget(deadline, HTTPER_RESOLVE_TIMEOUT_MS);
+        if (!budget) return STATUS_TIMEOUT;
+
+        /* A lookup is not cut short, it is only found to have overrun. */
+        start = clock_millis();
+        resolved = Resolver::get_instance()->resolve(host, &address);
+        if (CLOCK_ELAPSED(clock_millis(), start) >= budget) return STATUS_TIMEOUT;
+        if (!resolved)
+        {
+            DLOG_ERR2("Could not resolve", host);
+            return STATUS_DISCONNECT;
+        }
     }
 
-    DLOG2("Beginning HTTP Client", url.buffer());
+    *phase = PHASE_CONNECT;
+    budget = phase_budget(deadline,
+        tls ? HTTPER_TLS_CONNECT_TIMEOUT_MS : HTTPER_CONNECT_TIMEOUT_MS);
+    if (!budget) return STATUS_TIMEOUT;
+
+    /* The address just resolved is taken from the cache. */
+    start = clock_millis();
+    *conn = pool->acquire(host, port, reused, budget, tls);
+    if (*conn) return STATUS_OK;
+    if (CLOCK_ELAPSED(clock_millis(), start) >= budget) return STATUS_TIMEOUT;
+
+    DLOG_ERR2("Could not connect to", host);
+    return STATUS_DISCONNECT;
+}
+
+/* Writes the request, coalesced into a few socket writes. */
+bool_t HTTPer::write_request(NetConn * conn, bool_t is_post)
+{
+    byte_t buffer[WRITE_BUFFER_LENGTH];
+    httpwire_writer_t writer;
 
-    if (!client.begin(String(url.buffer())))
+    httpwire_writer_init(&writer, buffer, WRITE_BUFFER_LENGTH, write_conn, conn);
+    render_request(&writer, is_post);
+
+    if (!httpwire_writer_flush(&writer))
     {
-        DLOG_ERR2("Failed to begin client with URL", url.buffer());
-        return STATUS_INTERNAL_ERROR;
+        DLOG_ERR("Failed to write request");
+        return false;
     }
+    return true;
+}
 
-    /* Set Authorization of Device */
-    client.setAuthorization(kDeviceUser, kDevicePass);
+/* Writes the request line, headers and body straight from their pieces. */
+void HTTPer::render_request(httpwire_writer_t * writer, bool_t is_post)
+{
+    uint8_t i;
 
-    client.addHeader(kContentType, kApplicationUrlEncode);
+    /* Request line */
+    httpwire_write_str(writer, is_post ? kPost : kGet);
+    httpwire_write_str(writer, _path);
+    if (!is_post && _parameter_list.n > 0)
+    {
+        httpwire_write_char(writer, '?');
+        write_parameters(writer);
+    }
+    httpwire_write_str(writer, kHttpVersion);
 
-    DLOG("Sending POST request...");
-    http_code = client.POST((byte_t *) request_payload.buffer(), request_payload.length());
+    /* Headers */
+    write_host(writer);
+    write_headers(writer, &s_device_headers);
+    if (is_post && _body)
+    {
+        httpwire_write_header(writer, kContentType, _body_type);
+    }
+    else
+    {
+        write_headers(writer, is_post ? &s_post_headers : &s_get_headers);
+    }
+    for (i = 0; i < _n_header_sets; i++)
+    {
+        write_headers(writer, _header_sets[i]);
+    }
+    if (is_post)
+    {
+        httpwire_write_str(writer, kContentLength);
+        httpwire_write_uint(writer, _body ? _body_length : parameters_length());
+        httpwire_write_end(writer);
+    }
+    httpwire_write_end(writer);
 
-    if (http_code < 0)
+    /* Body */
+    if (is_post && _body)
     {
-        DLOG_ERR2("HTTP client returned error on POST", _path);
-        return STATUS_INTERNAL_ERROR;
+        httpwire_write(writer, _body, _body_length);
+    }
+    else if (is_post)
+    {
+        write_parameters(writer);
+    }
+}
+
+/* Reads from the connection until the response is complete, or the deadline. */
+HTTPer::status_t HTTPer::read_response(
+    NetConn * conn, httpwire_parser_t * parser, time_ms_t deadline)
+{
+    byte_t buffer[READ_BUFFER_LENGTH];
+    httpwire_status_t wire_status;
+    uint32_t left;
+    int16_t n;
+
+    wire_status = HTTPWIRE_MORE;
+
+    while (wire_status == HTTPWIRE_MORE)
+    {
+        n = conn->read(buffer, READ_BUFFER_LENGTH);
+        if (n > 0)
+        {
+            wire_status = httpwire_feed(parser, buffer, (uint16_t) n);
+            continue;
+        }
+
+        if (!conn->connected())
+        {
+            wire_status = httpwire_finish(parser);
+            break;
+        }
+
+        left = time_left(deadline);
+        if (!left) return STATUS_TIMEOUT;
+        conn->wait((left > UINT16_MAX) ? UINT16_MAX : (uint16_t) left);
+    }
+
+    switch (wire_status)
+    {
+        case HTTPWIRE_DONE:
+            return STATUS_OK;
+        case HTTPWIRE_SINK_FULL:
+            DLOG_ERR("Response body sink is full");
+            return STATUS_PAYLOAD_TOO_SMALL;
+        default:
+            if (httpwire_is_idle(parser))
+            {
+                return STATUS_DISCONNECT;
+            }
+            DLOG_ERR("Malformed response");
+            return STATUS_INTERNAL_ERROR;
     }
+}
 
-    http_code_str = http_code_to_string(http_code);
-    DLOG2("POST", http_code_str);
+HTTPer::status_t HTTPer::timed_out(phase_t phase)
+{
+    DLOG_ERR2("Request timed out in phase", phase_to_string(phase));
+    _timeout_phase = phase;
+    return STATUS_TIMEOUT;
+}
 
+time_ms_t HTTPer::request_deadline(void) const
+{
+    return _has_deadline ? _deadline : clock_millis() + HTTPER_TIMEOUT_MS;
+}
+
+/* A phase may take up to its cap, but never past the deadline. */
+uint16_t HTTPer::phase_budget(time_ms_t deadline, uint16_t cap)
+{
+    uint32_t left = time_left(deadline);
+    return (left < cap) ? (uint16_t) left : cap;
+}
+
+void HTTPer::init_body_sink(
+    body_sink_t * body_sink, sink_t sink, void * context, httpwire_parser_t * parser)
+{
+    body_sink->sink = sink;
+    body_sink->context = context;
+    body_sink->media_type = _typed_sink ? _typed_media_type : NULL;
+    body_sink->typed_sink = _typed_sink;
+    body_sink->typed_context = _typed_context;
+    body_sink->parser = parser;
+}
+
+void HTTPer::init_parser(httpwire_parser_t * parser, body_sink_t * body_sink)
+{
+    httpwire_parser_init(parser, write_body_sink, body_sink);
+    httpwire_expect_type(parser, body_sink->media_type);
+}
+
+bool_t HTTPer::write_body_sink(void * context, byte_t const * data, uint16_t length)
+{
+    body_sink_t * body_sink = (body_sink_t *) context;
+    int16_t http_code = body_sink->parser->code;
+
+    if (http_code < 200 || http_code >= 300) return true;
+    if (body_sink->parser->typed && body_sink->typed_sink)
+    {
+        return body_sink->typed_sink(body_sink->typed_context, data, length);
+    }
+    if (!body_sink->sink) return true;
+    return body_sink->sink(body_sink->context, data, length);
+}
+
+bool_t HTTPer::write_conn(void * context, byte_t const * data, uint16_t length)
+{
+    return ((NetConn *) context)->write(data, length) == (int16_t) length;
+}
+
+bool_t HTTPer::refuse_flush(void * context, byte_t const * data, uint16_t length)
+{
+    return false;
+}
+
+HTTPer::status_t HTTPer::response_status(bool_t is_post, int16_t http_code)
+{
     switch (http_code)
     {
         case HTTP_CODE_OK:
+            return STATUS_OK;
         case HTTP_CODE_CREATED:
         case HTTP_CODE_ACCEPTED:
-            /* Parse Payload */
-            if (payload)
-            {
-                response_body = client.getString();
-                DLOG2("Got data", response_body.c_str());
-                if (smlstrcpy(payload, response_body.c_str(), payload_length) >= payload_length)
-                {
-                    DLOG_ERR("Provided payload buffer is too small");
-                    return STATUS_PAYLOAD_TOO_SMALL;
-                }
-                return STATUS_OK;
-            }
-            return STATUS_OK;
+            return is_post ? STATUS_OK : STATUS_UNKNOWN;
+        default:
+            return code_to_status(http_code);
+    }
+}
+
+HTTPer::status_t HTTPer::code_to_status(int16_t http_code)
+{
+    switch (http_code)
+    {
         case HTTP_CODE_NO_CONTENT:
-            if (payload)
-            {
-                DLOG("No data, clearing buffer");
-                memset(payload, 0, payload_length);
-            }
             return STATUS_OK;
         case HTTP_CODE_BAD_REQUEST:
         case HTTP_CODE_METHOD_NOT_ALLOWED:
@@ -327,111 +1068,106 @@ HTTPer::status_t HTTPer::send_post(char_t * payload, uint16_t payload_length)
         case HTTP_CODE_NOT_IMPLEMENTED:
         case HTTP_CODE_REQUEST_TIMEOUT:
             return STATUS_REMOTE_ERROR;
+        case HTTP_CODE_UNSUPPORTED_MEDIA_TYPE:
+            return STATUS_UNSUPPORTED_MEDIA;
         default:
+            /* Any other 5xx (bad gateway, unavailable, ...) is the host. */
+            if (http_code >= 500 && http_code < 600)
+            {
+                return STATUS_REMOTE_ERROR;
+            }
             return STATUS_UNKNOWN;
     }
 }
 
-/* Private Methods */
-
-void prepare_parameter(char_t * buffer, uint16_t length)
+/* The length of the parameters as they are sent, encoded. */
+uint16_t HTTPer::parameters_length(void)
 {
-    BufStr parameters(buffer, length);
-
-    if (!buffer || !length) return;
+    uint16_t length;
+    uint8_t i;
 
+    length = 0;
+    for (i = 0; i < _parameter_list.n; i++)
+    {
+        if (i > 0) length++;
+        length += smlurlenclen(_parameter_list.elems[i].key, SMLURL_FORM) + 1;
+        length += smlurlenclen(_parameter_list.elems[i].value, SMLURL_FORM);
+    }
+    return length;
 }
 
-bool_t HTTPer::write_parameters(BufStr * bstr)
+/* Form encoded, in the body or the query alike. */
+void HTTPer::write_parameters(httpwire_writer_t * writer)
 {
     uint8_t i;
 
-    if (!bstr)
-    {
-        DLOG_ERR("NULL pointer for BufStr");
-        return false;
-    }
-
     for (i = 0; i < _parameter_list.n; i++)
     {
         if (i > 0)
         {
-            bstr->push_char('&');
-        }
-        bstr->push_str(_parameter_list.elems[i].key);
-        bstr->push_char('=');
-        if (!bstr->push_str(_parameter_list.elems[i].value))
-        {
-            DLOG_ERR("Failed to add parameter");
-            DLOG_ERR2(" KEY", _parameter_list.elems[i].key);
-            DLOG_ERR2(" VAL", _parameter_list.elems[i].value);
-            return false;
+            httpwire_write_char(writer, '&');
         }
+        httpwire_write_urlencoded(writer, _parameter_list.elems[i].key, SMLURL_FORM);
+        httpwire_write_char(writer, '=');
+        httpwire_write_urlencoded(writer, _parameter_list.elems[i].value, SMLURL_FORM);
     }
-    return true;
 }
 
-bool_t HTTPer::write_query_parameters(BufStr * url)
+void HTTPer::write_host(httpwire_writer_t * writer)
 {
-    if (!url)
-    {
-        DLOG_ERR("NULL pointer for BufStr uri");
-        return false;
-    }
-    if (_parameter_list.n > 0)
+    httpwire_write_str(writer, kHost);
+    httpwire_write_str(writer, _host);
+
+    /* Port component */
+    if (_port != (_tls ? HTTPER_HTTPS_PORT : HTTPER_HTTP_PORT))
     {
-        url->push_char('?');
-        return write_parameters(url);
+        httpwire_write_char(writer, ':');
+        httpwire_write_uint(writer, _port);
     }
-    return true;
+    httpwire_write_end(writer);
 }
 
-bool_t HTTPer::write_url(BufStr * url)
+void HTTPer::write_headers(httpwire_writer_t * writer, header_set_t const * headers)
 {
-    char_t port_buffer[PORT_BUFFER_LENGTH];
+    uint16_t i;
 
-    if (!url)
+    for (i = 0; i < headers->n; i++)
     {
-        DLOG_ERR("NULL pointer while writing URL");
-        return false;
+        httpwire_write_header(writer, headers->elems[i].name, headers->elems[i].value);
     }
+}
 
-    /* Protocol */
-    if (!url->push_str(kHttp))
-    {
-        DLOG_ERR("Could not write protocol to URL");
-        return false;
-    }
+/*
+ *  Builds the headers every request carries, the first time a
+ *  request is made.  The Authorization header of the device is
+ *  encoded here, once.
+ */
+void HTTPer::init_shared_headers(void)
+{
+    static bool_t initialized = false;
+    char_t credentials[CREDENTIALS_BUFFER_LENGTH];
+    uint16_t length;
 
-    /* Host component */
-    if (!url->push_str(_host))
-    {
-        DLOG_ERR2("Could not write host to URL", _host);
-        return false;
-    }
+    if (initialized) return;
+    initialized = true;
 
-    /* Port component */
-    if (_port != 80)
+    smlstrcpy(credentials, kDeviceUser, CREDENTIALS_BUFFER_LENGTH);
+    smlstrcat(credentials, ":", CREDENTIALS_BUFFER_LENGTH);
+    length = smlstrcat(credentials, kDevicePass, CREDENTIALS_BUFFER_LENGTH);
+
+    smlstrcpy(authorization, kBasic, AUTH_BUFFER_LENGTH);
+    if (length >= CREDENTIALS_BUFFER_LENGTH
+        || smlb64fmt(&authorization[strlen(kBasic)], (byte_t const *) credentials, length,
+            AUTH_BUFFER_LENGTH - strlen(kBasic)) >= (AUTH_BUFFER_LENGTH - strlen(kBasic)))
     {
-        url->push_char(':');
-        if (smluintfmt(port_buffer, _port, PORT_BUFFER_LENGTH) >= PORT_BUFFER_LENGTH)
-        {
-            DLOG_ERR("Could not convert port to string.");
-            return false;
-        }
-        if (!url->push_str(port_buffer))
-        {
-            DLOG_ERR2("Could not write port to URL", port_buffer);
-            return false;
-        }
+        DLOG_ERR("Device credentials are too long");
     }
-
-    /* Path component. */
-    if (!url->push_str(_path))
+    else
     {
-        DLOG_ERR2("Could not write path to URL", _path);
-        return false;
+        push_header(&s_device_headers, kAuthorization, authorization);
     }
 
-    return true;
+    /* Set Expected Conent Type */
+    push_header(&s_get_headers, kAccept, kApplicationJson);
+    push_header(&s_post_headers, kContentType, kApplicationUrlEncode);
 }
@@ -12,10 +12,34 @@
 #ifndef _HTTPER_HPP_
 #define _HTTPER_HPP_
 
-#include "bufstr.hpp"
+#include "httpwire.h"
+#include "netconn.hpp"
+#include "scheduler.h"
 #include "utils.h"
 
 #define HTTPER_PARAMETER_MAX    5
+#define HTTPER_HEADER_MAX       4
+#define HTTPER_HEADER_SET_MAX   2
+#define HTTPER_TIMEOUT_MS       5000
+
+/*
+ *  Most of the deadline the lookup and the handshake may take, so
+ *  that a slow one fails while there is still time to try again.
+ *  Sending and receiving may use whatever is left.
+ */
+#define HTTPER_RESOLVE_TIMEOUT_MS   1000
+#define HTTPER_CONNECT_TIMEOUT_MS   2000
+/* The handshake too, for HTTPS.  A full one takes seconds on the device. */
+#define HTTPER_TLS_CONNECT_TIMEOUT_MS 4000
+
+#define HTTPER_HTTP_PORT        80
+#define HTTPER_HTTPS_PORT       443
+
+/* Asynchronous requests */
+#define HTTPER_ASYNC_MAX                2
+#define HTTPER_ASYNC_REQUEST_LENGTH     384
+#define HTTPER_ASYNC_READS_PER_POLL     4
+#define HTTPER_POLL_PERIOD_US           2000
 
 class HTTPer {
 
@@ -36,19 +60,121 @@ public:
         STATUS_BAD_AUTH,
         STATUS_BAD_REQUEST,
         STATUS_REMOTE_ERROR,
+        STATUS_UNSUPPORTED_MEDIA,
 
         /* System Related */
         STATUS_DISCONNECT,
+        STATUS_TIMEOUT,
         STATUS_INTERNAL_ERROR,
         STATUS_PAYLOAD_TOO_SMALL,
+        STATUS_PENDING,
         STATUS_UNKNOWN
     } status_t;
 
+    /* The phases of a request, by which its deadline is split. */
+    typedef enum {
+        PHASE_NONE,
+        PHASE_RESOLVE,
+        PHASE_CONNECT,
+        PHASE_SEND,
+        PHASE_RECEIVE
+    } phase_t;
+
+    /* An asynchronous request in flight, negative if invalid. */
+    typedef int8_t handle_t;
+
+    /*
+     *  Receives the response body as it is read, possibly over
+     *  several calls.  Returns false if it cannot take the data.
+     */
+    typedef bool_t (*sink_t)(void * context, byte_t const * data, uint16_t length);
+
+    typedef struct {
+        kstring_t name;
+        kstring_t value;
+    } header_t;
+
+    /*
+     *  A block of headers.  A set is not copied when it is added to
+     *  a request, so one set can be shared by every request.
+     */
+    typedef struct {
+        uint16_t n;
+        header_t elems[HTTPER_HEADER_MAX];
+    } header_set_t;
+
 private:
+    typedef struct {
+        char_t * buffer;
+        uint16_t size;
+        uint16_t length;
+    } buffer_sink_t;
+
+    /*
+     *  Passes the body on only for successful responses, to the
+     *  typed sink if the response has its media type.
+     */
+    typedef struct {
+        sink_t sink;
+        void * context;
+        kstring_t media_type;
+        sink_t typed_sink;
+        void * typed_context;
+        httpwire_parser_t * parser;
+    } body_sink_t;
+
+    typedef enum {
+        ASYNC_IDLE,
+        ASYNC_CONNECT,
+        ASYNC_WRITE,
+        ASYNC_WAIT,     /* For the first byte of the response */
+        ASYNC_READ,
+        ASYNC_DONE
+    } async_state_t;
+
+    typedef struct {
+        uint8_t state;
+        bool_t is_post;
+        bool_t reused;
+        bool_t retried;
+        kstring_t host;
+        uint16_t port;
+        netconn_tls_t const * tls;
+        byte_t const * request;
+        uint16_t length;
+        NetConn * conn;
+        httpwire_parser_t parser;
+        body_sink_t body_sink;
+        event_mask_t event;
+        time_ms_t deadline;
+        uint8_t timeout_phase;
+        status_t status;
+        byte_t buffer[HTTPER_ASYNC_REQUEST_LENGTH];
+    } async_t;
+
+    static async_t s_async[HTTPER_ASYNC_MAX];
+
+    /* Headers shared by every request, built once. */
+    static header_set_t s_device_headers;
+    static header_set_t s_get_headers;
+    static header_set_t s_post_headers;
+
     parameter_list_t _parameter_list;
     kstring_t _host;
     uint16_t _port;
     kstring_t _path;
+    netconn_tls_t const * _tls;
+    byte_t const * _body;
+    uint16_t _body_length;
+    kstring_t _body_type;
+    kstring_t _typed_media_type;
+    sink_t _typed_sink;
+    void * _typed_context;
+    header_set_t const * _header_sets[HTTPER_HEADER_SET_MAX];
+    uint8_t _n_header_sets;
+    time_ms_t _deadline;
+    bool_t _has_deadline;
+    phase_t _timeout_phase;
 
 public:
     HTTPer(kstring_t host, uint16_t _port, kstring_t path);
@@ -56,15 +182,83 @@ public:
     bool_t push_parameter(kstring_t key, kstring_t value);
     bool_t remove_parameter(kstring_t key);
 
+    bool_t add_headers(header_set_t const * headers);
+
+    void set_tls(netconn_tls_t const * tls);
+    void set_body(byte_t const * body, uint16_t length, kstring_t content_type);
+    void set_typed_sink(kstring_t media_type, sink_t sink, void * context);
+
+    void set_deadline(time_ms_t deadline);
+    void clear_deadline(void);
+    phase_t timeout_phase(void) const;
+    static uint32_t time_left(time_ms_t deadline);
+    static bool_t push_header(header_set_t * headers, kstring_t name, kstring_t value);
+
+    status_t send_get(sink_t sink, void * context);
     status_t send_get(char_t * payload, uint16_t payload_length);
     status_t send_get(void);
+    status_t send_post(sink_t sink, void * context);
     status_t send_post(char_t * payload, uint16_t payload_length);
     status_t send_post(void);
 
+    uint16_t render_post(byte_t * request, uint16_t size);
+    uint16_t render_get(byte_t * request, uint16_t size);
+    status_t send_rendered_post(
+        byte_t const * request, uint16_t length, sink_t sink, void * context);
+
+    handle_t start_get(sink_t sink, void * context, event_mask_t event);
+    handle_t start_post(sink_t sink, void * context, event_mask_t event);
+    handle_t start_rendered_post(
+        byte_t const * request, uint16_t length,
+        sink_t sink, void * context, event_mask_t event);
+    static status_t async_result(handle_t handle, phase_t * timeout_phase=NULL);
+    static void cancel(handle_t handle);
+    static void poll(void);
+    static uint8_t poll_task(void * arg);
+
+    static bool_t preconnect(kstring_t host, uint16_t port, netconn_tls_t const * tls=NULL);
+    static void drop_preconnect(kstring_t host, uint16_t port);
+
 private:
-    bool_t write_parameters(BufStr * bstr);
-    bool_t write_query_parameters(BufStr * uri);
-    bool_t write_url(BufStr * url);
+    status_t post(byte_t const * request, uint16_t length, sink_t sink, void * context);
+    status_t perform(
+        bool_t is_post, byte_t const * request, uint16_t length,
+        sink_t sink, void * context, int16_t * http_code);
+    bool_t write_request(NetConn * conn, bool_t is_post);
+    void render_request(httpwire_writer_t * writer, bool_t is_post);
+    static status_t connect(
+        kstring_t host, uint16_t port, netconn_tls_t const * tls, time_ms_t deadline,
+        NetConn ** conn, bool_t * reused, phase_t * phase);
+    status_t read_response(NetConn * conn, httpwire_parser_t * parser, time_ms_t deadline);
+    status_t timed_out(phase_t phase);
+    time_ms_t request_deadline(void) const;
+    static uint16_t phase_budget(time_ms_t deadline, uint16_t cap);
+    static status_t response_status(bool_t is_post, int16_t http_code);
+    static status_t code_to_status(int16_t http_code);
+
+    handle_t start(
+        bool_t is_post, byte_t const * request, uint16_t length,
+        sink_t sink, void * context, event_mask_t event);
+    static bool_t advance(async_t * async);
+    static bool_t read_async(async_t * async);
+    static void retry_async(async_t * async);
+    static void finish_async(async_t * async, status_t status);
+    static void time_out_async(async_t * async, phase_t phase);
+
+    void init_body_sink(
+        body_sink_t * body_sink, sink_t sink, void * context, httpwire_parser_t * parser);
+    static void init_parser(httpwire_parser_t * parser, body_sink_t * body_sink);
+    static bool_t init_buffer_sink(buffer_sink_t * buffer_sink, char_t * buffer, uint16_t size);
+    static bool_t write_buffer_sink(void * context, byte_t const * data, uint16_t length);
+    static bool_t write_body_sink(void * context, byte_t const * data, uint16_t length);
+    static bool_t write_conn(void * context, byte_t const * data, uint16_t length);
+    static bool_t refuse_flush(void * context, byte_t const * data, uint16_t length);
+
+    uint16_t parameters_length(void);
+    void write_parameters(httpwire_writer_t * writer);
+    void write_host(httpwire_writer_t * writer);
+    static void write_headers(httpwire_writer_t * writer, header_set_t const * headers);
+    static void init_shared_headers(void);
 };
 
 #endif /* _HTTPER_HPP_ */
@@ -0,0 +1,733 @@
+/*
+ *  Module: HTTP Wire
+ *
+ *  HTTP/1.1 on the wire, without allocation.  The writer coalesces
+ *  request pieces into a small buffer which is flushed to the
+ *  socket.  The parser takes the response as it arrives, in chunks
+ *  of any size, and hands body bytes straight to a sink.  Content
+ *  length, chunked and read-until-close bodies are supported.
+ *
+ *  Author: Alex Dale @superoxigen
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for information.
+ */
+
+#include <string.h>
+
+#include "smlstr.h"
+#include "httpwire.h"
+
+/*
+ *  Writer
+ */
+
+void httpwire_writer_init(
+    httpwire_writer_t * writer, byte_t * buffer, uint16_t size,
+    httpwire_flush_t flush, void * context)
+{
+    if (!writer) return;
+    writer->buffer = buffer;
+    writer->size = size;
+    writer->length = 0;
+    writer->flush = flush;
+    writer->context = context;
+    writer->failed = !buffer || !size || !flush;
+}
+
+static void flush_buffer(httpwire_writer_t * writer)
+{
+    if (writer->failed || !writer->length) return;
+    writer->failed = !writer->flush(writer->context, writer->buffer, writer->length);
+    writer->length = 0;
+}
+
+void httpwire_write(httpwire_writer_t * writer, byte_t const * data, uint16_t length)
+{
+    if (!writer || writer->failed || !data || !length) return;
+
+    if ((writer->length + length) > writer->size)
+    {
+        flush_buffer(writer);
+        if (writer->failed) return;
+    }
+
+    /* Too large to coalesce, send it as is. */
+    if (length > writer->size)
+    {
+        writer->failed = !writer->flush(writer->context, data, length);
+        return;
+    }
+
+    memcpy(&writer->buffer[writer->length], data, length);
+    writer->length += length;
+}
+
+void httpwire_write_char(httpwire_writer_t * writer, char_t c)
+{
+    httpwire_write(writer, (byte_t const *) &c, 1);
+}
+
+void httpwire_write_str(httpwire_writer_t * writer, kstring_t str)
+{
+    if (!str) return;
+    httpwire_write(writer, (byte_t const *) str, (uint16_t) strlen(str));
+}
+
+void httpwire_write_uint(httpwire_writer_t * writer, uint32_t value)
+{
+    char_t buffer[12];
+    uint16_t length;
+
+    length = smluintfmt(buffer, value, sizeof(buffer));
+    httpwire_write(writer, (byte_t const *) buffer, length);
+}
+
+/*
+ *  Writes the string URL encoded straight into the buffer, flushing
+ *  it as it fills, so no copy of the encoding is ever made.
+ */
+void httpwire_write_urlencoded(httpwire_writer_t * writer, kstring_t str, smlurl_mode_t mode)
+{
+    uint16_t written;
+
+    if (!writer || !str) return;
+
+    while (*str && !writer->failed)
+    {
+        written = smlurlencpart((string_t) &writer->buffer[writer->length], &str, mode,
+            writer->size - writer->length);
+        writer->length += written;
+        if (!*str) break;
+
+        /* Too small a buffer for even one escape can never take it. */
+        if (!written && !writer->length)
+        {
+            writer->failed = true;
+            break;
+        }
+        flush_buffer(writer);
+    }
+}
+
+void httpwire_write_header(httpwire_writer_t * writer, kstring_t name, kstring_t value)
+{
+    httpwire_write_str(writer, name);
+    httpwire_write(writer, (byte_t const *) ": ", 2);
+    httpwire_write_str(writer, value);
+    httpwire_write(writer, (byte_t const *) "\r\n", 2);
+}
+
+void httpwire_write_end(httpwire_writer_t * writer)
+{
+    httpwire_write(writer, (byte_t const *) "\r\n", 2);
+}
+
+bool_t httpwire_writer_flush(httpwire_writer_t * writer)
+{
+    if (!writer) return false;
+    flush_buffer(writer);
+    return !writer->failed;
+}
+
+/*
+ *  Parser
+ */
+
+typedef enum {
+    STATE_VERSION,
+    STATE_CODE,
+    STATE_REASON,
+    STATE_HEADER_START,
+    STATE_HEADER_NAME,
+    STATE_HEADER_SPACE,
+    STATE_HEADER_VALUE,
+    STATE_HEADER_LF,
+    STATE_HEADERS_END_LF,
+    STATE_CHUNK_SIZE,
+    STATE_CHUNK_EXTENSION,
+    STATE_CHUNK_SIZE_LF,
+    STATE_CHUNK_DATA,
+    STATE_CHUNK_DATA_CR,
+    STATE_CHUNK_DATA_LF,
+    STATE_TRAILER_START,
+    STATE_TRAILER_LINE,
+    STATE_TRAILER_END_LF,
+    STATE_BODY,
+    STATE_BODY_UNTIL_CLOSE,
+    STATE_DONE,
+    STATE_ERROR,
+    STATE_SINK_FULL
+} state_t;
+
+/* Headers which are acted on, kHeaders is indexed by header - 1. */
+typedef enum {
+    HEADER_OTHER,
+    HEADER_CONTENT_LENGTH,
+    HEADER_TRANSFER_ENCODING,
+    HEADER_CONNECTION,
+    HEADER_CONTENT_TYPE
+} header_t;
+
+static kstring_t const kHeaders[] = {
+    "content-length",
+    "transfer-encoding",
+    "connection",
+    "content-type"
+};
+#define N_HEADERS (sizeof(kHeaders) / sizeof(kHeaders[0]))
+
+/* Header value tokens. */
+typedef enum {
+    TOKEN_CHUNKED,
+    TOKEN_CLOSE,
+    TOKEN_KEEP_ALIVE
+} token_t;
+
+static kstring_t const kTokens[] = {
+    "chunked",
+    "close",
+    "keep-alive"
+};
+#define N_TOKENS (sizeof(kTokens) / sizeof(kTokens[0]))
+
+static kstring_t const kVersionPrefix = "HTTP/1.";
+#define VERSION_PREFIX_LENGTH 7
+
+/* Chunk sizes past this are not believable for a pendant. */
+#define CHUNK_SIZE_DIGITS_MAX 7
+#define CONTENT_LENGTH_MAX 0x0FFFFFFF
+
+#define IS_DIGIT(c) ((c) >= '0' && (c) <= '9')
+#define TO_LOWER(c) (((c) >= 'A' && (c) <= 'Z') ? ((c) | 0x20) : (c))
+
+static int8_t hex_value(char_t c)
+{
+    if (IS_DIGIT(c)) return c - '0';
+    c = TO_LOWER(c);
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+}
+
+static void reset_response(httpwire_parser_t * parser)
+{
+    parser->state = STATE_VERSION;
+    parser->header = HEADER_OTHER;
+    parser->candidates = 0;
+    parser->match = 0;
+    parser->remaining = 0;
+    parser->code = 0;
+    parser->content_length = 0;
+    parser->has_content_length = false;
+    parser->chunked = false;
+    parser->keep_alive = true;
+    parser->typed = false;
+}
+
+void httpwire_parser_init(httpwire_parser_t * parser, httpwire_sink_t sink, void * context)
+{
+    if (!parser) return;
+    parser->sink = sink;
+    parser->context = context;
+    parser->media_type = NULL;
+    parser->header_length = 0;
+    parser->no_body = false;
+    parser->body_length = 0;
+    reset_response(parser);
+}
+
+/* The response to a HEAD request has headers only. */
+void httpwire_expect_no_body(httpwire_parser_t * parser)
+{
+    if (!parser) return;
+    parser->no_body = true;
+}
+
+/*
+ *  Looks for a media type in the Content-Type of the response, so
+ *  that the body can be told apart before it is read.
+ */
+void httpwire_expect_type(httpwire_parser_t * parser, kstring_t media_type)
+{
+    if (!parser) return;
+    parser->media_type = media_type;
+}
+
+/* Narrows the candidates to those still matching at this position. */
+static void match_char(httpwire_parser_t * parser, kstring_t const * names, uint8_t n_names, char_t c)
+{
+    uint8_t i;
+
+    c = TO_LOWER(c);
+    for (i = 0; i < n_names; i++)
+    {
+        if (!(parser->candidates & (1 << i))) continue;
+        if (!names[i][parser->match] || names[i][parser->match] != c)
+        {
+            parser->candidates &= ~(1 << i);
+        }
+    }
+    if (parser->match < UINT8_MAX)
+    {
+        parser->match++;
+    }
+}
+
+/* Index of the candidate matched in full, or -1. */
+static int8_t matched(httpwire_parser_t const * parser, kstring_t const * names, uint8_t n_names)
+{
+    uint8_t i;
+
+    for (i = 0; i < n_names; i++)
+    {
+        if (!(parser->candidates & (1 << i))) continue;
+        if (!names[i][parser->match]) return (int8_t) i;
+    }
+    return -1;
+}
+
+static void start_token(httpwire_parser_t * parser)
+{
+    parser->match = 0;
+    switch (parser->header)
+    {
+        case HEADER_TRANSFER_ENCODING:
+            parser->candidates = 1 << TOKEN_CHUNKED;
+            break;
+        case HEADER_CONNECTION:
+            parser->candidates = (1 << TOKEN_CLOSE) | (1 << TOKEN_KEEP_ALIVE);
+            break;
+        case HEADER_CONTENT_TYPE:
+            parser->candidates = parser->media_type ? 1 : 0;
+            break;
+        default:
+            parser->candidates = 0;
+            break;
+    }
+}
+
+static void end_token(httpwire_parser_t * parser)
+{
+    int8_t token;
+
+    if (!parser->match) return;
+
+    if (parser->header == HEADER_CONTENT_TYPE)
+    {
+        /* Only the media type counts, not the parameters after it. */
+        parser->typed = (matched(parser, &parser->media_type, 1) == 0);
+        parser->header = HEADER_OTHER;
+        return;
+    }
+
+    token = matched(parser, kTokens, N_TOKENS);
+    switch (parser->header)
+    {
+        case HEADER_TRANSFER_ENCODING:
+            /* Only the last coding decides the framing. */
+            parser->chunked = (token == TOKEN_CHUNKED);
+            break;
+        case HEADER_CONNECTION:
+            if (token == TOKEN_CLOSE) parser->keep_alive = false;
+            else if (token == TOKEN_KEEP_ALIVE) parser->keep_alive = true;
+            break;
+        default:
+            break;
+    }
+    start_token(parser);
+}
+
+static void put_value_char(httpwire_parser_t * parser, char_t c)
+{
+    switch (parser->header)
+    {
+        case HEADER_CONTENT_LENGTH:
+            if (IS_DIGIT(c))
+            {
+                if (parser->content_length > (CONTENT_LENGTH_MAX / 10))
+                {
+                    parser->state = STATE_ERROR;
+                    return;
+                }
+                parser->content_length = (parser->content_length * 10) + (c - '0');
+                parser->has_content_length = true;
+            }
+            else if (c != ' ' && c != '\t')
+            {
+                parser->state = STATE_ERROR;
+            }
+            break;
+        case HEADER_TRANSFER_ENCODING:
+        case HEADER_CONNECTION:
+            if (c == ',' || c == ' ' || c == '\t')
+            {
+                end_token(parser);
+            }
+            else
+            {
+                match_char(parser, kTokens, N_TOKENS, c);
+            }
+            break;
+        case HEADER_CONTENT_TYPE:
+            if (c == ';' || c == ' ' || c == '\t')
+            {
+                end_token(parser);
+            }
+            else if (parser->media_type)
+            {
+                match_char(parser, &parser->media_type, 1, c);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+/* Picks the body framing once the headers are in. */
+static void end_headers(httpwire_parser_t * parser)
+{
+    if ((parser->code / 100) == 1)
+    {
+        /* Interim response, the real one follows. */
+        reset_response(parser);
+        return;
+    }
+
+    if (parser->no_body
+        || parser->code == HTTP_CODE_NO_CONTENT
+        || parser->code == HTTP_CODE_NOT_MODIFIED)
+    {
+        parser->state = STATE_DONE;
+    }
+    else if (parser->chunked)
+    {
+        parser->remaining = 0;
+        parser->match = 0;
+        parser->state = STATE_CHUNK_SIZE;
+    }
+    else if (parser->has_content_length)
+    {
+        parser->remaining = parser->content_length;
+        parser->state = parser->remaining ? STATE_BODY : STATE_DONE;
+    }
+    else
+    {
+        parser->keep_alive = false;
+        parser->state = STATE_BODY_UNTIL_CLOSE;
+    }
+}
+
+static void start_chunk(httpwire_parser_t * parser)
+{
+    if (!parser->match)
+    {
+        parser->state = STATE_ERROR;
+        return;
+    }
+    parser->state = parser->remaining ? STATE_CHUNK_DATA : STATE_TRAILER_START;
+}
+
+/* Hands as much of the body as is available to the sink. */
+static uint16_t put_body(httpwire_parser_t * parser, byte_t const * data, uint16_t length)
+{
+    if (parser->state != STATE_BODY_UNTIL_CLOSE && length > parser->remaining)
+    {
+        length = (uint16_t) parser->remaining;
+    }
+
+    if (parser->sink && !parser->sink(parser->context, data, length))
+    {
+        parser->state = STATE_SINK_FULL;
+        return length;
+    }
+
+    parser->body_length += length;
+    if (parser->state == STATE_BODY_UNTIL_CLOSE) return length;
+
+    parser->remaining -= length;
+    if (!parser->remaining)
+    {
+        parser->state = (parser->state == STATE_BODY) ? STATE_DONE : STATE_CHUNK_DATA_CR;
+    }
+    return length;
+}
+
+/* Steps the header and framing states over one character. */
+static void put_char(httpwire_parser_t * parser, char_t c)
+{
+    int8_t value;
+
+    /* Chunk framing is not counted, it recurs through the body. */
+    if ((parser->state <= STATE_HEADERS_END_LF || parser->state >= STATE_TRAILER_START)
+        && ++parser->header_length > HTTPWIRE_HEADER_MAX)
+    {
+        parser->state = STATE_ERROR;
+        return;
+    }
+
+    switch (parser->state)
+    {
+        case STATE_VERSION:
+            if (parser->match < VERSION_PREFIX_LENGTH)
+            {
+                if (c != kVersionPrefix[parser->match]) parser->state = STATE_ERROR;
+                parser->match++;
+            }
+            else if (parser->match == VERSION_PREFIX_LENGTH && IS_DIGIT(c))
+            {
+                /* HTTP/1.0 closes unless told otherwise. */
+                parser->keep_alive = (c != '0');
+                parser->match++;
+            }
+            else if (parser->match > VERSION_PREFIX_LENGTH && c == ' ')
+            {
+                parser->match = 0;
+                parser->state = STATE_CODE;
+            }
+            else
+            {
+                parser->state = STATE_ERROR;
+            }
+            break;
+
+        case STATE_CODE:
+            if (parser->match < 3 && IS_DIGIT(c))
+            {
+                parser->code = (parser->code * 10) + (c - '0');
+                parser->match++;
+            }
+            else if (parser->match == 3 && (c == ' ' || c == '\r'))
+            {
+                parser->state = STATE_REASON;
+            }
+            else if (parser->match == 3 && c == '\n')
+            {
+                parser->state = STATE_HEADER_START;
+            }
+            else
+            {
+                parser->state = STATE_ERROR;
+            }
+            break;
+
+        case STATE_REASON:
+            if (c == '\n') parser->state = STATE_HEADER_START;
+            break;
+
+        case STATE_HEADER_START:
+            if (c == '\r')
+            {
+                parser->state = STATE_HEADERS_END_LF;
+                break;
+            }
+            if (c == '\n')
+            {
+                end_headers(parser);
+                break;
+            }
+            if (c == ':' || c == ' ' || c == '\t')
+            {
+                parser->state = STATE_ERROR;
+                break;
+            }
+            parser->candidates = (1 << N_HEADERS) - 1;
+            parser->match = 0;
+            parser->state = STATE_HEADER_NAME;
+            /* fall through */
+
+        case STATE_HEADER_NAME:
+            if (c == ':')
+            {
+                parser->header = (uint8_t) (matched(parser, kHeaders, N_HEADERS) + 1);
+                parser->state = STATE_HEADER_SPACE;
+            }
+            else if (c == '\r' || c == '\n')
+            {
+                parser->state = STATE_ERROR;
+            }
+            else
+            {
+                match_char(parser, kHeaders, N_HEADERS, c);
+            }
+            break;
+
+        case STATE_HEADER_SPACE:
+            if (c == ' ' || c == '\t') break;
+            start_token(parser);
+            parser->state = STATE_HEADER_VALUE;
+            /* fall through */
+
+        case STATE_HEADER_VALUE:
+            if (c == '\r' || c == '\n')
+            {
+                end_token(parser);
+                parser->header = HEADER_OTHER;
+                parser->state = (c == '\r') ? STATE_HEADER_LF : STATE_HEADER_START;
+            }
+            else
+            {
+                put_value_char(parser, c);
+            }
+            break;
+
+        case STATE_HEADER_LF:
+            parser->state = (c == '\n') ? STATE_HEADER_START : STATE_ERROR;
+            break;
+
+        case STATE_HEADERS_END_LF:
+            if (c == '\n') end_headers(parser);
+            else parser->state = STATE_ERROR;
+            break;
+
+        case STATE_CHUNK_SIZE:
+            value = hex_value(c);
+            if (value >= 0)
+            {
+                if (parser->match >= CHUNK_SIZE_DIGITS_MAX)
+                {
+                    parser->state = STATE_ERROR;
+                    break;
+                }
+                parser->remaining = (parser->remaining << 4) | (uint8_t) value;
+                parser->match++;
+            }
+            else if (c == ';' || c == ' ' || c == '\t')
+            {
+                parser->state = STATE_CHUNK_EXTENSION;
+            }
+            else if (c == '\r')
+            {
+                parser->state = STATE_CHUNK_SIZE_LF;
+            }
+            else if (c == '\n')
+            {
+                start_chunk(parser);
+            }
+            else
+            {
+                parser->state = STATE_ERROR;
+            }
+            break;
+
+        case STATE_CHUNK_EXTENSION:
+            if (c == '\n') start_chunk(parser);
+            break;
+
+        case STATE_CHUNK_SIZE_LF:
+            if (c == '\n') start_chunk(parser);
+            else parser->state = STATE_ERROR;
+            break;
+
+        case STATE_CHUNK_DATA_CR:
+        case STATE_CHUNK_DATA_LF:
+            if (c == '\r' && parser->state == STATE_CHUNK_DATA_CR)
+            {
+                parser->state = STATE_CHUNK_DATA_LF;
+            }
+            else if (c == '\n')
+            {
+                parser->remaining = 0;
+                parser->match = 0;
+                parser->state = STATE_CHUNK_SIZE;
+            }
+            else
+            {
+                parser->state = STATE_ERROR;
+            }
+            break;
+
+        case STATE_TRAILER_START:
+            if (c == '\r') parser->state = STATE_TRAILER_END_LF;
+            else if (c == '\n') parser->state = STATE_DONE;
+            else parser->state = STATE_TRAILER_LINE;
+            break;
+
+        case STATE_TRAILER_LINE:
+            if (c == '\n') parser->state = STATE_TRAILER_START;
+            break;
+
+        case STATE_TRAILER_END_LF:
+            parser->state = (c == '\n') ? STATE_DONE : STATE_ERROR;
+            break;
+
+        default:
+            parser->state = STATE_ERROR;
+            break;
+    }
+}
+
+httpwire_status_t httpwire_feed(httpwire_parser_t * parser, byte_t const * data, uint16_t length)
+{
+    uint16_t i;
+
+    if (!parser) return HTTPWIRE_ERROR;
+    if (!data && length) parser->state = STATE_ERROR;
+
+    for (i = 0; i < length;)
+    {
+        switch (parser->state)
+        {
+            case STATE_BODY:
+            case STATE_CHUNK_DATA:
+            case STATE_BODY_UNTIL_CLOSE:
+                i += put_body(parser, &data[i], length - i);
+                break;
+            case STATE_DONE:
+                /* Unasked for data, the connection cannot be trusted. */
+                parser->keep_alive = false;
+                return HTTPWIRE_DONE;
+            case STATE_ERROR:
+            case STATE_SINK_FULL:
+                return httpwire_status(parser);
+            default:
+                put_char(parser, (char_t) data[i++]);
+                break;
+        }
+    }
+    return httpwire_status(parser);
+}
+
+/* Ends the response when the connection is closed. */
+httpwire_status_t httpwire_finish(httpwire_parser_t * parser)
+{
+    if (!parser) return HTTPWIRE_ERROR;
+
+    switch (parser->state)
+    {
+        case STATE_BODY_UNTIL_CLOSE:
+            parser->state = STATE_DONE;
+            break;
+        case STATE_DONE:
+        case STATE_ERROR:
+        case STATE_SINK_FULL:
+            break;
+        default:
+            parser->state = STATE_ERROR;
+            break;
+    }
+    parser->keep_alive = false;
+    return httpwire_status(parser);
+}
+
+httpwire_status_t httpwire_status(httpwire_parser_t const * parser)
+{
+    if (!parser) return HTTPWIRE_ERROR;
+
+    switch (parser->state)
+    {
+        case STATE_DONE:
+            return HTTPWIRE_DONE;
+        case STATE_ERROR:
+            return HTTPWIRE_ERROR;
+        case STATE_SINK_FULL:
+            return HTTPWIRE_SINK_FULL;
+        default:
+            return HTTPWIRE_MORE;
+    }
+}
+
+/* True if nothing of the response has arrived yet. */
+bool_t httpwire_is_idle(httpwire_parser_t const * parser)
+{
+    return parser && parser->header_length == 0;
+}
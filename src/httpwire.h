@@ -0,0 +1,127 @@
+/*
+ *  Module: HTTP Wire
+ *
+ *  HTTP/1.1 on the wire, without allocation.  The writer coalesces
+ *  request pieces into a small buffer which is flushed to the
+ *  socket.  The parser takes the response as it arrives, in chunks
+ *  of any size, and hands body bytes straight to a sink.  Content
+ *  length, chunked and read-until-close bodies are supported.
+ *
+ *  Author: Alex Dale @superoxigen
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for information.
+ */
+
+#ifndef _HTTPWIRE_H_
+#define _HTTPWIRE_H_
+
+#include "smlstr.h"
+#include "utils.h"
+
+/* Limit on the status line and headers together. */
+#define HTTPWIRE_HEADER_MAX     4096
+
+START_C_SECTION
+
+typedef enum {
+    /* 100 series */
+    HTTP_CODE_CONTINUE = 100,
+    /* 200 series */
+    HTTP_CODE_OK = 200,
+    HTTP_CODE_CREATED = 201,
+    HTTP_CODE_ACCEPTED = 202,
+    HTTP_CODE_NO_CONTENT = 204,
+    /* 300 series */
+    HTTP_CODE_NOT_MODIFIED = 304,
+    /* 400 series */
+    HTTP_CODE_BAD_REQUEST = 400,
+    HTTP_CODE_UNAUTHORIZED = 401,
+    HTTP_CODE_FORBIDDEN = 403,
+    HTTP_CODE_NOT_FOUND = 404,
+    HTTP_CODE_METHOD_NOT_ALLOWED = 405,
+    HTTP_CODE_PROXY_AUTHENTICATION_REQUIRED = 407,
+    HTTP_CODE_REQUEST_TIMEOUT = 408,
+    HTTP_CODE_UNSUPPORTED_MEDIA_TYPE = 415,
+    /* 500 series */
+    HTTP_CODE_INTERNAL_SERVER_ERROR = 500,
+    HTTP_CODE_NOT_IMPLEMENTED = 501,
+    HTTP_CODE_NETWORK_AUTHENTICATION_REQUIRED = 511
+} http_code_t;
+
+/*
+ *  Writer
+ */
+
+/* Sends out buffered data.  Returns false if it could not. */
+typedef bool_t (*httpwire_flush_t)(void * context, byte_t const * data, uint16_t length);
+
+typedef struct {
+    byte_t * buffer;
+    uint16_t size;
+    uint16_t length;
+    httpwire_flush_t flush;
+    void * context;
+    bool_t failed;
+} httpwire_writer_t;
+
+void httpwire_writer_init(
+    httpwire_writer_t * writer, byte_t * buffer, uint16_t size,
+    httpwire_flush_t flush, void * context);
+void httpwire_write(httpwire_writer_t * writer, byte_t const * data, uint16_t length);
+void httpwire_write_char(httpwire_writer_t * writer, char_t c);
+void httpwire_write_str(httpwire_writer_t * writer, kstring_t str);
+void httpwire_write_uint(httpwire_writer_t * writer, uint32_t value);
+void httpwire_write_urlencoded(httpwire_writer_t * writer, kstring_t str, smlurl_mode_t mode);
+void httpwire_write_header(httpwire_writer_t * writer, kstring_t name, kstring_t value);
+void httpwire_write_end(httpwire_writer_t * writer);
+bool_t httpwire_writer_flush(httpwire_writer_t * writer);
+
+/*
+ *  Parser
+ */
+
+typedef enum {
+    HTTPWIRE_MORE,      /* Needs more of the response. */
+    HTTPWIRE_DONE,      /* Response is complete. */
+    HTTPWIRE_ERROR,     /* Malformed response. */
+    HTTPWIRE_SINK_FULL  /* The body sink refused data. */
+} httpwire_status_t;
+
+/* Receives body bytes, returns false if it cannot take them. */
+typedef bool_t (*httpwire_sink_t)(void * context, byte_t const * data, uint16_t length);
+
+typedef struct {
+    httpwire_sink_t sink;
+    void * context;
+    kstring_t media_type;   /* Looked for in Content-Type, lower case. */
+
+    uint8_t state;
+    uint8_t header;         /* Header being read. */
+    uint8_t candidates;     /* Names or tokens still matching. */
+    uint8_t match;          /* Position within the current match. */
+    uint16_t header_length;
+    uint32_t remaining;     /* Of the content length or current chunk. */
+
+    /* Response */
+    int16_t code;
+    uint32_t content_length;
+    bool_t has_content_length;
+    bool_t chunked;
+    bool_t keep_alive;
+    bool_t no_body;
+    bool_t typed;           /* Response has the media type looked for. */
+    uint32_t body_length;
+} httpwire_parser_t;
+
+void httpwire_parser_init(httpwire_parser_t * parser, httpwire_sink_t sink, void * context);
+void httpwire_expect_no_body(httpwire_parser_t * parser);
+void httpwire_expect_type(httpwire_parser_t * parser, kstring_t media_type);
+httpwire_status_t httpwire_feed(httpwire_parser_t * parser, byte_t const * data, uint16_t length);
+httpwire_status_t httpwire_finish(httpwire_parser_t * parser);
+httpwire_status_t httpwire_status(httpwire_parser_t const * parser);
+bool_t httpwire_is_idle(httpwire_parser_t const * parser);
+
+END_C_SECTION
+
+#endif /* _HTTPWIRE_H_ */
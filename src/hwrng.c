@@ -0,0 +1,92 @@
+/*
+ *  Module: Hardware RNG
+ *
+ *  Random numbers from the ESP8266's hardware generator, and from
+ *  the kernel on the host.
+ *
+ *  Author: Alex Dale @superoxigen
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for information.
+ */
+
+#include <string.h>
+
+#include "hwrng.h"
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#else
+#include <stdlib.h>
+#include <unistd.h>
+#endif
+
+#ifdef ARDUINO
+
+uint32_t hwrng_uint32(void)
+{
+    return RANDOM_REG32;
+}
+
+void hwrng_fill(byte_t * data, uint16_t length)
+{
+    uint32_t word;
+    uint16_t n;
+
+    if (!data) return;
+    while (length)
+    {
+        word = RANDOM_REG32;
+        n = (length < sizeof(word)) ? length : sizeof(word);
+        memcpy(data, &word, n);
+        data += n;
+        length -= n;
+    }
+}
+
+#else
+
+/* The kernel's generator gives at most this much a call. */
+#define ENTROPY_CHUNK   256
+
+/*
+ *  From the kernel's generator, with no file to open, so it is cheap
+ *  enough for each ID.  Falls back to rand() only if it fails.
+ */
+void hwrng_fill(byte_t * data, uint16_t length)
+{
+    uint16_t n, i;
+
+    if (!data) return;
+    while (length)
+    {
+        n = (length < ENTROPY_CHUNK) ? length : ENTROPY_CHUNK;
+        if (getentropy(data, n))
+        {
+            for (i = 0; i < n; i++) data[i] = (byte_t) rand();
+        }
+        data += n;
+        length -= n;
+    }
+}
+
+uint32_t hwrng_uint32(void)
+{
+    uint32_t value;
+
+    hwrng_fill((byte_t *) &value, sizeof(value));
+    return value;
+}
+
+#endif
+
+/* A random, version 4 UUID, in binary. */
+void hwrng_uuid(byte_t * uuid)
+{
+    if (!uuid) return;
+    hwrng_fill(uuid, UUID_BINARY_LENGTH);
+
+    /* Version 4, RFC 4122 variant. */
+    uuid[6] = (uuid[6] & 0x0F) | 0x40;
+    uuid[8] = (uuid[8] & 0x3F) | 0x80;
+}
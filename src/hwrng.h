@@ -0,0 +1,30 @@
+/*
+ *  Module: Hardware RNG
+ *
+ *  Random numbers from the ESP8266's hardware generator, which is
+ *  seeded by the radio's noise, and from the kernel on the host.
+ *  Used where an ID must not collide with any other device's, not
+ *  for keys.
+ *
+ *  Author: Alex Dale @superoxigen
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for information.
+ */
+
+#ifndef _HWRNG_H_
+#define _HWRNG_H_
+
+#include "uuid.h"
+#include "utils.h"
+
+START_C_SECTION
+
+void hwrng_fill(byte_t * data, uint16_t length);
+uint32_t hwrng_uint32(void);
+
+void hwrng_uuid(byte_t * uuid);
+
+END_C_SECTION
+
+#endif /* _HWRNG_H_ */
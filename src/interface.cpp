@@ -80,6 +80,16 @@ bool_t Interface::is_cancel_pressed(void)
     return _cancel_button.is_pressed();
 }
 
+bool_t Interface::is_help_debouncing(void) const
+{
+    return _help_button.is_debouncing();
+}
+
+bool_t Interface::is_help_rejected(void)
+{
+    return _help_button.is_rejected();
+}
+
 void Interface::loop(void)
 {
     _power_led.loop();
@@ -58,6 +58,9 @@ public:
     bool_t is_help_pressed(void);
     bool_t is_cancel_pressed(void);
 
+    bool_t is_help_debouncing(void) const;
+    bool_t is_help_rejected(void);
+
     void loop(void);
 };
 
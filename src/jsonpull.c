@@ -0,0 +1,298 @@
+/*
+ *  Module: JSON Pull Parser
+ *
+ *  A streaming parser which extracts the values of chosen keys
+ *  of a JSON object straight into caller buffers.  Input can be
+ *  fed in chunks of any size as it arrives; no parse tree is
+ *  built and nothing is allocated.
+ *
+ *  Author: Alex Dale @superoxigen
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for information.
+ */
+
+#include "jsonpull.h"
+
+typedef enum {
+    STATE_EXPECT_OBJECT,
+    STATE_EXPECT_KEY,       /* After '{' or ',' */
+    STATE_KEY,
+    STATE_EXPECT_COLON,
+    STATE_EXPECT_VALUE,
+    STATE_STRING,
+    STATE_SCALAR,
+    STATE_ESCAPE,
+    STATE_UNICODE,
+    STATE_NESTED,
+    STATE_NESTED_STRING,
+    STATE_EXPECT_NEXT,      /* After a value */
+    STATE_DONE,
+    STATE_ERROR
+} state_t;
+
+#define IS_WHITESPACE(c) ((c) == ' ' || (c) == '\t' || (c) == '\r' || (c) == '\n')
+
+/* Stores a value character, if the value is being extracted. */
+static void put_value_char(jsonpull_t * parser, char_t c)
+{
+    jsonpull_field_t * target;
+
+    target = parser->target;
+    if (!target) return;
+
+    if ((parser->value_length + 1) < target->length)
+    {
+        target->value[parser->value_length++] = c;
+        target->value[parser->value_length] = 0;
+    }
+    else
+    {
+        target->truncated = true;
+    }
+}
+
+/* Narrows the candidate fields to those matching the key so far. */
+static void put_key_char(jsonpull_t * parser, char_t c)
+{
+    uint8_t i;
+
+    for (i = 0; i < parser->n_fields; i++)
+    {
+        if (!(parser->candidates & (1 << i))) continue;
+        if (parser->fields[i].key[parser->key_position] != c)
+        {
+            parser->candidates &= ~(1 << i);
+        }
+    }
+    parser->key_position++;
+}
+
+/* Selects the field whose key is exactly the key parsed. */
+static void end_key(jsonpull_t * parser)
+{
+    uint8_t i;
+
+    parser->target = NULL;
+    for (i = 0; i < parser->n_fields; i++)
+    {
+        if (!(parser->candidates & (1 << i))) continue;
+        if (parser->fields[i].key[parser->key_position]) continue;
+        parser->target = &parser->fields[i];
+        break;
+    }
+}
+
+static void begin_value(jsonpull_t * parser)
+{
+    parser->value_length = 0;
+    if (parser->target)
+    {
+        parser->target->found = true;
+        parser->target->truncated = false;
+        if (parser->target->length)
+        {
+            parser->target->value[0] = 0;
+        }
+    }
+}
+
+static void put_char(jsonpull_t * parser, char_t c)
+{
+    if (parser->return_state == STATE_KEY)
+    {
+        put_key_char(parser, c);
+    }
+    else
+    {
+        put_value_char(parser, c);
+    }
+}
+
+static char_t unescape(char_t c)
+{
+    switch (c)
+    {
+        case 'b': return '\b';
+        case 'f': return '\f';
+        case 'n': return '\n';
+        case 'r': return '\r';
+        case 't': return '\t';
+        default: return c;
+    }
+}
+
+static state_t step(jsonpull_t * parser, char_t c)
+{
+    switch ((state_t) parser->state)
+    {
+        case STATE_EXPECT_OBJECT:
+            if (IS_WHITESPACE(c)) return STATE_EXPECT_OBJECT;
+            return (c == '{') ? STATE_EXPECT_KEY : STATE_ERROR;
+
+        case STATE_EXPECT_KEY:
+            if (IS_WHITESPACE(c)) return STATE_EXPECT_KEY;
+            if (c == '}') return STATE_DONE;
+            if (c != '"') return STATE_ERROR;
+            parser->candidates = (uint8_t) ((1 << parser->n_fields) - 1);
+            parser->key_position = 0;
+            return STATE_KEY;
+
+        case STATE_KEY:
+            if (c == '"')
+            {
+                end_key(parser);
+                return STATE_EXPECT_COLON;
+            }
+            if (c == '\\')
+            {
+                parser->return_state = STATE_KEY;
+                return STATE_ESCAPE;
+            }
+            put_key_char(parser, c);
+            return STATE_KEY;
+
+        case STATE_EXPECT_COLON:
+            if (IS_WHITESPACE(c)) return STATE_EXPECT_COLON;
+            return (c == ':') ? STATE_EXPECT_VALUE : STATE_ERROR;
+
+        case STATE_EXPECT_VALUE:
+            if (IS_WHITESPACE(c)) return STATE_EXPECT_VALUE;
+            if (c == '{' || c == '[')
+            {
+                /* Nested values are skipped, not extracted. */
+                parser->target = NULL;
+                parser->depth = 1;
+                return STATE_NESTED;
+            }
+            if (c == ',' || c == '}' || c == ']' || c == ':') return STATE_ERROR;
+            begin_value(parser);
+            if (c == '"') return STATE_STRING;
+            put_value_char(parser, c);
+            return STATE_SCALAR;
+
+        case STATE_STRING:
+            if (c == '"') return STATE_EXPECT_NEXT;
+            if (c == '\\')
+            {
+                parser->return_state = STATE_STRING;
+                return STATE_ESCAPE;
+            }
+            put_value_char(parser, c);
+            return STATE_STRING;
+
+        case STATE_ESCAPE:
+            if (c == 'u')
+            {
+                /* Code points are not decoded, they become '?'. */
+                parser->unicode_digits = 0;
+                put_char(parser, '?');
+                return STATE_UNICODE;
+            }
+            put_char(parser, unescape(c));
+            return (state_t) parser->return_state;
+
+        case STATE_UNICODE:
+            if (++parser->unicode_digits < 4) return STATE_UNICODE;
+            return (state_t) parser->return_state;
+
+        case STATE_SCALAR:
+            if (IS_WHITESPACE(c)) return STATE_EXPECT_NEXT;
+            if (c == ',') return STATE_EXPECT_KEY;
+            if (c == '}') return STATE_DONE;
+            put_value_char(parser, c);
+            return STATE_SCALAR;
+
+        case STATE_NESTED:
+            if (c == '"') return STATE_NESTED_STRING;
+            if (c == '{' || c == '[') parser->depth++;
+            if ((c == '}' || c == ']') && --parser->depth == 0) return STATE_EXPECT_NEXT;
+            return STATE_NESTED;
+
+        case STATE_NESTED_STRING:
+            if (c == '\\')
+            {
+                parser->return_state = STATE_NESTED_STRING;
+                return STATE_ESCAPE;
+            }
+            return (c == '"') ? STATE_NESTED : STATE_NESTED_STRING;
+
+        case STATE_EXPECT_NEXT:
+            if (IS_WHITESPACE(c)) return STATE_EXPECT_NEXT;
+            if (c == ',') return STATE_EXPECT_KEY;
+            return (c == '}') ? STATE_DONE : STATE_ERROR;
+
+        case STATE_DONE:
+            return IS_WHITESPACE(c) ? STATE_DONE : STATE_ERROR;
+
+        case STATE_ERROR:
+        default:
+            return STATE_ERROR;
+    }
+}
+
+void jsonpull_init(jsonpull_t * parser, jsonpull_field_t * fields, uint8_t n_fields)
+{
+    uint8_t i;
+
+    if (!parser) return;
+
+    if (!fields || n_fields > JSONPULL_FIELDS_MAX)
+    {
+        n_fields = 0;
+    }
+
+    parser->fields = fields;
+    parser->n_fields = n_fields;
+    parser->state = STATE_EXPECT_OBJECT;
+    parser->return_state = STATE_STRING;
+    parser->candidates = 0;
+    parser->unicode_digits = 0;
+    parser->key_position = 0;
+    parser->depth = 0;
+    parser->target = NULL;
+    parser->value_length = 0;
+
+    for (i = 0; i < n_fields; i++)
+    {
+        fields[i].found = false;
+        fields[i].truncated = false;
+        if (fields[i].value && fields[i].length)
+        {
+            fields[i].value[0] = 0;
+        }
+        else
+        {
+            fields[i].length = 0;
+        }
+    }
+}
+
+jsonpull_status_t jsonpull_feed(jsonpull_t * parser, byte_t const * data, uint16_t length)
+{
+    uint16_t i;
+
+    if (!parser || (!data && length)) return JSONPULL_ERROR;
+
+    for (i = 0; i < length && parser->state != STATE_ERROR; i++)
+    {
+        parser->state = step(parser, (char_t) data[i]);
+    }
+
+    return jsonpull_status(parser);
+}
+
+jsonpull_status_t jsonpull_status(jsonpull_t const * parser)
+{
+    if (!parser) return JSONPULL_ERROR;
+
+    switch ((state_t) parser->state)
+    {
+        case STATE_DONE:
+            return JSONPULL_DONE;
+        case STATE_ERROR:
+            return JSONPULL_ERROR;
+        default:
+            return JSONPULL_MORE;
+    }
+}
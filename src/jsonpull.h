@@ -0,0 +1,65 @@
+/*
+ *  Module: JSON Pull Parser
+ *
+ *  A streaming parser which extracts the values of chosen keys
+ *  of a JSON object straight into caller buffers.  Input can be
+ *  fed in chunks of any size as it arrives; no parse tree is
+ *  built and nothing is allocated.
+ *
+ *  Only keys of the top level object are extracted.  Strings are
+ *  unescaped, other scalars are copied as text, and nested
+ *  objects and arrays are skipped.
+ *
+ *  Author: Alex Dale @superoxigen
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for information.
+ */
+
+#ifndef _JSONPULL_H_
+#define _JSONPULL_H_
+
+#include "utils.h"
+
+/* Keys are tracked with a bitmask. */
+#define JSONPULL_FIELDS_MAX 8
+
+START_C_SECTION
+
+typedef struct {
+    kstring_t key;
+    string_t value;
+    uint16_t length;    /* Size of the value buffer */
+
+    /* Set by the parser */
+    bool_t found;
+    bool_t truncated;
+} jsonpull_field_t;
+
+typedef enum {
+    JSONPULL_MORE,      /* Object is not complete yet */
+    JSONPULL_DONE,      /* Object is complete */
+    JSONPULL_ERROR      /* Input is not a JSON object */
+} jsonpull_status_t;
+
+typedef struct {
+    jsonpull_field_t * fields;
+    uint8_t n_fields;
+
+    uint8_t state;
+    uint8_t return_state;   /* State to resume after a string escape */
+    uint8_t candidates;     /* Fields whose key matches so far */
+    uint8_t unicode_digits;
+    uint16_t key_position;
+    uint16_t depth;         /* Nesting depth of skipped values */
+    jsonpull_field_t * target;
+    uint16_t value_length;
+} jsonpull_t;
+
+void jsonpull_init(jsonpull_t * parser, jsonpull_field_t * fields, uint8_t n_fields);
+jsonpull_status_t jsonpull_feed(jsonpull_t * parser, byte_t const * data, uint16_t length);
+jsonpull_status_t jsonpull_status(jsonpull_t const * parser);
+
+END_C_SECTION
+
+#endif /* _JSONPULL_H_ */
@@ -36,5 +36,37 @@ kstring_t kDevicePass = "test";
 
 /* Platform Information */
 kstring_t kPlatformHost = PLATFORM_HOST;
+#ifdef PLATFORM_HOSTS
+kstring_t kPlatformHosts = PLATFORM_HOSTS;
+#else
+kstring_t kPlatformHosts = PLATFORM_HOST;
+#endif
+#ifdef PLATFORM_HEDGE_MS
+uint16_t const kPlatformHedgeMs = PLATFORM_HEDGE_MS;
+#else
+uint16_t const kPlatformHedgeMs = 0;
+#endif
+#ifdef PLATFORM_KEY
+kstring_t kPlatformKey = PLATFORM_KEY;
+#else
+kstring_t kPlatformKey = NULL;
+#endif
+#if defined(ALERT_KEY) && defined(ALERT_PORT)
+kstring_t kAlertKey = ALERT_KEY;
+uint16_t const kAlertPort = ALERT_PORT;
+#else
+kstring_t kAlertKey = NULL;
+uint16_t const kAlertPort = 0;
+#endif
+#ifdef MQTT_PORT
+uint16_t const kMqttPort = MQTT_PORT;
+#else
+uint16_t const kMqttPort = 0;
+#endif
+#ifdef MQTT_PASSWORD
+kstring_t kMqttPass = MQTT_PASSWORD;
+#else
+kstring_t kMqttPass = NULL;
+#endif
 
 kstring_t kHelpRequestType =  HELP_REQUEST_TYPE;
@@ -42,6 +42,28 @@ extern kstring_t kWifiPass;
  *  Platform Information
  */
 extern kstring_t kPlatformHost;
+/*
+ *  Comma separated platform hosts, each as host[:port], that requests
+ *  go to by speed and health; just kPlatformHost if none are set.
+ *  Milliseconds at least before a slow request is copied to a second
+ *  host, 0 to never hedge.
+ */
+extern kstring_t kPlatformHosts;
+extern uint16_t const kPlatformHedgeMs;
+/* Base64 DER public key of the platform, NULL to send in the clear. */
+extern kstring_t kPlatformKey;
+/*
+ *  Base64 key of 16 bytes shared with the platform for alerts over
+ *  UDP, and its port.  NULL and 0 to use HTTP only.
+ */
+extern kstring_t kAlertKey;
+extern uint16_t const kAlertPort;
+/*
+ *  Port of the platform's MQTT broker, 0 to keep no connection, and
+ *  the password the device logs in with, by its UUID.  NULL for none.
+ */
+extern uint16_t const kMqttPort;
+extern kstring_t kMqttPass;
 
 /*
  * Request Type
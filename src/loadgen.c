@@ -0,0 +1,242 @@
+/*
+ *  Module: Load Generator
+ *
+ *  Replays a rendered request over many connections, and times it.
+ *
+ *  Author: Alex Dale @superoxigen
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for information.
+ */
+
+#ifndef ARDUINO
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "clock.h"
+#include "httpwire.h"
+#include "loadgen.h"
+
+#define LOADGEN_READ_LENGTH     1024
+
+/* Marks a request that was not answered. */
+#define LOADGEN_NO_ANSWER       UINT32_MAX
+
+typedef struct {
+    loadgen_config_t const * config;
+    struct sockaddr_in addr;
+    uint32_t * latencies;
+    uint32_t next;              /* The next request to claim */
+} loadgen_shared_t;
+
+typedef struct {
+    loadgen_shared_t * shared;
+    pthread_t thread;
+    uint32_t answered;
+    uint32_t rejected;
+    uint32_t failed;
+    uint32_t connects;
+} loadgen_worker_t;
+
+static int loadgen_connect(loadgen_shared_t const * shared)
+{
+    struct timeval timeout;
+    int fd, on = 1;
+
+    fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    if (shared->config->timeout_ms)
+    {
+        timeout.tv_sec = shared->config->timeout_ms / 1000;
+        timeout.tv_usec = (shared->config->timeout_ms % 1000) * 1000;
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    }
+    if (connect(fd, (struct sockaddr const *) &shared->addr, sizeof(shared->addr)) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static bool_t loadgen_send(int fd, byte_t const * data, uint16_t length)
+{
+    ssize_t n;
+
+    while (length)
+    {
+        n = send(fd, data, length, MSG_NOSIGNAL);
+        if (n <= 0) return false;
+        data += n;
+        length -= (uint16_t) n;
+    }
+    return true;
+}
+
+/* Sends the request and reads its response.  Returns its code, or -1. */
+static int16_t loadgen_exchange(int fd, loadgen_config_t const * config, bool_t * keep_alive)
+{
+    byte_t buffer[LOADGEN_READ_LENGTH];
+    httpwire_parser_t parser;
+    httpwire_status_t status;
+    ssize_t n;
+
+    if (!loadgen_send(fd, config->request, config->length)) return -1;
+
+    httpwire_parser_init(&parser, NULL, NULL);
+    status = HTTPWIRE_MORE;
+    while (status == HTTPWIRE_MORE)
+    {
+        n = recv(fd, buffer, sizeof(buffer), 0);
+        status = (n > 0)
+            ? httpwire_feed(&parser, buffer, (uint16_t) n)
+            : (n == 0) ? httpwire_finish(&parser) : HTTPWIRE_ERROR;
+    }
+    if (status != HTTPWIRE_DONE) return -1;
+
+    *keep_alive = parser.keep_alive;
+    return parser.code;
+}
+
+static void * loadgen_work(void * context)
+{
+    loadgen_worker_t * worker = (loadgen_worker_t *) context;
+    loadgen_shared_t * shared = worker->shared;
+    loadgen_config_t const * config = shared->config;
+    time_us_t started;
+    bool_t keep_alive;
+    uint32_t i;
+    int16_t code;
+    int fd = -1;
+
+    while ((i = __atomic_fetch_add(&shared->next, 1, __ATOMIC_RELAXED)) < config->requests)
+    {
+        started = clock_micros();
+        if (fd < 0)
+        {
+            fd = loadgen_connect(shared);
+            worker->connects++;
+        }
+
+        keep_alive = false;
+        code = (fd < 0) ? -1 : loadgen_exchange(fd, config, &keep_alive);
+        shared->latencies[i] = LOADGEN_NO_ANSWER;
+        if (code < 0)
+        {
+            worker->failed++;
+        }
+        else if (code < 200 || code > 299)
+        {
+            worker->rejected++;
+        }
+        else
+        {
+            worker->answered++;
+            shared->latencies[i] = clock_micros() - started;
+        }
+
+        if (fd >= 0 && (code < 0 || !keep_alive || config->reconnect))
+        {
+            close(fd);
+            fd = -1;
+        }
+    }
+
+    if (fd >= 0) close(fd);
+    return NULL;
+}
+
+static int loadgen_compare(void const * a, void const * b)
+{
+    uint32_t x = *(uint32_t const *) a;
+    uint32_t y = *(uint32_t const *) b;
+
+    return (x > y) - (x < y);
+}
+
+/* The latency which the permille of the sorted ones are no longer than. */
+static uint32_t loadgen_percentile(uint32_t const * sorted, uint32_t n, uint16_t permille)
+{
+    uint64_t rank;
+
+    if (!n) return 0;
+    rank = ((uint64_t) n * permille + 999) / 1000;
+    return sorted[rank ? rank - 1 : 0];
+}
+
+/*
+ *  Sends the requests and waits for every one to be answered, or to
+ *  fail.  Returns false if it could not start.
+ */
+bool_t loadgen_run(loadgen_config_t const * config, loadgen_result_t * result)
+{
+    loadgen_worker_t workers[LOADGEN_CONCURRENCY_MAX];
+    loadgen_shared_t shared;
+    time_ms_t started;
+    uint32_t i, n;
+    uint16_t started_workers;
+
+    if (!config || !result || !config->request || !config->length
+        || !config->concurrency || config->concurrency > LOADGEN_CONCURRENCY_MAX)
+    {
+        return false;
+    }
+
+    memset(result, 0, sizeof(*result));
+    memset(&shared, 0, sizeof(shared));
+    shared.config = config;
+    shared.addr.sin_family = AF_INET;
+    shared.addr.sin_port = htons(config->port);
+    if (inet_pton(AF_INET, config->host, &shared.addr.sin_addr) != 1) return false;
+
+    shared.latencies = (uint32_t *) malloc(sizeof(uint32_t) * (config->requests ? config->requests : 1));
+    if (!shared.latencies) return false;
+
+    started = clock_millis();
+    started_workers = 0;
+    for (i = 0; i < config->concurrency; i++)
+    {
+        memset(&workers[i], 0, sizeof(workers[i]));
+        workers[i].shared = &shared;
+        if (pthread_create(&workers[i].thread, NULL, loadgen_work, &workers[i])) break;
+        started_workers++;
+    }
+    for (i = 0; i < started_workers; i++)
+    {
+        pthread_join(workers[i].thread, NULL);
+        result->answered += workers[i].answered;
+        result->rejected += workers[i].rejected;
+        result->failed += workers[i].failed;
+        result->connects += workers[i].connects;
+    }
+    result->elapsed_ms = clock_millis() - started;
+    if (result->elapsed_ms)
+    {
+        result->per_second = (uint32_t) ((uint64_t) result->answered * 1000 / result->elapsed_ms);
+    }
+
+    /* The unanswered sort last, past those counted. */
+    qsort(shared.latencies, config->requests, sizeof(uint32_t), loadgen_compare);
+    n = result->answered;
+    result->p50_us = loadgen_percentile(shared.latencies, n, 500);
+    result->p90_us = loadgen_percentile(shared.latencies, n, 900);
+    result->p99_us = loadgen_percentile(shared.latencies, n, 990);
+    result->p999_us = loadgen_percentile(shared.latencies, n, 999);
+    result->max_us = n ? shared.latencies[n - 1] : 0;
+
+    free(shared.latencies);
+    return started_workers == config->concurrency;
+}
+
+#endif /* ARDUINO */
@@ -0,0 +1,66 @@
+/*
+ *  Module: Load Generator
+ *
+ *  Replays one request, byte for byte as the pendant renders it, at
+ *  a platform or the stand-in for it, see standin.hpp, over a number
+ *  of connections at once.  Each connection has its own thread,
+ *  which sends the request and waits for its whole response before
+ *  sending the next, as the device does, either on the same
+ *  connection while the server keeps it alive, or on a new one each
+ *  time, as a device which wakes to send an alert would.
+ *
+ *  Every request is timed from before its connect, if it makes one,
+ *  to the end of its response, and the result has the throughput and
+ *  the tail of those times.  Host only.
+ *
+ *  Author: Alex Dale @superoxigen
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for information.
+ */
+
+#ifndef _LOADGEN_H_
+#define _LOADGEN_H_
+
+#ifndef ARDUINO
+
+#include "utils.h"
+
+#define LOADGEN_CONCURRENCY_MAX     256
+
+START_C_SECTION
+
+typedef struct {
+    kstring_t host;             /* An IPv4 address */
+    uint16_t port;
+    byte_t const * request;
+    uint16_t length;
+    uint16_t concurrency;       /* Connections at once */
+    uint32_t requests;          /* In all, shared between them */
+    bool_t reconnect;           /* A new connection for each request */
+    uint16_t timeout_ms;        /* For each request, 0 for none */
+} loadgen_config_t;
+
+typedef struct {
+    uint32_t answered;          /* With a 2xx code */
+    uint32_t rejected;          /* With any other */
+    uint32_t failed;            /* Not at all */
+    uint32_t connects;
+    uint32_t elapsed_ms;
+    uint32_t per_second;        /* Answered */
+
+    /* Of the requests answered, in microseconds */
+    uint32_t p50_us;
+    uint32_t p90_us;
+    uint32_t p99_us;
+    uint32_t p999_us;
+    uint32_t max_us;
+} loadgen_result_t;
+
+bool_t loadgen_run(loadgen_config_t const * config, loadgen_result_t * result);
+
+END_C_SECTION
+
+#endif /* ARDUINO */
+
+#endif /* _LOADGEN_H_ */
@@ -10,16 +10,23 @@
 #include <Arduino.h>
 
 #include "alertmgr.hpp"
+#include "clock.h"
+#include "dispatch.hpp"
 #include "dlog.h"
 #include "interface.hpp"
 #include "fake_messenger.hpp"
+#include "httper.hpp"
 #include "messenger.hpp"
+#include "mqtt.hpp"
 #include "pin_values.h"
+#include "resolver.hpp"
 #include "scheduler.h"
+#include "snapshot.h"
 #include "wifi_driver.h"
 
 #define INTERFACE_LOOP_PERIOD_US    20000
 #define MANAGER_LOOP_PERIOD_US      200000
+#define RESOLVER_LOOP_PERIOD_US     1000000
 
 
 
@@ -34,6 +41,55 @@ Manager Manager::s_instance = Manager();
 
 Manager * manager;
 
+/* Attempts made to send the pending help request. */
+static uint8_t send_attempts = 0;
+
+/*
+ *  Saves the manager state to RTC memory.  Unchanged state
+ *  is not rewritten.
+ */
+static void save_manager_snapshot(void)
+{
+    snapshot_t snapshot;
+
+    snapshot_init(&snapshot);
+    manager->save_snapshot(&snapshot);
+    snapshot.send_attempts = send_attempts;
+    if (!snapshot_save(&snapshot))
+    {
+        DLOG_WARN("Failed to save manager snapshot");
+    }
+}
+
+/*
+ *  Takes the help request's result once an attempt at it is over,
+ *  and gives up on the manager after four that failed.  The attempt
+ *  is stepped by the messenger's dispatch task meanwhile.
+ */
+static void take_send_result(void)
+{
+    if (!manager->is_sending()) return;
+    if (!manager->try_send()) return;
+
+    if (manager->is_sending())
+    {
+        send_attempts++;
+
+        if (send_attempts == 4)
+        {
+            DLOG("Hard Reset of Manager");
+            manager->hard_reset();
+            manager->enable();
+            send_attempts = 0;
+        }
+    }
+    else
+    {
+        DLOG("Done Send");
+        send_attempts = 0;
+    }
+}
+
 /*
  *  Interface Loop Task
  *
@@ -52,6 +108,20 @@ uint8_t interface_loop_task(void *)
     return TASK_EXIT_OK;
 }
 
+/*
+ *  Resolver Loop Task
+ *
+ *  Revalidates stale DNS entries in the background.
+ */
+uint8_t resolver_loop_task(void *)
+{
+    if (wifi_driver_is_connected())
+    {
+        Resolver::get_instance()->refresh();
+    }
+    return TASK_EXIT_OK;
+}
+
 /*
  *  Alert Manager Loop Task
  *
@@ -60,7 +130,6 @@ uint8_t interface_loop_task(void *)
 uint8_t manager_loop_task(void *)
 {
     static bool_t has_printed = false;
-    static uint32_t counter = 0;
     interface.loop();
     // if (!wifi_driver_is_connected())
     if (false)  /* For testing purposes */
@@ -78,6 +147,22 @@ uint8_t manager_loop_task(void *)
     {
         wifi_driver_log_status();
         has_printed = true;
+
+        /* Resolve the platform before the first alert needs it. */
+        Manager::messenger_t::get_instance()->prewarm();
+
+        /* Alert IDs are ordered by the wall clock, once it has one. */
+        clock_sync_start();
+    }
+
+    /* Warm up the platform connection while a help press debounces. */
+    if (interface.is_help_debouncing())
+    {
+        manager->help_button_debouncing();
+    }
+    else if (interface.is_help_rejected())
+    {
+        manager->help_button_rejected();
     }
 
     if (interface.is_help_pressed())
@@ -94,24 +179,7 @@ uint8_t manager_loop_task(void *)
     if (manager->is_sending())
     {
         DLOG("Trying to Send Help Request");
-        manager->try_send();
-        if (manager->is_sending())
-        {
-            counter++;
-
-            if (counter == 4)
-            {
-                DLOG("Hard Reset of Manager");
-                manager->hard_reset();
-                manager->enable();
-                counter = 0;
-            }
-        }
-        else
-        {
-            DLOG("Done Send");
-            counter = 0;
-        }
+        take_send_result();
     }
     else if (manager->is_cancelling())
     {
@@ -119,12 +187,52 @@ uint8_t manager_loop_task(void *)
         manager->try_cancel();
     }
 
+    save_manager_snapshot();
+
+    return TASK_EXIT_OK;
+}
+
+/*
+ *  Help Sent Task
+ *
+ *  Called as an attempt at the help request ends, so its result is
+ *  taken without waiting for the manager loop.
+ */
+uint8_t help_sent_task(void *)
+{
+    take_send_result();
+    save_manager_snapshot();
     return TASK_EXIT_OK;
 }
 
 void setup()
 {
+    snapshot_t snapshot;
+
     DLOG_INIT();
+
+    /*
+     *  AlertManager Setup
+     *      Done before the network is brought up, so that a
+     *      snapshot from before a reset is resumed right away.
+     */
+    manager = Manager::get_instance();
+    DLOG("Setting manager interface");
+    Manager::messenger_t::get_instance()->init();
+    manager->set_messenger_interface(Manager::messenger_t::get_instance());
+    DLOG("Setting indicator interface");
+    manager->set_indicator_interface(&interface);
+    if (snapshot_load(&snapshot) && manager->resume(&snapshot))
+    {
+        DLOG("Resumed Manager");
+        send_attempts = snapshot.send_attempts;
+    }
+    else
+    {
+        DLOG("Enabling Manager");
+        manager->enable();
+    }
+
     scheduler_init();
     // scheduler_periodic_callback(
     //     TASK_PRIORITY_LOWEST,
@@ -136,16 +244,37 @@ void setup()
         MANAGER_LOOP_PERIOD_US,
         manager_loop_task,
         NULL);
+    scheduler_periodic_callback(
+        TASK_PRIORITY_LOWEST,
+        RESOLVER_LOOP_PERIOD_US,
+        resolver_loop_task,
+        NULL);
+    scheduler_periodic_callback(
+        TASK_PRIORITY_LOWEST,
+        HTTPER_POLL_PERIOD_US,
+        HTTPer::poll_task,
+        NULL);
+    scheduler_periodic_callback(
+        TASK_PRIORITY_LOWEST,
+        MQTT_POLL_PERIOD_US,
+        MqttClient::poll_task,
+        NULL);
+    scheduler_periodic_callback(
+        TASK_PRIORITY_LOWEST,
+        DISPATCH_POLL_PERIOD_US,
+        Manager::messenger_t::dispatch_task,
+        NULL);
+    scheduler_on_event_callback_without_mask(
+        TASK_PRIORITY_LOWEST,
+        DISPATCH_EVENT_DONE,
+        help_sent_task,
+        NULL);
+    scheduler_periodic_callback(
+        TASK_PRIORITY_LOWEST,
+        MESSENGER_HEARTBEAT_PERIOD_US,
+        Messenger::heartbeat_task,
+        NULL);
     wifi_driver_init();
-
-    /* AlertManager Setup */
-    manager = Manager::get_instance();
-    DLOG("Setting manager interface");
-    manager->set_messenger_interface(Manager::messenger_t::get_instance());
-    DLOG("Setting indicator interface");
-    manager->set_indicator_interface(&interface);
-    DLOG("Enabling Manager");
-    manager->enable();
 }
 
 void messenger_test_loop(void)
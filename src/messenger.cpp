@@ -7,41 +7,773 @@
  *  See LICENSE for information.
  */
 
+#include <string.h>
+#ifdef ARDUINO
+#include <Arduino.h>
+#endif
+
+#include "clock.h"
+#include "connpool.hpp"
 #include "dlog.h"
 #include "httper.hpp"
-#include "json.hpp"
+#include "jsonpull.h"
 #include "konstants.h"
+#include "resolver.hpp"
+#include "scheduler.h"
 #include "smlstr.h"
+#include "uuid.h"
+#include "wifi_driver.h"
+#include "wiremsg.h"
 
 #include "messenger.hpp"
 
-#define PLATFORM_PORT 80
-
 static kstring_t kHelpRequestPath = "/patient/request1";
 static kstring_t kCancelRequestPath = "/patient/request/cancel";
 static kstring_t kTestPath = "/patient/test";
+static kstring_t kHeartbeatPath = "/patient/heartbeat";
 
 static kstring_t kDeviceUUIDKey = "device_id";
 static kstring_t kRequestUUIDKey = "issue_id";
 static kstring_t kRequestTypeKey = "request_type_id";
 
-#define RESPONSE_BODY_LENGTH  1024
+static kstring_t kTopicPrefix = "pendant/";
+static kstring_t kAlertTopic = "/alert";
+static kstring_t kAckTopic = "/ack";
+static kstring_t kCancelTopic = "/cancel";
+
+static kstring_t kAccept = "Accept";
+static kstring_t kAcceptTypes = "application/vnd.pendant.v1, application/json";
+
+/* The help request type as a number, or 0 if it is not one. */
+static uint16_t help_request_type(void)
+{
+    uint32_t request_type = smluintscan(kHelpRequestType);
+    return (request_type > UINT16_MAX) ? 0 : (uint16_t) request_type;
+}
+
+/* Whether the platform answered the request, however it did. */
+static bool_t is_answer(HTTPer::status_t status)
+{
+    switch (status)
+    {
+        case HTTPer::STATUS_OK:
+        case HTTPer::STATUS_BAD_AUTH:
+        case HTTPer::STATUS_BAD_REQUEST:
+        case HTTPer::STATUS_UNSUPPORTED_MEDIA:
+        case HTTPer::STATUS_PAYLOAD_TOO_SMALL:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/* Whether the host, rather than the device or its network, failed. */
+static bool_t host_failed(HTTPer::status_t status)
+{
+    switch (status)
+    {
+        case HTTPer::STATUS_TIMEOUT:
+        case HTTPer::STATUS_REMOTE_ERROR:
+            return true;
+        case HTTPer::STATUS_DISCONNECT:
+            return wifi_driver_is_connected();
+        default:
+            return false;
+    }
+}
+
+static uint32_t free_heap(void)
+{
+#ifdef ARDUINO
+    return ESP.getFreeHeap();
+#else
+    return 0;
+#endif
+}
 
 Messenger Messenger::s_instance = Messenger();
+HTTPer::header_set_t Messenger::s_accept_headers;
 
-Messenger::Messenger() {}
+Messenger::Messenger():
+    _endpoint(-1),
+    _help_request_length(0),
+    _help_id_offset(0),
+    _cancel_request_length(0),
+    _cancel_id_offset(0),
+    _help_binary_length(0),
+    _cancel_binary_length(0),
+    _binary(false),
+    _heartbeat(-1),
+    _heartbeat_endpoint(-1),
+    _heartbeat_started(0),
+    _last_heartbeat(0),
+    _last_sample(0),
+    _heartbeat_ms(MESSENGER_HEARTBEAT_MS),
+    _secure(false),
+    _mqtt_deadline(0),
+    _mqtt_alert(0),
+    _mqtt(false),
+    _alert_acked(false)
+{
+    uint8_t i;
+
+    telemetry_init(&_telemetry);
+    for (i = 0; i < MESSENGER_HELP_ATTEMPTS; i++)
+    {
+        _help[i].handle = -1;
+    }
+}
 
 Messenger * Messenger::get_instance(void)
 {
     return &s_instance;
 }
 
-bool_t Messenger::request_help(uuid_ref_t request_id)
+void Messenger::init(void)
 {
-    HTTPer client(kPlatformHost, PLATFORM_PORT, kHelpRequestPath);
-    HTTPer::status_t status;
-    SafeJson json_buf;
-    char_t response_body[RESPONSE_BODY_LENGTH];
+    init_endpoints();
+    init_tls();
+    init_udp();
+    init_mqtt();
+    init_transports();
+
+    if (!s_accept_headers.n)
+    {
+        HTTPer::push_header(&s_accept_headers, kAccept, kAcceptTypes);
+    }
+
+    use_endpoint(_endpoints.pick());
+}
+
+/*
+ *  Renders the help and cancel requests for the endpoint in use.
+ *  Their bytes never change but for the ID of the request, which is
+ *  the last parameter of each body and is patched in place before
+ *  it is sent.  Each request is then a single write.  They are only
+ *  rendered again when another endpoint is used.
+ *
+ *  Every request offers the platform the binary encoding for its
+ *  response.  Once it has answered in it, requests are sent in it
+ *  too, see render_binary().
+ */
+void Messenger::render(void)
+{
+    HTTPer help(_endpoints.host(_endpoint), port(_endpoint), kHelpRequestPath);
+    HTTPer cancel(_endpoints.host(_endpoint), port(_endpoint), kCancelRequestPath);
+
+    help.set_tls(tls(_endpoint));
+    help.add_headers(&s_accept_headers);
+    cancel.set_tls(tls(_endpoint));
+    cancel.add_headers(&s_accept_headers);
+
+    help.push_parameter(kDeviceUUIDKey, kDeviceUUID);
+    help.push_parameter(kRequestTypeKey, kHelpRequestType);
+    help.push_parameter(kRequestUUIDKey, kZeroUUID);
+    _help_request_length = help.render_post(_help_request, MESSENGER_REQUEST_LENGTH);
+    if (_help_request_length)
+    {
+        _help_id_offset = _help_request_length - (UUID_BUFFER_LENGTH - 1);
+    }
+
+    cancel.push_parameter(kDeviceUUIDKey, kDeviceUUID);
+    cancel.push_parameter(kRequestUUIDKey, kZeroUUID);
+    _cancel_request_length = cancel.render_post(_cancel_request, MESSENGER_REQUEST_LENGTH);
+    if (_cancel_request_length)
+    {
+        _cancel_id_offset = _cancel_request_length - (UUID_BUFFER_LENGTH - 1);
+    }
+
+    if (!_help_request_length || !_cancel_request_length)
+    {
+        DLOG_ERR("Failed to render platform requests");
+    }
+
+    render_binary();
+}
+
+/*
+ *  Renders the help and cancel requests in the binary encoding.  The
+ *  issue ID is the last 16 bytes of each, patched in place like the
+ *  form.  Without them, the form is always sent.
+ */
+void Messenger::render_binary(void)
+{
+    HTTPer help(_endpoints.host(_endpoint), port(_endpoint), kHelpRequestPath);
+    HTTPer cancel(_endpoints.host(_endpoint), port(_endpoint), kCancelRequestPath);
+    byte_t body[WIREMSG_LENGTH_MAX];
+    wiremsg_t msg;
+
+    _help_binary_length = 0;
+    _cancel_binary_length = 0;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.request_type = help_request_type();
+    if (!uuid_to_binary(kDeviceUUID, msg.device_id) || !msg.request_type)
+    {
+        DLOG_WARN("Device or request type cannot be sent in binary");
+        return;
+    }
+
+    help.set_tls(tls(_endpoint));
+    help.add_headers(&s_accept_headers);
+    msg.type = WIREMSG_HELP;
+    help.set_body(body, wiremsg_encode(&msg, body, sizeof(body)), kWiremsgMediaType);
+    _help_binary_length = help.render_post(_help_binary, MESSENGER_BINARY_REQUEST_LENGTH);
+
+    cancel.set_tls(tls(_endpoint));
+    cancel.add_headers(&s_accept_headers);
+    msg.type = WIREMSG_CANCEL;
+    cancel.set_body(body, wiremsg_encode(&msg, body, sizeof(body)), kWiremsgMediaType);
+    _cancel_binary_length = cancel.render_post(_cancel_binary, MESSENGER_BINARY_REQUEST_LENGTH);
+
+    if (!_help_binary_length || !_cancel_binary_length)
+    {
+        DLOG_ERR("Failed to render binary platform requests");
+        _help_binary_length = 0;
+        _cancel_binary_length = 0;
+    }
+}
+
+/* Whether the platform has answered in binary, and it can be sent. */
+bool_t Messenger::use_binary(void) const
+{
+    return _binary && _help_binary_length && _cancel_binary_length;
+}
+
+/*
+ *  Resolves every host of the platform, and the broker's, so that
+ *  neither failing over nor hedging waits for DNS.  For when the
+ *  network comes up.
+ */
+void Messenger::prewarm(void)
+{
+    Resolver * resolver = Resolver::get_instance();
+    MqttClient * client = MqttClient::get_instance();
+    uint8_t i;
+
+    for (i = 0; i < _endpoints.count(); i++)
+    {
+        resolver->prewarm(_endpoints.host(i));
+    }
+    if (client->is_configured())
+    {
+        resolver->prewarm(client->host());
+    }
+}
+
+/*
+ *  Reads the platform's hosts.  Requests go to the fastest that is
+ *  healthy, and, if hedging is configured, a slow help request is
+ *  copied to the next.
+ */
+void Messenger::init_endpoints(void)
+{
+    if (_endpoints.count()) return;
+
+    if (!_endpoints.parse(kPlatformHosts))
+    {
+        DLOG_ERR("No platform hosts configured");
+        return;
+    }
+    _endpoints.set_hedge(kPlatformHedgeMs);
+}
+
+/*
+ *  Talks to the platform over HTTPS if its key is configured.  The
+ *  key is pinned, no other certificate is trusted; every host of the
+ *  platform holds the same one.
+ */
+void Messenger::init_tls(void)
+{
+    uint16_t key_length;
+    uint8_t i;
+
+    if (_secure || !kPlatformKey || !_endpoints.count()) return;
+
+    key_length = smlb64scan(_platform_key, kPlatformKey, MESSENGER_KEY_LENGTH);
+    if (!key_length)
+    {
+        DLOG_ERR("Platform key is not valid, sending in the clear");
+        return;
+    }
+
+    for (i = 0; i < _endpoints.count(); i++)
+    {
+        _tls[i].host = _endpoints.host(i);
+        _tls[i].key = _platform_key;
+        _tls[i].key_length = key_length;
+    }
+    _secure = true;
+}
+
+/* Sends alerts over UDP first, if the alert key is configured. */
+void Messenger::init_udp(void)
+{
+    byte_t key[SIPHASH_KEY_LENGTH + 1];
+
+    if (_udp.is_configured() || !kAlertKey) return;
+
+    if (smlb64scan(key, kAlertKey, sizeof(key)) != SIPHASH_KEY_LENGTH
+        || !help_request_type()
+        || !_udp.init(key, kAlertPort, kDeviceUUID, help_request_type()))
+    {
+        DLOG_ERR("Alert key is not valid, alerting over HTTP only");
+    }
+    memset(key, 0, sizeof(key));
+}
+
+/* Builds the device's topic, "pendant/<device UUID><suffix>". */
+static bool_t make_topic(char_t * topic, kstring_t suffix)
+{
+    smlstrcpy(topic, kTopicPrefix, MESSENGER_TOPIC_LENGTH);
+    smlstrcat(topic, kDeviceUUID, MESSENGER_TOPIC_LENGTH);
+    return smlstrcat(topic, suffix, MESSENGER_TOPIC_LENGTH) < MESSENGER_TOPIC_LENGTH;
+}
+
+/*
+ *  Keeps a connection to the platform's broker, if its port is
+ *  configured, secured as HTTP is.  The session is the device's and
+ *  persists, so acknowledgements published while the pendant was
+ *  away are still delivered.  MqttClient::poll_task() connects.
+ */
+void Messenger::init_mqtt(void)
+{
+    MqttClient * client = MqttClient::get_instance();
+
+    if (_mqtt || !kMqttPort || !_endpoints.count()) return;
+
+    if (!make_topic(_alert_topic, kAlertTopic)
+        || !make_topic(_ack_topic, kAckTopic)
+        || !make_topic(_cancel_topic, kCancelTopic)
+        || !help_request_type()
+        || !uuid_is_uuid(kDeviceUUID))
+    {
+        DLOG_ERR("Device cannot alert over MQTT");
+        return;
+    }
+
+    client->configure(_endpoints.host(0), kMqttPort, tls(0), kDeviceUUID, kDeviceUUID, kMqttPass);
+    _mqtt = client->subscribe(_ack_topic, on_alert_ack, this);
+}
+
+/*
+ *  The first attempt at an alert goes over the kept MQTT connection
+ *  if it is up, then over UDP, if they can.  Once they have gone
+ *  unacknowledged, HTTP is used until the alert is sent or its
+ *  budget is spent, failing over between the platform's hosts and
+ *  hedging slow requests, see Dispatcher.
+ */
+void Messenger::init_transports(void)
+{
+    transport_t mqtt = {
+        "MQTT", TRANSPORT_FAST, MESSENGER_MQTT_WAIT_MS,
+        start_mqtt, mqtt_result, mqtt_cancel, NULL, this
+    };
+    transport_t udp = {
+        "UDP", TRANSPORT_FAST, UDPALERT_BUDGET_MS,
+        start_udp, udp_result, udp_cancel, NULL, this
+    };
+    transport_t http = {
+        "HTTP", TRANSPORT_FAILOVER | TRANSPORT_HEDGED, HTTPER_TIMEOUT_MS,
+        start_http, http_result, http_cancel, http_poll, this
+    };
+
+    if (_dispatcher.count()) return;
+
+    _dispatcher.init(&_endpoints, MESSENGER_ALERT_BUDGET_MS, MESSENGER_RETRY_MIN_MS);
+    _mqtt_transport = mqtt;
+    _udp_transport = udp;
+    _http_transport = http;
+    if (_mqtt)
+    {
+        _dispatcher.add(&_mqtt_transport);
+    }
+    if (_udp.is_configured())
+    {
+        _dispatcher.add(&_udp_transport);
+    }
+    _dispatcher.add(&_http_transport);
+}
+
+uint16_t Messenger::port(int8_t endpoint) const
+{
+    return _endpoints.port(endpoint, _secure ? HTTPER_HTTPS_PORT : HTTPER_HTTP_PORT);
+}
+
+netconn_tls_t const * Messenger::tls(int8_t endpoint) const
+{
+    return (_secure && endpoint >= 0 && endpoint < _endpoints.count()) ? &_tls[endpoint] : NULL;
+}
+
+/*
+ *  Renders the requests for the best endpoint now, if they are not
+ *  already, and after init() if it has not been called.
+ */
+bool_t Messenger::is_rendered(void)
+{
+    if (!_endpoints.count())
+    {
+        init();
+    }
+    return use_endpoint(_endpoints.pick());
+}
+
+/* Renders the requests for the endpoint, if they are not.  Returns whether they are. */
+bool_t Messenger::use_endpoint(int8_t endpoint)
+{
+    if (endpoint < 0) return false;
+
+    if (endpoint != _endpoint || !_help_request_length || !_cancel_request_length)
+    {
+        _endpoint = endpoint;
+        render();
+    }
+    return _help_request_length && _cancel_request_length;
+}
+
+/*
+ *  Called while a help press is still being confirmed.  Opens the
+ *  connection to the best endpoint, and renders the requests for it,
+ *  so both are done by the time request_help() is called.
+ */
+void Messenger::prepare_help(void)
+{
+    if (!is_rendered()) return;
+    HTTPer::preconnect(_endpoints.host(_endpoint), port(_endpoint), tls(_endpoint));
+}
+
+/* The help press was not confirmed. */
+void Messenger::abandon_help(void)
+{
+    if (_endpoint < 0) return;
+    HTTPer::drop_preconnect(_endpoints.host(_endpoint), port(_endpoint));
+}
+
+/*
+ *  Gives an alert without a request ID one, as the manager does when
+ *  the button is pushed, rather than the platform.  It is kept for
+ *  every attempt, on every path, and over a reset in the manager's
+ *  snapshot, so the platform can tell them apart from a new alert,
+ *  and the alert can be cancelled by it even if no response ever
+ *  arrived.
+ */
+void Messenger::set_alert_id(uuid_ref_t request_id)
+{
+    if (uuid_is_zero(request_id))
+    {
+        uuid_v7(request_id);
+        DLOG("New request ID");
+    }
+    memcpy(_alert_id, request_id, UUID_BINARY_LENGTH);
+}
+
+/* Patches the request ID into the rendered help requests. */
+void Messenger::patch_help_id(byte_t const * alert_id)
+{
+    uuid_str_t request_id;
+
+    if (_help_request_length)
+    {
+        uuid_from_binary(request_id, alert_id);
+        memcpy(&_help_request[_help_id_offset], request_id, UUID_BUFFER_LENGTH - 1);
+    }
+    if (_help_binary_length)
+    {
+        memcpy(&_help_binary[_help_binary_length - UUID_BINARY_LENGTH],
+            alert_id, UUID_BINARY_LENGTH);
+    }
+}
+
+/*
+ *  Publishes the alert, for the platform to acknowledge on the
+ *  device's ack topic, see on_alert_ack().  Unacknowledged, it stays
+ *  queued for the broker while the other paths are tried, until the
+ *  alert is given up or cancelled, see discard_mqtt().
+ */
+bool_t Messenger::alert_mqtt(byte_t const * alert_id)
+{
+    MqttClient * client = MqttClient::get_instance();
+    byte_t payload[WIREMSG_LENGTH_MAX];
+    wiremsg_t msg;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.type = WIREMSG_ALERT;
+    uuid_to_binary(kDeviceUUID, msg.device_id);
+    memcpy(msg.alert_id, alert_id, UUID_BINARY_LENGTH);
+    msg.request_type = help_request_type();
+
+    _alert_acked = false;
+    return client->publish(_alert_topic, payload,
+        wiremsg_encode(&msg, payload, sizeof(payload)), 1, false, &_mqtt_alert);
+}
+
+/* Drops the alert published over MQTT, if the broker has yet to take it. */
+void Messenger::discard_mqtt(void)
+{
+    if (!_mqtt_alert) return;
+
+    if (MqttClient::get_instance()->discard(_mqtt_alert))
+    {
+        DLOG("Alert dropped from the MQTT queue");
+    }
+    _mqtt_alert = 0;
+}
+
+/*
+ *  Publishes the cancel, which is done once the broker has it: the
+ *  platform's session holds it until it is read.
+ */
+bool_t Messenger::cancel_mqtt(uuid_kref_t request_id)
+{
+    MqttClient * client = MqttClient::get_instance();
+    byte_t payload[WIREMSG_LENGTH_MAX];
+    wiremsg_t msg;
+    time_ms_t end;
+    uint16_t packet_id;
+
+    if (!_mqtt || !client->is_connected()) return false;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.type = WIREMSG_CANCEL;
+    uuid_to_binary(kDeviceUUID, msg.device_id);
+    memcpy(msg.issue_id, request_id, UUID_BINARY_LENGTH);
+
+    if (!client->publish(_cancel_topic, payload,
+        wiremsg_encode(&msg, payload, sizeof(payload)), 1, false, &packet_id))
+    {
+        return false;
+    }
+
+    end = clock_millis() + MESSENGER_MQTT_WAIT_MS;
+    while (!client->is_delivered(packet_id) && HTTPer::time_left(end)
+        && client->wait((uint16_t) HTTPer::time_left(end))) {}
+
+    if (!client->is_delivered(packet_id))
+    {
+        DLOG_WARN("Cancel was not acknowledged over MQTT");
+        return false;
+    }
+    DLOG("Request cancelled over MQTT");
+    return true;
+}
+
+/*
+ *  Takes the acknowledgement of the alert being sent.  Any other,
+ *  such as one retained from an earlier alert, is ignored.
+ */
+void Messenger::on_alert_ack(
+    void * context, kstring_t topic, uint16_t topic_length,
+    byte_t const * payload, uint16_t length)
+{
+    Messenger * messenger = (Messenger *) context;
+    wiremsg_t ack;
+
+    if (!wiremsg_decode(&ack, payload, length) || ack.type != WIREMSG_ALERT_ACK) return;
+    if (!messenger->_dispatcher.is_pending()
+        || memcmp(ack.alert_id, messenger->_alert_id, UUID_BINARY_LENGTH))
+    {
+        return;
+    }
+    memcpy(messenger->_acked_issue_id, ack.issue_id, UUID_BINARY_LENGTH);
+    messenger->_alert_acked = true;
+    messenger->_mqtt_alert = 0;
+}
+
+/* Feeds the response body to the JSON pull parser. */
+static bool_t parse_body(void * context, byte_t const * data, uint16_t length)
+{
+    return jsonpull_feed((jsonpull_t *) context, data, length) != JSONPULL_ERROR;
+}
+
+/* Takes a response body in the binary encoding. */
+static bool_t read_reply(void * context, byte_t const * data, uint16_t length)
+{
+    return wiremsg_reader_feed((wiremsg_reader_t *) context, data, length);
+}
+
+/*
+ *  The platform answers with the ID of the issue it raised, the
+ *  request's own unless it has its own scheme.  Until a valid one is
+ *  parsed, the request's is kept.
+ */
+static void init_reply(jsonpull_t * parser, jsonpull_field_t * field,
+    wiremsg_reader_t * reader, char_t * issued_id)
+{
+    field->key = kRequestUUIDKey;
+    field->value = issued_id;
+    field->length = UUID_BUFFER_LENGTH;
+    jsonpull_init(parser, field, 1);
+    wiremsg_reader_init(reader);
+}
+
+/*
+ *  Starts the help request to the endpoint.  The one the requests are
+ *  rendered for is sent them; a hedge to another is rendered for it.
+ */
+HTTPer::handle_t Messenger::start_help(
+    int8_t endpoint, bool_t binary, byte_t const * alert_id,
+    help_reply_t * reply, time_ms_t deadline)
+{
+    HTTPer client(_endpoints.host(endpoint), port(endpoint), kHelpRequestPath);
+    byte_t body[WIREMSG_LENGTH_MAX];
+    uuid_str_t request_id;
+    wiremsg_t msg;
+
+    init_reply(&reply->parser, &reply->field, &reply->reader, reply->issued_id);
+    client.set_tls(tls(endpoint));
+    client.set_typed_sink(kWiremsgMediaType, read_reply, &reply->reader);
+    client.set_deadline(deadline);
+
+    if (endpoint == _endpoint)
+    {
+        return binary
+            ? client.start_rendered_post(
+                _help_binary, _help_binary_length, parse_body, &reply->parser, 0)
+            : client.start_rendered_post(
+                _help_request, _help_request_length, parse_body, &reply->parser, 0);
+    }
+
+    client.add_headers(&s_accept_headers);
+    if (binary)
+    {
+        memset(&msg, 0, sizeof(msg));
+        msg.type = WIREMSG_HELP;
+        uuid_to_binary(kDeviceUUID, msg.device_id);
+        msg.request_type = help_request_type();
+        memcpy(msg.issue_id, alert_id, UUID_BINARY_LENGTH);
+        client.set_body(body, wiremsg_encode(&msg, body, sizeof(body)), kWiremsgMediaType);
+    }
+    else
+    {
+        uuid_from_binary(request_id, alert_id);
+        client.push_parameter(kDeviceUUIDKey, kDeviceUUID);
+        client.push_parameter(kRequestTypeKey, kHelpRequestType);
+        client.push_parameter(kRequestUUIDKey, request_id);
+    }
+    return client.start_post(parse_body, &reply->parser, 0);
+}
+
+/* Counts the request's answer, or failure, against its endpoint. */
+void Messenger::record(int8_t endpoint, HTTPer::status_t status, time_ms_t started)
+{
+    if (endpoint < 0) return;
+
+    if (is_answer(status))
+    {
+        _endpoints.succeeded(endpoint, clock_millis() - started);
+    }
+    else if (host_failed(status))
+    {
+        _endpoints.failed(endpoint);
+    }
+}
+
+/*
+ *  Makes the transport's status of the help request's, and takes the
+ *  ID of the issue the platform raised: the alert's own unless it has
+ *  its own scheme, or the answer cannot be parsed.
+ */
+transport_status_t Messenger::take_reply(
+    HTTPer::status_t status, help_attempt_t * attempt, byte_t * issue_id)
+{
+    help_reply_t * reply = &attempt->reply;
+    uuid_t issued_id;
+    wiremsg_t decoded;
+
+    switch (status)
+    {
+        case HTTPer::STATUS_OK:
+            break;
+        case HTTPer::STATUS_PAYLOAD_TOO_SMALL:
+            DLOG_WARN("Response body could not be parsed");
+            memcpy(issue_id, _alert_id, UUID_BINARY_LENGTH);
+            return TRANSPORT_DELIVERED;
+        case HTTPer::STATUS_UNSUPPORTED_MEDIA:
+            if (!attempt->binary) return TRANSPORT_REFUSED;
+            DLOG_WARN("Platform refused binary request, sending form");
+            _binary = false;
+            return TRANSPORT_RETRY;
+        case HTTPer::STATUS_BAD_AUTH:
+        case HTTPer::STATUS_BAD_REQUEST:
+            return TRANSPORT_REFUSED;
+        case HTTPer::STATUS_TIMEOUT:
+            return TRANSPORT_TIMEOUT;
+        case HTTPer::STATUS_REMOTE_ERROR:
+            return TRANSPORT_SERVER_ERROR;
+        case HTTPer::STATUS_DISCONNECT:
+            return host_failed(status) ? TRANSPORT_UNREACHABLE : TRANSPORT_UNAVAILABLE;
+        default:
+            return TRANSPORT_UNAVAILABLE;
+    }
+
+    DLOG("Request successully sent and accepted");
+    memcpy(issue_id, _alert_id, UUID_BINARY_LENGTH);
+    if (reply->reader.length)
+    {
+        /* The platform speaks binary, so requests are sent in it too. */
+        _binary = true;
+        if (!wiremsg_reader_decode(&reply->reader, &decoded)
+            || decoded.type != WIREMSG_HELP_REPLY)
+        {
+            DLOG_WARN("Failed to parse binary response");
+            return TRANSPORT_DELIVERED;
+        }
+        memcpy(issue_id, decoded.issue_id, UUID_BINARY_LENGTH);
+    }
+    else if (jsonpull_status(&reply->parser) != JSONPULL_DONE)
+    {
+        DLOG_WARN("Failed to parse response as JSON");
+    }
+    else if (!reply->field.found)
+    {
+        DLOG_WARN("Returned JSON does not have request ID key");
+    }
+    else if (reply->field.truncated || !uuid_to_binary(reply->issued_id, issued_id))
+    {
+        DLOG_WARN2("Returned request ID is not UUID", reply->issued_id);
+    }
+    else
+    {
+        memcpy(issue_id, issued_id, UUID_BINARY_LENGTH);
+    }
+    return TRANSPORT_DELIVERED;
+}
+
+/*
+ *  Starts sending the alert, abandoning any heartbeat in flight, or
+ *  collects the result of the one already started, which
+ *  dispatch_task() steps and which triggers DISPATCH_EVENT_DONE as
+ *  it ends.  TRANSPORT_PENDING until then.  Once over, the alert is
+ *  counted in the telemetry, with how long it took from its first
+ *  attempt, and if delivered its ID is replaced by the issue's.
+ */
+transport_status_t Messenger::request_help(uuid_ref_t request_id)
+{
+    transport_status_t status;
+
+    if (!_dispatcher.is_running())
+    {
+        abandon_heartbeat();
+        if (!start_alert(request_id)) return TRANSPORT_UNAVAILABLE;
+        /* The first attempt goes now, not on the task's next turn. */
+        _dispatcher.poll();
+    }
+
+    status = _dispatcher.result(request_id);
+    if (status == TRANSPORT_PENDING) return status;
+
+    telemetry_alert(
+        &_telemetry, clock_millis() - _dispatcher.started(), status == TRANSPORT_DELIVERED);
+    if (status != TRANSPORT_DELIVERED)
+    {
+        DLOG_ERR("Request for help failed");
+    }
+    return status;
+}
+
+bool_t Messenger::start_alert(uuid_ref_t request_id)
+{
+    transport_alert_t alert;
 
     if (!request_id)
     {
@@ -49,74 +781,253 @@ bool_t Messenger::request_help(uuid_ref_t request_id)
         return false;
     }
 
-    /* Push Parameters */
-    DLOG("Pushing parameters");
-    client.push_parameter(kDeviceUUIDKey, kDeviceUUID);
-    client.push_parameter(kRequestTypeKey, kHelpRequestType);
+    /* Rendered first, for the endpoint every path uses. */
+    is_rendered();
+    set_alert_id(request_id);
+    memset(&alert, 0, sizeof(alert));
+    memcpy(alert.alert_id, _alert_id, UUID_BINARY_LENGTH);
 
-    /* Send Post */
     DLOG("Sending request for help");
-    status = client.send_post(response_body, RESPONSE_BODY_LENGTH);
+    return _dispatcher.start(&alert, DISPATCH_EVENT_DONE);
+}
 
-    if (status == HTTPer::STATUS_OK)
+uint8_t Messenger::dispatch_task(void *)
+{
+    s_instance._dispatcher.poll();
+    return TASK_EXIT_OK;
+}
+
+/*
+ *  MQTT and UDP Transports
+ *
+ *  Both are polled for their acknowledgement, MQTT's by
+ *  MqttClient::poll_task(), and neither waits on it.  One attempt
+ *  over each is in flight at most.
+ */
+
+transport_handle_t Messenger::start_mqtt(
+    void * context, int8_t endpoint, transport_alert_t const * alert, time_ms_t deadline)
+{
+    Messenger * messenger = (Messenger *) context;
+
+    if (!messenger->_mqtt || !MqttClient::get_instance()->is_connected()) return -1;
+    if (!messenger->alert_mqtt(alert->alert_id)) return -1;
+
+    messenger->_mqtt_deadline = deadline;
+    return 0;
+}
+
+transport_status_t Messenger::mqtt_result(
+    void * context, transport_handle_t handle, byte_t * issue_id)
+{
+    Messenger * messenger = (Messenger *) context;
+
+    if (messenger->_alert_acked)
     {
-        DLOG("Request successully sent and accepted");
-        JsonObject& root = json_buf.parseObject(response_body);
-        if (!root.success())
-        {
-            DLOG_WARN2("Failed to parse object as JSON", response_body);
-            uuid_set_zero(request_id);
-            return true;
-        }
-        else if (!root[kRequestUUIDKey].success())
+        memcpy(issue_id, messenger->_acked_issue_id, UUID_BINARY_LENGTH);
+        return TRANSPORT_DELIVERED;
+    }
+    if (HTTPer::time_left(messenger->_mqtt_deadline))
+    {
+        return TRANSPORT_PENDING;
+    }
+    DLOG_WARN("Alert was not acknowledged over MQTT");
+    return TRANSPORT_TIMEOUT;
+}
+
+/* An alert given up is not sent on to the broker, see alert_mqtt(). */
+void Messenger::mqtt_cancel(void * context, transport_handle_t handle)
+{
+    Messenger * messenger = (Messenger *) context;
+
+    messenger->discard_mqtt();
+}
+
+/* Sent to the host the help requests go to, over the alert port. */
+transport_handle_t Messenger::start_udp(
+    void * context, int8_t endpoint, transport_alert_t const * alert, time_ms_t deadline)
+{
+    Messenger * messenger = (Messenger *) context;
+    uint32_t budget_ms;
+
+    if (!messenger->_udp.is_configured() || endpoint < 0) return -1;
+
+    budget_ms = HTTPer::time_left(deadline);
+    if (budget_ms > UINT16_MAX) budget_ms = UINT16_MAX;
+
+    return messenger->_udp.start_help(
+        messenger->_endpoints.host(endpoint), alert->alert_id, (uint16_t) budget_ms) ? 0 : -1;
+}
+
+transport_status_t Messenger::udp_result(
+    void * context, transport_handle_t handle, byte_t * issue_id)
+{
+    Messenger * messenger = (Messenger *) context;
+
+    switch (messenger->_udp.poll_help(issue_id))
+    {
+        case UDPALERT_PENDING:
+            return TRANSPORT_PENDING;
+        case UDPALERT_ACKED:
+            return TRANSPORT_DELIVERED;
+        default:
+            return TRANSPORT_TIMEOUT;
+    }
+}
+
+void Messenger::udp_cancel(void * context, transport_handle_t handle)
+{
+    Messenger * messenger = (Messenger *) context;
+
+    messenger->_udp.cancel_help();
+}
+
+/*
+ *  HTTP Transport
+ *
+ *  The first help request in flight goes to the endpoint the requests
+ *  are rendered for, rendering them again for another; a hedge is
+ *  rendered for its own.  A hedge over TLS needs an idle connection
+ *  to its host or room for another, such as when MQTT is not up over
+ *  TLS, see NetConn::tls_room().
+ */
+
+transport_handle_t Messenger::start_http(
+    void * context, int8_t endpoint, transport_alert_t const * alert, time_ms_t deadline)
+{
+    Messenger * messenger = (Messenger *) context;
+    help_attempt_t * attempt;
+    uint8_t i, slot, busy;
+
+    slot = MESSENGER_HELP_ATTEMPTS;
+    busy = 0;
+    for (i = 0; i < MESSENGER_HELP_ATTEMPTS; i++)
+    {
+        if (messenger->_help[i].handle >= 0)
         {
-            DLOG_WARN2("Returned JSON does not have request ID key", response_body);
-            uuid_set_zero(request_id);
-            return true;
+            busy++;
         }
-        smlstrcpy(request_id, root[kRequestUUIDKey], UUID_BUFFER_LENGTH);
-        if (!uuid_is_uuid(request_id))
+        else if (slot == MESSENGER_HELP_ATTEMPTS)
         {
-            DLOG_WARN2("Returned request ID is not UUID", request_id);
-            uuid_set_zero(request_id);
-            return true;
+            slot = i;
         }
-        return true;
     }
-    else if (status == HTTPer::STATUS_PAYLOAD_TOO_SMALL)
+    if (slot == MESSENGER_HELP_ATTEMPTS) return -1;
+
+    if (!busy)
     {
-        DLOG_WARN("Response body was too small");
-        uuid_set_zero(request_id);
-        return true;
+        if (!messenger->use_endpoint(endpoint)) return -1;
+        messenger->patch_help_id(alert->alert_id);
     }
-    else
+    else if (messenger->tls(endpoint) && !NetConn::tls_room()
+        && !ConnPool::get_instance()->has_idle(messenger->_endpoints.host(endpoint),
+            messenger->port(endpoint), messenger->tls(endpoint)))
     {
-        DLOG_ERR("Request for help failed");
-        return false;
+        DLOG_WARN("No room to hedge over TLS");
+        return -1;
     }
 
-    return true;
+    attempt = &messenger->_help[slot];
+    attempt->binary = messenger->use_binary();
+    attempt->handle = messenger->start_help(
+        endpoint, attempt->binary, alert->alert_id, &attempt->reply, deadline);
+    return (attempt->handle < 0) ? -1 : (transport_handle_t) slot;
+}
+
+transport_status_t Messenger::http_result(
+    void * context, transport_handle_t handle, byte_t * issue_id)
+{
+    Messenger * messenger = (Messenger *) context;
+    help_attempt_t * attempt = &messenger->_help[handle];
+    HTTPer::status_t status;
+
+    status = HTTPer::async_result(attempt->handle);
+    if (status == HTTPer::STATUS_PENDING) return TRANSPORT_PENDING;
+
+    attempt->handle = -1;
+    return messenger->take_reply(status, attempt, issue_id);
+}
+
+void Messenger::http_cancel(void * context, transport_handle_t handle)
+{
+    Messenger * messenger = (Messenger *) context;
+
+    HTTPer::cancel(messenger->_help[handle].handle);
+    messenger->_help[handle].handle = -1;
+}
+
+void Messenger::http_poll(void * context)
+{
+    HTTPer::poll();
 }
 
+/*
+ *  Cancels by the request's ID, which the device made, so an alert
+ *  can be cancelled even if no response to it ever arrived.  An
+ *  endpoint that fails is passed over for the next, once for each.
+ */
 bool_t Messenger::cancel_help(uuid_kref_t request_id)
 {
-    HTTPer client(kPlatformHost, PLATFORM_PORT, kCancelRequestPath);
     HTTPer::status_t status;
+    uuid_str_t text;
+    time_ms_t started;
+    bool_t binary;
+    uint8_t tries;
 
-    if (!request_id)
+    if (!request_id || uuid_is_zero(request_id))
     {
         DLOG_ERR("Cannot cancel help without request ID");
         return false;
     }
 
-    /* Push Parameters */
-    DLOG("Pushing parameters");
-    client.push_parameter(kDeviceUUIDKey, kDeviceUUID);
-    client.push_parameter(kRequestUUIDKey, request_id);
+    /*
+     *  Any attempt still in flight is given up, and an alert still
+     *  queued for the broker is not sent.
+     */
+    _dispatcher.cancel();
+    discard_mqtt();
+
+    if (cancel_mqtt(request_id))
+    {
+        return true;
+    }
 
     /* Send Post */
     DLOG("Sending request to cancel help");
-    status = client.send_post();
+    tries = 0;
+    do
+    {
+        if (!is_rendered())
+        {
+            return false;
+        }
+        HTTPer client(_endpoints.host(_endpoint), port(_endpoint), kCancelRequestPath);
+        client.set_tls(tls(_endpoint));
+
+        /* Patch the request ID into the rendered requests. */
+        uuid_from_binary(text, request_id);
+        memcpy(&_cancel_request[_cancel_id_offset], text, UUID_BUFFER_LENGTH - 1);
+        binary = use_binary();
+        if (binary)
+        {
+            memcpy(&_cancel_binary[_cancel_binary_length - UUID_BINARY_LENGTH],
+                request_id, UUID_BINARY_LENGTH);
+        }
+
+        started = clock_millis();
+        status = binary
+            ? client.send_rendered_post(_cancel_binary, _cancel_binary_length, NULL, NULL)
+            : client.send_rendered_post(_cancel_request, _cancel_request_length, NULL, NULL);
+        record(_endpoint, status, started);
+        tries++;
+
+        if (binary && status == HTTPer::STATUS_UNSUPPORTED_MEDIA)
+        {
+            DLOG_WARN("Platform refused binary request, sending form");
+            _binary = false;
+        }
+    } while ((binary && status == HTTPer::STATUS_UNSUPPORTED_MEDIA)
+        || (host_failed(status) && tries < _endpoints.count()));
 
     if (status == HTTPer::STATUS_OK)
     {
@@ -130,14 +1041,24 @@ bool_t Messenger::cancel_help(uuid_kref_t request_id)
 
 bool_t Messenger::test(void)
 {
-    HTTPer client(kPlatformHost, PLATFORM_PORT, kTestPath);
     HTTPer::status_t status;
+    time_ms_t started;
+
+    if (!is_rendered())
+    {
+        return false;
+    }
+
+    HTTPer client(_endpoints.host(_endpoint), port(_endpoint), kTestPath);
+    client.set_tls(tls(_endpoint));
 
     DLOG("Pushing parameters");
     client.push_parameter(kDeviceUUIDKey, kDeviceUUID);
 
     DLOG("Testing service");
+    started = clock_millis();
     status = client.send_get();
+    record(_endpoint, status, started);
 
     if (status == HTTPer::STATUS_OK)
     {
@@ -147,3 +1068,132 @@ bool_t Messenger::test(void)
     DLOG_ERR("Test failed");
     return false;
 }
+
+/*
+ *  Called every second.  Samples the device's health across the
+ *  heartbeat interval, and uploads it all once the interval is up,
+ *  or earlier if a connection to the platform is already open, so
+ *  the radio need not wake for it.  Nothing is sent while an alert
+ *  is.
+ */
+void Messenger::heartbeat(void)
+{
+    time_ms_t now = clock_millis();
+    uint32_t since;
+
+    if (now - _last_sample >= _heartbeat_ms / TELEMETRY_SAMPLES)
+    {
+        take_sample();
+    }
+
+    if (_heartbeat >= 0)
+    {
+        finish_heartbeat();
+        return;
+    }
+    if (_dispatcher.is_pending() || !wifi_driver_is_connected() || !is_rendered())
+    {
+        return;
+    }
+
+    since = now - _last_heartbeat;
+    if (since >= _heartbeat_ms
+        || (since >= MESSENGER_HEARTBEAT_MIN_MS && ConnPool::get_instance()->has_idle(
+            _endpoints.host(_endpoint), port(_endpoint), tls(_endpoint))))
+    {
+        send_heartbeat();
+    }
+}
+
+uint8_t Messenger::heartbeat_task(void *)
+{
+    s_instance.heartbeat();
+    return TASK_EXIT_OK;
+}
+
+void Messenger::take_sample(void)
+{
+    scheduler_stats_t stats;
+
+    _last_sample = clock_millis();
+    scheduler_read_stats(&stats);
+    telemetry_sample(&_telemetry, _last_sample / 1000, wifi_driver_rssi(), free_heap(), &stats);
+}
+
+/* Starts the heartbeat to the endpoint in use, rendered with all there is. */
+void Messenger::send_heartbeat(void)
+{
+    HTTPer client(_endpoints.host(_endpoint), port(_endpoint), kHeartbeatPath);
+    byte_t body[TELEMETRY_LENGTH_MAX];
+    byte_t device_id[UUID_BINARY_LENGTH];
+    uint16_t length;
+
+    _last_heartbeat = clock_millis();
+    if (!uuid_to_binary(kDeviceUUID, device_id))
+    {
+        return;
+    }
+
+    length = telemetry_encode(&_telemetry, device_id, _last_heartbeat / 1000,
+        body, sizeof(body), &_telemetry_mark);
+    client.set_tls(tls(_endpoint));
+    client.set_body(body, length, kWiremsgMediaType);
+    length = client.render_post(_heartbeat_request, MESSENGER_REQUEST_LENGTH);
+    if (!length)
+    {
+        DLOG_ERR("Failed to render heartbeat");
+        return;
+    }
+
+    _heartbeat = client.start_rendered_post(_heartbeat_request, length, NULL, NULL, 0);
+    _heartbeat_endpoint = _endpoint;
+    _heartbeat_started = _last_heartbeat;
+}
+
+/*
+ *  Takes the heartbeat's result once it is in.  The interval doubles
+ *  after one with no alerts to report, and after a failure, which
+ *  keeps what it carried for the next; one with alerts brings it
+ *  back.
+ */
+void Messenger::finish_heartbeat(void)
+{
+    HTTPer::status_t status;
+    bool_t quiet;
+
+    status = HTTPer::async_result(_heartbeat);
+    if (status == HTTPer::STATUS_PENDING) return;
+
+    _heartbeat = -1;
+    record(_heartbeat_endpoint, status, _heartbeat_started);
+
+    if (status == HTTPer::STATUS_OK)
+    {
+        quiet = !_telemetry_mark.alerts && !_telemetry_mark.failed_alerts;
+        telemetry_sent(&_telemetry, &_telemetry_mark);
+    }
+    else
+    {
+        DLOG_WARN("Heartbeat failed");
+        quiet = true;
+    }
+
+    if (!quiet)
+    {
+        _heartbeat_ms = MESSENGER_HEARTBEAT_MS;
+    }
+    else if (_heartbeat_ms < MESSENGER_HEARTBEAT_MAX_MS)
+    {
+        _heartbeat_ms *= 2;
+        if (_heartbeat_ms > MESSENGER_HEARTBEAT_MAX_MS) _heartbeat_ms = MESSENGER_HEARTBEAT_MAX_MS;
+    }
+}
+
+/* An alert takes the connection; the heartbeat's samples are kept for the next. */
+void Messenger::abandon_heartbeat(void)
+{
+    if (_heartbeat < 0) return;
+
+    HTTPer::cancel(_heartbeat);
+    _heartbeat = -1;
+}
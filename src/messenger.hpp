@@ -10,20 +10,218 @@
 #ifndef _MESSENGER_HPP_
 #define _MESSENGER_HPP_
 
+#include "dispatch.hpp"
+#include "endpoints.hpp"
+#include "httper.hpp"
+#include "jsonpull.h"
+#include "mqtt.hpp"
+#include "telemetry.h"
+#include "transport.h"
+#include "udpalert.hpp"
 #include "uuid.h"
 #include "utils.h"
+#include "wiremsg.h"
+
+/* Fits a rendered help or cancel request. */
+#define MESSENGER_REQUEST_LENGTH 512
+/* Fits one in the binary encoding, see wiremsg.h. */
+#define MESSENGER_BINARY_REQUEST_LENGTH 384
+
+/* Fits the DER public key of the platform, up to RSA 2048. */
+#define MESSENGER_KEY_LENGTH 300
+
+/*
+ *  How long an alert may take to reach the platform, from its first
+ *  attempt, and how much of that must be left to try again at once
+ *  after a timeout.
+ */
+#define MESSENGER_ALERT_BUDGET_MS   10000
+#define MESSENGER_RETRY_MIN_MS      1500
+
+/* A help request and its hedge. */
+#define MESSENGER_HELP_ATTEMPTS     2
+
+/*
+ *  Heartbeats go every 15 minutes, stretched up to an hour while all
+ *  is quiet, and back off the same way when they fail.  One may go
+ *  as early as 5 minutes if a connection to the platform is open.
+ *  The ring is sampled across the interval, so each heartbeat
+ *  carries it full.
+ */
+#define MESSENGER_HEARTBEAT_MS      900000UL
+#define MESSENGER_HEARTBEAT_MAX_MS  3600000UL
+#define MESSENGER_HEARTBEAT_MIN_MS  300000UL
+#define MESSENGER_HEARTBEAT_PERIOD_US 1000000
+
+/* How long an alert or cancel published over MQTT waits for its answer. */
+#define MESSENGER_MQTT_WAIT_MS      1500
+/* Fits "pendant/<device UUID>/cancel". */
+#define MESSENGER_TOPIC_LENGTH      56
 
 class Messenger {
+    /* The answer to a help request, as it is parsed. */
+    typedef struct {
+        jsonpull_t parser;
+        jsonpull_field_t field;
+        wiremsg_reader_t reader;
+        uuid_str_t issued_id;
+    } help_reply_t;
+
+    /* A help request in flight over HTTP, and how it was sent. */
+    typedef struct {
+        HTTPer::handle_t handle;
+        bool_t binary;
+        help_reply_t reply;
+    } help_attempt_t;
+
     static Messenger s_instance;
 
+    /* Offers the binary encoding with every request. */
+    static HTTPer::header_set_t s_accept_headers;
+
+    /* The platform's hosts, and the one the requests are rendered for. */
+    Endpoints _endpoints;
+    int8_t _endpoint;
+
+    /* Requests rendered at boot, see render(). */
+    byte_t _help_request[MESSENGER_REQUEST_LENGTH];
+    uint16_t _help_request_length;
+    uint16_t _help_id_offset;
+    byte_t _cancel_request[MESSENGER_REQUEST_LENGTH];
+    uint16_t _cancel_request_length;
+    uint16_t _cancel_id_offset;
+
+    /*
+     *  The same in the binary encoding, used once the platform has
+     *  answered in it, until it refuses one.
+     */
+    byte_t _help_binary[MESSENGER_BINARY_REQUEST_LENGTH];
+    uint16_t _help_binary_length;
+    byte_t _cancel_binary[MESSENGER_BINARY_REQUEST_LENGTH];
+    uint16_t _cancel_binary_length;
+    bool_t _binary;
+
+    /*
+     *  Device health, uploaded in one heartbeat.  The one in flight
+     *  is abandoned for an alert.
+     */
+    telemetry_t _telemetry;
+    telemetry_mark_t _telemetry_mark;
+    byte_t _heartbeat_request[MESSENGER_REQUEST_LENGTH];
+    HTTPer::handle_t _heartbeat;
+    int8_t _heartbeat_endpoint;
+    time_ms_t _heartbeat_started;
+    time_ms_t _last_heartbeat;
+    time_ms_t _last_sample;
+    uint32_t _heartbeat_ms;
+
+    /* HTTPS, when the platform's key is configured. */
+    byte_t _platform_key[MESSENGER_KEY_LENGTH];
+    netconn_tls_t _tls[ENDPOINTS_MAX];
+    bool_t _secure;
+
+    /*
+     *  The alert being sent, its ID in binary, and the transports it
+     *  goes over, see init_transports().
+     */
+    byte_t _alert_id[UUID_BINARY_LENGTH];
+    Dispatcher _dispatcher;
+    transport_t _mqtt_transport;
+    transport_t _udp_transport;
+    transport_t _http_transport;
+    help_attempt_t _help[MESSENGER_HELP_ATTEMPTS];
+
+    /*
+     *  The deadline of the alert published over MQTT, and its packet
+     *  ID while it may still be queued, 0 once it is not.
+     */
+    time_ms_t _mqtt_deadline;
+    uint16_t _mqtt_alert;
+
+    /* The fast path, when the alert key is configured. */
+    UdpAlert _udp;
+
+    /*
+     *  The kept connection, when the broker's port is configured.
+     *  The acknowledgement of the alert being sent sets its issue ID.
+     */
+    char_t _alert_topic[MESSENGER_TOPIC_LENGTH];
+    char_t _ack_topic[MESSENGER_TOPIC_LENGTH];
+    char_t _cancel_topic[MESSENGER_TOPIC_LENGTH];
+    bool_t _mqtt;
+    bool_t _alert_acked;
+    byte_t _acked_issue_id[UUID_BINARY_LENGTH];
+
     Messenger();
 public:
     static Messenger * get_instance(void);
 
-    bool_t request_help(uuid_ref_t request_id);
+    void init(void);
+
+    void prepare_help(void);
+    void abandon_help(void);
+
+    transport_status_t request_help(uuid_ref_t request_id);
     bool_t cancel_help(uuid_kref_t request_id);
+    static uint8_t dispatch_task(void * arg);
 
     bool_t test(void);
+
+    void prewarm(void);
+
+    void heartbeat(void);
+    static uint8_t heartbeat_task(void * arg);
+
+private:
+    bool_t start_alert(uuid_ref_t request_id);
+    void take_sample(void);
+    void send_heartbeat(void);
+    void finish_heartbeat(void);
+    void abandon_heartbeat(void);
+    bool_t is_rendered(void);
+    bool_t use_endpoint(int8_t endpoint);
+    void render(void);
+    void render_binary(void);
+    bool_t use_binary(void) const;
+    void init_endpoints(void);
+    void init_tls(void);
+    void init_udp(void);
+    void init_mqtt(void);
+    void init_transports(void);
+    bool_t alert_mqtt(byte_t const * alert_id);
+    void discard_mqtt(void);
+    bool_t cancel_mqtt(uuid_kref_t request_id);
+    static void on_alert_ack(
+        void * context, kstring_t topic, uint16_t topic_length,
+        byte_t const * payload, uint16_t length);
+    HTTPer::handle_t start_help(
+        int8_t endpoint, bool_t binary, byte_t const * alert_id,
+        help_reply_t * reply, time_ms_t deadline);
+    transport_status_t take_reply(
+        HTTPer::status_t status, help_attempt_t * attempt, byte_t * issue_id);
+    void record(int8_t endpoint, HTTPer::status_t status, time_ms_t started);
+    uint16_t port(int8_t endpoint) const;
+    netconn_tls_t const * tls(int8_t endpoint) const;
+    void set_alert_id(uuid_ref_t request_id);
+    void patch_help_id(byte_t const * alert_id);
+
+    /* The transports, over the singleton. */
+    static transport_handle_t start_mqtt(
+        void * context, int8_t endpoint, transport_alert_t const * alert, time_ms_t deadline);
+    static transport_status_t mqtt_result(
+        void * context, transport_handle_t handle, byte_t * issue_id);
+    static void mqtt_cancel(void * context, transport_handle_t handle);
+    static transport_handle_t start_udp(
+        void * context, int8_t endpoint, transport_alert_t const * alert, time_ms_t deadline);
+    static transport_status_t udp_result(
+        void * context, transport_handle_t handle, byte_t * issue_id);
+    static void udp_cancel(void * context, transport_handle_t handle);
+    static transport_handle_t start_http(
+        void * context, int8_t endpoint, transport_alert_t const * alert, time_ms_t deadline);
+    static transport_status_t http_result(
+        void * context, transport_handle_t handle, byte_t * issue_id);
+    static void http_cancel(void * context, transport_handle_t handle);
+    static void http_poll(void * context);
 };
 
 #endif /* _MESSENGER_HPP_ */
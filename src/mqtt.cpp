@@ -0,0 +1,855 @@
+/*
+ *  Module: MQTT
+ *
+ *  An MQTT 3.1.1 client over one long-lived connection, with a
+ *  persistent session.
+ *
+ *  Author: Alex Dale @superoxigen
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for information.
+ */
+
+/* Standard Library */
+#include <string.h>
+
+/* Project Library */
+#include "clock.h"
+#include "dlog.h"
+#include "httpwire.h"
+#include "resolver.hpp"
+#include "wifi_driver.h"
+
+/* Self Header */
+#include "mqtt.hpp"
+
+#define WRITE_BUFFER_LENGTH 64
+#define READ_BUFFER_LENGTH 64
+
+/* Control packet types, the high nibble of the fixed header. */
+#define PACKET_CONNECT      0x10
+#define PACKET_CONNACK      0x20
+#define PACKET_PUBLISH      0x30
+#define PACKET_PUBACK       0x40
+#define PACKET_SUBSCRIBE    0x82    /* Its reserved flags are fixed */
+#define PACKET_SUBACK       0x90
+#define PACKET_PINGREQ      0xC0
+#define PACKET_PINGRESP     0xD0
+#define PACKET_DISCONNECT   0xE0
+
+#define FLAG_DUP            0x08
+#define FLAG_RETAIN         0x01
+#define QOS_SHIFT           1
+
+#define CONNECT_USERNAME    0x80
+#define CONNECT_PASSWORD    0x40
+
+#define SUBACK_FAILURE      0x80
+
+#define PROTOCOL_LEVEL      4
+
+/* The remaining length takes at most four bytes. */
+#define LENGTH_BYTES_MAX    4
+
+typedef enum {
+    READ_HEADER,
+    READ_LENGTH,
+    READ_BODY
+} read_state_t;
+
+static kstring_t kProtocolName = "MQTT";
+
+/* Packet Writing */
+
+static void write_u16(httpwire_writer_t * writer, uint16_t value)
+{
+    byte_t bytes[2];
+
+    bytes[0] = (byte_t) (value >> 8);
+    bytes[1] = (byte_t) value;
+    httpwire_write(writer, bytes, 2);
+}
+
+static void write_length(httpwire_writer_t * writer, uint32_t length)
+{
+    byte_t c;
+
+    do
+    {
+        c = length & 0x7F;
+        length >>= 7;
+        if (length) c |= 0x80;
+        httpwire_write(writer, &c, 1);
+    } while (length);
+}
+
+static void write_string(httpwire_writer_t * writer, kstring_t str)
+{
+    uint16_t length;
+
+    length = (uint16_t) strlen(str);
+    write_u16(writer, length);
+    httpwire_write(writer, (byte_t const *) str, length);
+}
+
+static uint16_t read_u16(byte_t const * data)
+{
+    return (uint16_t) ((data[0] << 8) | data[1]);
+}
+
+/* Whether a topic matches a subscription's, exactly or by a trailing '#'. */
+static bool_t topic_matches(kstring_t filter, byte_t const * topic, uint16_t length)
+{
+    uint16_t filter_length;
+
+    filter_length = (uint16_t) strlen(filter);
+    if (filter_length && filter[filter_length - 1] == '#')
+    {
+        filter_length--;
+        return length >= filter_length && !memcmp(filter, topic, filter_length);
+    }
+    return length == filter_length && !memcmp(filter, topic, length);
+}
+
+/* Whether sequence a was taken before b, across wrapping. */
+static bool_t is_before(uint16_t a, uint16_t b)
+{
+    return (int16_t) (a - b) < 0;
+}
+
+MqttClient MqttClient::s_instance;
+
+MqttClient::MqttClient():
+    _state(STATE_DISCONNECTED),
+    _host(NULL),
+    _port(0),
+    _tls(NULL),
+    _client_id(NULL),
+    _user(NULL),
+    _pass(NULL),
+    _keepalive_s(MQTT_KEEPALIVE_S),
+    _n_subscriptions(0),
+    _next_packet_id(1),
+    _next_sequence(0),
+    _stopped(false),
+    _session_present(false),
+    _last_sent(0),
+    _ping_sent(0),
+    _ping_pending(false),
+    _connack_deadline(0),
+    _retry_at(0),
+    _retry_ms(MQTT_RECONNECT_MIN_MS)
+{
+    memset(&_reader, 0, sizeof(_reader));
+    memset(_queue, 0, sizeof(_queue));
+    memset(_subscriptions, 0, sizeof(_subscriptions));
+    memset(&_stats, 0, sizeof(_stats));
+}
+
+MqttClient * MqttClient::get_instance(void)
+{
+    return &s_instance;
+}
+
+/*
+ *  The client ID names the session on the broker, so it must stay
+ *  the same across restarts for the session to persist.  The user
+ *  and password may be NULL.
+ */
+void MqttClient::configure(
+    kstring_t host, uint16_t port, netconn_tls_t const * tls,
+    kstring_t client_id, kstring_t user, kstring_t pass,
+    uint16_t keepalive_s)
+{
+    _host = host;
+    _port = port;
+    _tls = tls;
+    _client_id = client_id;
+    _user = user;
+    _pass = pass;
+    _keepalive_s = keepalive_s;
+}
+
+bool_t MqttClient::is_configured(void) const
+{
+    return _host && _port && _client_id;
+}
+
+kstring_t MqttClient::host(void) const
+{
+    return _host;
+}
+
+/* Subscribes at QoS 1, now if connected and again on each connection. */
+bool_t MqttClient::subscribe(kstring_t topic, mqtt_handler_t handler, void * context)
+{
+    subscription_t * subscription;
+
+    if (!topic || !handler || _n_subscriptions >= MQTT_SUBSCRIPTION_MAX) return false;
+
+    subscription = &_subscriptions[_n_subscriptions++];
+    subscription->topic = topic;
+    subscription->handler = handler;
+    subscription->context = context;
+
+    if (_state == STATE_CONNECTED && !send_subscribe(subscription))
+    {
+        drop();
+    }
+    return true;
+}
+
+/*
+ *  Queues a message, to be sent now if connected or else once
+ *  reconnected.  A QoS 1 message stays queued until the broker
+ *  acknowledges it, and its packet ID is set to check for that.
+ *  Returns false if the queue is full or the payload too large.
+ */
+bool_t MqttClient::publish(
+    kstring_t topic, byte_t const * payload, uint16_t length,
+    uint8_t qos, bool_t retain, uint16_t * packet_id)
+{
+    message_t * message;
+    uint8_t i;
+
+    if (packet_id) *packet_id = 0;
+    if (!topic || qos > 1 || length > MQTT_PAYLOAD_MAX) return false;
+
+    message = NULL;
+    for (i = 0; i < MQTT_QUEUE_LENGTH; i++)
+    {
+        if (!_queue[i].used)
+        {
+            message = &_queue[i];
+            break;
+        }
+    }
+    if (!message)
+    {
+        _stats.dropped++;
+        DLOG_WARN("MQTT queue is full");
+        return false;
+    }
+
+    message->topic = topic;
+    memcpy(message->payload, payload, length);
+    message->length = length;
+    message->qos = qos;
+    message->retain = retain;
+    message->packet_id = qos ? new_packet_id() : 0;
+    message->sequence = _next_sequence++;
+    message->sent = false;
+    message->dup = false;
+    message->used = true;
+    _stats.published++;
+    if (packet_id) *packet_id = message->packet_id;
+
+    if (_state == STATE_CONNECTED) flush_queue();
+    return true;
+}
+
+/* Whether the broker has acknowledged the QoS 1 message. */
+bool_t MqttClient::is_delivered(uint16_t packet_id) const
+{
+    uint8_t i;
+
+    for (i = 0; i < MQTT_QUEUE_LENGTH; i++)
+    {
+        if (_queue[i].used && _queue[i].qos && _queue[i].packet_id == packet_id) return false;
+    }
+    return true;
+}
+
+/*
+ *  Drops the QoS 1 message if the broker has not acknowledged it, so
+ *  it is not sent again after a reconnect.  A copy already sent may
+ *  still reach the broker.  Returns whether it was queued.
+ */
+bool_t MqttClient::discard(uint16_t packet_id)
+{
+    uint8_t i;
+
+    if (!packet_id) return false;
+    for (i = 0; i < MQTT_QUEUE_LENGTH; i++)
+    {
+        if (_queue[i].used && _queue[i].qos && _queue[i].packet_id == packet_id)
+        {
+            _queue[i].used = false;
+            return true;
+        }
+    }
+    return false;
+}
+
+uint8_t MqttClient::queued(void) const
+{
+    uint8_t i, count;
+
+    count = 0;
+    for (i = 0; i < MQTT_QUEUE_LENGTH; i++)
+    {
+        if (_queue[i].used) count++;
+    }
+    return count;
+}
+
+/*
+ *  Starts connecting, which poll() carries on without waiting, and
+ *  skips the backoff.  False if not configured.
+ */
+bool_t MqttClient::connect(void)
+{
+    if (!is_configured()) return false;
+    _stopped = false;
+    if (_state == STATE_DISCONNECTED) _state = STATE_CONNECTING;
+    return true;
+}
+
+/* Ends the session politely, and stops poll() from reconnecting. */
+void MqttClient::disconnect(void)
+{
+    byte_t packet[2] = {PACKET_DISCONNECT, 0x00};
+
+    _stopped = true;
+    if (_state == STATE_CONNECTED) write_conn(this, packet, sizeof(packet));
+    _conn.stop();
+    _state = STATE_DISCONNECTED;
+    _ping_pending = false;
+}
+
+bool_t MqttClient::is_connected(void) const
+{
+    return _state == STATE_CONNECTED;
+}
+
+/* Whether the broker still held the session at the last connection. */
+bool_t MqttClient::session_present(void) const
+{
+    return _session_present;
+}
+
+/*
+ *  Reads and handles whatever has arrived, keeps the connection
+ *  alive and sends what is queued.  Reconnects when the backoff
+ *  allows, a step at a time: opening the connection on one poll,
+ *  then checking for its acknowledgement on each that follows.
+ */
+void MqttClient::poll(void)
+{
+    if (!is_configured() || _stopped) return;
+
+    switch (_state)
+    {
+        case STATE_DISCONNECTED:
+            if (!wifi_driver_is_connected() || (int32_t) (clock_millis() - _retry_at) < 0) return;
+            _state = STATE_CONNECTING;
+            open();
+            return;
+        case STATE_CONNECTING:
+            open();
+            return;
+        case STATE_AWAIT_CONNACK:
+            await_connack();
+            return;
+        default:
+            break;
+    }
+
+    if (!read())
+    {
+        /* A handler may have dropped the connection already. */
+        if (_state == STATE_CONNECTED)
+        {
+            DLOG_WARN("MQTT connection lost");
+            drop();
+        }
+        return;
+    }
+    keep_alive();
+    flush_queue();
+}
+
+/* Waits for something to arrive, then polls.  False if not connected. */
+bool_t MqttClient::wait(uint16_t timeout_ms)
+{
+    if (_state != STATE_CONNECTED) return false;
+    _conn.wait(timeout_ms);
+    poll();
+    return _state == STATE_CONNECTED;
+}
+
+uint8_t MqttClient::poll_task(void * arg)
+{
+    s_instance.poll();
+    return TASK_EXIT_OK;
+}
+
+mqtt_stats_t const * MqttClient::stats(void) const
+{
+    return &_stats;
+}
+
+/* Private Methods */
+
+/*
+ *  Opens the connection and asks for the session.  The only step
+ *  that blocks, for up to the connect timeout; the broker's answer
+ *  is left to the polls that follow.
+ */
+void MqttClient::open(void)
+{
+    net_addr_t address;
+
+    _conn.stop();
+    if (!Resolver::get_instance()->resolve(_host, &address))
+    {
+        DLOG_ERR2("Could not resolve", _host);
+        drop();
+        return;
+    }
+    if (!_conn.connect(address, _port, MQTT_CONNECT_TIMEOUT_MS, _tls))
+    {
+        DLOG_ERR2("Could not connect to", _host);
+        drop();
+        return;
+    }
+
+    memset(&_reader, 0, sizeof(_reader));
+    _state = STATE_AWAIT_CONNACK;
+    _connack_deadline = clock_millis() + MQTT_CONNECT_TIMEOUT_MS;
+    if (!send_connect()) drop();
+}
+
+/* Reads what has arrived, and gives up once the CONNACK is overdue. */
+void MqttClient::await_connack(void)
+{
+    if (!read())
+    {
+        /* A refusal has dropped the connection already. */
+        if (_state == STATE_AWAIT_CONNACK) drop();
+        return;
+    }
+    if (_state == STATE_CONNECTED)
+    {
+        flush_queue();
+        return;
+    }
+    if ((int32_t) (clock_millis() - _connack_deadline) >= 0)
+    {
+        DLOG_ERR("MQTT connection was not acknowledged");
+        drop();
+    }
+}
+
+/* Returns false if the connection was closed or broke the protocol. */
+bool_t MqttClient::read(void)
+{
+    byte_t buffer[READ_BUFFER_LENGTH];
+    int16_t length, i;
+
+    while (_conn.available() > 0)
+    {
+        length = _conn.read(buffer, sizeof(buffer));
+        if (length <= 0) break;
+        for (i = 0; i < length; i++)
+        {
+            if (!feed(buffer[i])) return false;
+            if (_state == STATE_DISCONNECTED) return false;
+        }
+    }
+    return _conn.connected();
+}
+
+/* Takes the next byte of a packet, and handles the packet once whole. */
+bool_t MqttClient::feed(byte_t c)
+{
+    uint32_t offset;
+
+    switch (_reader.state)
+    {
+        case READ_HEADER:
+            _reader.header = c;
+            _reader.length = 0;
+            _reader.length_bytes = 0;
+            _reader.received = 0;
+            _reader.packet_id = 0;
+            _reader.state = READ_LENGTH;
+            break;
+
+        case READ_LENGTH:
+            _reader.length |= (uint32_t) (c & 0x7F) << (7 * _reader.length_bytes);
+            _reader.length_bytes++;
+            if (c & 0x80)
+            {
+                if (_reader.length_bytes >= LENGTH_BYTES_MAX)
+                {
+                    DLOG_ERR("Malformed MQTT packet length");
+                    return false;
+                }
+                break;
+            }
+            if (_reader.length)
+            {
+                _reader.state = READ_BODY;
+                break;
+            }
+            _reader.state = READ_HEADER;
+            handle_packet();
+            break;
+
+        case READ_BODY:
+            if (_reader.received < MQTT_PACKET_MAX) _reader.body[_reader.received] = c;
+            /* The packet ID of a PUBLISH follows its topic, wherever that ends. */
+            if (_reader.received >= 2)
+            {
+                offset = _reader.received - 2 - read_u16(_reader.body);
+                if (offset < 2) _reader.packet_id = (uint16_t) ((_reader.packet_id << 8) | c);
+            }
+            _reader.received++;
+            if (_reader.received < _reader.length) break;
+
+            _reader.state = READ_HEADER;
+            if (_reader.length > MQTT_PACKET_MAX)
+            {
+                skip_packet();
+                break;
+            }
+            handle_packet();
+            break;
+    }
+    return true;
+}
+
+void MqttClient::handle_packet(void)
+{
+    switch (_reader.header & 0xF0)
+    {
+        case PACKET_CONNACK:
+            handle_connack();
+            break;
+        case PACKET_PUBLISH:
+            handle_publish();
+            break;
+        case PACKET_PUBACK:
+            handle_puback();
+            break;
+        case PACKET_SUBACK:
+            if (_reader.length > 2 && _reader.body[2] == SUBACK_FAILURE)
+            {
+                DLOG_ERR("MQTT subscription was refused");
+            }
+            break;
+        case PACKET_PINGRESP:
+            _ping_pending = false;
+            break;
+        default:
+            break;
+    }
+}
+
+/*
+ *  A QoS 1 publish is still acknowledged, or the broker would send
+ *  it again on every connection.
+ */
+void MqttClient::skip_packet(void)
+{
+    DLOG_WARN("Skipped an MQTT packet too large to read");
+    if ((_reader.header & 0xF0) != PACKET_PUBLISH) return;
+    if (((_reader.header >> QOS_SHIFT) & 0x03) != 1) return;
+    if (2 + (uint32_t) read_u16(_reader.body) + 2 > _reader.length) return;
+    if (!send_ack(PACKET_PUBACK, _reader.packet_id)) drop();
+}
+
+/*
+ *  The subscriptions are made again even when the session was kept,
+ *  as that is what asks the broker for the retained messages.  The
+ *  publishes left unacknowledged go first, in their order, flagged
+ *  as duplicates.
+ */
+void MqttClient::handle_connack(void)
+{
+    uint8_t i;
+
+    if (_state != STATE_AWAIT_CONNACK || _reader.length < 2) return;
+    if (_reader.body[1] != 0)
+    {
+        DLOG_ERR("MQTT connection was refused");
+        drop();
+        return;
+    }
+
+    _state = STATE_CONNECTED;
+    _session_present = _reader.body[0] & 0x01;
+    _retry_ms = MQTT_RECONNECT_MIN_MS;
+    _ping_pending = false;
+    _stats.connects++;
+    DLOG(_session_present ? "MQTT session resumed" : "MQTT session started");
+
+    for (i = 0; i < MQTT_QUEUE_LENGTH; i++)
+    {
+        if (_queue[i].used && _queue[i].sent)
+        {
+            _queue[i].sent = false;
+            _queue[i].dup = true;
+        }
+    }
+    for (i = 0; i < _n_subscriptions; i++)
+    {
+        if (!send_subscribe(&_subscriptions[i]))
+        {
+            drop();
+            return;
+        }
+    }
+}
+
+void MqttClient::handle_publish(void)
+{
+    byte_t const * topic;
+    byte_t const * payload;
+    uint32_t offset;
+    uint16_t topic_length;
+    uint8_t qos, i;
+
+    /* A topic said to run past the packet drops it. */
+    qos = (_reader.header >> QOS_SHIFT) & 0x03;
+    if (_reader.length < 2 || qos > 1) return;
+    topic_length = read_u16(_reader.body);
+    offset = 2 + (uint32_t) topic_length + (qos ? 2 : 0);
+    if (offset > _reader.length) return;
+
+    topic = &_reader.body[2];
+    payload = &_reader.body[offset];
+    _stats.received++;
+
+    for (i = 0; i < _n_subscriptions; i++)
+    {
+        if (topic_matches(_subscriptions[i].topic, topic, topic_length))
+        {
+            _subscriptions[i].handler(
+                _subscriptions[i].context, (kstring_t) topic, topic_length,
+                payload, (uint16_t) (_reader.length - offset));
+        }
+    }
+
+    if (qos && !send_ack(PACKET_PUBACK, _reader.packet_id)) drop();
+}
+
+void MqttClient::handle_puback(void)
+{
+    uint16_t packet_id;
+    uint8_t i;
+
+    if (_reader.length < 2) return;
+    packet_id = read_u16(_reader.body);
+    for (i = 0; i < MQTT_QUEUE_LENGTH; i++)
+    {
+        if (_queue[i].used && _queue[i].sent && _queue[i].packet_id == packet_id)
+        {
+            _queue[i].used = false;
+            _stats.acked++;
+            return;
+        }
+    }
+}
+
+/*
+ *  Pings once the connection has been idle for the keep alive, and
+ *  drops it if the ping goes unanswered, rather than wait on a
+ *  connection that went away silently.
+ */
+void MqttClient::keep_alive(void)
+{
+    uint32_t timeout_ms;
+    time_ms_t now;
+
+    now = clock_millis();
+    if (_ping_pending)
+    {
+        timeout_ms = (uint32_t) _keepalive_s * 500;
+        if (timeout_ms > MQTT_PING_TIMEOUT_MS) timeout_ms = MQTT_PING_TIMEOUT_MS;
+        if (now - _ping_sent >= timeout_ms)
+        {
+            DLOG_WARN("MQTT ping was not answered");
+            drop();
+        }
+        return;
+    }
+
+    if (_keepalive_s && now - _last_sent >= (uint32_t) _keepalive_s * 1000)
+    {
+        if (!send_ping()) drop();
+    }
+}
+
+void MqttClient::flush_queue(void)
+{
+    message_t * message;
+
+    while (_state == STATE_CONNECTED && (message = next_unsent()))
+    {
+        if (!send_publish(message, message->dup))
+        {
+            drop();
+            return;
+        }
+    }
+}
+
+/* The earliest published message not yet sent on this connection. */
+MqttClient::message_t * MqttClient::next_unsent(void)
+{
+    message_t * next;
+    uint8_t i;
+
+    next = NULL;
+    for (i = 0; i < MQTT_QUEUE_LENGTH; i++)
+    {
+        if (!_queue[i].used || _queue[i].sent) continue;
+        if (!next || is_before(_queue[i].sequence, next->sequence)) next = &_queue[i];
+    }
+    return next;
+}
+
+/*
+ *  Closes a broken connection.  One that was established is tried
+ *  again at once; one that never was backs off.
+ */
+void MqttClient::drop(void)
+{
+    bool_t was_connected;
+
+    was_connected = _state == STATE_CONNECTED;
+    _conn.stop();
+    _state = STATE_DISCONNECTED;
+    _ping_pending = false;
+
+    if (was_connected) _retry_at = clock_millis();
+    else schedule_retry();
+}
+
+void MqttClient::schedule_retry(void)
+{
+    _retry_at = clock_millis() + _retry_ms;
+    _retry_ms = (_retry_ms > MQTT_RECONNECT_MAX_MS / 2) ? MQTT_RECONNECT_MAX_MS : _retry_ms * 2;
+}
+
+/* Never 0, nor one still awaiting its acknowledgement. */
+uint16_t MqttClient::new_packet_id(void)
+{
+    uint16_t packet_id;
+
+    do
+    {
+        packet_id = _next_packet_id++;
+        if (!_next_packet_id) _next_packet_id = 1;
+    } while (!is_delivered(packet_id));
+    return packet_id;
+}
+
+bool_t MqttClient::send_connect(void)
+{
+    byte_t buffer[WRITE_BUFFER_LENGTH];
+    httpwire_writer_t writer;
+    uint32_t length;
+    byte_t flags;
+
+    /* The clean session flag is left clear, so the session persists. */
+    flags = 0;
+    length = 2 + strlen(kProtocolName) + 4 + 2 + strlen(_client_id);
+    if (_user)
+    {
+        flags |= CONNECT_USERNAME;
+        length += 2 + strlen(_user);
+    }
+    if (_pass)
+    {
+        flags |= CONNECT_PASSWORD;
+        length += 2 + strlen(_pass);
+    }
+
+    httpwire_writer_init(&writer, buffer, sizeof(buffer), write_conn, this);
+    httpwire_write_char(&writer, (char_t) PACKET_CONNECT);
+    write_length(&writer, length);
+    write_string(&writer, kProtocolName);
+    httpwire_write_char(&writer, PROTOCOL_LEVEL);
+    httpwire_write(&writer, &flags, 1);
+    write_u16(&writer, _keepalive_s);
+    write_string(&writer, _client_id);
+    if (_user) write_string(&writer, _user);
+    if (_pass) write_string(&writer, _pass);
+    return httpwire_writer_flush(&writer);
+}
+
+bool_t MqttClient::send_subscribe(subscription_t const * subscription)
+{
+    byte_t buffer[WRITE_BUFFER_LENGTH];
+    httpwire_writer_t writer;
+
+    httpwire_writer_init(&writer, buffer, sizeof(buffer), write_conn, this);
+    httpwire_write_char(&writer, (char_t) PACKET_SUBSCRIBE);
+    write_length(&writer, 2 + 2 + strlen(subscription->topic) + 1);
+    write_u16(&writer, new_packet_id());
+    write_string(&writer, subscription->topic);
+    httpwire_write_char(&writer, 1);
+    return httpwire_writer_flush(&writer);
+}
+
+/* A QoS 0 message is done with once written. */
+bool_t MqttClient::send_publish(message_t * message, bool_t dup)
+{
+    byte_t buffer[WRITE_BUFFER_LENGTH];
+    httpwire_writer_t writer;
+    byte_t header;
+
+    header = PACKET_PUBLISH | (message->qos << QOS_SHIFT);
+    if (dup) header |= FLAG_DUP;
+    if (message->retain) header |= FLAG_RETAIN;
+
+    httpwire_writer_init(&writer, buffer, sizeof(buffer), write_conn, this);
+    httpwire_write(&writer, &header, 1);
+    write_length(&writer,
+        2 + strlen(message->topic) + (message->qos ? 2 : 0) + message->length);
+    write_string(&writer, message->topic);
+    if (message->qos) write_u16(&writer, message->packet_id);
+    httpwire_write(&writer, message->payload, message->length);
+    if (!httpwire_writer_flush(&writer)) return false;
+
+    if (dup) _stats.resent++;
+    message->sent = true;
+    message->dup = false;
+    if (!message->qos) message->used = false;
+    return true;
+}
+
+bool_t MqttClient::send_ack(uint8_t type, uint16_t packet_id)
+{
+    byte_t packet[4];
+
+    packet[0] = type;
+    packet[1] = 2;
+    packet[2] = (byte_t) (packet_id >> 8);
+    packet[3] = (byte_t) packet_id;
+    return write_conn(this, packet, sizeof(packet));
+}
+
+bool_t MqttClient::send_ping(void)
+{
+    byte_t packet[2] = {PACKET_PINGREQ, 0x00};
+
+    if (!write_conn(this, packet, sizeof(packet))) return false;
+    _ping_sent = clock_millis();
+    _ping_pending = true;
+    _stats.pings++;
+    return true;
+}
+
+/* Flushes a writer to the connection, and notes when it was last used. */
+bool_t MqttClient::write_conn(void * context, byte_t const * data, uint16_t length)
+{
+    MqttClient * client = (MqttClient *) context;
+
+    if (client->_conn.write(data, length) != (int16_t) length) return false;
+    client->_last_sent = clock_millis();
+    return true;
+}
@@ -0,0 +1,197 @@
+/*
+ *  Module: MQTT
+ *
+ *  An MQTT 3.1.1 client over one long-lived connection, secured
+ *  with TLS like HTTPer's.  The session is persistent: the broker
+ *  keeps the subscriptions and the undelivered QoS 1 messages while
+ *  the pendant is away, and the client keeps its own unacknowledged
+ *  publishes, which it sends again when it reconnects.
+ *
+ *  Publishes wait in a fixed outbound queue, which is never grown.
+ *  Topics are not copied and must outlive their messages.  Nothing
+ *  is allocated; packets are parsed as they arrive, in chunks of
+ *  any size.  Only QoS 0 and 1 are supported.
+ *
+ *  Author: Alex Dale @superoxigen
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for information.
+ */
+
+#ifndef _MQTT_HPP_
+#define _MQTT_HPP_
+
+#include "netconn.hpp"
+#include "scheduler.h"
+#include "utils.h"
+
+#define MQTT_PORT                   1883
+#define MQTT_TLS_PORT               8883
+
+/*
+ *  Seconds between pings of an idle connection.  Long, as each ping
+ *  wakes the radio; the broker waits half as long again before it
+ *  gives up on the pendant.
+ */
+#define MQTT_KEEPALIVE_S            300
+/* How long a ping may go unanswered, at most half the keep alive. */
+#define MQTT_PING_TIMEOUT_MS        5000
+#define MQTT_CONNECT_TIMEOUT_MS     4000
+
+/* Reconnection backs off from the least to the most. */
+#define MQTT_RECONNECT_MIN_MS       1000
+#define MQTT_RECONNECT_MAX_MS       60000
+
+#define MQTT_QUEUE_LENGTH           4
+#define MQTT_PAYLOAD_MAX            48
+#define MQTT_SUBSCRIPTION_MAX       2
+/* Larger incoming packets are skipped. */
+#define MQTT_PACKET_MAX             128
+
+#define MQTT_POLL_PERIOD_US         10000
+
+/* Receives a message published to a subscribed topic. */
+typedef void (*mqtt_handler_t)(
+    void * context, kstring_t topic, uint16_t topic_length,
+    byte_t const * payload, uint16_t length);
+
+typedef struct {
+    uint32_t connects;
+    uint32_t published;
+    uint32_t acked;
+    uint32_t resent;
+    uint32_t dropped;       /* Refused, the queue was full */
+    uint32_t received;
+    uint32_t pings;
+} mqtt_stats_t;
+
+class MqttClient {
+    typedef struct {
+        kstring_t topic;
+        byte_t payload[MQTT_PAYLOAD_MAX];
+        uint16_t length;
+        uint16_t packet_id;
+        uint16_t sequence;      /* Order of publishing */
+        uint8_t qos;
+        bool_t retain;
+        bool_t used;
+        bool_t sent;
+        bool_t dup;             /* Sent before the connection was lost */
+    } message_t;
+
+    typedef struct {
+        kstring_t topic;
+        mqtt_handler_t handler;
+        void * context;
+    } subscription_t;
+
+    /* Incoming packet, read so far. */
+    typedef struct {
+        uint8_t state;
+        uint8_t header;
+        uint32_t length;        /* Remaining length */
+        uint8_t length_bytes;
+        uint32_t received;
+        uint16_t packet_id;     /* Of a PUBLISH, kept even if skipped */
+        byte_t body[MQTT_PACKET_MAX];
+    } reader_t;
+
+    typedef enum {
+        STATE_DISCONNECTED,
+        STATE_CONNECTING,       /* To open on the next poll */
+        STATE_AWAIT_CONNACK,
+        STATE_CONNECTED
+    } state_t;
+
+    static MqttClient s_instance;
+
+    NetConn _conn;
+    uint8_t _state;
+    reader_t _reader;
+
+    /* Settings */
+    kstring_t _host;
+    uint16_t _port;
+    netconn_tls_t const * _tls;
+    kstring_t _client_id;
+    kstring_t _user;
+    kstring_t _pass;
+    uint16_t _keepalive_s;
+
+    message_t _queue[MQTT_QUEUE_LENGTH];
+    subscription_t _subscriptions[MQTT_SUBSCRIPTION_MAX];
+    uint8_t _n_subscriptions;
+    uint16_t _next_packet_id;
+    uint16_t _next_sequence;
+
+    bool_t _stopped;        /* Disconnected on purpose, do not reconnect */
+    bool_t _session_present;
+    time_ms_t _last_sent;
+    time_ms_t _ping_sent;
+    bool_t _ping_pending;
+    time_ms_t _connack_deadline;
+    time_ms_t _retry_at;
+    uint32_t _retry_ms;
+
+    mqtt_stats_t _stats;
+
+    MqttClient();
+public:
+    static MqttClient * get_instance(void);
+
+    void configure(
+        kstring_t host, uint16_t port, netconn_tls_t const * tls,
+        kstring_t client_id, kstring_t user, kstring_t pass,
+        uint16_t keepalive_s=MQTT_KEEPALIVE_S);
+    bool_t is_configured(void) const;
+    kstring_t host(void) const;
+
+    bool_t subscribe(kstring_t topic, mqtt_handler_t handler, void * context);
+    bool_t publish(
+        kstring_t topic, byte_t const * payload, uint16_t length,
+        uint8_t qos, bool_t retain=false, uint16_t * packet_id=NULL);
+    bool_t is_delivered(uint16_t packet_id) const;
+    bool_t discard(uint16_t packet_id);
+    uint8_t queued(void) const;
+
+    bool_t connect(void);
+    void disconnect(void);
+    bool_t is_connected(void) const;
+    bool_t session_present(void) const;
+
+    void poll(void);
+    bool_t wait(uint16_t timeout_ms);
+    static uint8_t poll_task(void * arg);
+
+    mqtt_stats_t const * stats(void) const;
+
+private:
+    void open(void);
+    void await_connack(void);
+    bool_t read(void);
+    bool_t feed(byte_t c);
+    void handle_packet(void);
+    void skip_packet(void);
+    void handle_connack(void);
+    void handle_publish(void);
+    void handle_puback(void);
+    void keep_alive(void);
+    void flush_queue(void);
+    message_t * next_unsent(void);
+    void drop(void);
+    void schedule_retry(void);
+    uint16_t new_packet_id(void);
+
+    bool_t send_connect(void);
+    bool_t send_subscribe(subscription_t const * subscription);
+    bool_t send_publish(message_t * message, bool_t dup);
+    bool_t send_ack(uint8_t type, uint16_t packet_id);
+    bool_t send_ping(void);
+
+    static bool_t write_conn(void * context, byte_t const * data, uint16_t length);
+
+    MqttClient(MqttClient const &);
+    MqttClient & operator=(MqttClient const &);
+};
+
+#endif /* _MQTT_HPP_ */
@@ -0,0 +1,700 @@
+/*
+ *  Module: NetConn
+ *
+ *  A TCP connection.  Wraps the ESP WiFiClient on the device,
+ *  and POSIX sockets on the host so the network code above it
+ *  can be exercised off-device.  A connection can be secured with
+ *  TLS, by BearSSL on the device and OpenSSL on the host.
+ *
+ *  Author: Alex Dale @superoxigen
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for information.
+ */
+
+#ifndef ARDUINO
+/* Standard Library */
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include <openssl/crypto.h>
+#include <openssl/x509.h>
+#endif
+
+/* Project Library */
+#include "clock.h"
+#include "dlog.h"
+#include "smlstr.h"
+
+/* Self Header */
+#include "netconn.hpp"
+
+netconn_tls_stats_t NetConn::s_tls_stats;
+uint8_t NetConn::s_tls_open = 0;
+
+netconn_tls_stats_t const * NetConn::tls_stats(void)
+{
+    return &s_tls_stats;
+}
+
+/* How many secured connections are open. */
+uint8_t NetConn::tls_open(void)
+{
+    return s_tls_open;
+}
+
+/* Whether another secured connection may be opened, such as for a hedge. */
+bool_t NetConn::tls_room(void)
+{
+    if (s_tls_open >= NETCONN_TLS_MAX) return false;
+#ifdef ARDUINO
+    if (ESP.getMaxFreeBlockSize() < NETCONN_TLS_HEAP_MIN) return false;
+#endif
+    return true;
+}
+
+/* Counts the connection as open, once it is secured. */
+void NetConn::record_handshake(bool_t resumed, time_ms_t start)
+{
+    char_t ms[12];
+
+    _tls_open = true;
+    s_tls_open++;
+
+    s_tls_stats.last_ms = CLOCK_ELAPSED(clock_millis(), start);
+    if (resumed)
+    {
+        s_tls_stats.resumed++;
+        s_tls_stats.resumed_ms += s_tls_stats.last_ms;
+    }
+    else
+    {
+        s_tls_stats.full++;
+        s_tls_stats.full_ms += s_tls_stats.last_ms;
+    }
+
+    smluintfmt(ms, s_tls_stats.last_ms, sizeof(ms));
+    DLOG2(resumed ? "TLS session resumed, ms" : "TLS full handshake, ms", ms);
+}
+
+void NetConn::close_tls(void)
+{
+    if (!_tls_open) return;
+    _tls_open = false;
+    s_tls_open--;
+}
+
+#ifdef ARDUINO
+
+BearSSL::Session NetConn::s_session;
+
+NetConn::NetConn():
+    _client(&_plain_client),
+    _tls_open(false) {}
+
+NetConn::~NetConn()
+{
+    stop();
+}
+
+bool_t NetConn::connect(kstring_t host, uint16_t port)
+{
+    if (!host) return false;
+    stop();
+    _client = &_plain_client;
+    _client->setNoDelay(true);
+    return _client->connect(host, port) == 1;
+}
+
+/* A timeout of 0 leaves the client's own connect timeout. */
+bool_t NetConn::connect(
+    net_addr_t address, uint16_t port, uint16_t timeout_ms, netconn_tls_t const * tls)
+{
+    br_ssl_session_parameters * parameters;
+    tlssession_t session;
+    time_ms_t start;
+    bool_t resumed, small;
+    int error;
+
+    stop();
+    _client = tls ? (WiFiClient *) &_secure_client : &_plain_client;
+    _client->setNoDelay(true);
+    if (timeout_ms)
+    {
+        _client->setTimeout(timeout_ms);
+    }
+    if (!tls)
+    {
+        return _client->connect(IPAddress(address), port) == 1;
+    }
+
+    if (!_key.parse(tls->key, tls->key_length))
+    {
+        DLOG_ERR("Pinned key is not valid");
+        return false;
+    }
+    _secure_client.setKnownKey(&_key);
+
+    /* Offer the saved session, if there is one. */
+    parameters = s_session.getSession();
+    memset(parameters, 0, sizeof(br_ssl_session_parameters));
+    if (tlssession_load(tls->host, port, &session))
+    {
+        memcpy(parameters->session_id, session.id, session.id_length);
+        parameters->session_id_len = session.id_length;
+        parameters->version = session.version;
+        parameters->cipher_suite = session.cipher_suite;
+        memcpy(parameters->master_secret, session.master_secret, TLSSESSION_SECRET_LENGTH);
+    }
+    _secure_client.setSession(&s_session);
+
+    /*
+     *  Only what the device sends is up to it.  BearSSL asks the
+     *  server for small records when its receive buffer is small.
+     */
+    small = small_records(tls, port, &session);
+    _secure_client.setBufferSizes(
+        small ? NETCONN_TLS_FRAGMENT : NETCONN_TLS_RECORD, NETCONN_TLS_FRAGMENT);
+
+    /*
+     *  Connected by name, as BearSSL only sends SNI then.  The name
+     *  was just resolved, so lwIP answers from its own cache.
+     */
+    start = clock_millis();
+    if (_secure_client.connect(tls->host, port) != 1)
+    {
+        s_tls_stats.failed++;
+        error = _secure_client.getLastSSLError();
+        if (error == BR_ERR_X509_NOT_TRUSTED || error == BR_ERR_BAD_SIGNATURE)
+        {
+            DLOG_ERR2("Server does not have the pinned key", tls->host);
+            s_tls_stats.pin_failures++;
+        }
+        tlssession_forget(tls->host, port);
+        return false;
+    }
+
+    /* The server took the session if it echoed the offered ID. */
+    resumed = session.id_length
+        && parameters->session_id_len == session.id_length
+        && !memcmp(parameters->session_id, session.id, session.id_length);
+    if (!resumed)
+    {
+        memcpy(session.id, parameters->session_id, parameters->session_id_len);
+        session.id_length = parameters->session_id_len;
+        session.version = parameters->version;
+        session.cipher_suite = parameters->cipher_suite;
+        session.flags = small ? TLSSESSION_FLAG_SMALL_RECORDS : 0;
+        memcpy(session.master_secret, parameters->master_secret, TLSSESSION_SECRET_LENGTH);
+        tlssession_save(tls->host, port, &session);
+    }
+
+    record_handshake(resumed, start);
+    return true;
+}
+
+/*
+ *  Whether the server takes small records, asked before a full
+ *  handshake.  Once a session is saved, it carries the answer.
+ */
+bool_t NetConn::small_records(
+    netconn_tls_t const * tls, uint16_t port, tlssession_t const * session)
+{
+    if (session->id_length) return session->flags & TLSSESSION_FLAG_SMALL_RECORDS;
+
+    if (BearSSL::WiFiClientSecure::probeMFLN(tls->host, port, NETCONN_TLS_FRAGMENT))
+    {
+        return true;
+    }
+    DLOG_WARN2("Server takes only full TLS records", tls->host);
+    return false;
+}
+
+bool_t NetConn::connected(void)
+{
+    return _client->connected();
+}
+
+void NetConn::stop(void)
+{
+    _client->stop();
+    close_tls();
+}
+
+int16_t NetConn::write(byte_t const * data, uint16_t length)
+{
+    if (!data) return -1;
+    return (int16_t) _client->write(data, length);
+}
+
+int16_t NetConn::read(byte_t * data, uint16_t length)
+{
+    if (!data) return -1;
+    return (int16_t) _client->read(data, length);
+}
+
+int16_t NetConn::available(void)
+{
+    return (int16_t) _client->available();
+}
+
+/*
+ *  Waits for data to read, or for the connection to close.
+ *  Returns false if the timeout passed first.
+ */
+bool_t NetConn::wait(uint16_t timeout_ms)
+{
+    time_ms_t start;
+
+    start = millis();
+    while (!_client->available())
+    {
+        if (!_client->connected()) return true;
+        if ((millis() - start) >= timeout_ms) return false;
+        delay(1);
+    }
+    return true;
+}
+
+bool_t NetConn::is_secure(void) const
+{
+    return _client == &_secure_client;
+}
+
+WiFiClient * NetConn::client(void)
+{
+    return _client;
+}
+
+#else /* POSIX */
+
+uint16_t NetConn::s_sim_connect_latency_ms = 0;
+SSL_CTX * NetConn::s_tls_context = NULL;
+
+static void sleep_ms(uint16_t ms)
+{
+    struct timespec ts;
+    ts.tv_sec = ms / 1000;
+    ts.tv_nsec = (long) (ms % 1000) * 1000000L;
+    while (nanosleep(&ts, &ts) && errno == EINTR);
+}
+
+NetConn::NetConn():
+    _fd(-1),
+    _ssl(NULL),
+    _tls_open(false) {}
+
+NetConn::~NetConn()
+{
+    stop();
+}
+
+bool_t NetConn::connect(kstring_t host, uint16_t port)
+{
+    struct addrinfo hints, *results, *ai;
+    char_t port_buffer[8];
+    int one = 1;
+
+    if (!host) return false;
+    stop();
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    smluintfmt(port_buffer, port, sizeof(port_buffer));
+
+    if (getaddrinfo(host, port_buffer, &hints, &results)) return false;
+
+    for (ai = results; ai; ai = ai->ai_next)
+    {
+        _fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (_fd < 0) continue;
+        if (!::connect(_fd, ai->ai_addr, ai->ai_addrlen)) break;
+        close(_fd);
+        _fd = -1;
+    }
+    freeaddrinfo(results);
+
+    if (_fd < 0) return false;
+
+    setsockopt(_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (s_sim_connect_latency_ms)
+    {
+        sleep_ms(s_sim_connect_latency_ms);
+    }
+    return true;
+}
+
+bool_t NetConn::connect(
+    net_addr_t address, uint16_t port, uint16_t timeout_ms, netconn_tls_t const * tls)
+{
+    struct sockaddr_in addr;
+    struct pollfd pfd;
+    socklen_t error_length;
+    int one = 1, flags, error, n;
+    time_ms_t start;
+
+    stop();
+    start = clock_millis();
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = address;
+
+    _fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (_fd < 0) return false;
+
+    /* Connect without blocking, so the handshake can be timed out. */
+    flags = fcntl(_fd, F_GETFL, 0);
+    fcntl(_fd, F_SETFL, flags | O_NONBLOCK);
+    if (::connect(_fd, (struct sockaddr *) &addr, sizeof(addr)))
+    {
+        if (errno != EINPROGRESS)
+        {
+            stop();
+            return false;
+        }
+
+        pfd.fd = _fd;
+        pfd.events = POLLOUT;
+        pfd.revents = 0;
+        do
+        {
+            n = poll(&pfd, 1, timeout_ms ? timeout_ms : -1);
+        } while (n < 0 && errno == EINTR);
+
+        error = 0;
+        error_length = sizeof(error);
+        if (n <= 0
+            || getsockopt(_fd, SOL_SOCKET, SO_ERROR, &error, &error_length)
+            || error)
+        {
+            stop();
+            return false;
+        }
+    }
+
+    setsockopt(_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (s_sim_connect_latency_ms)
+    {
+        sleep_ms(s_sim_connect_latency_ms);
+    }
+
+    /* A secured connection is kept non-blocking, for OpenSSL. */
+    if (tls)
+    {
+        return handshake(tls, port, start, timeout_ms);
+    }
+    fcntl(_fd, F_SETFL, flags);
+    return true;
+}
+
+/* Builds the session to offer from the one saved. */
+static SSL_SESSION * restore_session(SSL * ssl, tlssession_t const * saved)
+{
+    byte_t suite[2];
+    SSL_CIPHER const * cipher;
+    SSL_SESSION * session;
+
+    suite[0] = (byte_t) (saved->cipher_suite >> 8);
+    suite[1] = (byte_t) saved->cipher_suite;
+    cipher = SSL_CIPHER_find(ssl, suite);
+    if (!cipher) return NULL;
+
+    session = SSL_SESSION_new();
+    if (!session) return NULL;
+    if (!SSL_SESSION_set1_id(session, saved->id, saved->id_length)
+        || !SSL_SESSION_set1_master_key(session, saved->master_secret, TLSSESSION_SECRET_LENGTH)
+        || !SSL_SESSION_set_cipher(session, cipher)
+        || !SSL_SESSION_set_protocol_version(session, saved->version))
+    {
+        SSL_SESSION_free(session);
+        return NULL;
+    }
+    return session;
+}
+
+static void save_session(kstring_t host, uint16_t port, SSL_SESSION const * session)
+{
+    tlssession_t saved;
+    unsigned int id_length;
+    byte_t const * id;
+
+    memset(&saved, 0, sizeof(saved));
+    id = SSL_SESSION_get_id(session, &id_length);
+    if (!id_length || id_length > TLSSESSION_ID_MAX) return;
+    if (SSL_SESSION_get_master_key(session, saved.master_secret, TLSSESSION_SECRET_LENGTH)
+        != TLSSESSION_SECRET_LENGTH)
+    {
+        return;
+    }
+
+    memcpy(saved.id, id, id_length);
+    saved.id_length = (uint8_t) id_length;
+    saved.version = (uint16_t) SSL_SESSION_get_protocol_version(session);
+    saved.cipher_suite = SSL_CIPHER_get_protocol_id(SSL_SESSION_get0_cipher(session));
+    tlssession_save(host, port, &saved);
+}
+
+/* Whether the server's certificate carries the pinned key. */
+static bool_t is_pinned(SSL * ssl, netconn_tls_t const * tls)
+{
+    byte_t * der;
+    X509 * certificate;
+    bool_t pinned;
+    int length;
+
+    certificate = SSL_get_peer_certificate(ssl);
+    if (!certificate) return false;
+
+    der = NULL;
+    length = i2d_PUBKEY(X509_get0_pubkey(certificate), &der);
+    pinned = length > 0 && length == tls->key_length
+        && !CRYPTO_memcmp(der, tls->key, length);
+
+    OPENSSL_free(der);
+    X509_free(certificate);
+    return pinned;
+}
+
+/*
+ *  Secures the connection, within what is left of the timeout.
+ *  Like BearSSL on the device, only TLS 1.2 is spoken and sessions
+ *  are resumed by ID, so the saved session is the same on both.
+ */
+bool_t NetConn::handshake(
+    netconn_tls_t const * tls, uint16_t port, time_ms_t start, uint16_t timeout_ms)
+{
+    SSL_SESSION * offered;
+    tlssession_t saved;
+    struct pollfd pfd;
+    uint32_t elapsed;
+    bool_t resumed;
+    int n, error;
+
+    if (!s_tls_context)
+    {
+        s_tls_context = SSL_CTX_new(TLS_client_method());
+        if (!s_tls_context) return false;
+        SSL_CTX_set_min_proto_version(s_tls_context, TLS1_2_VERSION);
+        SSL_CTX_set_max_proto_version(s_tls_context, TLS1_2_VERSION);
+        SSL_CTX_set_options(s_tls_context, SSL_OP_NO_TICKET);
+#ifdef SSL_OP_NO_EXTENDED_MASTER_SECRET
+        SSL_CTX_set_options(s_tls_context, SSL_OP_NO_EXTENDED_MASTER_SECRET);
+#endif
+        /* Trust comes from the pinned key, not a certificate chain. */
+        SSL_CTX_set_verify(s_tls_context, SSL_VERIFY_NONE, NULL);
+    }
+
+    _ssl = SSL_new(s_tls_context);
+    if (!_ssl || !SSL_set_fd(_ssl, _fd))
+    {
+        stop();
+        return false;
+    }
+    SSL_set_tlsext_host_name(_ssl, tls->host);
+
+    if (tlssession_load(tls->host, port, &saved))
+    {
+        offered = restore_session(_ssl, &saved);
+        if (offered)
+        {
+            SSL_set_session(_ssl, offered);
+            SSL_SESSION_free(offered);
+        }
+    }
+
+    pfd.fd = _fd;
+    while ((n = SSL_connect(_ssl)) != 1)
+    {
+        error = SSL_get_error(_ssl, n);
+        elapsed = CLOCK_ELAPSED(clock_millis(), start);
+        if ((error != SSL_ERROR_WANT_READ && error != SSL_ERROR_WANT_WRITE)
+            || (timeout_ms && elapsed >= timeout_ms))
+        {
+            DLOG_ERR2("TLS handshake failed with", tls->host);
+            s_tls_stats.failed++;
+            tlssession_forget(tls->host, port);
+            stop();
+            return false;
+        }
+
+        pfd.events = (error == SSL_ERROR_WANT_READ) ? POLLIN : POLLOUT;
+        pfd.revents = 0;
+        poll(&pfd, 1, timeout_ms ? (int) (timeout_ms - elapsed) : -1);
+    }
+
+    /* Resuming proves the server has the session made with the pinned key. */
+    resumed = SSL_session_reused(_ssl);
+    if (!resumed && !is_pinned(_ssl, tls))
+    {
+        DLOG_ERR2("Server does not have the pinned key", tls->host);
+        s_tls_stats.failed++;
+        s_tls_stats.pin_failures++;
+        tlssession_forget(tls->host, port);
+        stop();
+        return false;
+    }
+
+    if (!resumed)
+    {
+        save_session(tls->host, port, SSL_get_session(_ssl));
+    }
+    record_handshake(resumed, start);
+    return true;
+}
+
+bool_t NetConn::connected(void)
+{
+    byte_t peek;
+    ssize_t n;
+
+    if (_fd < 0) return false;
+    if (_ssl && SSL_pending(_ssl) > 0) return true;
+
+    n = recv(_fd, &peek, 1, MSG_PEEK | MSG_DONTWAIT);
+    if (n > 0) return true;
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return true;
+
+    /* Closed by peer, or errored. */
+    stop();
+    return false;
+}
+
+void NetConn::stop(void)
+{
+    if (_ssl)
+    {
+        SSL_shutdown(_ssl);
+        SSL_free(_ssl);
+        _ssl = NULL;
+        close_tls();
+    }
+    if (_fd < 0) return;
+    close(_fd);
+    _fd = -1;
+}
+
+int16_t NetConn::write(byte_t const * data, uint16_t length)
+{
+    struct pollfd pfd;
+    uint16_t sent;
+    ssize_t n;
+    int error;
+
+    if (_fd < 0 || !data) return -1;
+
+    for (sent = 0; _ssl && sent < length; sent += (uint16_t) n)
+    {
+        n = SSL_write(_ssl, data + sent, length - sent);
+        if (n > 0) continue;
+
+        error = SSL_get_error(_ssl, (int) n);
+        if (error != SSL_ERROR_WANT_READ && error != SSL_ERROR_WANT_WRITE)
+        {
+            stop();
+            return -1;
+        }
+        pfd.fd = _fd;
+        pfd.events = (error == SSL_ERROR_WANT_READ) ? POLLIN : POLLOUT;
+        pfd.revents = 0;
+        poll(&pfd, 1, -1);
+        n = 0;
+    }
+    if (_ssl) return (int16_t) sent;
+
+    for (sent = 0; sent < length; sent += (uint16_t) n)
+    {
+        n = send(_fd, data + sent, length - sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+        {
+            n = 0;
+        }
+        else if (n <= 0)
+        {
+            stop();
+            return -1;
+        }
+    }
+    return (int16_t) sent;
+}
+
+int16_t NetConn::read(byte_t * data, uint16_t length)
+{
+    ssize_t n;
+
+    if (_fd < 0 || !data) return -1;
+    if (length > INT16_MAX) length = INT16_MAX;
+
+    if (_ssl)
+    {
+        n = SSL_read(_ssl, data, length);
+        if (n > 0) return (int16_t) n;
+
+        /* Nothing more has arrived, or the connection is over. */
+        n = SSL_get_error(_ssl, (int) n);
+        if (n != SSL_ERROR_WANT_READ && n != SSL_ERROR_WANT_WRITE)
+        {
+            stop();
+        }
+        return -1;
+    }
+
+    n = recv(_fd, data, length, MSG_DONTWAIT);
+    if (n == 0)
+    {
+        stop();
+        return -1;
+    }
+    if (n < 0) return -1;
+    return (int16_t) n;
+}
+
+int16_t NetConn::available(void)
+{
+    int n;
+
+    if (_fd < 0) return 0;
+    if (_ssl && SSL_pending(_ssl) > 0) return (int16_t) SSL_pending(_ssl);
+    if (ioctl(_fd, FIONREAD, &n) < 0) return 0;
+    return (n > INT16_MAX) ? INT16_MAX : (int16_t) n;
+}
+
+bool_t NetConn::wait(uint16_t timeout_ms)
+{
+    struct pollfd pfd;
+    int n;
+
+    if (_fd < 0) return true;
+    if (_ssl && SSL_pending(_ssl) > 0) return true;
+
+    pfd.fd = _fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    do
+    {
+        n = poll(&pfd, 1, timeout_ms);
+    } while (n < 0 && errno == EINTR);
+    return n != 0;
+}
+
+bool_t NetConn::is_secure(void) const
+{
+    return _ssl != NULL;
+}
+
+void NetConn::set_sim_connect_latency(uint16_t latency_ms)
+{
+    s_sim_connect_latency_ms = latency_ms;
+}
+
+#endif /* ARDUINO */
@@ -0,0 +1,134 @@
+/*
+ *  Module: NetConn
+ *
+ *  A TCP connection.  Wraps the ESP WiFiClient on the device,
+ *  and POSIX sockets on the host so the network code above it
+ *  can be exercised off-device.  A connection can be secured with
+ *  TLS, by BearSSL on the device and OpenSSL on the host.
+ *
+ *  Author: Alex Dale @superoxigen
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for information.
+ */
+
+#ifndef _NETCONN_HPP_
+#define _NETCONN_HPP_
+
+#ifdef ARDUINO
+#include <WiFiClient.h>
+#include <WiFiClientSecureBearSSL.h>
+#else
+#include <openssl/ssl.h>
+#endif
+
+#include "tlssession.h"
+#include "utils.h"
+
+/*
+ *  Secured connections open at once, past which a hedge is not sent
+ *  over TLS, see tls_room().  Each holds BearSSL's context and its
+ *  record buffers on the device: about 5 KB when the server takes
+ *  512 byte records (MFLN), about 22 KB when it does not.
+ */
+#define NETCONN_TLS_MAX             2
+/* The largest record sent, and received when the server agrees. */
+#define NETCONN_TLS_FRAGMENT        512
+/* The largest record a server that does not agree may send. */
+#define NETCONN_TLS_RECORD          16384
+/* Enough heap for another connection, even with full records. */
+#define NETCONN_TLS_HEAP_MIN        24576
+
+/* An IPv4 address, in network byte order. */
+typedef uint32_t net_addr_t;
+
+/*
+ *  A TLS server.  Its certificate is trusted only if it carries the
+ *  pinned public key (the DER SubjectPublicKeyInfo), whoever signed
+ *  it.  The session is kept for resumption, see tlssession.h.
+ */
+typedef struct {
+    kstring_t host;         /* Server name, sent for SNI */
+    byte_t const * key;
+    uint16_t key_length;
+} netconn_tls_t;
+
+/* Handshake metrics, over every secured connection. */
+typedef struct {
+    uint32_t full;
+    uint32_t resumed;
+    uint32_t failed;
+    uint32_t pin_failures;
+    uint32_t full_ms;       /* Total time of full handshakes */
+    uint32_t resumed_ms;    /* Total time of resumed handshakes */
+    uint32_t last_ms;
+} netconn_tls_stats_t;
+
+class NetConn {
+#ifdef ARDUINO
+    WiFiClient _plain_client;
+    BearSSL::WiFiClientSecure _secure_client;
+    BearSSL::PublicKey _key;
+    WiFiClient * _client;
+
+    /* Offered for resumption, and filled in by the handshake. */
+    static BearSSL::Session s_session;
+#else
+    int _fd;
+    SSL * _ssl;
+
+    static SSL_CTX * s_tls_context;
+
+    /* Simulated handshake latency, host only. */
+    static uint16_t s_sim_connect_latency_ms;
+#endif
+
+    /* Whether this is counted in s_tls_open. */
+    bool_t _tls_open;
+
+    static netconn_tls_stats_t s_tls_stats;
+    static uint8_t s_tls_open;
+
+public:
+    NetConn();
+    ~NetConn();
+
+    bool_t connect(kstring_t host, uint16_t port);
+    bool_t connect(
+        net_addr_t address, uint16_t port, uint16_t timeout_ms=0,
+        netconn_tls_t const * tls=NULL);
+    bool_t connected(void);
+    void stop(void);
+
+    int16_t write(byte_t const * data, uint16_t length);
+    int16_t read(byte_t * data, uint16_t length);
+    int16_t available(void);
+    bool_t wait(uint16_t timeout_ms);
+    bool_t is_secure(void) const;
+
+    static netconn_tls_stats_t const * tls_stats(void);
+    static uint8_t tls_open(void);
+    static bool_t tls_room(void);
+
+#ifdef ARDUINO
+    WiFiClient * client(void);
+#else
+    static void set_sim_connect_latency(uint16_t latency_ms);
+#endif
+
+private:
+#ifdef ARDUINO
+    static bool_t small_records(
+        netconn_tls_t const * tls, uint16_t port, tlssession_t const * session);
+#else
+    bool_t handshake(
+        netconn_tls_t const * tls, uint16_t port, time_ms_t start, uint16_t timeout_ms);
+#endif
+    void record_handshake(bool_t resumed, time_ms_t start);
+    void close_tls(void);
+
+    NetConn(NetConn const &);
+    NetConn & operator=(NetConn const &);
+};
+
+#endif /* _NETCONN_HPP_ */
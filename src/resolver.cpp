@@ -0,0 +1,265 @@
+/*
+ *  Module: Resolver
+ *
+ *  A small DNS result cache.  Entries are kept for their TTL, then
+ *  served stale for a while as they are revalidated in the
+ *  background.  Failed lookups are cached briefly as well.
+ *
+ *  Author: Alex Dale @superoxigen
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for information.
+ */
+
+/* Standard Library */
+#include <string.h>
+
+#ifdef ARDUINO
+#include <ESP8266WiFi.h>
+#else
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#endif
+
+/* Project Library */
+#include "clock.h"
+#include "dlog.h"
+#include "smlstr.h"
+
+/* Self Header */
+#include "resolver.hpp"
+
+Resolver Resolver::s_instance;
+
+Resolver::Resolver():
+    _lookup(system_lookup),
+    _hits(0),
+    _stale_hits(0),
+    _negative_hits(0),
+    _misses(0)
+{
+    memset(_entries, 0, sizeof(_entries));
+}
+
+Resolver * Resolver::get_instance(void)
+{
+    return &s_instance;
+}
+
+/* Replaces the lookup function, for testing. */
+void Resolver::set_lookup(lookup_t lookup)
+{
+    _lookup = lookup ? lookup : system_lookup;
+    flush();
+}
+
+/*
+ *  Resolves the host, from the cache when possible.  An entry past
+ *  its TTL is still returned, and refreshed on the next refresh().
+ */
+bool_t Resolver::resolve(kstring_t host, net_addr_t * address)
+{
+    entry_t * entry;
+    uint32_t age;
+
+    if (!host || !address) return false;
+
+    entry = find(host);
+    if (entry)
+    {
+        age = CLOCK_ELAPSED(clock_millis(), entry->updated);
+        if (entry->negative && age < entry->ttl_ms)
+        {
+            _negative_hits++;
+            return false;
+        }
+        if (!entry->negative && age < entry->ttl_ms)
+        {
+            _hits++;
+            *address = entry->address;
+            return true;
+        }
+        if (!entry->negative && age < (entry->ttl_ms + RESOLVER_STALE_MS))
+        {
+            _stale_hits++;
+            entry->refresh_pending = true;
+            *address = entry->address;
+            return true;
+        }
+    }
+    else
+    {
+        entry = find_free();
+        if (smlstrcpy(entry->host, host, RESOLVER_HOST_LENGTH) >= RESOLVER_HOST_LENGTH)
+        {
+            DLOG_ERR2("Host name too long to cache", host);
+            entry->host[0] = 0;
+            return false;
+        }
+    }
+
+    _misses++;
+    update(entry);
+    if (entry->negative) return false;
+    *address = entry->address;
+    return true;
+}
+
+/* Resolves the host ahead of its first use. */
+bool_t Resolver::prewarm(kstring_t host)
+{
+    net_addr_t address;
+    return resolve(host, &address);
+}
+
+/* Forgets the host, e.g. after its cached address failed to connect. */
+void Resolver::invalidate(kstring_t host)
+{
+    entry_t * entry;
+
+    entry = find(host);
+    if (entry)
+    {
+        memset(entry, 0, sizeof(entry_t));
+    }
+}
+
+/*
+ *  Revalidates stale entries which have been used.  Meant to be
+ *  run from a low priority task.  A failed revalidation keeps the
+ *  stale entry until it is too old to serve.
+ */
+void Resolver::refresh(void)
+{
+    entry_t saved;
+    uint8_t i;
+
+    for (i = 0; i < RESOLVER_CACHE_SIZE; i++)
+    {
+        if (!_entries[i].host[0] || !_entries[i].refresh_pending) continue;
+
+        DLOG2("Revalidating", _entries[i].host);
+        memcpy(&saved, &_entries[i], sizeof(entry_t));
+        update(&_entries[i]);
+        if (_entries[i].negative)
+        {
+            memcpy(&_entries[i], &saved, sizeof(entry_t));
+        }
+        _entries[i].refresh_pending = false;
+    }
+}
+
+void Resolver::flush(void)
+{
+    memset(_entries, 0, sizeof(_entries));
+}
+
+uint32_t Resolver::hits(void) const
+{
+    return _hits;
+}
+
+uint32_t Resolver::stale_hits(void) const
+{
+    return _stale_hits;
+}
+
+uint32_t Resolver::negative_hits(void) const
+{
+    return _negative_hits;
+}
+
+uint32_t Resolver::misses(void) const
+{
+    return _misses;
+}
+
+#ifdef ARDUINO
+
+/* lwIP does not expose record TTLs. */
+bool_t Resolver::system_lookup(kstring_t host, net_addr_t * address, uint32_t * ttl_ms)
+{
+    IPAddress ip;
+
+    if (WiFi.hostByName(host, ip) != 1) return false;
+    *address = (uint32_t) ip;
+    return true;
+}
+
+#else /* POSIX */
+
+/* getaddrinfo() does not expose record TTLs. */
+bool_t Resolver::system_lookup(kstring_t host, net_addr_t * address, uint32_t * ttl_ms)
+{
+    struct addrinfo hints, *results;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+
+    if (getaddrinfo(host, NULL, &hints, &results) || !results) return false;
+    *address = ((struct sockaddr_in *) results->ai_addr)->sin_addr.s_addr;
+    freeaddrinfo(results);
+    return true;
+}
+
+#endif /* ARDUINO */
+
+/* Private Methods */
+
+Resolver::entry_t * Resolver::find(kstring_t host)
+{
+    uint8_t i;
+
+    for (i = 0; i < RESOLVER_CACHE_SIZE; i++)
+    {
+        if (_entries[i].host[0] && !strcmp(_entries[i].host, host))
+        {
+            return &_entries[i];
+        }
+    }
+    return NULL;
+}
+
+/* An unused entry, or else the least recently updated one. */
+Resolver::entry_t * Resolver::find_free(void)
+{
+    entry_t * oldest;
+    uint8_t i;
+
+    oldest = &_entries[0];
+    for (i = 0; i < RESOLVER_CACHE_SIZE; i++)
+    {
+        if (!_entries[i].host[0]) return &_entries[i];
+        if (CLOCK_ELAPSED(_entries[i].updated, oldest->updated) > INT32_MAX)
+        {
+            oldest = &_entries[i];
+        }
+    }
+    memset(oldest, 0, sizeof(entry_t));
+    return oldest;
+}
+
+/* Looks up the entry's host.  Failures become negative entries. */
+void Resolver::update(entry_t * entry)
+{
+    net_addr_t address;
+    uint32_t ttl_ms;
+
+    ttl_ms = 0;
+    entry->updated = clock_millis();
+    entry->refresh_pending = false;
+
+    if (!_lookup(entry->host, &address, &ttl_ms))
+    {
+        DLOG_WARN2("Failed to resolve", entry->host);
+        entry->negative = true;
+        entry->ttl_ms = RESOLVER_NEGATIVE_TTL_MS;
+        return;
+    }
+
+    entry->negative = false;
+    entry->address = address;
+    entry->ttl_ms = ttl_ms ? ttl_ms : RESOLVER_DEFAULT_TTL_MS;
+}
@@ -0,0 +1,84 @@
+/*
+ *  Module: Resolver
+ *
+ *  A small DNS result cache.  Entries are kept for their TTL, then
+ *  served stale for a while as they are revalidated in the
+ *  background.  Failed lookups are cached briefly as well.
+ *
+ *  Author: Alex Dale @superoxigen
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for information.
+ */
+
+#ifndef _RESOLVER_HPP_
+#define _RESOLVER_HPP_
+
+#include "netconn.hpp"
+#include "utils.h"
+
+#define RESOLVER_CACHE_SIZE         4
+#define RESOLVER_HOST_LENGTH        64
+
+/* TTL used when the lookup does not report one. */
+#define RESOLVER_DEFAULT_TTL_MS     60000
+/* How long past its TTL an entry may be served while revalidating. */
+#define RESOLVER_STALE_MS           600000
+/* How long a failed lookup is remembered. */
+#define RESOLVER_NEGATIVE_TTL_MS    2000
+
+class Resolver {
+public:
+    /*
+     *  Performs a lookup.  Sets the TTL in milliseconds, or leaves
+     *  it as 0 if unknown.
+     */
+    typedef bool_t (*lookup_t)(kstring_t host, net_addr_t * address, uint32_t * ttl_ms);
+
+private:
+    typedef struct {
+        char_t host[RESOLVER_HOST_LENGTH];
+        net_addr_t address;
+        time_ms_t updated;
+        uint32_t ttl_ms;
+        bool_t negative;
+        bool_t refresh_pending;
+    } entry_t;
+
+    static Resolver s_instance;
+
+    entry_t _entries[RESOLVER_CACHE_SIZE];
+    lookup_t _lookup;
+
+    /* Statistics */
+    uint32_t _hits;
+    uint32_t _stale_hits;
+    uint32_t _negative_hits;
+    uint32_t _misses;
+
+    Resolver();
+public:
+    static Resolver * get_instance(void);
+
+    void set_lookup(lookup_t lookup);
+
+    bool_t resolve(kstring_t host, net_addr_t * address);
+    bool_t prewarm(kstring_t host);
+    void invalidate(kstring_t host);
+    void refresh(void);
+    void flush(void);
+
+    uint32_t hits(void) const;
+    uint32_t stale_hits(void) const;
+    uint32_t negative_hits(void) const;
+    uint32_t misses(void) const;
+
+    static bool_t system_lookup(kstring_t host, net_addr_t * address, uint32_t * ttl_ms);
+
+private:
+    entry_t * find(kstring_t host);
+    entry_t * find_free(void);
+    void update(entry_t * entry);
+};
+
+#endif /* _RESOLVER_HPP_ */
@@ -0,0 +1,91 @@
+/*
+ *  Module: RTC Memory
+ *
+ *  Access to the RTC user memory, which survives deep sleep and
+ *  resets.  On hosts without RTC memory, a file is used instead.
+ *
+ *  Author: Alex Dale @superoxigen
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for information.
+ */
+
+#include "rtcmem.h"
+
+#ifdef ARDUINO
+#include <user_interface.h>
+#else
+#include <stdio.h>
+#endif
+
+/* First RTC block available to the user. */
+#define RTCMEM_USER_BLOCK 64
+
+static bool_t rtcmem_is_valid_range(uint16_t offset, uint16_t length)
+{
+    if (offset % RTCMEM_BLOCK_SIZE) return false;
+    if (length == 0 || length > RTCMEM_USER_SIZE) return false;
+    return (offset + length) <= RTCMEM_USER_SIZE;
+}
+
+#ifdef ARDUINO
+
+bool_t rtcmem_read(uint16_t offset, void * data, uint16_t length)
+{
+    if (!data || !rtcmem_is_valid_range(offset, length)) return false;
+    return system_rtc_mem_read(
+        RTCMEM_USER_BLOCK + (offset / RTCMEM_BLOCK_SIZE), data, length);
+}
+
+bool_t rtcmem_write(uint16_t offset, void const * data, uint16_t length)
+{
+    if (!data || !rtcmem_is_valid_range(offset, length)) return false;
+    return system_rtc_mem_write(
+        RTCMEM_USER_BLOCK + (offset / RTCMEM_BLOCK_SIZE), data, length);
+}
+
+#else /* Host shim */
+
+bool_t rtcmem_read(uint16_t offset, void * data, uint16_t length)
+{
+    FILE * file;
+    bool_t ok;
+
+    if (!data || !rtcmem_is_valid_range(offset, length)) return false;
+
+    file = fopen(RTCMEM_SHIM_FILE, "rb");
+    if (!file) return false;
+
+    ok = (fseek(file, offset, SEEK_SET) == 0)
+        && (fread(data, 1, length, file) == length);
+    fclose(file);
+    return ok;
+}
+
+bool_t rtcmem_write(uint16_t offset, void const * data, uint16_t length)
+{
+    FILE * file;
+    bool_t ok;
+
+    if (!data || !rtcmem_is_valid_range(offset, length)) return false;
+
+    file = fopen(RTCMEM_SHIM_FILE, "r+b");
+    if (!file)
+    {
+        /* First use, create a zeroed memory image. */
+        file = fopen(RTCMEM_SHIM_FILE, "w+b");
+        if (!file) return false;
+        if (fseek(file, RTCMEM_USER_SIZE - 1, SEEK_SET) || fputc(0, file) == EOF)
+        {
+            fclose(file);
+            return false;
+        }
+    }
+
+    ok = (fseek(file, offset, SEEK_SET) == 0)
+        && (fwrite(data, 1, length, file) == length);
+    ok = (fclose(file) == 0) && ok;
+    return ok;
+}
+
+#endif /* ARDUINO */
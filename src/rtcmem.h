@@ -0,0 +1,47 @@
+/*
+ *  Module: RTC Memory
+ *
+ *  Access to the RTC user memory, which survives deep sleep and
+ *  resets.  On hosts without RTC memory, a file is used instead.
+ *
+ *  Author: Alex Dale @superoxigen
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for information.
+ */
+
+#ifndef _RTCMEM_H_
+#define _RTCMEM_H_
+
+#include "utils.h"
+
+/* Bytes of RTC memory available to the user (ESP8266: 128 blocks). */
+#define RTCMEM_USER_SIZE        512
+
+/* RTC memory is addressed in 4 byte blocks. */
+#define RTCMEM_BLOCK_SIZE       4
+
+/*
+ *  Slot Layout
+ *      Offsets must be a multiple of RTCMEM_BLOCK_SIZE.
+ */
+#define RTCMEM_SLOT_SNAPSHOT        0
+#define RTCMEM_SLOT_SNAPSHOT_SIZE   64
+#define RTCMEM_SLOT_TLS_SESSION     64
+#define RTCMEM_SLOT_TLS_SESSION_SIZE 100
+/* Sessions follow one another, one for each server. */
+#define RTCMEM_SLOT_TLS_SESSION_COUNT 3
+
+/* Backing file used by the host shim. */
+#ifndef RTCMEM_SHIM_FILE
+#define RTCMEM_SHIM_FILE "rtcmem.bin"
+#endif
+
+START_C_SECTION
+
+bool_t rtcmem_read(uint16_t offset, void * data, uint16_t length);
+bool_t rtcmem_write(uint16_t offset, void const * data, uint16_t length);
+
+END_C_SECTION
+
+#endif /* _RTCMEM_H_ */
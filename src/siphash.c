@@ -0,0 +1,113 @@
+/*
+ *  Module: SipHash
+ *
+ *  SipHash-2-4, a keyed hash fast enough for short messages on the
+ *  device.  Its 8 byte tag authenticates datagrams sent with a key
+ *  shared with the platform.
+ *
+ *  Author: Alex Dale @superoxigen
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for information.
+ */
+
+#include "siphash.h"
+
+#define ROTL(x, b) (uint64_t) (((x) << (b)) | ((x) >> (64 - (b))))
+
+#define SIPROUND(v0, v1, v2, v3)                                    \
+    do {                                                            \
+        v0 += v1; v1 = ROTL(v1, 13); v1 ^= v0; v0 = ROTL(v0, 32);   \
+        v2 += v3; v3 = ROTL(v3, 16); v3 ^= v2;                      \
+        v0 += v3; v3 = ROTL(v3, 21); v3 ^= v0;                      \
+        v2 += v1; v1 = ROTL(v1, 17); v1 ^= v2; v2 = ROTL(v2, 32);   \
+    } while (0)
+
+/* Little endian, whatever the alignment. */
+static uint64_t load64(byte_t const * p)
+{
+    return ((uint64_t) p[0])
+        | ((uint64_t) p[1] << 8)
+        | ((uint64_t) p[2] << 16)
+        | ((uint64_t) p[3] << 24)
+        | ((uint64_t) p[4] << 32)
+        | ((uint64_t) p[5] << 40)
+        | ((uint64_t) p[6] << 48)
+        | ((uint64_t) p[7] << 56);
+}
+
+uint64_t siphash24(byte_t const * key, void const * data, uint16_t length)
+{
+    byte_t const * ptr = (byte_t const *) data;
+    uint64_t k0 = load64(key);
+    uint64_t k1 = load64(&key[8]);
+    uint64_t v0 = k0 ^ 0x736f6d6570736575ULL;
+    uint64_t v1 = k1 ^ 0x646f72616e646f6dULL;
+    uint64_t v2 = k0 ^ 0x6c7967656e657261ULL;
+    uint64_t v3 = k1 ^ 0x7465646279746573ULL;
+    uint64_t m, last;
+    uint16_t left;
+
+    for (left = length; left >= 8; left -= 8, ptr += 8)
+    {
+        m = load64(ptr);
+        v3 ^= m;
+        SIPROUND(v0, v1, v2, v3);
+        SIPROUND(v0, v1, v2, v3);
+        v0 ^= m;
+    }
+
+    /* The last block carries the length in its top byte. */
+    last = ((uint64_t) length) << 56;
+    switch (left)
+    {
+        case 7: last |= ((uint64_t) ptr[6]) << 48; /* fall through */
+        case 6: last |= ((uint64_t) ptr[5]) << 40; /* fall through */
+        case 5: last |= ((uint64_t) ptr[4]) << 32; /* fall through */
+        case 4: last |= ((uint64_t) ptr[3]) << 24; /* fall through */
+        case 3: last |= ((uint64_t) ptr[2]) << 16; /* fall through */
+        case 2: last |= ((uint64_t) ptr[1]) << 8;  /* fall through */
+        case 1: last |= ((uint64_t) ptr[0]);       /* fall through */
+        default: break;
+    }
+
+    v3 ^= last;
+    SIPROUND(v0, v1, v2, v3);
+    SIPROUND(v0, v1, v2, v3);
+    v0 ^= last;
+
+    v2 ^= 0xFF;
+    SIPROUND(v0, v1, v2, v3);
+    SIPROUND(v0, v1, v2, v3);
+    SIPROUND(v0, v1, v2, v3);
+    SIPROUND(v0, v1, v2, v3);
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+/* Writes the 8 byte tag, little endian as in the reference. */
+void siphash_tag(byte_t const * key, void const * data, uint16_t length, byte_t * tag)
+{
+    uint64_t hash = siphash24(key, data, length);
+    uint8_t i;
+
+    for (i = 0; i < SIPHASH_TAG_LENGTH; i++)
+    {
+        tag[i] = (byte_t) (hash >> (8 * i));
+    }
+}
+
+/* Compares in constant time, so a forger learns nothing from timing. */
+bool_t siphash_verify(byte_t const * key, void const * data, uint16_t length, byte_t const * tag)
+{
+    byte_t expected[SIPHASH_TAG_LENGTH];
+    byte_t diff;
+    uint8_t i;
+
+    siphash_tag(key, data, length, expected);
+    diff = 0;
+    for (i = 0; i < SIPHASH_TAG_LENGTH; i++)
+    {
+        diff |= expected[i] ^ tag[i];
+    }
+    return diff == 0;
+}
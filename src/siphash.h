@@ -0,0 +1,31 @@
+/*
+ *  Module: SipHash
+ *
+ *  SipHash-2-4, a keyed hash fast enough for short messages on the
+ *  device.  Its 8 byte tag authenticates datagrams sent with a key
+ *  shared with the platform.
+ *
+ *  Author: Alex Dale @superoxigen
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for information.
+ */
+
+#ifndef _SIPHASH_H_
+#define _SIPHASH_H_
+
+#include "utils.h"
+
+#define SIPHASH_KEY_LENGTH  16
+#define SIPHASH_TAG_LENGTH  8
+
+START_C_SECTION
+
+uint64_t siphash24(byte_t const * key, void const * data, uint16_t length);
+
+void siphash_tag(byte_t const * key, void const * data, uint16_t length, byte_t * tag);
+bool_t siphash_verify(byte_t const * key, void const * data, uint16_t length, byte_t const * tag);
+
+END_C_SECTION
+
+#endif /* _SIPHASH_H_ */
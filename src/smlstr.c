@@ -11,221 +11,718 @@
  */
 
 #include <ctype.h>
+#include <stdint.h>
+#include <string.h>
+
 #include "smlstr.h"
 
 static kstring_t kDigits = "0123456789ABCDEF";
 
-#define DEC_LAST_DIGIT(val) (kDigits[(val) % 10])
-#define HEX_LAST_DIGIT(val) (kDigits[(val) % 0x10])
+/* The two digits of each number below 100. */
+static char_t const kDigitPairs[2 * 100 + 1] =
+    "00010203040506070809101112131415161718192021222324"
+    "25262728293031323334353637383940414243444546474849"
+    "50515253545556575859606162636465666768697071727374"
+    "75767778798081828384858687888990919293949596979899";
+
+/* Where each count of decimal digits starts. */
+static uint32_t const kPowersOf10[] = {
+    10UL, 100UL, 1000UL, 10000UL, 100000UL,
+    1000000UL, 10000000UL, 100000000UL, 1000000000UL
+};
+
+#define UINT_DIGITS_MAX     10
+#define HEX_DIGITS_MAX      8
+
+/* A sign, ten digits, the point and the terminator. */
+#define FIX_CHARS_MAX       13
+
+/* A word that may be read from, or stored to, characters. */
+typedef uint32_t __attribute__((__may_alias__)) word_t;
 
+#define WORD_SIZE           ((uint16_t) sizeof(word_t))
+#define WORD_MASK           (sizeof(word_t) - 1)
+
+/* Whether any byte of the word is zero. */
+#define HAS_ZERO(word)      (((word) - 0x01010101UL) & ~(word) & 0x80808080UL)
+
+/* A byte repeated in each byte of a word. */
+#define BYTES(b)            (0x01010101UL * (uint8_t) (b))
+#define HIGH_BITS           BYTES(0x80)
+
+/* Whether the character is in the set, a bit for each of the 128 ASCII. */
+#define IN_SET(set, c)      ((c) < 0x80 && (((set)[(c) >> 3] >> ((c) & 7)) & 1))
+
+/* What each encoding leaves as it is: RFC 3986's unreserved, and the form's. */
+static byte_t const kUrlSafe[2][16] = {
+    {
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x60, 0xFF, 0x03,
+        0xFE, 0xFF, 0xFF, 0x87, 0xFE, 0xFF, 0xFF, 0x47
+    },
+    {
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x64, 0xFF, 0x03,
+        0xFE, 0xFF, 0xFF, 0x87, 0xFE, 0xFF, 0xFF, 0x07
+    }
+};
+
+static byte_t const kHexChars[16] = {
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xFF, 0x03,
+    0x7E, 0x00, 0x00, 0x00, 0x7E, 0x00, 0x00, 0x00
+};
+
+/* The bits the value needs, at least one. */
+static inline uint16_t num_of_bits(uint32_t val)
+{
+    return (uint16_t) (32 - __builtin_clz(val | 1));
+}
+
+/*
+ *  From the bits: 1233 / 4096 is just over log10(2), so this is the
+ *  digits of the smallest value with as many bits, or one short.
+ */
 static inline uint16_t num_of_dec_digits(uint32_t val)
 {
-    uint16_t n;
-    for (n = 0; val; n++)
+    uint16_t n = (uint16_t) ((num_of_bits(val) * 1233UL) >> 12);
+    return n ? n + (val >= kPowersOf10[n - 1]) : 1;
+}
+
+static inline uint16_t num_of_hex_digits(uint32_t val)
+{
+    return (uint16_t) ((num_of_bits(val) + 3) >> 2);
+}
+
+/*
+ *  val / 100, exactly, as a multiply and a shift.  The ESP8266 has
+ *  no divider, so a division is a call of some forty cycles.  Small
+ *  values keep to 32 bits.
+ */
+static inline uint32_t div100(uint32_t val)
+{
+    if (val < 43699)
     {
-        val = val / 10;
+        return (val * 5243UL) >> 19;
     }
-    return n ? n : 1; /* 0 needs a digit */
+    return (uint32_t) (((uint64_t) val * 0x51EB851FULL) >> 37);
 }
 
-#ifdef SMLSTR_HEX_ENABLED
 
-static inline uint16_t num_of_hex_digits(uint32_t val)
+/*
+ *  String Kernels
+ *
+ *  Copying and scanning go a word at a time.  Words are only read
+ *  from aligned addresses, so a read past the terminator never
+ *  crosses into another page, and are only stored aligned when the
+ *  destination lines up with the source, as the ESP8266 faults on
+ *  an unaligned word.  Otherwise each word is stored as its bytes.
+ */
+
+/* Finds the end of the string, but reads no further than `max`. */
+static uint16_t span(kstring_t src, uint16_t max)
 {
     uint16_t n;
-    for (n = 0; val; n++)
+    word_t word, next;
+
+    for (n = 0; n < max && ((uintptr_t) &src[n] & WORD_MASK); n++)
+    {
+        if (!src[n]) return n;
+    }
+    for (; (uint16_t) (max - n) >= 2 * WORD_SIZE; n += 2 * WORD_SIZE)
     {
-        val = val / 16;
+        word = *(word_t const *) &src[n];
+        next = *(word_t const *) &src[n + WORD_SIZE];
+        if (HAS_ZERO(word) | HAS_ZERO(next)) break;
     }
+    for (; n < max && src[n]; n++);
     return n;
 }
 
-#endif /* SMLSTR_HEX_ENABLED */
+/* Copies up to `room` characters, without the terminator, and returns how many. */
+static uint16_t copy_run(string_t dest, kstring_t src, uint16_t room)
+{
+    uint16_t n;
+    word_t word, next;
+
+    for (n = 0; n < room && ((uintptr_t) &src[n] & WORD_MASK); n++)
+    {
+        if (!src[n]) return n;
+        dest[n] = src[n];
+    }
+
+    if (!((uintptr_t) &dest[n] & WORD_MASK))
+    {
+        for (; (uint16_t) (room - n) >= 2 * WORD_SIZE; n += 2 * WORD_SIZE)
+        {
+            word = *(word_t const *) &src[n];
+            next = *(word_t const *) &src[n + WORD_SIZE];
+            if (HAS_ZERO(word) | HAS_ZERO(next)) break;
+            *(word_t *) &dest[n] = word;
+            *(word_t *) &dest[n + WORD_SIZE] = next;
+        }
+    }
+    else
+    {
+        for (; (uint16_t) (room - n) >= 2 * WORD_SIZE; n += 2 * WORD_SIZE)
+        {
+            word = *(word_t const *) &src[n];
+            next = *(word_t const *) &src[n + WORD_SIZE];
+            if (HAS_ZERO(word) | HAS_ZERO(next)) break;
+            memcpy(&dest[n], &word, WORD_SIZE);
+            memcpy(&dest[n + WORD_SIZE], &next, WORD_SIZE);
+        }
+    }
 
+    /* The word with the terminator, or what is left of the room. */
+    for (; n < room && src[n]; n++)
+    {
+        dest[n] = src[n];
+    }
+    return n;
+}
 
 uint16_t smlstrcat(string_t dest, kstring_t src, uint16_t len)
 {
-    uint16_t required;
-    string_t dptr;
-    kstring_t sptr;
-
-    required = 0;
-    dptr = dest;
-    sptr = src;
+    uint16_t end, copied;
 
     if (!dest || !src)
     {
         return 0;
     }
+    if (len == 0)
+    {
+        return span(src, UINT16_MAX);
+    }
 
     /* Find end of current string. */
-    while (*dptr && required < (len-1))
+    end = span(dest, len - 1);
+
+    /* Concatinate the parts of the string which can fit */
+    copied = copy_run(&dest[end], src, len - 1 - end);
+    dest[end + copied] = 0;
+
+    /* Count the rest. */
+    return end + copied + span(&src[copied], UINT16_MAX);
+}
+
+uint16_t smlstrcpy(string_t dest, kstring_t src, uint16_t len)
+{
+    uint16_t copied;
+
+    if (!dest || !src)
     {
-        dptr++;
-        required++;
+        return 0;
+    }
+    if (len == 0)
+    {
+        return span(src, UINT16_MAX);
     }
 
-    /* Concatinate the parts of the string which can fit */
-    while (*sptr && len > 0 && required < (len-1))
+    /* Copy the parts of the string which can fit */
+    copied = copy_run(dest, src, len - 1);
+    dest[copied] = 0;
+
+    /* Count the rest. */
+    return copied + span(&src[copied], UINT16_MAX);
+}
+
+/*
+ *  Writes the digits two at a time from a table, from the last.
+ *  Returns the number of digits, and writes as many of the first of
+ *  them as fit, as snprintf() does.
+ */
+uint16_t smluintfmt(string_t dest, uint32_t val, uint16_t len)
+{
+    char_t digits[UINT_DIGITS_MAX];
+    uint16_t required, at;
+    string_t out;
+    uint32_t quotient;
+
+    if (!dest)
     {
-        *dptr++ = *sptr++;
-        required++;
+        return 0;
     }
 
-    /* Skip over the rest. */
-    while (*sptr)
+    required = num_of_dec_digits(val);
+    if (len == 0)
     {
-        sptr++;
-        required++;
+        /* Destination buffer is zero-sized */
+        return required;
     }
 
-    /* Add a null terminator if it is possible. */
-    if (len > 0)
+    /* Straight into the buffer if it fits, else cut from a copy. */
+    out = (required < len) ? dest : digits;
+    at = required;
+    while (val >= 100)
+    {
+        quotient = div100(val);
+        at -= 2;
+        memcpy(&out[at], &kDigitPairs[2 * (val - quotient * 100)], 2);
+        val = quotient;
+    }
+    if (val >= 10)
     {
-        *dptr = 0;
+        memcpy(out, &kDigitPairs[2 * val], 2);
+    }
+    else
+    {
+        *out = (char_t) ('0' + val);
     }
 
+    if (out == dest)
+    {
+        dest[required] = 0;
+    }
+    else
+    {
+        memcpy(dest, digits, len - 1);
+        dest[len - 1] = 0;
+    }
     return required;
 }
 
-
-uint16_t smlstrcpy(string_t dest, kstring_t src, uint16_t len)
+/* The magnitude is taken unsigned, so the most negative value needs no special case. */
+uint16_t smlintfmt(string_t dest, int32_t val, uint16_t len)
 {
     uint16_t required;
-    string_t dptr;
-    kstring_t sptr;
 
-    required = 0;
-    dptr = dest;
-    sptr = src;
+    if (!dest)
+    {
+        return 0;
+    }
+    if (val >= 0)
+    {
+        return smluintfmt(dest, (uint32_t) val, len);
+    }
 
-    if (!dest || !src)
+    required = smluintfmt(dest + 1, 0UL - (uint32_t) val, len ? len - 1 : 0) + 1;
+    if (len > 1)
+    {
+        *dest = '-';
+    }
+    else if (len == 1)
+    {
+        *dest = 0;
+    }
+    return required;
+}
+
+/*
+ *  Writes upper case hex digits, at least `width` of them, zero
+ *  padded, up to eight.  Returns and cuts as smluintfmt() does.
+ */
+uint16_t smlhexfmt(string_t dest, uint32_t val, uint8_t width, uint16_t len)
+{
+    char_t digits[HEX_DIGITS_MAX];
+    uint16_t required, at;
+    string_t out;
+
+    if (!dest)
     {
         return 0;
     }
 
-    /* Copy the parts of the string which can fit */
-    while (*sptr && len > 0 && required < (len-1))
+    required = num_of_hex_digits(val);
+    if (width > required)
+    {
+        required = (width < HEX_DIGITS_MAX) ? width : HEX_DIGITS_MAX;
+    }
+    if (len == 0)
+    {
+        return required;
+    }
+
+    out = (required < len) ? dest : digits;
+    for (at = required; at; val >>= 4)
+    {
+        out[--at] = kDigits[val & 0x0F];
+    }
+
+    if (out == dest)
+    {
+        dest[required] = 0;
+    }
+    else
+    {
+        memcpy(dest, digits, len - 1);
+        dest[len - 1] = 0;
+    }
+    return required;
+}
+
+/*
+ *  Writes `val` as a decimal with `places` digits after the point, up
+ *  to nine: a value of -1234 with two places is "-12.34".  The
+ *  magnitude is written whole, zero padded to a digit before the
+ *  point, and its fraction moved up for the point, so there is no
+ *  division.  Returns and cuts as smluintfmt() does.
+ */
+uint16_t smlfixfmt(string_t dest, int32_t val, uint8_t places, uint16_t len)
+{
+    char_t text[FIX_CHARS_MAX];
+    uint32_t magnitude;
+    uint16_t required, digits, padded, point, at;
+    string_t out;
+
+    if (!dest)
+    {
+        return 0;
+    }
+    if (places == 0)
     {
-        *dptr++ = *sptr++;
-        required++;
+        return smlintfmt(dest, val, len);
     }
+    if (places > UINT_DIGITS_MAX - 1)
+    {
+        places = UINT_DIGITS_MAX - 1;
+    }
+
+    magnitude = (val < 0) ? 0UL - (uint32_t) val : (uint32_t) val;
+    digits = num_of_dec_digits(magnitude);
+    padded = (digits > places) ? digits : places + 1;
+    point = (val < 0) + padded - places;
 
-    /* Skip over the rest. */
-    while (*sptr)
+    required = (val < 0) + padded + 1;
+    if (len == 0)
     {
-        sptr++;
-        required++;
+        return required;
     }
 
-    /* Add a null terminator if it is possible. */
-    if (len > 0)
+    out = (required < len) ? dest : text;
+    out[0] = '-';
+    if (padded > digits)
     {
-        *dptr = 0;
+        memset(&out[val < 0], '0', padded - digits);
     }
+    smluintfmt(&out[required - 1 - digits], magnitude, UINT_DIGITS_MAX + 1);
 
+    /* The fraction and the terminator move up, for the point. */
+    for (at = required; at > point; at--)
+    {
+        out[at] = out[at - 1];
+    }
+    out[point] = '.';
+
+    if (out != dest)
+    {
+        memcpy(dest, text, len - 1);
+        dest[len - 1] = 0;
+    }
     return required;
 }
 
-uint16_t smluintfmt(string_t dest, uint32_t val, uint16_t len)
+/*
+ *  Base64 (RFC 4648) encodes `src_len` bytes of `src`.  Like the
+ *  other formatters, returns the length of the full encoding, and
+ *  writes nothing but the terminator if it does not fit.
+ */
+uint16_t smlb64fmt(string_t dest, byte_t const * src, uint16_t src_len, uint16_t len)
 {
+    static kstring_t kBase64 =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
     uint16_t required, i;
+    uint32_t triple;
     string_t dptr;
 
-    if (!dest)
+    if (!dest || (!src && src_len))
     {
         return 0;
     }
 
-    required = num_of_dec_digits(val);
+    required = ((src_len + 2) / 3) * 4;
 
-    if (len > 0 && required < (len-1))
+    if (len == 0)
     {
-        /* Buffer is large enough to fit the whole conversion. */
-        dptr = &dest[required];
-        *dptr-- = 0;
+        return required;
     }
-    else if (len > 0)
+    if (required >= len)
+    {
+        *dest = 0;
+        return required;
+    }
+
+    dptr = dest;
+    for (i = 0; (i + 2) < src_len; i += 3)
     {
-        /* Buffer not large enough to fit the whole conversion. */
-        dptr = &dest[len-1];
-        *dptr-- = 0;
+        triple = ((uint32_t) src[i] << 16) | ((uint32_t) src[i+1] << 8) | src[i+2];
+        *dptr++ = kBase64[(triple >> 18) & 0x3F];
+        *dptr++ = kBase64[(triple >> 12) & 0x3F];
+        *dptr++ = kBase64[(triple >> 6) & 0x3F];
+        *dptr++ = kBase64[triple & 0x3F];
+    }
 
-        for (i = 0; i <= (required-len); i++)
+    if (i < src_len)
+    {
+        triple = (uint32_t) src[i] << 16;
+        if ((i + 1) < src_len)
         {
-            val = val / 10;
+            triple |= (uint32_t) src[i+1] << 8;
         }
+        *dptr++ = kBase64[(triple >> 18) & 0x3F];
+        *dptr++ = kBase64[(triple >> 12) & 0x3F];
+        *dptr++ = ((i + 1) < src_len) ? kBase64[(triple >> 6) & 0x3F] : '=';
+        *dptr++ = '=';
     }
-    else
+
+    *dptr = 0;
+    return required;
+}
+
+static int8_t b64value(char_t c)
+{
+    if (c >= 'A' && c <= 'Z') return c - 'A';
+    if (c >= 'a' && c <= 'z') return c - 'a' + 26;
+    if (c >= '0' && c <= '9') return c - '0' + 52;
+    if (c == '+') return 62;
+    if (c == '/') return 63;
+    return -1;
+}
+
+/*
+ *  Decodes base64 (RFC 4648) `src` into at most `len` bytes of
+ *  `dest`.  Returns the number of bytes decoded, or 0 if `src` is
+ *  not base64 or does not fit.
+ */
+uint16_t smlb64scan(byte_t * dest, kstring_t src, uint16_t len)
+{
+    uint16_t length, bits;
+    uint32_t accumulator;
+    int8_t value;
+
+    if (!dest || !src)
     {
-        /* Destination buffer is zero-sized */
-        return required;
+        return 0;
     }
 
-    while (len > 0 && dest <= dptr)
+    length = 0;
+    bits = 0;
+    accumulator = 0;
+    for (; *src && *src != '='; src++)
     {
-        *dptr-- = DEC_LAST_DIGIT(val);
-        val = val / 10;
+        value = b64value(*src);
+        if (value < 0)
+        {
+            return 0;
+        }
+
+        accumulator = (accumulator << 6) | (uint32_t) value;
+        bits += 6;
+        if (bits >= 8)
+        {
+            bits -= 8;
+            if (length >= len)
+            {
+                return 0;
+            }
+            dest[length++] = (byte_t) (accumulator >> bits);
+        }
     }
 
-    return required;
+    /* Only padding may follow, and only as much as is missing. */
+    for (; *src == '='; src++, bits -= 2)
+    {
+        if (bits < 2) return 0;
+    }
+    if (*src || bits >= 6)
+    {
+        return 0;
+    }
+    return length;
 }
 
-uint16_t smlintfmt(string_t dest, int32_t val, uint16_t len)
+/*
+ *  URL Encoding
+ *
+ *  Characters are looked up in a bitmap of those each encoding
+ *  leaves as they are.  Letters and digits, most of any value, are
+ *  checked a word at a time and copied as one run.
+ */
+
+/*
+ *  The high bit of each byte of the word that is from lo to hi.  The
+ *  bytes must be below 0x80, so that no sum carries into the next.
+ */
+static inline word_t in_range(word_t word, uint8_t lo, uint8_t hi)
 {
-    uint16_t required;
+    word_t from_lo = word + BYTES(0x80 - lo);
+    word_t past_hi = word + BYTES(0x7F - hi);
 
-    if (!dest)
+    return from_lo & ~past_hi & HIGH_BITS;
+}
+
+/* Whether each character of the word is a letter or a digit. */
+static inline bool_t are_alnum(word_t chars)
+{
+    word_t ascii = chars & ~HIGH_BITS;
+    word_t alnum = in_range(ascii, '0', '9') | in_range(ascii | BYTES(0x20), 'a', 'z');
+
+    return !(chars & HIGH_BITS) && alnum == HIGH_BITS;
+}
+
+uint16_t smlurlenclen(kstring_t src, smlurl_mode_t mode)
+{
+    byte_t const * safe = kUrlSafe[mode == SMLURL_FORM];
+    uint16_t length;
+    byte_t c;
+
+    if (!src)
     {
         return 0;
     }
 
-    if (val < 0 && (val-1) < 0)
+    for (length = 0; *src; src++)
+    {
+        while (!((uintptr_t) src & WORD_MASK) && are_alnum(*(word_t const *) src))
+        {
+            length += WORD_SIZE;
+            src += WORD_SIZE;
+        }
+        c = (byte_t) *src;
+        if (!c)
+        {
+            break;
+        }
+        length += (IN_SET(safe, c) || (c == ' ' && mode == SMLURL_FORM)) ? 1 : 3;
+    }
+    return length;
+}
+
+/*
+ *  Encodes as much of `*src` as fits in `len` characters, never
+ *  splitting an escape, and moves `*src` past it.  Writes no
+ *  terminator, so a caller can encode straight into a buffer which
+ *  it then sends, and go on from where it stopped.  Returns how
+ *  many characters it wrote.
+ */
+uint16_t smlurlencpart(string_t dest, kstring_t * src, smlurl_mode_t mode, uint16_t len)
+{
+    byte_t const * safe = kUrlSafe[mode == SMLURL_FORM];
+    kstring_t sptr;
+    word_t word;
+    uint16_t n;
+    byte_t c;
+
+    if (!dest || !src || !*src)
     {
-        required = smluintfmt(dest+1, -val, len ? len-1 : 0);
+        return 0;
     }
-    else if (val < 0) /* Value is max negative. */
+
+    n = 0;
+    sptr = *src;
+    for (;; sptr++)
     {
-        /*
-         *  For max negative, its negative is itself.  For
-         *  this case, we get the unsigned format of -(value+1),
-         *  then replace the last character with the correct
-         *  digit.
-         */
-        required = smluintfmt(dest+1,  -(val+1), len ? len-1 : 0);
+        if (!((uintptr_t) sptr & WORD_MASK))
+        {
+            while ((uint16_t) (len - n) >= WORD_SIZE
+                && are_alnum(word = *(word_t const *) sptr))
+            {
+                memcpy(&dest[n], &word, WORD_SIZE);
+                n += WORD_SIZE;
+                sptr += WORD_SIZE;
+            }
+        }
 
-        /*
-         * If possible, change the last digit to correct value.
-         *  The last digit will be an odd number (max positive
-         *  is always odd, b011...111).
-         */
-        if (len > 0 && required < (len-2))
+        c = (byte_t) *sptr;
+        if (!c) break;
+        if (IN_SET(safe, c) || (c == ' ' && mode == SMLURL_FORM))
         {
-            /* Shifts digits up. */
-            dest[required] = (dest[required] == '9') ? '0': dest[required]+1;
+            if (n >= len) break;
+            dest[n++] = (c == ' ') ? '+' : (char_t) c;
         }
+        else
+        {
+            if ((uint16_t) (len - n) < 3) break;
+            dest[n++] = '%';
+            dest[n++] = kDigits[c >> 4];
+            dest[n++] = kDigits[c & 0x0F];
+        }
+    }
+
+    *src = sptr;
+    return n;
+}
+
+/* Returns and cuts as the other formatters do, but never within an escape. */
+uint16_t smlurlenc(string_t dest, kstring_t src, smlurl_mode_t mode, uint16_t len)
+{
+    uint16_t written;
+
+    if (!dest || !src)
+    {
+        return 0;
     }
-    else /* A positive value. */
+    if (len == 0)
     {
-        required = smluintfmt(dest, (uint32_t) val, len);
+        return smlurlenclen(src, mode);
     }
 
+    written = smlurlencpart(dest, &src, mode, len - 1);
+    dest[written] = 0;
+    return written + smlurlenclen(src, mode);
+}
+
+/*
+ *  Decodes `src_len` URL encoded characters of `src`, which need not
+ *  be terminated, into `dest`, terminated.  Runs with no escape are
+ *  copied a word at a time.  As decoding only shortens, `dest` may
+ *  be `src`.  Returns the decoded length, or 0 if an escape is
+ *  malformed or it does not fit.
+ */
+uint16_t smlurldec(string_t dest, char_t const * src, uint16_t src_len,
+    smlurl_mode_t mode, uint16_t len)
+{
+    uint16_t i, n, run;
+    word_t word;
+    byte_t c;
+
+    if (!dest || !src || !len)
+    {
+        return 0;
+    }
 
-    if (val < 0)
+    for (i = 0, n = 0; i < src_len; n++)
     {
-        if (len > 1)
+        if (!((uintptr_t) &src[i] & WORD_MASK))
         {
-            *dest = '-';
+            for (run = 0; (uint16_t) (src_len - i - run) >= WORD_SIZE; run += WORD_SIZE)
+            {
+                word = *(word_t const *) &src[i + run];
+                if (HAS_ZERO(word ^ BYTES('%')) || HAS_ZERO(word ^ BYTES('+'))) break;
+            }
+            if (run)
+            {
+                if (n + run >= len) return 0;
+                memmove(&dest[n], &src[i], run);
+                n += run;
+                i += run;
+                if (i == src_len) break;
+            }
         }
-        required++;
-    }
 
-    if (len == 1)
-    {
-        *dest = 0;
+        c = (byte_t) src[i];
+        if (c == '%')
+        {
+            if ((uint16_t) (src_len - i) < 3
+                || !IN_SET(kHexChars, (byte_t) src[i + 1])
+                || !IN_SET(kHexChars, (byte_t) src[i + 2]))
+            {
+                return 0;
+            }
+            /* A digit's low four bits, and nine more for a letter. */
+            c = (byte_t) ((((src[i + 1] & 0x0F) + 9 * (src[i + 1] >> 6)) << 4)
+                | ((src[i + 2] & 0x0F) + 9 * (src[i + 2] >> 6)));
+            i += 3;
+        }
+        else
+        {
+            if (c == '+' && mode == SMLURL_FORM) c = ' ';
+            i++;
+        }
+
+        if (n + 1 >= len) return 0;
+        dest[n] = (char_t) c;
     }
 
-    return required;
+    dest[n] = 0;
+    return n;
 }
 
 bool_t smlisdec(kstring_t src)
@@ -252,38 +749,54 @@ bool_t smlisdec(kstring_t src)
     return !*ptr;
 }
 
+/*
+ *  Reads an unsigned decimal in one pass, a compare a digit.  Only
+ *  a tenth digit can overflow, so only it is checked.  Returns 0 if
+ *  it is empty, has anything but digits, or does not fit 32 bits.
+ */
 uint32_t smluintscan(kstring_t src)
 {
-    char_t const * ptr;
-    uint32_t value;
+    uint32_t value, digit;
+    uint16_t i;
 
-    ptr = src;
-    value = 0;
-
-    if (!*ptr || *ptr == '-')
+    if (!src)
     {
         return 0;
     }
 
-    while (*ptr && isdigit((*ptr)))
+    /* Leading zeros count for nothing, but leave the last. */
+    while (*src == '0' && src[1])
     {
-        value *= 10;
-        value += (*ptr - '0');
-        ptr++;
+        src++;
     }
 
-    if (*ptr)
+    value = 0;
+    for (i = 0; i < UINT_DIGITS_MAX; i++)
     {
-        return 0;
+        digit = (uint32_t) (byte_t) src[i] - '0';
+        if (digit > 9)
+        {
+            break;
+        }
+        if (i == UINT_DIGITS_MAX - 1
+            && (value > UINT32_MAX / 10 || (value == UINT32_MAX / 10 && digit > UINT32_MAX % 10)))
+        {
+            return 0;
+        }
+        value = value * 10 + digit;
     }
 
-    return value;
+    return (i && !src[i]) ? value : 0;
 }
 
+/*
+ *  Reads a signed decimal.  Returns 0, as smluintscan() does, if it
+ *  does not fit: past INT32_MAX, or below INT32_MAX + 1 negated.
+ */
 int32_t smlintscan(kstring_t src)
 {
+    uint32_t magnitude;
     uint8_t neg;
-    int32_t value;
 
     if (!src)
     {
@@ -291,8 +804,12 @@ int32_t smlintscan(kstring_t src)
     }
 
     neg = (*src == '-') ? 1 : 0;
-    value = smluintscan(&src[neg]);
-    value = (value < 0) ? -value : value;
-    value = (value < 0) ? 0 : value;
-    return neg ? -value : value;
+    magnitude = smluintscan(&src[neg]);
+    if (magnitude > (uint32_t) INT32_MAX + neg)
+    {
+        return 0;
+    }
+
+    /* Negated wider, as INT32_MAX + 1 is not an int32_t. */
+    return neg ? (int32_t) -(int64_t) magnitude : (int32_t) magnitude;
 }
@@ -17,11 +17,31 @@
 
 START_C_SECTION
 
+/*
+ *  URL encodings: SMLURL_PERCENT escapes all but RFC 3986's
+ *  unreserved characters, SMLURL_FORM is
+ *  application/x-www-form-urlencoded, with a space as '+'.
+ */
+typedef enum {
+    SMLURL_PERCENT,
+    SMLURL_FORM
+} smlurl_mode_t;
+
 uint16_t smlstrcpy(string_t dest, kstring_t src, uint16_t len);
 uint16_t smlstrcat(string_t dest, kstring_t src, uint16_t len);
 
 uint16_t smluintfmt(string_t dest, uint32_t val, uint16_t len);
 uint16_t smlintfmt(string_t dest, int32_t val, uint16_t len);
+uint16_t smlhexfmt(string_t dest, uint32_t val, uint8_t width, uint16_t len);
+uint16_t smlfixfmt(string_t dest, int32_t val, uint8_t places, uint16_t len);
+uint16_t smlb64fmt(string_t dest, byte_t const * src, uint16_t src_len, uint16_t len);
+uint16_t smlb64scan(byte_t * dest, kstring_t src, uint16_t len);
+
+uint16_t smlurlenclen(kstring_t src, smlurl_mode_t mode);
+uint16_t smlurlencpart(string_t dest, kstring_t * src, smlurl_mode_t mode, uint16_t len);
+uint16_t smlurlenc(string_t dest, kstring_t src, smlurl_mode_t mode, uint16_t len);
+uint16_t smlurldec(string_t dest, char_t const * src, uint16_t src_len,
+    smlurl_mode_t mode, uint16_t len);
 
 bool_t smlisdec(kstring_t src);
 uint32_t smluintscan(kstring_t src);
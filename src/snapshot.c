@@ -0,0 +1,99 @@
+/*
+ *  Module: Snapshot
+ *
+ *  A compact, versioned and CRC checked copy of the Alert Manager
+ *  state.  Kept in RTC memory so that a pendant which resets
+ *  mid-alert can resume without waiting on the network.
+ *
+ *  Author: Alex Dale @superoxigen
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for information.
+ */
+
+#include <stddef.h>
+#include <string.h>
+
+#include "checksum.h"
+#include "rtcmem.h"
+#include "snapshot.h"
+
+/* The snapshot must fit inside its RTC slot. */
+typedef char snapshot_size_check_t[
+    (sizeof(snapshot_t) <= RTCMEM_SLOT_SNAPSHOT_SIZE) ? 1 : -1];
+
+/* CRC of the last snapshot written, used to skip redundant writes. */
+static uint32_t last_saved_crc = 0;
+static bool_t has_saved = false;
+
+static uint32_t snapshot_crc(snapshot_t const * snapshot)
+{
+    return checksum_crc32(snapshot, offsetof(snapshot_t, crc));
+}
+
+void snapshot_init(snapshot_t * snapshot)
+{
+    if (!snapshot) return;
+    memset(snapshot, 0, sizeof(snapshot_t));
+    snapshot->magic = SNAPSHOT_MAGIC;
+    snapshot->version = SNAPSHOT_VERSION;
+}
+
+void snapshot_seal(snapshot_t * snapshot)
+{
+    if (!snapshot) return;
+    snapshot->magic = SNAPSHOT_MAGIC;
+    snapshot->version = SNAPSHOT_VERSION;
+    memset(snapshot->reserved, 0, sizeof(snapshot->reserved));
+    snapshot->crc = snapshot_crc(snapshot);
+}
+
+bool_t snapshot_is_valid(snapshot_t const * snapshot)
+{
+    if (!snapshot) return false;
+    if (snapshot->magic != SNAPSHOT_MAGIC) return false;
+    if (snapshot->version != SNAPSHOT_VERSION) return false;
+    return snapshot->crc == snapshot_crc(snapshot);
+}
+
+bool_t snapshot_save(snapshot_t * snapshot)
+{
+    if (!snapshot) return false;
+
+    snapshot_seal(snapshot);
+    if (has_saved && snapshot->crc == last_saved_crc) return true;
+
+    if (!rtcmem_write(RTCMEM_SLOT_SNAPSHOT, snapshot, sizeof(snapshot_t)))
+    {
+        return false;
+    }
+    last_saved_crc = snapshot->crc;
+    has_saved = true;
+    return true;
+}
+
+bool_t snapshot_load(snapshot_t * snapshot)
+{
+    if (!snapshot) return false;
+
+    if (!rtcmem_read(RTCMEM_SLOT_SNAPSHOT, snapshot, sizeof(snapshot_t))
+        || !snapshot_is_valid(snapshot))
+    {
+        snapshot_init(snapshot);
+        return false;
+    }
+
+    last_saved_crc = snapshot->crc;
+    has_saved = true;
+    return true;
+}
+
+bool_t snapshot_clear(void)
+{
+    snapshot_t snapshot;
+
+    /* An all zero slot never has a valid magic number. */
+    memset(&snapshot, 0, sizeof(snapshot));
+    has_saved = false;
+    return rtcmem_write(RTCMEM_SLOT_SNAPSHOT, &snapshot, sizeof(snapshot));
+}
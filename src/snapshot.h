@@ -0,0 +1,59 @@
+/*
+ *  Module: Snapshot
+ *
+ *  A compact, versioned and CRC checked copy of the Alert Manager
+ *  state.  Kept in RTC memory so that a pendant which resets
+ *  mid-alert can resume without waiting on the network.
+ *
+ *  Author: Alex Dale @superoxigen
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for information.
+ */
+
+#ifndef _SNAPSHOT_H_
+#define _SNAPSHOT_H_
+
+#include "uuid.h"
+#include "utils.h"
+
+#define SNAPSHOT_MAGIC      0x50534E41  /* "ANSP" */
+#define SNAPSHOT_VERSION    2
+
+START_C_SECTION
+
+typedef struct {
+    /* Header */
+    uint32_t magic;
+    uint8_t version;
+
+    /* Alert Manager state */
+    uint8_t mode;
+    uint8_t enabled_mode;
+    uint8_t enabled_active_mode;
+    uint8_t stored_mode;
+    uint8_t stored_enabled_mode;
+    uint8_t stored_enabled_active_mode;
+
+    /* Retry counter of the pending help request. */
+    uint8_t send_attempts;
+
+    /* Pending request ID, in binary since version 2 */
+    uuid_t request_id;
+    uint8_t reserved[4];
+
+    /* CRC-32 of all of the above. */
+    uint32_t crc;
+} snapshot_t;
+
+void snapshot_init(snapshot_t * snapshot);
+void snapshot_seal(snapshot_t * snapshot);
+bool_t snapshot_is_valid(snapshot_t const * snapshot);
+
+bool_t snapshot_save(snapshot_t * snapshot);
+bool_t snapshot_load(snapshot_t * snapshot);
+bool_t snapshot_clear(void);
+
+END_C_SECTION
+
+#endif /* _SNAPSHOT_H_ */
@@ -0,0 +1,838 @@
+/*
+ *  Module: Stand-in Server
+ *
+ *  A stand-in for the platform, on the host, to answer and time the
+ *  pendant's requests.
+ *
+ *  Author: Alex Dale @superoxigen
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for information.
+ */
+
+#ifndef ARDUINO
+
+/* Standard Library */
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/* Project Library */
+#include "bufstr.hpp"
+#include "clock.h"
+#include "dlog.h"
+#include "hwrng.h"
+#include "smlstr.h"
+#include "telemetry.h"
+#include "uuid.h"
+#include "wiremsg.h"
+
+/* Self Header */
+#include "standin.hpp"
+
+#define STANDIN_EVENTS          64
+#define STANDIN_SEND_WAIT_MS    1000
+
+static kstring_t kHelpPath = "/patient/request1";
+static kstring_t kCancelPath = "/patient/request/cancel";
+static kstring_t kTestPath = "/patient/test";
+static kstring_t kHeartbeatPath = "/patient/heartbeat";
+
+static kstring_t kDeviceKey = "device_id";
+static kstring_t kIssueKey = "issue_id";
+
+static kstring_t kJsonType = "application/json";
+
+/* Where a worker's answers are written to. */
+typedef struct {
+    int fd;
+    uint64_t * bytes;
+} standin_flush_t;
+
+static kstring_t reason(uint16_t code)
+{
+    switch (code)
+    {
+        case HTTP_CODE_OK:
+            return "OK";
+        case HTTP_CODE_CREATED:
+            return "Created";
+        case HTTP_CODE_BAD_REQUEST:
+            return "Bad Request";
+        case HTTP_CODE_NOT_FOUND:
+            return "Not Found";
+        case HTTP_CODE_METHOD_NOT_ALLOWED:
+            return "Method Not Allowed";
+        case HTTP_CODE_UNSUPPORTED_MEDIA_TYPE:
+            return "Unsupported Media Type";
+        default:
+            return "Unknown";
+    }
+}
+
+/* Writes all of the data, waiting while the socket is full. */
+static bool_t send_all(void * context, byte_t const * data, uint16_t length)
+{
+    standin_flush_t * flush = (standin_flush_t *) context;
+    struct pollfd pfd;
+    ssize_t n;
+
+    while (length)
+    {
+        n = send(flush->fd, data, length, MSG_NOSIGNAL);
+        if (n > 0)
+        {
+            data += n;
+            length -= (uint16_t) n;
+            *flush->bytes += (uint64_t) n;
+            continue;
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            pfd.fd = flush->fd;
+            pfd.events = POLLOUT;
+            if (poll(&pfd, 1, STANDIN_SEND_WAIT_MS) > 0) continue;
+        }
+        return false;
+    }
+    return true;
+}
+
+static bool_t equals(char_t const * data, uint16_t length, kstring_t str)
+{
+    return length == strlen(str) && !memcmp(data, str, length);
+}
+
+static bool_t is_zero(byte_t const * data, uint16_t length)
+{
+    while (length--)
+    {
+        if (*data++) return false;
+    }
+    return true;
+}
+
+/* The value of the key in a form, or query, if it has one. */
+static bool_t find_param(char_t const * data, uint32_t length, kstring_t key,
+    char_t const ** value, uint16_t * value_length)
+{
+    char_t const * end = data + length;
+    char_t const * pair;
+    char_t const * equal;
+
+    while (data < end)
+    {
+        pair = data;
+        while (data < end && *data != '&') data++;
+        equal = (char_t const *) memchr(pair, '=', data - pair);
+        if (equal && equals(pair, equal - pair, key) && data - equal - 1 <= UINT16_MAX)
+        {
+            *value = equal + 1;
+            *value_length = (uint16_t) (data - equal - 1);
+            return true;
+        }
+        data++;
+    }
+    return false;
+}
+
+/* The ID in the form or query, decoded and in binary, if it has a valid one. */
+static bool_t find_uuid(char_t const * data, uint32_t length, kstring_t key, byte_t * binary)
+{
+    char_t uuid[UUID_BUFFER_LENGTH];
+    char_t const * value;
+    uint16_t value_length;
+
+    if (!find_param(data, length, key, &value, &value_length)
+        || smlurldec(uuid, value, value_length, SMLURL_FORM, sizeof(uuid)) != UUID_BUFFER_LENGTH - 1)
+    {
+        return false;
+    }
+    return uuid_to_binary(uuid, binary);
+}
+
+/* Whether the header value has the media type, in any case. */
+static bool_t has_type(char_t const * value, uint16_t length, kstring_t type)
+{
+    uint16_t type_length = strlen(type);
+    uint16_t i;
+
+    for (i = 0; i + type_length <= length; i++)
+    {
+        if (!strncasecmp(&value[i], type, type_length)) return true;
+    }
+    return false;
+}
+
+StandinServer::StandinServer():
+    _listen_fd(-1),
+    _stop_fd(-1),
+    _port(0),
+    _threads(0)
+{
+    memset(&_config, 0, sizeof(_config));
+    memset(_workers, 0, sizeof(_workers));
+}
+
+StandinServer::~StandinServer()
+{
+    stop();
+}
+
+/* Listens on the port and starts the workers. */
+bool_t StandinServer::start(standin_config_t const * config)
+{
+    struct sockaddr_in addr;
+    struct epoll_event event;
+    socklen_t length;
+    worker_t * worker;
+    int on = 1;
+    uint8_t i;
+
+    if (!config || !config->threads || config->threads > STANDIN_THREADS_MAX || _threads)
+    {
+        return false;
+    }
+    _config = *config;
+
+    _listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    _stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (_listen_fd < 0 || _stop_fd < 0)
+    {
+        DLOG_ERR("Failed to open stand-in sockets");
+        stop();
+        return false;
+    }
+    setsockopt(_listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(config->port);
+    length = sizeof(addr);
+    if (bind(_listen_fd, (struct sockaddr *) &addr, sizeof(addr)) < 0
+        || listen(_listen_fd, SOMAXCONN) < 0
+        || getsockname(_listen_fd, (struct sockaddr *) &addr, &length) < 0)
+    {
+        DLOG_ERR("Failed to listen for stand-in");
+        stop();
+        return false;
+    }
+    _port = ntohs(addr.sin_port);
+
+    for (i = 0; i < config->threads; i++)
+    {
+        worker = &_workers[i];
+        memset(worker, 0, sizeof(*worker));
+        worker->server = this;
+        worker->running = true;
+        hwrng_fill((byte_t *) &worker->random, sizeof(worker->random));
+        worker->random |= 1;
+
+        worker->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (worker->epoll_fd < 0) break;
+
+        /* Only one worker is woken for each connection. */
+        event.events = EPOLLIN | EPOLLEXCLUSIVE;
+        event.data.ptr = &_listen_fd;
+        if (epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, _listen_fd, &event) < 0) break;
+        event.events = EPOLLIN;
+        event.data.ptr = &_stop_fd;
+        if (epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, _stop_fd, &event) < 0) break;
+
+        if (pthread_create(&worker->thread, NULL, run, worker)) break;
+        _threads++;
+    }
+    if (_threads < config->threads)
+    {
+        if (_workers[_threads].epoll_fd > 0)
+        {
+            close(_workers[_threads].epoll_fd);
+        }
+        DLOG_ERR("Failed to start stand-in workers");
+        stop();
+        return false;
+    }
+
+    DLOG("Stand-in server started");
+    return true;
+}
+
+/* Stops the workers, which close their connections. */
+void StandinServer::stop(void)
+{
+    uint64_t one = 1;
+    uint8_t i;
+
+    if (_threads && write(_stop_fd, &one, sizeof(one)) == sizeof(one))
+    {
+        for (i = 0; i < _threads; i++)
+        {
+            pthread_join(_workers[i].thread, NULL);
+        }
+    }
+    _threads = 0;
+
+    if (_listen_fd >= 0) close(_listen_fd);
+    if (_stop_fd >= 0) close(_stop_fd);
+    _listen_fd = -1;
+    _stop_fd = -1;
+}
+
+/* The port listened on, once started. */
+uint16_t StandinServer::port(void) const
+{
+    return _port;
+}
+
+/*
+ *  The workers' counts, summed.  They are only settled once it has
+ *  stopped; while it runs they are read as they are.
+ */
+void StandinServer::read_stats(standin_stats_t * stats) const
+{
+    standin_stats_t const * own;
+    uint16_t i, j;
+
+    if (!stats) return;
+    memset(stats, 0, sizeof(*stats));
+
+    for (i = 0; i < _config.threads; i++)
+    {
+        own = &_workers[i].stats;
+        for (j = 0; j < STANDIN_ROUTES; j++)
+        {
+            stats->requests[j] += own->requests[j];
+        }
+        stats->issued += own->issued;
+        stats->binary += own->binary;
+        stats->bad_requests += own->bad_requests;
+        stats->connections += own->connections;
+        stats->bytes_in += own->bytes_in;
+        stats->bytes_out += own->bytes_out;
+        for (j = 0; j < STANDIN_LATENCY_BUCKETS; j++)
+        {
+            stats->latency[j] += own->latency[j];
+        }
+    }
+}
+
+uint8_t StandinServer::latency_bucket(uint32_t latency_us)
+{
+    uint8_t exponent;
+
+    if (latency_us < STANDIN_LATENCY_SPLIT) return (uint8_t) latency_us;
+
+    exponent = 31 - __builtin_clz(latency_us);
+    return (uint8_t) ((exponent - 2) * STANDIN_LATENCY_SPLIT
+        + ((latency_us >> (exponent - 3)) & (STANDIN_LATENCY_SPLIT - 1)));
+}
+
+/* The least latency in the bucket. */
+uint32_t StandinServer::latency_floor(uint8_t bucket)
+{
+    uint8_t exponent;
+
+    if (bucket < STANDIN_LATENCY_SPLIT) return bucket;
+
+    exponent = bucket / STANDIN_LATENCY_SPLIT + 2;
+    return (uint32_t) (STANDIN_LATENCY_SPLIT + bucket % STANDIN_LATENCY_SPLIT) << (exponent - 3);
+}
+
+/* The latency which the permille of requests took no longer than, to within its bucket. */
+uint32_t StandinServer::percentile_us(standin_stats_t const * stats, uint16_t permille)
+{
+    uint64_t total, target, seen;
+    uint16_t i;
+
+    total = 0;
+    for (i = 0; i < STANDIN_LATENCY_BUCKETS; i++)
+    {
+        total += stats->latency[i];
+    }
+    if (!total) return 0;
+
+    target = (total * permille + 999) / 1000;
+    seen = 0;
+    for (i = 0; i < STANDIN_LATENCY_BUCKETS; i++)
+    {
+        seen += stats->latency[i];
+        if (seen >= target && seen) break;
+    }
+    return latency_floor((uint8_t) i);
+}
+
+void * StandinServer::run(void * context)
+{
+    worker_t * worker = (worker_t *) context;
+    StandinServer * server = worker->server;
+    struct epoll_event events[STANDIN_EVENTS];
+    connection_t * conn;
+    int n, i;
+
+    while (worker->running)
+    {
+        n = epoll_wait(worker->epoll_fd, events, STANDIN_EVENTS, -1);
+        for (i = 0; i < n; i++)
+        {
+            if (events[i].data.ptr == &server->_stop_fd)
+            {
+                worker->running = false;
+            }
+            else if (events[i].data.ptr == &server->_listen_fd)
+            {
+                server->accept_connection(worker);
+            }
+            else
+            {
+                server->serve(worker, (connection_t *) events[i].data.ptr);
+            }
+        }
+        if (n < 0 && errno != EINTR)
+        {
+            DLOG_ERR("Stand-in worker failed to wait");
+            break;
+        }
+    }
+
+    while ((conn = worker->connections))
+    {
+        server->close_connection(worker, conn);
+    }
+    close(worker->epoll_fd);
+    return NULL;
+}
+
+/*
+ *  Takes one connection.  The socket stays readable while more wait,
+ *  so the rest go to whichever workers are woken for them.
+ */
+void StandinServer::accept_connection(worker_t * worker)
+{
+    struct epoll_event event;
+    connection_t * conn;
+    int fd, on = 1;
+
+    fd = accept4(_listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) return;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+    conn = new connection_t;
+    conn->fd = fd;
+    conn->length = 0;
+    conn->prev = NULL;
+    conn->next = worker->connections;
+    if (conn->next)
+    {
+        conn->next->prev = conn;
+    }
+    worker->connections = conn;
+    worker->stats.connections++;
+
+    event.events = EPOLLIN | EPOLLRDHUP;
+    event.data.ptr = conn;
+    if (epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0)
+    {
+        close_connection(worker, conn);
+    }
+}
+
+void StandinServer::close_connection(worker_t * worker, connection_t * conn)
+{
+    if (conn->prev)
+    {
+        conn->prev->next = conn->next;
+    }
+    else
+    {
+        worker->connections = conn->next;
+    }
+    if (conn->next)
+    {
+        conn->next->prev = conn->prev;
+    }
+    close(conn->fd);
+    delete conn;
+}
+
+/*
+ *  Reads what has arrived and answers every request it completes,
+ *  with one write.  Each is timed from the read to the write.
+ */
+void StandinServer::serve(worker_t * worker, connection_t * conn)
+{
+    byte_t out[STANDIN_BUFFER_LENGTH];
+    httpwire_writer_t writer;
+    standin_flush_t flush;
+    request_t request;
+    time_us_t read_at;
+    uint32_t latency;
+    uint16_t offset, answered;
+    int32_t used;
+    bool_t closing;
+    ssize_t n;
+
+    n = recv(conn->fd, &conn->buffer[conn->length], STANDIN_BUFFER_LENGTH - conn->length, 0);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) return;
+    if (n <= 0)
+    {
+        close_connection(worker, conn);
+        return;
+    }
+    read_at = clock_micros();
+    conn->length += (uint16_t) n;
+    worker->stats.bytes_in += (uint64_t) n;
+
+    flush.fd = conn->fd;
+    flush.bytes = &worker->stats.bytes_out;
+    httpwire_writer_init(&writer, out, sizeof(out), send_all, &flush);
+
+    offset = 0;
+    answered = 0;
+    closing = false;
+    while (offset < conn->length && !closing)
+    {
+        used = parse(&conn->buffer[offset], conn->length - offset, &request);
+        if (!used && !offset && conn->length == STANDIN_BUFFER_LENGTH)
+        {
+            used = -1;
+        }
+        if (!used) break;
+
+        if (used < 0)
+        {
+            worker->stats.bad_requests++;
+            httpwire_write_str(&writer, "HTTP/1.1 400 Bad Request\r\n");
+            httpwire_write_header(&writer, "Content-Length", "0");
+            httpwire_write_header(&writer, "Connection", "close");
+            httpwire_write_end(&writer);
+            closing = true;
+            break;
+        }
+
+        answer(worker, &request, &writer);
+        answered++;
+        offset += (uint16_t) used;
+        closing = request.close;
+    }
+
+    if (!httpwire_writer_flush(&writer))
+    {
+        closing = true;
+    }
+    latency = clock_micros() - read_at;
+    worker->stats.latency[latency_bucket(latency)] += answered;
+
+    if (closing)
+    {
+        close_connection(worker, conn);
+        return;
+    }
+    conn->length -= offset;
+    memmove(conn->buffer, &conn->buffer[offset], conn->length);
+}
+
+/*
+ *  Parses the request at the start of the data.  Returns its length,
+ *  0 if it is not all there yet, or -1 if it is malformed.
+ */
+int32_t StandinServer::parse(byte_t const * data, uint16_t length, request_t * request)
+{
+    char_t const * text = (char_t const *) data;
+    char_t const * end;
+    char_t const * line;
+    char_t const * eol;
+    char_t const * colon;
+    char_t const * value;
+    char_t const * target;
+    uint16_t name_length, value_length, i;
+    uint32_t content_length, header_length;
+
+    end = (char_t const *) memmem(text, length, "\r\n\r\n", 4);
+    if (!end) return 0;
+    header_length = (uint32_t) (end - text) + 4;
+
+    memset(request, 0, sizeof(*request));
+
+    /* Request line */
+    eol = (char_t const *) memmem(text, header_length, "\r\n", 2);
+    if (eol - text > 5 && !memcmp(text, "POST ", 5))
+    {
+        request->is_post = true;
+        target = text + 5;
+    }
+    else if (eol - text > 4 && !memcmp(text, "GET ", 4))
+    {
+        target = text + 4;
+    }
+    else
+    {
+        return -1;
+    }
+    line = (char_t const *) memchr(target, ' ', eol - target);
+    if (!line || eol - line != 9 || memcmp(line, " HTTP/1.", 8)) return -1;
+    request->close = line[8] == '0';
+
+    request->path = target;
+    value = (char_t const *) memchr(target, '?', line - target);
+    request->path_length = (uint16_t) ((value ? value : line) - target);
+    if (value)
+    {
+        request->query = value + 1;
+        request->query_length = (uint16_t) (line - value - 1);
+    }
+
+    /* Headers */
+    content_length = 0;
+    for (line = eol + 2; line < end + 2; line = eol + 2)
+    {
+        eol = (char_t const *) memmem(line, end + 2 - line, "\r\n", 2);
+        colon = (char_t const *) memchr(line, ':', eol - line);
+        if (!colon) return -1;
+
+        name_length = (uint16_t) (colon - line);
+        for (value = colon + 1; value < eol && *value == ' '; value++) {}
+        value_length = (uint16_t) (eol - value);
+
+        if (name_length == 14 && !strncasecmp(line, "Content-Length", 14))
+        {
+            if (!value_length || value_length > 5) return -1;
+            for (i = 0; i < value_length; i++)
+            {
+                if (value[i] < '0' || value[i] > '9') return -1;
+                content_length = content_length * 10 + (value[i] - '0');
+            }
+        }
+        else if (name_length == 12 && !strncasecmp(line, "Content-Type", 12))
+        {
+            request->binary = has_type(value, value_length, kWiremsgMediaType);
+        }
+        else if (name_length == 6 && !strncasecmp(line, "Accept", 6))
+        {
+            request->accepts_binary = has_type(value, value_length, kWiremsgMediaType);
+        }
+        else if (name_length == 10 && !strncasecmp(line, "Connection", 10))
+        {
+            request->close = has_type(value, value_length, "close");
+        }
+        else if (name_length == 17 && !strncasecmp(line, "Transfer-Encoding", 17))
+        {
+            /* The device never sends a body in chunks. */
+            return -1;
+        }
+    }
+
+    if (header_length + content_length > STANDIN_BUFFER_LENGTH) return -1;
+    if (header_length + content_length > length) return 0;
+
+    request->body = &data[header_length];
+    request->body_length = content_length;
+    return (int32_t) (header_length + content_length);
+}
+
+/* Routes the request and writes its answer. */
+void StandinServer::answer(worker_t * worker, request_t const * request, httpwire_writer_t * writer)
+{
+    byte_t device_id[UUID_BINARY_LENGTH];
+    standin_route_t route;
+    reply_t reply;
+
+    if (equals(request->path, request->path_length, kHelpPath))
+    {
+        route = STANDIN_HELP;
+    }
+    else if (equals(request->path, request->path_length, kCancelPath))
+    {
+        route = STANDIN_CANCEL;
+    }
+    else if (equals(request->path, request->path_length, kTestPath))
+    {
+        route = STANDIN_TEST;
+    }
+    else if (equals(request->path, request->path_length, kHeartbeatPath))
+    {
+        route = STANDIN_HEARTBEAT;
+    }
+    else
+    {
+        route = STANDIN_OTHER;
+    }
+
+    worker->stats.requests[route]++;
+    if (request->binary)
+    {
+        worker->stats.binary++;
+    }
+    if (_config.delay_us)
+    {
+        usleep(_config.delay_us);
+    }
+
+    memset(&reply, 0, sizeof(reply));
+    reply.code = HTTP_CODE_OK;
+    if (route == STANDIN_OTHER)
+    {
+        reply.code = HTTP_CODE_NOT_FOUND;
+    }
+    else if (request->is_post != (route != STANDIN_TEST))
+    {
+        reply.code = HTTP_CODE_METHOD_NOT_ALLOWED;
+    }
+    else if (request->binary && !_config.binary)
+    {
+        reply.code = HTTP_CODE_UNSUPPORTED_MEDIA_TYPE;
+    }
+    else if (route == STANDIN_HELP)
+    {
+        help(worker, request, &reply);
+    }
+    else if (route == STANDIN_CANCEL)
+    {
+        cancel(worker, request, &reply);
+    }
+    else if (route == STANDIN_HEARTBEAT)
+    {
+        heartbeat(worker, request, &reply);
+    }
+    else if (!find_uuid(request->query, request->query_length, kDeviceKey, device_id))
+    {
+        reply.code = HTTP_CODE_BAD_REQUEST;
+    }
+
+    if (reply.code == HTTP_CODE_BAD_REQUEST)
+    {
+        worker->stats.bad_requests++;
+    }
+
+    httpwire_write_str(writer, "HTTP/1.1 ");
+    httpwire_write_uint(writer, reply.code);
+    httpwire_write_char(writer, ' ');
+    httpwire_write_str(writer, reason(reply.code));
+    httpwire_write_end(writer);
+    httpwire_write_str(writer, "Content-Length: ");
+    httpwire_write_uint(writer, reply.length);
+    httpwire_write_end(writer);
+    if (reply.type)
+    {
+        httpwire_write_header(writer, "Content-Type", reply.type);
+    }
+    if (request->close)
+    {
+        httpwire_write_header(writer, "Connection", "close");
+    }
+    httpwire_write_end(writer);
+    httpwire_write(writer, reply.body, reply.length);
+}
+
+/*
+ *  Raises the issue, under the request's own ID if it has one, and
+ *  replies with it in binary if that is accepted.
+ */
+void StandinServer::help(worker_t * worker, request_t const * request, reply_t * reply)
+{
+    byte_t device_id[UUID_BINARY_LENGTH];
+    char_t const * form = (char_t const *) request->body;
+    char_t const * value;
+    uint16_t value_length;
+    wiremsg_t msg;
+
+    memset(&msg, 0, sizeof(msg));
+    if (request->binary)
+    {
+        if (!wiremsg_decode(&msg, request->body, request->body_length) || msg.type != WIREMSG_HELP)
+        {
+            reply->code = HTTP_CODE_BAD_REQUEST;
+            return;
+        }
+    }
+    else if (!find_uuid(form, request->body_length, kDeviceKey, device_id)
+        || (find_param(form, request->body_length, kIssueKey, &value, &value_length)
+            && !find_uuid(form, request->body_length, kIssueKey, msg.issue_id)))
+    {
+        reply->code = HTTP_CODE_BAD_REQUEST;
+        return;
+    }
+
+    if (is_zero(msg.issue_id, UUID_BINARY_LENGTH))
+    {
+        issue(worker, msg.issue_id);
+        worker->stats.issued++;
+    }
+
+    reply->code = HTTP_CODE_CREATED;
+    if (request->accepts_binary && _config.binary)
+    {
+        msg.type = WIREMSG_HELP_REPLY;
+        reply->type = kWiremsgMediaType;
+        reply->length = wiremsg_encode(&msg, reply->body, sizeof(reply->body));
+        return;
+    }
+
+    BufStr json((char_t *) reply->body, sizeof(reply->body));
+    json.push_str("{\"");
+    json.push_escaped(kIssueKey);
+    json.push_str("\":\"");
+    json.push_uuid(msg.issue_id);
+    json.push_str("\"}");
+    reply->type = kJsonType;
+    reply->length = json.length();
+}
+
+void StandinServer::cancel(worker_t * worker, request_t const * request, reply_t * reply)
+{
+    char_t const * form = (char_t const *) request->body;
+    byte_t id[UUID_BINARY_LENGTH];
+    wiremsg_t msg;
+
+    if (request->binary
+        ? !wiremsg_decode(&msg, request->body, request->body_length) || msg.type != WIREMSG_CANCEL
+        : !find_uuid(form, request->body_length, kDeviceKey, id)
+            || !find_uuid(form, request->body_length, kIssueKey, id))
+    {
+        reply->code = HTTP_CODE_BAD_REQUEST;
+    }
+}
+
+/* Takes the heartbeat if it has the header of one, see telemetry.h. */
+void StandinServer::heartbeat(worker_t * worker, request_t const * request, reply_t * reply)
+{
+    if (!request->binary
+        || request->body_length < TELEMETRY_HEADER_LENGTH
+        || request->body[0] != WIREMSG_VERSION
+        || request->body[1] != WIREMSG_HEARTBEAT)
+    {
+        reply->code = HTTP_CODE_BAD_REQUEST;
+    }
+}
+
+/*
+ *  A random, version 4 UUID.  Drawn from the worker's own generator,
+ *  seeded from hwrng, rather than hwrng_uuid(), which reads the
+ *  system's on each call.
+ */
+void StandinServer::issue(worker_t * worker, byte_t * issue_id)
+{
+    uint64_t word;
+    uint8_t i;
+
+    for (i = 0; i < UUID_BINARY_LENGTH; i += sizeof(word))
+    {
+        worker->random ^= worker->random >> 12;
+        worker->random ^= worker->random << 25;
+        worker->random ^= worker->random >> 27;
+        word = worker->random * 0x2545F4914F6CDD1DULL;
+        memcpy(&issue_id[i], &word, sizeof(word));
+    }
+    issue_id[6] = (issue_id[6] & 0x0F) | 0x40;
+    issue_id[8] = (issue_id[8] & 0x3F) | 0x80;
+}
+
+#endif /* ARDUINO */
@@ -0,0 +1,156 @@
+/*
+ *  Module: Stand-in Server
+ *
+ *  A stand-in for the platform, on the host, so the pendant's
+ *  requests can be answered, timed and loaded with no outside
+ *  services.  It answers what the device sends:
+ *
+ *      POST /patient/request1          raises an issue, 201
+ *      POST /patient/request/cancel    200
+ *      GET  /patient/test              200
+ *      POST /patient/heartbeat         200
+ *
+ *  in the form or binary encoding, see wiremsg.h, and replies to a
+ *  help request in binary if it is accepted, JSON otherwise.  The
+ *  issue ID of a help request is kept, as the platform does; one
+ *  without is issued a new, random one.  Anything else is 404.
+ *
+ *  Each worker thread has its own epoll set, which holds the shared
+ *  listening socket, exclusively, and the connections it accepted.
+ *  Connections are kept alive, and pipelined requests are answered
+ *  with one write.  Each worker keeps its own counts, and a histogram
+ *  of how long each request took, from the read that completed it to
+ *  its answer being written, so nothing is shared while it runs.
+ *
+ *  Author: Alex Dale @superoxigen
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for information.
+ */
+
+#ifndef _STANDIN_HPP_
+#define _STANDIN_HPP_
+
+#ifndef ARDUINO
+
+#include <pthread.h>
+
+#include "httpwire.h"
+#include "utils.h"
+
+#define STANDIN_THREADS_MAX         16
+#define STANDIN_BUFFER_LENGTH       4096
+
+/*
+ *  Latencies are binned by their power of two in microseconds, each
+ *  split into 8, so a bin is within an eighth of its value.
+ */
+#define STANDIN_LATENCY_SPLIT       8
+#define STANDIN_LATENCY_BUCKETS     256
+
+typedef enum {
+    STANDIN_HELP,
+    STANDIN_CANCEL,
+    STANDIN_TEST,
+    STANDIN_HEARTBEAT,
+    STANDIN_OTHER,
+    STANDIN_ROUTES
+} standin_route_t;
+
+typedef struct {
+    uint16_t port;          /* 0 for any free one, see port() */
+    uint8_t threads;
+    uint32_t delay_us;      /* Taken over each request, as the platform's own work */
+    bool_t binary;          /* If not, binary requests are refused with 415 */
+} standin_config_t;
+
+typedef struct {
+    uint64_t requests[STANDIN_ROUTES];
+    uint64_t issued;        /* Issue IDs made, rather than kept from the request */
+    uint64_t binary;        /* Requests in the binary encoding */
+    uint64_t bad_requests;
+    uint64_t connections;
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+    uint64_t latency[STANDIN_LATENCY_BUCKETS];
+} standin_stats_t;
+
+class StandinServer {
+    typedef struct connection {
+        int fd;
+        uint16_t length;
+        byte_t buffer[STANDIN_BUFFER_LENGTH];
+        struct connection * next;
+        struct connection * prev;
+    } connection_t;
+
+    typedef struct {
+        StandinServer * server;
+        pthread_t thread;
+        int epoll_fd;
+        bool_t running;
+        uint64_t random;
+        connection_t * connections;
+        standin_stats_t stats;
+    } worker_t;
+
+    /* A parsed request, pointing into its connection's buffer. */
+    typedef struct {
+        bool_t is_post;
+        char_t const * path;
+        uint16_t path_length;
+        char_t const * query;
+        uint16_t query_length;
+        bool_t binary;          /* The body is a binary message */
+        bool_t accepts_binary;
+        bool_t close;
+        byte_t const * body;
+        uint32_t body_length;
+    } request_t;
+
+    typedef struct {
+        uint16_t code;
+        kstring_t type;
+        byte_t body[64];
+        uint16_t length;
+    } reply_t;
+
+    standin_config_t _config;
+    int _listen_fd;
+    int _stop_fd;
+    uint16_t _port;
+    uint8_t _threads;
+    worker_t _workers[STANDIN_THREADS_MAX];
+
+public:
+    StandinServer();
+    ~StandinServer();
+
+    bool_t start(standin_config_t const * config);
+    void stop(void);
+    uint16_t port(void) const;
+
+    void read_stats(standin_stats_t * stats) const;
+    static uint8_t latency_bucket(uint32_t latency_us);
+    static uint32_t latency_floor(uint8_t bucket);
+    static uint32_t percentile_us(standin_stats_t const * stats, uint16_t permille);
+
+private:
+    static void * run(void * context);
+    void accept_connection(worker_t * worker);
+    void close_connection(worker_t * worker, connection_t * conn);
+    void serve(worker_t * worker, connection_t * conn);
+    static int32_t parse(byte_t const * data, uint16_t length, request_t * request);
+    void answer(worker_t * worker, request_t const * request, httpwire_writer_t * writer);
+    void help(worker_t * worker, request_t const * request, reply_t * reply);
+    void cancel(worker_t * worker, request_t const * request, reply_t * reply);
+    void heartbeat(worker_t * worker, request_t const * request, reply_t * reply);
+    void issue(worker_t * worker, byte_t * issue_id);
+
+    StandinServer(StandinServer const &);
+    StandinServer & operator=(StandinServer const &);
+};
+
+#endif /* ARDUINO */
+
+#endif /* _STANDIN_HPP_ */
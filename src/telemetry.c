@@ -0,0 +1,190 @@
+/*
+ *  Module: Telemetry
+ *
+ *  The pendant's health between heartbeats, in fixed buffers, and
+ *  its encoding for upload.
+ *
+ *  Author: Alex Dale @superoxigen
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for information.
+ */
+
+#include <string.h>
+
+#include "wiremsg.h"
+#include "telemetry.h"
+
+static uint16_t saturate16(uint32_t value)
+{
+    return (value > UINT16_MAX) ? UINT16_MAX : (uint16_t) value;
+}
+
+static uint16_t add16(uint16_t count, uint16_t more)
+{
+    return saturate16((uint32_t) count + more);
+}
+
+static uint16_t sub16(uint16_t count, uint16_t less)
+{
+    return (count > less) ? (uint16_t) (count - less) : 0;
+}
+
+static byte_t * put16(byte_t * ptr, uint16_t value)
+{
+    *ptr++ = (byte_t) (value >> 8);
+    *ptr++ = (byte_t) value;
+    return ptr;
+}
+
+static byte_t * put32(byte_t * ptr, uint32_t value)
+{
+    ptr = put16(ptr, (uint16_t) (value >> 16));
+    return put16(ptr, (uint16_t) value);
+}
+
+void telemetry_init(telemetry_t * telemetry)
+{
+    if (!telemetry) return;
+    memset(telemetry, 0, sizeof(telemetry_t));
+}
+
+/* Takes a sample, over the oldest if the ring is full. */
+void telemetry_sample(
+    telemetry_t * telemetry, uint32_t uptime_s, int8_t rssi, uint32_t free_heap,
+    scheduler_stats_t const * stats)
+{
+    telemetry_sample_t * sample;
+
+    if (!telemetry) return;
+
+    sample = &telemetry->samples[telemetry->head];
+    sample->uptime_s = uptime_s;
+    sample->rssi = rssi;
+    sample->free_heap = saturate16(free_heap);
+    sample->tasks_run = stats ? saturate16(stats->tasks_run) : 0;
+    sample->longest_task_ms = stats ? saturate16((stats->longest_task_us + 999) / 1000) : 0;
+    sample->tasks_failed = (!stats) ? 0
+        : (stats->tasks_failed > UINT8_MAX) ? UINT8_MAX : (uint8_t) stats->tasks_failed;
+
+    telemetry->head = (uint8_t) ((telemetry->head + 1) % TELEMETRY_SAMPLES);
+    telemetry->taken++;
+    if (telemetry->count < TELEMETRY_SAMPLES)
+    {
+        telemetry->count++;
+    }
+    else
+    {
+        telemetry->dropped = add16(telemetry->dropped, 1);
+    }
+}
+
+/* The histogram bucket of an alert's latency. */
+uint8_t telemetry_bucket(uint32_t latency_ms)
+{
+    uint32_t bound;
+    uint8_t bucket;
+
+    bound = TELEMETRY_BUCKET_MIN_MS;
+    for (bucket = 0; bucket < TELEMETRY_BUCKETS - 1; bucket++)
+    {
+        if (latency_ms < bound) break;
+        bound <<= 1;
+    }
+    return bucket;
+}
+
+/* Counts an alert, and how long it took if it was delivered. */
+void telemetry_alert(telemetry_t * telemetry, uint32_t latency_ms, bool_t delivered)
+{
+    uint8_t bucket;
+
+    if (!telemetry) return;
+
+    if (!delivered)
+    {
+        telemetry->failed_alerts = add16(telemetry->failed_alerts, 1);
+        return;
+    }
+    telemetry->alerts = add16(telemetry->alerts, 1);
+    bucket = telemetry_bucket(latency_ms);
+    telemetry->latency[bucket] = add16(telemetry->latency[bucket], 1);
+}
+
+/*
+ *  Encodes a heartbeat of all there is, and marks what it carried.
+ *  Returns its length, or 0 if it does not fit.
+ */
+uint16_t telemetry_encode(
+    telemetry_t const * telemetry, byte_t const * device_id, uint32_t uptime_s,
+    byte_t * buffer, uint16_t size, telemetry_mark_t * mark)
+{
+    telemetry_sample_t const * sample;
+    uint16_t length;
+    uint8_t i, index;
+    byte_t * ptr;
+
+    if (!telemetry || !device_id || !buffer || !mark) return 0;
+    length = TELEMETRY_HEADER_LENGTH + (telemetry->count * TELEMETRY_SAMPLE_LENGTH);
+    if (length > size) return 0;
+
+    ptr = buffer;
+    *ptr++ = WIREMSG_VERSION;
+    *ptr++ = WIREMSG_HEARTBEAT;
+    memcpy(ptr, device_id, UUID_BINARY_LENGTH);
+    ptr += UUID_BINARY_LENGTH;
+    ptr = put32(ptr, uptime_s);
+    ptr = put16(ptr, telemetry->alerts);
+    ptr = put16(ptr, telemetry->failed_alerts);
+    for (i = 0; i < TELEMETRY_BUCKETS; i++)
+    {
+        ptr = put16(ptr, telemetry->latency[i]);
+    }
+    ptr = put16(ptr, telemetry->dropped);
+    *ptr++ = telemetry->count;
+
+    index = (uint8_t) ((telemetry->head + TELEMETRY_SAMPLES - telemetry->count) % TELEMETRY_SAMPLES);
+    for (i = 0; i < telemetry->count; i++)
+    {
+        sample = &telemetry->samples[index];
+        ptr = put16(ptr, saturate16(uptime_s - sample->uptime_s));
+        *ptr++ = (byte_t) sample->rssi;
+        ptr = put16(ptr, sample->free_heap);
+        ptr = put16(ptr, sample->tasks_run);
+        ptr = put16(ptr, sample->longest_task_ms);
+        *ptr++ = sample->tasks_failed;
+        index = (uint8_t) ((index + 1) % TELEMETRY_SAMPLES);
+    }
+
+    mark->taken = telemetry->taken;
+    mark->dropped = telemetry->dropped;
+    mark->alerts = telemetry->alerts;
+    mark->failed_alerts = telemetry->failed_alerts;
+    memcpy(mark->latency, telemetry->latency, sizeof(mark->latency));
+    return length;
+}
+
+/*
+ *  Takes out what the delivered heartbeat carried.  Samples and
+ *  alerts that came in while it was in flight are kept for the next.
+ */
+void telemetry_sent(telemetry_t * telemetry, telemetry_mark_t const * mark)
+{
+    uint16_t newer;
+    uint8_t i;
+
+    if (!telemetry || !mark) return;
+
+    newer = (uint16_t) (telemetry->taken - mark->taken);
+    if (newer < telemetry->count)
+    {
+        telemetry->count = (uint8_t) newer;
+    }
+    telemetry->dropped = sub16(telemetry->dropped, mark->dropped);
+    telemetry->alerts = sub16(telemetry->alerts, mark->alerts);
+    telemetry->failed_alerts = sub16(telemetry->failed_alerts, mark->failed_alerts);
+    for (i = 0; i < TELEMETRY_BUCKETS; i++)
+    {
+        telemetry->latency[i] = sub16(telemetry->latency[i], mark->latency[i]);
+    }
+}
@@ -0,0 +1,92 @@
+/*
+ *  Module: Telemetry
+ *
+ *  The pendant's health between heartbeats: periodic samples of its
+ *  signal, memory and scheduler, in a fixed ring that drops the
+ *  oldest when full, and a histogram of how long its alerts took to
+ *  be delivered.  All of it is uploaded in one heartbeat, so a radio
+ *  wake-up carries every metric at once.
+ *
+ *  The heartbeat is sent in the binary encoding of wiremsg.h, with
+ *  big endian fields:
+ *
+ *      version, type, device ID, uptime (s), alerts, failed alerts,
+ *      alert latency histogram (TELEMETRY_BUCKETS counts), samples
+ *      dropped, sample count, then each sample, oldest first:
+ *
+ *          age (s), RSSI (dBm), free heap, tasks run, longest
+ *          task (ms), tasks failed                     (10 bytes)
+ *
+ *  Counts saturate rather than wrap.  What was sent is only taken
+ *  out once the platform has it, see telemetry_sent().
+ *
+ *  Author: Alex Dale @superoxigen
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for information.
+ */
+
+#ifndef _TELEMETRY_H_
+#define _TELEMETRY_H_
+
+#include "scheduler.h"
+#include "uuid.h"
+#include "utils.h"
+
+#define TELEMETRY_SAMPLES           16
+
+/* Alert latencies, by powers of two from under 64 ms to 4 s and over. */
+#define TELEMETRY_BUCKETS           8
+#define TELEMETRY_BUCKET_MIN_MS     64
+
+#define TELEMETRY_HEADER_LENGTH     (2 + UUID_BINARY_LENGTH + 8 + (2 * TELEMETRY_BUCKETS) + 3)
+#define TELEMETRY_SAMPLE_LENGTH     10
+#define TELEMETRY_LENGTH_MAX \
+    (TELEMETRY_HEADER_LENGTH + (TELEMETRY_SAMPLES * TELEMETRY_SAMPLE_LENGTH))
+
+START_C_SECTION
+
+typedef struct {
+    uint32_t uptime_s;
+    int8_t rssi;
+    uint16_t free_heap;
+    uint16_t tasks_run;
+    uint16_t longest_task_ms;
+    uint8_t tasks_failed;
+} telemetry_sample_t;
+
+typedef struct {
+    telemetry_sample_t samples[TELEMETRY_SAMPLES];
+    uint8_t head;           /* Where the next sample goes */
+    uint8_t count;
+    uint16_t taken;         /* Samples ever taken, wrapping */
+    uint16_t dropped;
+    uint16_t alerts;
+    uint16_t failed_alerts;
+    uint16_t latency[TELEMETRY_BUCKETS];
+} telemetry_t;
+
+/* What a heartbeat carried, to be taken out once it is delivered. */
+typedef struct {
+    uint16_t taken;
+    uint16_t dropped;
+    uint16_t alerts;
+    uint16_t failed_alerts;
+    uint16_t latency[TELEMETRY_BUCKETS];
+} telemetry_mark_t;
+
+void telemetry_init(telemetry_t * telemetry);
+void telemetry_sample(
+    telemetry_t * telemetry, uint32_t uptime_s, int8_t rssi, uint32_t free_heap,
+    scheduler_stats_t const * stats);
+void telemetry_alert(telemetry_t * telemetry, uint32_t latency_ms, bool_t delivered);
+uint8_t telemetry_bucket(uint32_t latency_ms);
+
+uint16_t telemetry_encode(
+    telemetry_t const * telemetry, byte_t const * device_id, uint32_t uptime_s,
+    byte_t * buffer, uint16_t size, telemetry_mark_t * mark);
+void telemetry_sent(telemetry_t * telemetry, telemetry_mark_t const * mark);
+
+END_C_SECTION
+
+#endif /* _TELEMETRY_H_ */
@@ -0,0 +1,174 @@
+/*
+ *  Module: TLS Session
+ *
+ *  The parameters of the last TLS session with the platform, kept
+ *  in RTC memory so that a handshake after a reset or deep sleep
+ *  can resume it rather than do the full key exchange again.  Only
+ *  what session ID resumption needs is kept, in the same form on
+ *  the device (BearSSL) and the host (OpenSSL).
+ *
+ *  Author: Alex Dale @superoxigen
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for information.
+ */
+
+#include <stddef.h>
+#include <string.h>
+
+#include "checksum.h"
+#include "rtcmem.h"
+#include "tlssession.h"
+
+/* A session must fit inside its RTC slot, and the slots in RTC memory. */
+typedef char tlssession_size_check_t[
+    (sizeof(tlssession_t) <= RTCMEM_SLOT_TLS_SESSION_SIZE) ? 1 : -1];
+typedef char tlssession_slots_check_t[
+    (RTCMEM_SLOT_TLS_SESSION + RTCMEM_SLOT_TLS_SESSION_COUNT * RTCMEM_SLOT_TLS_SESSION_SIZE
+        <= RTCMEM_USER_SIZE) ? 1 : -1];
+
+/* FNV-1a, so a session is never offered to another server. */
+static uint32_t server_hash(kstring_t host, uint16_t port)
+{
+    uint32_t hash = 0x811C9DC5;
+
+    while (*host)
+    {
+        hash = (hash ^ (byte_t) *host++) * 0x01000193;
+    }
+    hash = (hash ^ (byte_t) (port >> 8)) * 0x01000193;
+    return (hash ^ (byte_t) port) * 0x01000193;
+}
+
+static uint32_t tlssession_crc(tlssession_t const * session)
+{
+    return checksum_crc32(session, offsetof(tlssession_t, crc));
+}
+
+static uint16_t slot_offset(uint8_t slot)
+{
+    return RTCMEM_SLOT_TLS_SESSION + slot * RTCMEM_SLOT_TLS_SESSION_SIZE;
+}
+
+/* Reads the slot, returning whether it holds a session. */
+static bool_t read_slot(uint8_t slot, tlssession_t * session)
+{
+    return rtcmem_read(slot_offset(slot), session, sizeof(tlssession_t))
+        && session->magic == TLSSESSION_MAGIC
+        && session->crc == tlssession_crc(session)
+        && session->id_length
+        && session->id_length <= TLSSESSION_ID_MAX;
+}
+
+static bool_t clear_slot(uint8_t slot)
+{
+    tlssession_t session;
+
+    /* An all zero slot never has a valid magic number. */
+    memset(&session, 0, sizeof(session));
+    return rtcmem_write(slot_offset(slot), &session, sizeof(session));
+}
+
+/* Finds the slot of the server's session, or -1 if there is none. */
+static int8_t find_slot(uint32_t hash, tlssession_t * session)
+{
+    uint8_t i;
+
+    for (i = 0; i < RTCMEM_SLOT_TLS_SESSION_COUNT; i++)
+    {
+        if (read_slot(i, session) && session->server_hash == hash) return (int8_t) i;
+    }
+    return -1;
+}
+
+/* Loads the session made with the server, if there is one. */
+bool_t tlssession_load(kstring_t host, uint16_t port, tlssession_t * session)
+{
+    if (!host || !session) return false;
+
+    if (find_slot(server_hash(host, port), session) < 0)
+    {
+        memset(session, 0, sizeof(tlssession_t));
+        return false;
+    }
+    return true;
+}
+
+/*
+ *  Saves the session over the server's last one, else in a free
+ *  slot, else over the one saved longest ago.
+ */
+bool_t tlssession_save(kstring_t host, uint16_t port, tlssession_t * session)
+{
+    tlssession_t saved;
+    uint16_t newest, oldest_serial;
+    int8_t match, empty, oldest;
+    uint8_t i;
+
+    if (!host || !session) return false;
+    if (!session->id_length || session->id_length > TLSSESSION_ID_MAX) return false;
+
+    session->magic = TLSSESSION_MAGIC;
+    session->server_hash = server_hash(host, port);
+
+    match = empty = oldest = -1;
+    newest = oldest_serial = 0;
+    for (i = 0; i < RTCMEM_SLOT_TLS_SESSION_COUNT; i++)
+    {
+        if (!read_slot(i, &saved))
+        {
+            if (empty < 0) empty = (int8_t) i;
+            continue;
+        }
+        if (saved.serial > newest) newest = saved.serial;
+
+        if (saved.server_hash == session->server_hash)
+        {
+            /* A resumed session is the same one, which is already saved. */
+            if (saved.id_length == session->id_length
+                && !memcmp(saved.id, session->id, session->id_length))
+            {
+                return true;
+            }
+            match = (int8_t) i;
+        }
+        else if (oldest < 0 || saved.serial < oldest_serial)
+        {
+            oldest = (int8_t) i;
+            oldest_serial = saved.serial;
+        }
+    }
+
+    if (match < 0)
+    {
+        match = (empty >= 0) ? empty : oldest;
+    }
+    session->serial = newest + 1;
+    session->crc = tlssession_crc(session);
+    return rtcmem_write(slot_offset((uint8_t) match), session, sizeof(tlssession_t));
+}
+
+/* Forgets the server's session, such as when it could not be trusted. */
+bool_t tlssession_forget(kstring_t host, uint16_t port)
+{
+    tlssession_t session;
+    int8_t slot;
+
+    if (!host) return false;
+
+    slot = find_slot(server_hash(host, port), &session);
+    return slot < 0 || clear_slot((uint8_t) slot);
+}
+
+/* Forgets every session. */
+bool_t tlssession_clear(void)
+{
+    bool_t cleared = true;
+    uint8_t i;
+
+    for (i = 0; i < RTCMEM_SLOT_TLS_SESSION_COUNT; i++)
+    {
+        cleared = clear_slot(i) && cleared;
+    }
+    return cleared;
+}
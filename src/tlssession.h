@@ -0,0 +1,58 @@
+/*
+ *  Module: TLS Session
+ *
+ *  The parameters of the last TLS session with each server of the
+ *  platform, such as its HTTPS hosts and the MQTT broker, kept in
+ *  RTC memory so that a handshake after a reset or deep sleep can
+ *  resume it rather than do the full key exchange again.  A server
+ *  is its name and port.  When there are more servers than slots,
+ *  the session saved longest ago gives way.  Only what session ID
+ *  resumption needs is kept, in the same form on the device
+ *  (BearSSL) and the host (OpenSSL).
+ *
+ *  Author: Alex Dale @superoxigen
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for information.
+ */
+
+#ifndef _TLSSESSION_H_
+#define _TLSSESSION_H_
+
+#include "utils.h"
+
+#define TLSSESSION_MAGIC            0x534C5441  /* "ATLS" */
+#define TLSSESSION_ID_MAX           32
+#define TLSSESSION_SECRET_LENGTH    48
+
+/* The server takes small records, see NetConn. */
+#define TLSSESSION_FLAG_SMALL_RECORDS   0x01
+
+START_C_SECTION
+
+typedef struct {
+    /* Header */
+    uint32_t magic;
+    uint32_t server_hash;   /* Of the server name and port it was made with. */
+
+    /* Session */
+    uint16_t version;
+    uint16_t cipher_suite;
+    uint8_t id_length;
+    uint8_t flags;
+    uint16_t serial;        /* Counts up with each session saved. */
+    uint8_t id[TLSSESSION_ID_MAX];
+    uint8_t master_secret[TLSSESSION_SECRET_LENGTH];
+
+    /* CRC-32 of all of the above. */
+    uint32_t crc;
+} tlssession_t;
+
+bool_t tlssession_load(kstring_t host, uint16_t port, tlssession_t * session);
+bool_t tlssession_save(kstring_t host, uint16_t port, tlssession_t * session);
+bool_t tlssession_forget(kstring_t host, uint16_t port);
+bool_t tlssession_clear(void);
+
+END_C_SECTION
+
+#endif /* _TLSSESSION_H_ */
@@ -0,0 +1,78 @@
+/*
+ *  Module: Transport
+ *
+ *  What the Dispatcher makes of a transport's results, and the
+ *  loopback transport.
+ *
+ *  Author: Alex Dale @superoxigen
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for information.
+ */
+
+#include <string.h>
+
+#include "transport.h"
+
+/* Whether the platform answered the alert, however it did. */
+bool_t transport_is_answer(transport_status_t status)
+{
+    switch (status)
+    {
+        case TRANSPORT_DELIVERED:
+        case TRANSPORT_REFUSED:
+        case TRANSPORT_RETRY:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/* Whether the host, rather than the device or its network, failed. */
+bool_t transport_host_failed(transport_status_t status)
+{
+    switch (status)
+    {
+        case TRANSPORT_TIMEOUT:
+        case TRANSPORT_SERVER_ERROR:
+        case TRANSPORT_UNREACHABLE:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/*
+ *  Loopback
+ *
+ *  Delivers every alert at once, as the issue of its own ID, without
+ *  a network.  Only one attempt is ever in flight, as it is never
+ *  hedged.
+ */
+
+static byte_t s_loopback_id[UUID_BINARY_LENGTH];
+
+static transport_handle_t loopback_start(
+    void * context, int8_t endpoint, transport_alert_t const * alert, time_ms_t deadline)
+{
+    memcpy(s_loopback_id, alert->alert_id, UUID_BINARY_LENGTH);
+    return 0;
+}
+
+static transport_status_t loopback_result(
+    void * context, transport_handle_t handle, byte_t * issue_id)
+{
+    memcpy(issue_id, s_loopback_id, UUID_BINARY_LENGTH);
+    return TRANSPORT_DELIVERED;
+}
+
+static void loopback_cancel(void * context, transport_handle_t handle) {}
+
+static transport_t const s_loopback = {
+    "loopback", 0, 0, loopback_start, loopback_result, loopback_cancel, NULL, NULL
+};
+
+transport_t const * transport_loopback(void)
+{
+    return &s_loopback;
+}
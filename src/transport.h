@@ -0,0 +1,85 @@
+/*
+ *  Module: Transport
+ *
+ *  One way of getting an alert to the platform: HTTP, UDP, MQTT, the
+ *  loopback below, or an emulated network on the host.  Each is a
+ *  table of functions over its own context, so the Dispatcher tries
+ *  them in turn, retries, fails over between endpoints and hedges
+ *  the same way for all of them.
+ *
+ *  An attempt is started, then polled for its result, so two can be
+ *  in flight at once.  A transport that can only block does all of
+ *  its work in start(), and has its result ready at the first poll.
+ *
+ *  Author: Alex Dale @superoxigen
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for information.
+ */
+
+#ifndef _TRANSPORT_H_
+#define _TRANSPORT_H_
+
+#include "uuid.h"
+#include "utils.h"
+
+/* Tried only on an alert's first call, and only once. */
+#define TRANSPORT_FAST          0x01
+/*
+ *  Goes to the endpoint it is given, which is credited with its
+ *  answer or blamed for its failure, and tried again on the next.
+ */
+#define TRANSPORT_FAILOVER      0x02
+/* A slow attempt may be copied to the next best endpoint. */
+#define TRANSPORT_HEDGED        0x04
+
+START_C_SECTION
+
+typedef enum {
+    TRANSPORT_PENDING,
+    TRANSPORT_DELIVERED,        /* The platform has it */
+    TRANSPORT_REFUSED,          /* The platform answered, but will not take it */
+    TRANSPORT_RETRY,            /* Answered, and the transport changed how it sends */
+    TRANSPORT_TIMEOUT,          /* No answer by the deadline */
+    TRANSPORT_SERVER_ERROR,     /* The host answered that it failed */
+    TRANSPORT_UNREACHABLE,      /* The host could not be reached */
+    TRANSPORT_UNAVAILABLE       /* Not sent: not configured, offline or busy */
+} transport_status_t;
+
+typedef int8_t transport_handle_t;
+
+typedef struct {
+    byte_t alert_id[UUID_BINARY_LENGTH];
+    byte_t issue_id[UUID_BINARY_LENGTH];    /* Set once it is delivered */
+} transport_alert_t;
+
+typedef struct {
+    kstring_t name;
+    uint8_t flags;
+    uint16_t timeout_ms;        /* The most an attempt takes, 0 for the whole budget */
+
+    /*
+     *  Starts an attempt at the alert, to the endpoint, to be answered
+     *  by the deadline.  Returns its handle, or -1 if it cannot.
+     */
+    transport_handle_t (*start)(
+        void * context, int8_t endpoint, transport_alert_t const * alert, time_ms_t deadline);
+    /*
+     *  TRANSPORT_PENDING while the attempt is in flight.  Otherwise
+     *  its handle is freed, and the issue ID set if it was delivered.
+     */
+    transport_status_t (*result)(void * context, transport_handle_t handle, byte_t * issue_id);
+    void (*cancel)(void * context, transport_handle_t handle);
+    /* Moves the attempts in flight on, if they need it. */
+    void (*poll)(void * context);
+    void * context;
+} transport_t;
+
+bool_t transport_is_answer(transport_status_t status);
+bool_t transport_host_failed(transport_status_t status);
+
+transport_t const * transport_loopback(void);
+
+END_C_SECTION
+
+#endif /* _TRANSPORT_H_ */
@@ -0,0 +1,274 @@
+/*
+ *  Module: UdpAlert
+ *
+ *  The fast path for a help alert: one small authenticated datagram,
+ *  sent again on an adaptive timer until the platform acknowledges
+ *  it.
+ *
+ *  Author: Alex Dale @superoxigen
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for information.
+ */
+
+/* Standard Library */
+#include <string.h>
+
+/* Project Library */
+#include "clock.h"
+#include "dlog.h"
+#include "resolver.hpp"
+
+/* Self Header */
+#include "udpalert.hpp"
+
+#define DATAGRAM_LENGTH_MAX (WIREMSG_LENGTH_MAX + SIPHASH_TAG_LENGTH)
+
+UdpAlert::UdpAlert():
+    _request_type(0),
+    _port(0),
+    _configured(false),
+    _measured(false),
+    _srtt_us(0),
+    _rttvar_us(0),
+    _rto_ms(UDPALERT_RTO_INITIAL_MS),
+    _sending(false),
+    _address(0),
+    _end(0),
+    _retransmit_at(0),
+    _backoff_ms(0),
+    _attempts(0)
+{
+    memset(_key, 0, sizeof(_key));
+    memset(_device_id, 0, sizeof(_device_id));
+    memset(_alert_id, 0, sizeof(_alert_id));
+    memset(_sent_at, 0, sizeof(_sent_at));
+    memset(&_stats, 0, sizeof(_stats));
+}
+
+/* Returns false, leaving the fast path off, if the device ID is not a UUID. */
+bool_t UdpAlert::init(
+    byte_t const * key, uint16_t port, kstring_t device_id, uint16_t request_type)
+{
+    _configured = false;
+    if (!key || !port || !uuid_to_binary(device_id, _device_id)) return false;
+
+    memcpy(_key, key, SIPHASH_KEY_LENGTH);
+    _port = port;
+    _request_type = request_type;
+    _configured = true;
+    return true;
+}
+
+bool_t UdpAlert::is_configured(void) const
+{
+    return _configured;
+}
+
+/*
+ *  Starts sending the alert, which poll_help() carries on.  Any alert
+ *  still being sent is abandoned.  Returns false if it cannot be sent.
+ */
+bool_t UdpAlert::start_help(kstring_t host, byte_t const * alert_id, uint16_t budget_ms)
+{
+    time_ms_t now;
+
+    if (!_configured || !alert_id) return false;
+    cancel_help();
+
+    if (!Resolver::get_instance()->resolve(host, &_address))
+    {
+        DLOG_ERR2("Could not resolve", host);
+        return false;
+    }
+    if (!_conn.open())
+    {
+        DLOG_ERR("Could not open UDP socket");
+        return false;
+    }
+
+    _stats.alerts++;
+    memcpy(_alert_id, alert_id, UUID_BINARY_LENGTH);
+    now = clock_millis();
+    _end = now + budget_ms;
+    _retransmit_at = now;
+    _backoff_ms = _rto_ms;
+    _attempts = 0;
+    _sending = true;
+    return true;
+}
+
+/*
+ *  Reads any acknowledgement, and sends the alert again once its
+ *  timer runs out, without waiting.  Once acknowledged, sets the
+ *  issue ID the platform gave the alert.  UDPALERT_UNACKED once the
+ *  budget has run out, and the caller should use HTTP.
+ */
+udpalert_status_t UdpAlert::poll_help(uuid_ref_t issue_id)
+{
+    wiremsg_t ack;
+
+    if (!_sending) return UDPALERT_UNACKED;
+
+    if (read_ack(_alert_id, _attempts, &ack))
+    {
+        sample_rtt(clock_micros() - _sent_at[ack.attempt]);
+        memcpy(issue_id, ack.issue_id, UUID_BINARY_LENGTH);
+        _stats.acked++;
+        cancel_help();
+        return UDPALERT_ACKED;
+    }
+
+    if (!ms_until(_end))
+    {
+        /* Keep the backed off timeout until a round trip is measured again. */
+        _rto_ms = (_rto_ms > UDPALERT_RTO_MAX_MS / 2) ? UDPALERT_RTO_MAX_MS : _rto_ms * 2;
+        _stats.unacked++;
+        cancel_help();
+        DLOG_WARN("Alert was not acknowledged");
+        return UDPALERT_UNACKED;
+    }
+
+    if (!ms_until(_retransmit_at))
+    {
+        if (_attempts < UDPALERT_ATTEMPT_MAX)
+        {
+            _sent_at[_attempts] = clock_micros();
+            send_attempt(_address, _alert_id, _attempts);
+            _attempts++;
+            _retransmit_at = clock_millis() + _backoff_ms;
+            _backoff_ms = (_backoff_ms > UDPALERT_RTO_MAX_MS / 2)
+                ? UDPALERT_RTO_MAX_MS : _backoff_ms * 2;
+        }
+        else
+        {
+            _retransmit_at = _end;
+        }
+    }
+    return UDPALERT_PENDING;
+}
+
+/* Abandons the alert being sent, if any. */
+void UdpAlert::cancel_help(void)
+{
+    if (!_sending) return;
+    _sending = false;
+    _conn.close();
+}
+
+/*
+ *  Sends the alert until it is acknowledged or the budget runs out,
+ *  waiting on the socket in between.  Sets the issue ID the platform
+ *  gave the alert.  Returns false if it was not acknowledged, and the
+ *  caller should use HTTP.
+ */
+bool_t UdpAlert::send_help(
+    kstring_t host, byte_t const * alert_id, uuid_ref_t issue_id, uint16_t budget_ms)
+{
+    udpalert_status_t status;
+    uint32_t wait_ms;
+
+    if (!issue_id || !start_help(host, alert_id, budget_ms)) return false;
+
+    while ((status = poll_help(issue_id)) == UDPALERT_PENDING)
+    {
+        wait_ms = ms_until(_retransmit_at);
+        if (wait_ms > ms_until(_end)) wait_ms = ms_until(_end);
+        _conn.wait((uint16_t) wait_ms);
+    }
+    return status == UDPALERT_ACKED;
+}
+
+uint16_t UdpAlert::rto(void) const
+{
+    return _rto_ms;
+}
+
+uint32_t UdpAlert::srtt_us(void) const
+{
+    return _srtt_us;
+}
+
+udpalert_stats_t const * UdpAlert::stats(void) const
+{
+    return &_stats;
+}
+
+bool_t UdpAlert::send_attempt(net_addr_t address, byte_t const * alert_id, uint8_t attempt)
+{
+    byte_t datagram[DATAGRAM_LENGTH_MAX];
+    wiremsg_t msg;
+    uint16_t length;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.type = WIREMSG_ALERT;
+    memcpy(msg.device_id, _device_id, UUID_BINARY_LENGTH);
+    memcpy(msg.alert_id, alert_id, UUID_BINARY_LENGTH);
+    msg.request_type = _request_type;
+    msg.attempt = attempt;
+    length = wiremsg_encode(&msg, datagram, sizeof(datagram));
+    siphash_tag(_key, datagram, length, &datagram[length]);
+
+    _stats.sent++;
+    if (attempt > 0) _stats.retransmits++;
+    return _conn.send(address, _port, datagram, length + SIPHASH_TAG_LENGTH);
+}
+
+/*
+ *  Reads every datagram waiting, until one acknowledges this alert.
+ *  Anything else, forged, stale or malformed, is dropped.
+ */
+bool_t UdpAlert::read_ack(byte_t const * alert_id, uint8_t attempts, wiremsg_t * ack)
+{
+    byte_t datagram[DATAGRAM_LENGTH_MAX + 1];
+    uint16_t ack_length;
+    int16_t length;
+
+    ack_length = wiremsg_length(WIREMSG_ALERT_ACK);
+    while ((length = _conn.receive(datagram, sizeof(datagram))) >= 0)
+    {
+        if (length == ack_length + SIPHASH_TAG_LENGTH
+            && siphash_verify(_key, datagram, ack_length, &datagram[ack_length])
+            && wiremsg_decode(ack, datagram, ack_length)
+            && ack->type == WIREMSG_ALERT_ACK
+            && !memcmp(ack->alert_id, alert_id, UUID_BINARY_LENGTH)
+            && ack->attempt < attempts)
+        {
+            return true;
+        }
+        _stats.rejected++;
+    }
+    return false;
+}
+
+/* Updates the retransmission timeout as RFC 6298 does. */
+void UdpAlert::sample_rtt(uint32_t rtt_us)
+{
+    uint32_t delta, rto_us;
+
+    _stats.last_rtt_us = rtt_us;
+    if (!_measured)
+    {
+        _srtt_us = rtt_us;
+        _rttvar_us = rtt_us / 2;
+        _measured = true;
+    }
+    else
+    {
+        delta = (_srtt_us > rtt_us) ? (_srtt_us - rtt_us) : (rtt_us - _srtt_us);
+        _rttvar_us = ((3 * _rttvar_us) + delta) / 4;
+        _srtt_us = ((7 * _srtt_us) + rtt_us) / 8;
+    }
+
+    rto_us = _srtt_us + (4 * _rttvar_us);
+    if (rto_us < UDPALERT_RTO_MIN_MS * 1000UL) _rto_ms = UDPALERT_RTO_MIN_MS;
+    else if (rto_us > UDPALERT_RTO_MAX_MS * 1000UL) _rto_ms = UDPALERT_RTO_MAX_MS;
+    else _rto_ms = (uint16_t) ((rto_us + 999) / 1000);
+}
+
+/* Milliseconds left until the time, by clock_millis(), or 0 if past. */
+uint32_t UdpAlert::ms_until(time_ms_t when)
+{
+    int32_t left = (int32_t) (when - clock_millis());
+    return (left > 0) ? (uint32_t) left : 0;
+}
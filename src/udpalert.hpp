@@ -0,0 +1,115 @@
+/*
+ *  Module: UdpAlert
+ *
+ *  The fast path for a help alert: one small authenticated datagram,
+ *  sent again on an adaptive timer until the platform acknowledges
+ *  it.  On a healthy network the alert is confirmed in one round
+ *  trip, with no lookup, handshake or HTTP exchange after the first.
+ *  The caller falls back to HTTP if no acknowledgement comes in time.
+ *
+ *  The alert ID is the same for every copy, so the platform raises
+ *  one issue however many arrive.  Each copy carries its attempt
+ *  number, echoed by the acknowledgement, so every round trip can be
+ *  timed even after a copy is lost.  Datagrams both ways carry a
+ *  SipHash tag under a key shared with the platform.
+ *
+ *  An alert is started, then polled until it is acknowledged or its
+ *  budget runs out, so the caller never waits on it; send_help()
+ *  does both, and blocks.
+ *
+ *  Author: Alex Dale @superoxigen
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for information.
+ */
+
+#ifndef _UDPALERT_HPP_
+#define _UDPALERT_HPP_
+
+#include "siphash.h"
+#include "udpconn.hpp"
+#include "uuid.h"
+#include "utils.h"
+#include "wiremsg.h"
+
+/* How long to wait for an acknowledgement before HTTP is used. */
+#define UDPALERT_BUDGET_MS          1500
+
+/* Retransmission timeout, as in RFC 6298 but bounded for a LAN. */
+#define UDPALERT_RTO_INITIAL_MS     250
+#define UDPALERT_RTO_MIN_MS         20
+#define UDPALERT_RTO_MAX_MS         1000
+
+#define UDPALERT_ATTEMPT_MAX        8
+
+typedef enum {
+    UDPALERT_PENDING,
+    UDPALERT_ACKED,
+    UDPALERT_UNACKED        /* The budget ran out, or it was not sent */
+} udpalert_status_t;
+
+typedef struct {
+    uint32_t alerts;
+    uint32_t sent;
+    uint32_t retransmits;
+    uint32_t acked;
+    uint32_t unacked;       /* Left to HTTP */
+    uint32_t rejected;      /* Failed the tag, or not for this alert */
+    uint32_t last_rtt_us;
+} udpalert_stats_t;
+
+class UdpAlert {
+    UdpConn _conn;
+    byte_t _key[SIPHASH_KEY_LENGTH];
+    byte_t _device_id[UUID_BINARY_LENGTH];
+    uint16_t _request_type;
+    uint16_t _port;
+    bool_t _configured;
+
+    /* Smoothed round trip and its variation, in microseconds. */
+    bool_t _measured;
+    uint32_t _srtt_us;
+    uint32_t _rttvar_us;
+    uint16_t _rto_ms;
+
+    /* The alert being sent, see start_help(). */
+    bool_t _sending;
+    net_addr_t _address;
+    byte_t _alert_id[UUID_BINARY_LENGTH];
+    time_us_t _sent_at[UDPALERT_ATTEMPT_MAX];
+    time_ms_t _end;
+    time_ms_t _retransmit_at;
+    uint16_t _backoff_ms;
+    uint8_t _attempts;
+
+    udpalert_stats_t _stats;
+
+public:
+    UdpAlert();
+
+    bool_t init(byte_t const * key, uint16_t port, kstring_t device_id, uint16_t request_type);
+    bool_t is_configured(void) const;
+
+    bool_t start_help(
+        kstring_t host, byte_t const * alert_id, uint16_t budget_ms=UDPALERT_BUDGET_MS);
+    udpalert_status_t poll_help(uuid_ref_t issue_id);
+    void cancel_help(void);
+    bool_t send_help(
+        kstring_t host, byte_t const * alert_id, uuid_ref_t issue_id,
+        uint16_t budget_ms=UDPALERT_BUDGET_MS);
+
+    uint16_t rto(void) const;
+    uint32_t srtt_us(void) const;
+    udpalert_stats_t const * stats(void) const;
+
+private:
+    bool_t send_attempt(net_addr_t address, byte_t const * alert_id, uint8_t attempt);
+    bool_t read_ack(byte_t const * alert_id, uint8_t attempts, wiremsg_t * ack);
+    void sample_rtt(uint32_t rtt_us);
+    static uint32_t ms_until(time_ms_t when);
+
+    UdpAlert(UdpAlert const &);
+    UdpAlert & operator=(UdpAlert const &);
+};
+
+#endif /* _UDPALERT_HPP_ */
@@ -0,0 +1,167 @@
+/*
+ *  Module: UdpConn
+ *
+ *  A UDP socket.  Wraps the ESP WiFiUDP on the device, and POSIX
+ *  sockets on the host, like NetConn does for TCP.
+ *
+ *  Author: Alex Dale @superoxigen
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for information.
+ */
+
+#ifndef ARDUINO
+/* Standard Library */
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+/* Self Header */
+#include "udpconn.hpp"
+
+#ifdef ARDUINO
+
+UdpConn::UdpConn():
+    _open(false),
+    _pending(0) {}
+
+UdpConn::~UdpConn()
+{
+    close();
+}
+
+/* Binds an ephemeral local port. */
+bool_t UdpConn::open(void)
+{
+    if (_open) return true;
+    _open = _udp.begin(0) == 1;
+    _pending = 0;
+    return _open;
+}
+
+void UdpConn::close(void)
+{
+    if (!_open) return;
+    _udp.stop();
+    _open = false;
+}
+
+bool_t UdpConn::send(net_addr_t address, uint16_t port, byte_t const * data, uint16_t length)
+{
+    if (!_open) return false;
+    if (!_udp.beginPacket(IPAddress(address), port)) return false;
+    if (_udp.write(data, length) != length) return false;
+    return _udp.endPacket() == 1;
+}
+
+/*
+ *  Reads the next datagram, cut to the size given.  Returns its
+ *  length, or -1 if there is none.
+ */
+int16_t UdpConn::receive(byte_t * data, uint16_t size)
+{
+    int16_t length;
+
+    if (!_open) return -1;
+    length = _pending ? _pending : (int16_t) _udp.parsePacket();
+    _pending = 0;
+    if (length <= 0) return -1;
+    return (int16_t) _udp.read(data, size);
+}
+
+/* Whether a datagram arrived within the timeout. */
+bool_t UdpConn::wait(uint16_t timeout_ms)
+{
+    time_ms_t start;
+
+    if (!_open) return false;
+    start = millis();
+    while (!_pending)
+    {
+        /* parsePacket() moves past any unread datagram, so it is kept. */
+        _pending = (int16_t) _udp.parsePacket();
+        if (_pending) break;
+        if ((millis() - start) >= timeout_ms) return false;
+        delay(1);
+    }
+    return true;
+}
+
+#else /* POSIX */
+
+UdpConn::UdpConn():
+    _fd(-1) {}
+
+UdpConn::~UdpConn()
+{
+    close();
+}
+
+/* Binds an ephemeral local port, without blocking. */
+bool_t UdpConn::open(void)
+{
+    if (_fd >= 0) return true;
+    _fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (_fd < 0) return false;
+    fcntl(_fd, F_SETFL, fcntl(_fd, F_GETFL, 0) | O_NONBLOCK);
+    return true;
+}
+
+void UdpConn::close(void)
+{
+    if (_fd < 0) return;
+    ::close(_fd);
+    _fd = -1;
+}
+
+bool_t UdpConn::send(net_addr_t address, uint16_t port, byte_t const * data, uint16_t length)
+{
+    struct sockaddr_in addr;
+
+    if (_fd < 0) return false;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = address;
+    return sendto(_fd, data, length, 0, (struct sockaddr *) &addr, sizeof(addr)) == length;
+}
+
+/*
+ *  Reads the next datagram, cut to the size given.  Returns its
+ *  length, or -1 if there is none.
+ */
+int16_t UdpConn::receive(byte_t * data, uint16_t size)
+{
+    ssize_t n;
+
+    if (_fd < 0) return -1;
+    do
+    {
+        n = recv(_fd, data, size, MSG_DONTWAIT);
+    } while (n < 0 && errno == EINTR);
+    return (n < 0) ? -1 : (int16_t) n;
+}
+
+/* Whether a datagram arrived within the timeout. */
+bool_t UdpConn::wait(uint16_t timeout_ms)
+{
+    struct pollfd pfd;
+    int n;
+
+    if (_fd < 0) return false;
+    pfd.fd = _fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    do
+    {
+        n = poll(&pfd, 1, timeout_ms);
+    } while (n < 0 && errno == EINTR);
+    return n > 0;
+}
+
+#endif /* ARDUINO */
@@ -0,0 +1,50 @@
+/*
+ *  Module: UdpConn
+ *
+ *  A UDP socket.  Wraps the ESP WiFiUDP on the device, and POSIX
+ *  sockets on the host, like NetConn does for TCP.
+ *
+ *  Author: Alex Dale @superoxigen
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for information.
+ */
+
+#ifndef _UDPCONN_HPP_
+#define _UDPCONN_HPP_
+
+#ifdef ARDUINO
+#include <WiFiUdp.h>
+#endif
+
+#include "netconn.hpp"
+#include "utils.h"
+
+class UdpConn {
+#ifdef ARDUINO
+    WiFiUDP _udp;
+    bool_t _open;
+
+    /* Size of a datagram found by wait() and not yet read. */
+    int16_t _pending;
+#else
+    int _fd;
+#endif
+
+public:
+    UdpConn();
+    ~UdpConn();
+
+    bool_t open(void);
+    void close(void);
+
+    bool_t send(net_addr_t address, uint16_t port, byte_t const * data, uint16_t length);
+    int16_t receive(byte_t * data, uint16_t size);
+    bool_t wait(uint16_t timeout_ms);
+
+private:
+    UdpConn(UdpConn const &);
+    UdpConn & operator=(UdpConn const &);
+};
+
+#endif /* _UDPCONN_HPP_ */
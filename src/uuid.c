@@ -12,60 +12,217 @@
 
 #include <string.h>
 
-#include "smlstr.h"
+#include "clock.h"
+#include "hwrng.h"
+
 #include "uuid.h"
 
+#define UUID_TEXT_LENGTH    (UUID_BUFFER_LENGTH - 1)
+#define UUID_CHUNKS         8
+
+/* A byte repeated in each byte of a word. */
+#define BYTES(b)            (0x01010101UL * (uint8_t) (b))
+#define HIGH_BITS           BYTES(0x80)
+
+/* The count within a millisecond, and where a new one starts below. */
+#define V7_COUNT_MAX        0x0FFF
+#define V7_COUNT_START      0x01FF
+
 kstring_t kZeroUUID = "00000000-0000-0000-0000-000000000000";
 
-static bool_t is_hex(char_t c)
+/* Where each run of four hex digits starts in the text. */
+static uint8_t const kChunks[UUID_CHUNKS] = { 0, 4, 9, 14, 19, 24, 28, 32 };
+
+/* Where each byte's two digits go in the text. */
+static uint8_t const kDigits[UUID_BINARY_LENGTH] = {
+    0, 2, 4, 6, 9, 11, 14, 16, 19, 21, 24, 26, 28, 30, 32, 34
+};
+
+/* The two digits of each byte. */
+static char_t const kHexPairs[2 * 256 + 1] =
+    "000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f"
+    "202122232425262728292a2b2c2d2e2f303132333435363738393a3b3c3d3e3f"
+    "404142434445464748494a4b4c4d4e4f505152535455565758595a5b5c5d5e5f"
+    "606162636465666768696a6b6c6d6e6f707172737475767778797a7b7c7d7e7f"
+    "808182838485868788898a8b8c8d8e8f909192939495969798999a9b9c9d9e9f"
+    "a0a1a2a3a4a5a6a7a8a9aaabacadaeafb0b1b2b3b4b5b6b7b8b9babbbcbdbebf"
+    "c0c1c2c3c4c5c6c7c8c9cacbcccdcecfd0d1d2d3d4d5d6d7d8d9dadbdcdddedf"
+    "e0e1e2e3e4e5e6e7e8e9eaebecedeeeff0f1f2f3f4f5f6f7f8f9fafbfcfdfeff";
+
+/* Four characters as a word, the first in the low byte, on any host. */
+static uint32_t load_chars(char_t const * text)
 {
-    return (c >= '0' && c <= '9')
-        || (c >= 'a' && c <= 'z')
-        || (c >= 'A' && c <= 'Z');
+    byte_t const * bytes = (byte_t const *) text;
+
+    return (uint32_t) bytes[0]
+        | ((uint32_t) bytes[1] << 8)
+        | ((uint32_t) bytes[2] << 16)
+        | ((uint32_t) bytes[3] << 24);
 }
 
-bool_t uuid_is_uuid(uuid_kref_t uuid)
+/*
+ *  The high bit of each byte of the word that is from lo to hi.  The
+ *  bytes must be below 0x80, so that no sum carries into the next.
+ */
+static uint32_t in_range(uint32_t word, uint8_t lo, uint8_t hi)
 {
-    static uint16_t groups[] = {8, 4, 4, 4, 12, 0};
-    uint16_t i, g;
-    char_t const * ptr;
+    uint32_t from_lo = word + BYTES(0x80 - lo);
+    uint32_t past_hi = word + BYTES(0x7F - hi);
 
-    /* Check for NULL */
-    if (!uuid)
+    return from_lo & ~past_hi & HIGH_BITS;
+}
+
+/*
+ *  Packs four hex digits into two bytes, with no branch on them.
+ *  Returns non-zero if any is not a digit, leaving the bytes
+ *  undefined.
+ */
+static uint32_t parse_chunk(char_t const * text, byte_t * bytes)
+{
+    uint32_t word = load_chars(text);
+    uint32_t ascii = word & ~HIGH_BITS;
+    uint32_t digit = in_range(ascii, '0', '9');
+    uint32_t letter = in_range(ascii | BYTES(0x20), 'a', 'f');
+
+    /* Each nibble: the low 4 bits, and 9 more for a letter. */
+    uint32_t value = (word & BYTES(0x0F)) + (letter >> 7) * 9;
+
+    /* Each even nibble joins the odd one after it. */
+    value = (value << 4) | (value >> 8);
+    bytes[0] = (byte_t) value;
+    bytes[1] = (byte_t) (value >> 16);
+
+    return ((digit | letter) ^ HIGH_BITS) | (word & HIGH_BITS);
+}
+
+/* Whether the ID is all zero, in the same time whatever its bytes. */
+bool_t uuid_is_zero(uuid_kref_t uuid)
+{
+    byte_t bits = 0;
+    uint8_t i;
+
+    if (!uuid) return false;
+
+    for (i = 0; i < UUID_BINARY_LENGTH; i++)
     {
-        return false;
+        bits |= uuid[i];
     }
+    return !bits;
+}
+
+void uuid_set_zero(uuid_ref_t uuid)
+{
+    if (!uuid) return;
+    memset(uuid, 0, UUID_BINARY_LENGTH);
+}
+
+/* Whether the IDs are the same, in the same time however much of them is. */
+bool_t uuid_equal(uuid_kref_t a, uuid_kref_t b)
+{
+    byte_t diff = 0;
+    uint8_t i;
 
-    ptr = uuid;
-    for (g = 0; groups[g] > 0; g++)
+    if (!a || !b) return false;
+
+    for (i = 0; i < UUID_BINARY_LENGTH; i++)
     {
-        /* Check for hyphen between groups */
-        if (g != 0 && *ptr++ != '-')
-        {
-            return false;
-        }
-        /* Check each group is hexidecimal values. */
-        for (i = 0; i < groups[g]; i++)
-        {
-            if (!is_hex(*ptr++))
-            {
-                return false;
-            }
-        }
+        diff |= a[i] ^ b[i];
     }
+    return !diff;
+}
 
-    /* Check that there are no additional characters */
-    return !*ptr;
+/* The last millisecond and count given, so that no ID repeats or goes back. */
+static uint64_t s_v7_millis = 0;
+static uint16_t s_v7_count = 0;
+
+/*
+ *  A version 7 UUID, in binary.  A new millisecond starts its count
+ *  at random, below the middle, so that IDs made in the same one
+ *  by other devices are unlikely to interleave.  Counting out a
+ *  millisecond borrows the next.  Until the clock has been set, the
+ *  time would be the uptime, which sorts against nothing, so the ID
+ *  is a random version 4 one instead.  Not for more than one thread.
+ */
+void uuid_v7(uuid_ref_t uuid)
+{
+    uint64_t millis;
+    uint8_t i;
+
+    if (!uuid) return;
+
+    if (!clock_unix_is_set())
+    {
+        hwrng_uuid(uuid);
+        return;
+    }
+
+    hwrng_fill(&uuid[6], UUID_BINARY_LENGTH - 6);
+    millis = clock_unix_millis();
+    if (millis > s_v7_millis)
+    {
+        s_v7_millis = millis;
+        s_v7_count = ((uuid[6] << 8) | uuid[7]) & V7_COUNT_START;
+    }
+    else if (++s_v7_count > V7_COUNT_MAX)
+    {
+        s_v7_millis++;
+        s_v7_count = 0;
+    }
+
+    for (i = 0; i < 6; i++)
+    {
+        uuid[i] = (byte_t) (s_v7_millis >> (40 - 8 * i));
+    }
+
+    /* Version 7, RFC 4122 variant. */
+    uuid[6] = (byte_t) (0x70 | (s_v7_count >> 8));
+    uuid[7] = (byte_t) s_v7_count;
+    uuid[8] = (uuid[8] & 0x3F) | 0x80;
 }
 
-bool_t uuid_is_zero(uuid_kref_t uuid)
+bool_t uuid_is_uuid(kstring_t text)
+{
+    uuid_t uuid;
+
+    return uuid_to_binary(text, uuid);
+}
+
+/*
+ *  Reads a UUID's text into its 16 bytes, in either case.  Returns
+ *  false, leaving the bytes undefined, if it is not a UUID.
+ */
+bool_t uuid_to_binary(kstring_t text, uuid_ref_t uuid)
 {
-    if (!uuid_is_uuid(uuid)) return false;
-    return strncmp(uuid, kZeroUUID, UUID_BUFFER_LENGTH);
+    uint32_t bad;
+    uint8_t i;
+
+    if (!text || !uuid || strnlen(text, UUID_BUFFER_LENGTH) != UUID_TEXT_LENGTH)
+    {
+        return false;
+    }
+
+    bad = (text[8] ^ '-') | (text[13] ^ '-') | (text[18] ^ '-') | (text[23] ^ '-');
+    for (i = 0; i < UUID_CHUNKS; i++)
+    {
+        bad |= parse_chunk(&text[kChunks[i]], &uuid[2 * i]);
+    }
+    return !bad;
 }
 
-void uuid_set_zero(uuid_ref_t uuid)
+/* Writes the ID as lower case text, with its terminator. */
+void uuid_from_binary(char_t * text, uuid_kref_t uuid)
 {
-    if (!uuid) return;
-    smlstrcpy(uuid, kZeroUUID, UUID_BUFFER_LENGTH);
+    uint8_t i;
+
+    if (!text || !uuid) return;
+
+    for (i = 0; i < UUID_BINARY_LENGTH; i++)
+    {
+        memcpy(&text[kDigits[i]], &kHexPairs[2 * uuid[i]], 2);
+    }
+    text[8] = '-';
+    text[13] = '-';
+    text[18] = '-';
+    text[23] = '-';
+    text[UUID_TEXT_LENGTH] = '\0';
 }
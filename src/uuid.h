@@ -4,6 +4,19 @@
  *  A library for the ID types used in this project.
  *  The IDs are based on UUIDs.
  *
+ *  An ID is kept and compared as its 16 bytes, a uuid_t.  The text
+ *  form is only made at the wire, by uuid_from_binary(), and read
+ *  from it by uuid_to_binary().  Both work a word at a time, with no
+ *  branch on the digits, and equality takes the same time however
+ *  many bytes match.
+ *
+ *  uuid_v7() makes an ID on the device, ordered by when it was made:
+ *  48 bits of Unix milliseconds, a 12 bit count within the
+ *  millisecond, and 62 random bits from the hardware generator.
+ *  Each is greater than the last, even if the clock steps back.
+ *  Until the device's clock is set, by SNTP or the platform, it
+ *  makes random version 4 IDs, as there is no time to order them by.
+ *
  *  Author: Alex Dale @superoxigen
  *
  *  Copyright (c) 2017 Alex Dale
@@ -18,18 +31,29 @@
 /* 32 Hex Characters, 4 Hyphens, 1 Null Term */
 #define UUID_BUFFER_LENGTH 37
 
+/* The 16 bytes of a UUID, as kept and as sent in binary messages. */
+#define UUID_BINARY_LENGTH 16
+
 START_C_SECTION
 
-typedef char_t uuid_t[UUID_BUFFER_LENGTH];
-typedef char_t * uuid_ref_t;
-typedef char_t const * uuid_kref_t;
+typedef byte_t uuid_t[UUID_BINARY_LENGTH];
+typedef byte_t * uuid_ref_t;
+typedef byte_t const * uuid_kref_t;
+
+/* The text form, only at the wire. */
+typedef char_t uuid_str_t[UUID_BUFFER_LENGTH];
 
 extern kstring_t kZeroUUID;
 
-bool_t uuid_is_uuid(uuid_kref_t uuid);
 bool_t uuid_is_zero(uuid_kref_t uuid);
-
 void uuid_set_zero(uuid_ref_t uuid);
+bool_t uuid_equal(uuid_kref_t a, uuid_kref_t b);
+
+void uuid_v7(uuid_ref_t uuid);
+
+bool_t uuid_is_uuid(kstring_t text);
+bool_t uuid_to_binary(kstring_t text, uuid_ref_t uuid);
+void uuid_from_binary(char_t * text, uuid_kref_t uuid);
 
 END_C_SECTION
 
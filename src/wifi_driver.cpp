@@ -23,6 +23,8 @@
  * Native Drivers
  */
 
+#ifdef ARDUINO
+
 #ifdef WIFI_ENTEPRISE
 
 /*
@@ -91,6 +93,11 @@ C_FUNCTION bool_t wifi_driver_is_connected(void)
     return (WiFi.status() == WL_CONNECTED);
 }
 
+C_FUNCTION int8_t wifi_driver_rssi(void)
+{
+    return wifi_driver_is_connected() ? (int8_t) WiFi.RSSI() : 0;
+}
+
 C_FUNCTION void wifi_driver_log_status(void)
 {
     if (wifi_driver_is_connected())
@@ -144,3 +151,31 @@ C_FUNCTION void wifi_driver_loop(void)
 {
     /* Nothing to do... yet. */
 }
+
+#else /* Host shim */
+
+#include "wifi_driver.h"
+
+/* The host is taken to be on the network already. */
+
+C_FUNCTION void wifi_driver_connect(void) {}
+
+C_FUNCTION void wifi_driver_disconnect(void) {}
+
+C_FUNCTION bool_t wifi_driver_is_connected(void)
+{
+    return true;
+}
+
+C_FUNCTION int8_t wifi_driver_rssi(void)
+{
+    return 0;
+}
+
+C_FUNCTION void wifi_driver_log_status(void) {}
+
+C_FUNCTION void wifi_driver_init(void) {}
+
+C_FUNCTION void wifi_driver_loop(void) {}
+
+#endif /* ARDUINO */
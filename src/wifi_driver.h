@@ -19,6 +19,8 @@ START_C_SECTION
 void wifi_driver_connect(void);
 void wifi_driver_disconnect(void);
 bool_t wifi_driver_is_connected(void);
+/* Signal strength in dBm, 0 while not connected. */
+int8_t wifi_driver_rssi(void);
 
 void wifi_driver_log_status(void);
 
@@ -0,0 +1,172 @@
+/*
+ *  Module: Wire Message
+ *
+ *  The compact binary encoding of the messages exchanged with the
+ *  platform, offered alongside the form and JSON ones.
+ *
+ *  Author: Alex Dale @superoxigen
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for information.
+ */
+
+#include <string.h>
+
+#include "wiremsg.h"
+
+#define HEADER_LENGTH 2
+
+kstring_t kWiremsgMediaType = "application/vnd.pendant.v1";
+
+/* Zero if the type is not known. */
+uint16_t wiremsg_length(uint8_t type)
+{
+    switch (type)
+    {
+        case WIREMSG_HELP:
+            return HEADER_LENGTH + (2 * UUID_BINARY_LENGTH) + 2;
+        case WIREMSG_CANCEL:
+            return HEADER_LENGTH + (2 * UUID_BINARY_LENGTH);
+        case WIREMSG_TEST:
+        case WIREMSG_HELP_REPLY:
+            return HEADER_LENGTH + UUID_BINARY_LENGTH;
+        case WIREMSG_ALERT:
+            return HEADER_LENGTH + (2 * UUID_BINARY_LENGTH) + 3;
+        case WIREMSG_ALERT_ACK:
+            return HEADER_LENGTH + (2 * UUID_BINARY_LENGTH) + 1;
+        default:
+            return 0;
+    }
+}
+
+/*
+ *  Which fields a type carries.  They are laid out in the order of
+ *  wiremsg_t, so these are all encode and decode need to know.
+ */
+static bool_t has_device_id(uint8_t type)
+{
+    return type == WIREMSG_HELP || type == WIREMSG_CANCEL
+        || type == WIREMSG_TEST || type == WIREMSG_ALERT;
+}
+
+static bool_t has_alert_id(uint8_t type)
+{
+    return type == WIREMSG_ALERT || type == WIREMSG_ALERT_ACK;
+}
+
+static bool_t has_request_type(uint8_t type)
+{
+    return type == WIREMSG_HELP || type == WIREMSG_ALERT;
+}
+
+static bool_t has_issue_id(uint8_t type)
+{
+    return type == WIREMSG_HELP || type == WIREMSG_CANCEL
+        || type == WIREMSG_HELP_REPLY || type == WIREMSG_ALERT_ACK;
+}
+
+/* Returns the length of the message, or 0 if it does not fit. */
+uint16_t wiremsg_encode(wiremsg_t const * msg, byte_t * buffer, uint16_t size)
+{
+    uint16_t length;
+    byte_t * ptr;
+
+    if (!msg || !buffer) return 0;
+    length = wiremsg_length(msg->type);
+    if (!length || length > size) return 0;
+
+    ptr = buffer;
+    *ptr++ = WIREMSG_VERSION;
+    *ptr++ = msg->type;
+
+    if (has_device_id(msg->type))
+    {
+        memcpy(ptr, msg->device_id, UUID_BINARY_LENGTH);
+        ptr += UUID_BINARY_LENGTH;
+    }
+    if (has_alert_id(msg->type))
+    {
+        memcpy(ptr, msg->alert_id, UUID_BINARY_LENGTH);
+        ptr += UUID_BINARY_LENGTH;
+    }
+    if (has_request_type(msg->type))
+    {
+        *ptr++ = (byte_t) (msg->request_type >> 8);
+        *ptr++ = (byte_t) msg->request_type;
+    }
+    if (has_alert_id(msg->type))
+    {
+        *ptr++ = msg->attempt;
+    }
+    if (has_issue_id(msg->type))
+    {
+        memcpy(ptr, msg->issue_id, UUID_BINARY_LENGTH);
+    }
+    return length;
+}
+
+/* Fails on another version, an unknown type or the wrong length. */
+bool_t wiremsg_decode(wiremsg_t * msg, byte_t const * data, uint16_t length)
+{
+    byte_t const * ptr;
+
+    if (!msg || !data || length < HEADER_LENGTH) return false;
+    if (data[0] != WIREMSG_VERSION) return false;
+    if (length != wiremsg_length(data[1])) return false;
+
+    memset(msg, 0, sizeof(wiremsg_t));
+    msg->type = data[1];
+    ptr = &data[HEADER_LENGTH];
+
+    if (has_device_id(msg->type))
+    {
+        memcpy(msg->device_id, ptr, UUID_BINARY_LENGTH);
+        ptr += UUID_BINARY_LENGTH;
+    }
+    if (has_alert_id(msg->type))
+    {
+        memcpy(msg->alert_id, ptr, UUID_BINARY_LENGTH);
+        ptr += UUID_BINARY_LENGTH;
+    }
+    if (has_request_type(msg->type))
+    {
+        msg->request_type = (uint16_t) ((ptr[0] << 8) | ptr[1]);
+        ptr += 2;
+    }
+    if (has_alert_id(msg->type))
+    {
+        msg->attempt = *ptr++;
+    }
+    if (has_issue_id(msg->type))
+    {
+        memcpy(msg->issue_id, ptr, UUID_BINARY_LENGTH);
+    }
+    return true;
+}
+
+void wiremsg_reader_init(wiremsg_reader_t * reader)
+{
+    if (!reader) return;
+    reader->length = 0;
+    reader->overflow = false;
+}
+
+/* Returns false once more has arrived than any message can be. */
+bool_t wiremsg_reader_feed(wiremsg_reader_t * reader, byte_t const * data, uint16_t length)
+{
+    if (!reader || reader->overflow) return false;
+    if (length > WIREMSG_LENGTH_MAX - reader->length)
+    {
+        reader->overflow = true;
+        return false;
+    }
+    memcpy(&reader->buffer[reader->length], data, length);
+    reader->length += length;
+    return true;
+}
+
+bool_t wiremsg_reader_decode(wiremsg_reader_t const * reader, wiremsg_t * msg)
+{
+    if (!reader || reader->overflow) return false;
+    return wiremsg_decode(msg, reader->buffer, reader->length);
+}
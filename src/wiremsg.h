@@ -0,0 +1,82 @@
+/*
+ *  Module: Wire Message
+ *
+ *  The compact binary encoding of the messages exchanged with the
+ *  platform, offered alongside the form and JSON ones.  Each message
+ *  has a fixed layout, by its type, of big endian fields:
+ *
+ *      help        version, type, device ID, request type,
+ *                  issue ID                                (36 bytes)
+ *      cancel      version, type, device ID, issue ID      (34 bytes)
+ *      test        version, type, device ID                (18 bytes)
+ *      help reply  version, type, issue ID                 (18 bytes)
+ *      alert       version, type, device ID, alert ID,
+ *                  request type, attempt                   (37 bytes)
+ *      alert ack   version, type, alert ID, attempt,
+ *                  issue ID                                (35 bytes)
+ *      heartbeat   version, type, device ID, health        (see telemetry.h)
+ *
+ *  IDs are the 16 bytes of their UUID.  The issue ID of a help
+ *  request is the one the device made for it, which the platform
+ *  keeps, so that a request sent twice raises one issue.  Nothing
+ *  is allocated; the reader takes a reply in chunks of any size, as
+ *  it arrives.
+ *
+ *  Author: Alex Dale @superoxigen
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for information.
+ */
+
+#ifndef _WIREMSG_H_
+#define _WIREMSG_H_
+
+#include "uuid.h"
+#include "utils.h"
+
+#define WIREMSG_VERSION         1
+#define WIREMSG_LENGTH_MAX      37
+
+START_C_SECTION
+
+typedef enum {
+    WIREMSG_HELP = 0x01,
+    WIREMSG_CANCEL = 0x02,
+    WIREMSG_TEST = 0x03,
+    WIREMSG_ALERT = 0x04,
+    WIREMSG_HEARTBEAT = 0x05,   /* Of its own length, see telemetry.h */
+    WIREMSG_HELP_REPLY = 0x81,
+    WIREMSG_ALERT_ACK = 0x84
+} wiremsg_type_t;
+
+/* Fields not carried by a type are left zero. */
+typedef struct {
+    uint8_t type;
+    byte_t device_id[UUID_BINARY_LENGTH];
+    byte_t alert_id[UUID_BINARY_LENGTH];
+    uint16_t request_type;
+    uint8_t attempt;
+    byte_t issue_id[UUID_BINARY_LENGTH];
+} wiremsg_t;
+
+/* Accumulates a message from a response body. */
+typedef struct {
+    byte_t buffer[WIREMSG_LENGTH_MAX];
+    uint16_t length;
+    bool_t overflow;
+} wiremsg_reader_t;
+
+/* The Content-Type of binary messages. */
+extern kstring_t kWiremsgMediaType;
+
+uint16_t wiremsg_length(uint8_t type);
+uint16_t wiremsg_encode(wiremsg_t const * msg, byte_t * buffer, uint16_t size);
+bool_t wiremsg_decode(wiremsg_t * msg, byte_t const * data, uint16_t length);
+
+void wiremsg_reader_init(wiremsg_reader_t * reader);
+bool_t wiremsg_reader_feed(wiremsg_reader_t * reader, byte_t const * data, uint16_t length);
+bool_t wiremsg_reader_decode(wiremsg_reader_t const * reader, wiremsg_t * msg);
+
+END_C_SECTION
+
+#endif /* _WIREMSG_H_ */
@@ -0,0 +1,419 @@
+/*
+ *  Module: Buffer String - Host Test & Benchmark
+ *
+ *  Builds a line of every typed push in each buffer length, down to
+ *  none, and checks it against snprintf(): whole when it fits, and
+ *  otherwise the pieces that did, with text cut but numbers and IDs
+ *  never, and the overflow flag held until clear().  Escaping is
+ *  checked against a character at a time reference over random text,
+ *  never splitting an escape.  Then times a telemetry line built in
+ *  place against snprintf().
+ *
+ *  Author: Alex Dale @superoxigen
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for information.
+ */
+
+#ifdef UNIT_TEST
+
+#include <stdio.h>
+#include <string.h>
+
+#include "unity.h"
+#include "utils.h"
+
+#include "bufstr.hpp"
+#include "clock.h"
+#include "uuid.h"
+
+#define LINE_LENGTH         160
+#define GUARD               0x5A
+#define PIECES              11
+#define FUZZ_CASES          20000
+#define FUZZ_SEED           0x6C078965
+#define ESCAPE_TEXT         48
+#define BENCH_LINES         200000
+
+static kstring_t kIssueID = "0f8fad5b-d9cb-469f-a165-70867728950e";
+
+static uint32_t s_state = FUZZ_SEED;
+
+static uint32_t next_random(void)
+{
+    s_state ^= s_state << 13;
+    s_state ^= s_state >> 17;
+    s_state ^= s_state << 5;
+    return s_state;
+}
+
+/*
+ *  Reference
+ */
+
+/* Each piece of the line as snprintf() writes it, and whether it may be cut. */
+typedef struct {
+    char_t text[48];
+    bool_t cuttable;
+} piece_t;
+
+static void ref_pieces(piece_t * pieces, uint32_t u, int32_t i, uint32_t h, int32_t f)
+{
+    uint32_t magnitude = (f < 0) ? 0UL - (uint32_t) f : (uint32_t) f;
+    uint8_t n;
+
+    snprintf(pieces[0].text, sizeof(pieces[0].text), "port=");
+    snprintf(pieces[1].text, sizeof(pieces[1].text), "%u", u);
+    snprintf(pieces[2].text, sizeof(pieces[2].text), " rssi=");
+    snprintf(pieces[3].text, sizeof(pieces[3].text), "%d", (int) i);
+    snprintf(pieces[4].text, sizeof(pieces[4].text), " heap=0x");
+    snprintf(pieces[5].text, sizeof(pieces[5].text), "%08X", h);
+    snprintf(pieces[6].text, sizeof(pieces[6].text), " volts=");
+    snprintf(pieces[7].text, sizeof(pieces[7].text), "%s%u.%03u",
+        (f < 0) ? "-" : "", magnitude / 1000, magnitude % 1000);
+    snprintf(pieces[8].text, sizeof(pieces[8].text), " id=");
+    snprintf(pieces[9].text, sizeof(pieces[9].text), "%s", kIssueID);
+    snprintf(pieces[10].text, sizeof(pieces[10].text), " ok");
+
+    for (n = 0; n < PIECES; n++)
+    {
+        pieces[n].cuttable = !(n & 1);
+    }
+}
+
+/* What the line must be in a buffer of `size`, and whether it overflows. */
+static bool_t ref_line(piece_t const * pieces, char_t * line, uint16_t size)
+{
+    uint16_t length = 0, n, piece;
+
+    line[0] = 0;
+    for (n = 0; n < PIECES; n++)
+    {
+        piece = (uint16_t) strlen(pieces[n].text);
+        if (length + piece < size)
+        {
+            memcpy(&line[length], pieces[n].text, piece + 1);
+            length += piece;
+            continue;
+        }
+        if (pieces[n].cuttable && size)
+        {
+            memcpy(&line[length], pieces[n].text, size - 1 - length);
+            line[size - 1] = 0;
+        }
+        return true;
+    }
+    return false;
+}
+
+static void push_line(BufStr * str, uint32_t u, int32_t i, uint32_t h, int32_t f, uuid_kref_t id)
+{
+    str->push_str("port=");
+    str->push_uint(u);
+    str->push_str(" rssi=");
+    str->push_int(i);
+    str->push_str(" heap=0x");
+    str->push_hex(h, 8);
+    str->push_str(" volts=");
+    str->push_fixed(f, 3);
+    str->push_str(" id=");
+    str->push_uuid(id);
+    str->push_escaped(" ok");
+}
+
+static uint16_t ref_escape(char_t * dest, kstring_t src)
+{
+    uint16_t length = 0;
+
+    for (; *src; src++)
+    {
+        switch (*src)
+        {
+            case '"':  length += sprintf(&dest[length], "\\\""); break;
+            case '\\': length += sprintf(&dest[length], "\\\\"); break;
+            case '\b': length += sprintf(&dest[length], "\\b"); break;
+            case '\f': length += sprintf(&dest[length], "\\f"); break;
+            case '\n': length += sprintf(&dest[length], "\\n"); break;
+            case '\r': length += sprintf(&dest[length], "\\r"); break;
+            case '\t': length += sprintf(&dest[length], "\\t"); break;
+            default:
+                if ((byte_t) *src < 0x20)
+                {
+                    length += sprintf(&dest[length], "\\u%04X", (byte_t) *src);
+                }
+                else
+                {
+                    dest[length++] = *src;
+                }
+                break;
+        }
+    }
+    dest[length] = 0;
+    return length;
+}
+
+/* How much of the escaped text fits in `size`, without splitting an escape. */
+static uint16_t ref_escaped_fit(kstring_t src, uint16_t size)
+{
+    char_t escape[8], one_char[2] = { 0, 0 };
+    uint16_t length = 0, one;
+
+    for (; *src; src++)
+    {
+        one_char[0] = *src;
+        one = ref_escape(escape, one_char);
+        if (length + one >= size) break;
+        length += one;
+    }
+    return length;
+}
+
+/*
+ *  Tests
+ */
+
+/* A push_str() once stopped at 255 characters, with a byte index. */
+void test_push_long(void)
+{
+    char_t text[301], buffer[640];
+    BufStr str(buffer, sizeof(buffer));
+
+    memset(text, 'a', 300);
+    text[300] = 0;
+
+    TEST_ASSERT(str.push_str(text));
+    TEST_ASSERT(str.push_str(text));
+    TEST_ASSERT_EQUAL(600, str.length());
+    TEST_ASSERT_EQUAL(600, strlen(buffer));
+    TEST_ASSERT_FALSE(str.overflowed());
+}
+
+void test_typed_sweep(void)
+{
+    char_t expected[LINE_LENGTH], buffer[LINE_LENGTH + 1];
+    piece_t pieces[PIECES];
+    uuid_t id;
+    uint32_t c, u, h;
+    int32_t i, f;
+    uint16_t size;
+    bool_t overflow;
+
+    uuid_to_binary(kIssueID, id);
+    for (c = 0; c < FUZZ_CASES; c++)
+    {
+        u = next_random() >> (next_random() % 32);
+        i = (int32_t) (next_random() >> (next_random() % 32));
+        h = next_random() >> (next_random() % 32);
+        f = (int32_t) (next_random() >> (next_random() % 32));
+        if (c & 1) i = -i;
+        if (c & 2) f = -f;
+        if (c == 0) i = INT32_MIN;
+        ref_pieces(pieces, u, i, h, f);
+
+        for (size = (c < 64) ? 0 : LINE_LENGTH - 1; size < LINE_LENGTH; size++)
+        {
+            memset(buffer, GUARD, sizeof(buffer));
+            BufStr str(buffer, size);
+
+            push_line(&str, u, i, h, f, id);
+            overflow = ref_line(pieces, expected, size);
+
+            TEST_ASSERT_EQUAL(overflow, str.overflowed());
+            TEST_ASSERT_EQUAL(GUARD, (byte_t) buffer[size]);
+            if (size)
+            {
+                TEST_ASSERT_EQUAL_STRING(expected, buffer);
+                TEST_ASSERT_EQUAL(strlen(expected), str.length());
+            }
+        }
+    }
+}
+
+void test_overflow_sticks(void)
+{
+    char_t buffer[8];
+    BufStr str(buffer, sizeof(buffer));
+
+    str.push_uint(1234).push_uint(5678);
+    TEST_ASSERT(str.overflowed());
+    TEST_ASSERT_EQUAL_STRING("1234", buffer);
+
+    /* Room for these, but they would follow a gap. */
+    TEST_ASSERT_FALSE(str.push_char('!'));
+    TEST_ASSERT_FALSE(str.push_str("x"));
+    str.push_hex(0xF);
+    TEST_ASSERT_EQUAL_STRING("1234", buffer);
+    TEST_ASSERT_EQUAL(4, str.length());
+
+    TEST_ASSERT(str.clear());
+    TEST_ASSERT_FALSE(str.overflowed());
+    str.push_int(-42).push_char(':');
+    str.push_fixed(5, 1);
+    TEST_ASSERT_EQUAL_STRING("-42:0.5", buffer);
+    TEST_ASSERT_FALSE(str.overflowed());
+
+    /* The terminator's byte is never taken. */
+    TEST_ASSERT_FALSE(str.push_char('z'));
+    TEST_ASSERT(str.overflowed());
+}
+
+void test_no_buffer(void)
+{
+    BufStr none(NULL, 16);
+    BufStr empty(NULL, 0);
+    uuid_t id;
+
+    uuid_set_zero(id);
+    none.push_uint(1);
+    TEST_ASSERT(none.overflowed());
+    empty.push_uuid(id);
+    TEST_ASSERT(empty.overflowed());
+    TEST_ASSERT_EQUAL(0, empty.length());
+
+    /* Nothing to push is not an overflow. */
+    char_t buffer[4];
+    BufStr str(buffer, sizeof(buffer));
+    str.push_escaped(NULL).push_uuid(NULL).push_escaped("");
+    TEST_ASSERT_FALSE(str.overflowed());
+    TEST_ASSERT_EQUAL_STRING("", buffer);
+}
+
+void test_escaped_sweep(void)
+{
+    char_t text[ESCAPE_TEXT + 1], expected[6 * ESCAPE_TEXT + 1], buffer[6 * ESCAPE_TEXT + 2];
+    uint16_t length, size;
+    uint32_t c;
+    uint8_t n;
+
+    for (c = 0; c < FUZZ_CASES / 10; c++)
+    {
+        length = (uint16_t) (next_random() % ESCAPE_TEXT);
+        for (n = 0; n < length; n++)
+        {
+            switch (next_random() % 4)
+            {
+                case 0:  text[n] = "\"\\\b\f\n\r\t"[next_random() % 7]; break;
+                case 1:  text[n] = (char_t) (1 + next_random() % 0x1F); break;
+                default: text[n] = (char_t) (0x20 + next_random() % 0x5F); break;
+            }
+        }
+        text[length] = 0;
+        length = ref_escape(expected, text);
+
+        for (size = 1; size <= length + 1; size++)
+        {
+            memset(buffer, GUARD, sizeof(buffer));
+            BufStr str(buffer, size);
+
+            str.push_escaped(text);
+            TEST_ASSERT_EQUAL(length >= size, str.overflowed());
+            TEST_ASSERT_EQUAL(GUARD, (byte_t) buffer[size]);
+            TEST_ASSERT_EQUAL_MEMORY(expected, buffer, str.length());
+
+            /* Cut after the last whole character's escape that fits. */
+            TEST_ASSERT_EQUAL(ref_escaped_fit(text, size), str.length());
+        }
+    }
+
+    char_t line[32];
+    BufStr str(line, sizeof(line));
+    str.push_escaped("a\"b\\c\n\x01");
+    TEST_ASSERT_EQUAL_STRING("a\\\"b\\\\c\\n\\u0001", line);
+}
+
+/*
+ *  Benchmark
+ */
+
+static volatile uint32_t s_sink;
+
+/* A telemetry line, both ways; the quotes are escaped as for a JSON string. */
+static uint16_t build_line(bool_t libc, uint32_t i, char_t * line, uuid_kref_t id, kstring_t id_text)
+{
+    int32_t f = (int32_t) (i * 37) - 500000;
+    uint32_t magnitude = (f < 0) ? 0UL - (uint32_t) f : (uint32_t) f;
+
+    if (libc)
+    {
+        return (uint16_t) snprintf(line, LINE_LENGTH,
+            "port=%u rssi=%d heap=0x%08X volts=%s%u.%03u id=%s \\\"ok\\\"",
+            i & 0xFFFF, -(int) (i & 0x7F), i * 2654435761U,
+            (f < 0) ? "-" : "", magnitude / 1000, magnitude % 1000, id_text);
+    }
+
+    /* Started empty, not cleared, as snprintf() does not clear. */
+    line[0] = 0;
+    BufStr str(line, LINE_LENGTH, false);
+    str.push_str("port=");
+    str.push_uint(i & 0xFFFF);
+    str.push_str(" rssi=");
+    str.push_int(-(int32_t) (i & 0x7F));
+    str.push_str(" heap=0x");
+    str.push_hex(i * 2654435761U, 8);
+    str.push_str(" volts=");
+    str.push_fixed(f, 3);
+    str.push_str(" id=");
+    str.push_uuid(id);
+    str.push_escaped(" \"ok\"");
+    return str.length();
+}
+
+/* The best of three, as the host is shared. */
+static uint32_t bench_line(bool_t libc, uuid_kref_t id, kstring_t id_text)
+{
+    char_t line[LINE_LENGTH];
+    uint32_t i, sink = 0, ns, best = UINT32_MAX;
+    time_us_t started;
+    uint8_t round;
+
+    for (round = 0; round < 3; round++)
+    {
+        started = clock_micros();
+        for (i = 0; i < BENCH_LINES; i++)
+        {
+            sink += build_line(libc, i, line, id, id_text) + line[7];
+        }
+        ns = (uint32_t) ((uint64_t) (clock_micros() - started) * 1000 / BENCH_LINES);
+        if (ns < best) best = ns;
+    }
+    s_sink = sink;
+    return best;
+}
+
+void test_bench(void)
+{
+    char_t report[96], expected[LINE_LENGTH], actual[LINE_LENGTH];
+    uint32_t bufstr_ns, libc_ns, i;
+    uuid_t id;
+
+    uuid_to_binary(kIssueID, id);
+    for (i = 0; i < BENCH_LINES; i += 997)
+    {
+        TEST_ASSERT_EQUAL(build_line(true, i, expected, id, kIssueID),
+            build_line(false, i, actual, id, kIssueID));
+        TEST_ASSERT_EQUAL_STRING(expected, actual);
+    }
+
+    bufstr_ns = bench_line(false, id, kIssueID);
+    libc_ns = bench_line(true, id, kIssueID);
+
+    TEST_MESSAGE("            bufstr ns  snprintf ns");
+    snprintf(report, sizeof(report), "  line      %9u  %11u", bufstr_ns, libc_ns);
+    TEST_MESSAGE(report);
+}
+
+int main(int argc, char ** argv)
+{
+    UNITY_BEGIN();
+
+    RUN_TEST(test_push_long);
+    RUN_TEST(test_typed_sweep);
+    RUN_TEST(test_overflow_sticks);
+    RUN_TEST(test_no_buffer);
+    RUN_TEST(test_escaped_sweep);
+    RUN_TEST(test_bench);
+
+    return UNITY_END();
+}
+
+#endif /* UNIT_TEST */
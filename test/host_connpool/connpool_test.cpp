@@ -0,0 +1,251 @@
+/*
+ *  Module: Connection Pool - Host Test & Benchmark
+ *
+ *  Runs sequential HTTP requests against a local keep-alive
+ *  stand-in server, with and without connection reuse.
+ *
+ *  Author: Alex Dale @superoxigen
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for information.
+ */
+
+#ifdef UNIT_TEST
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "unity.h"
+#include "utils.h"
+
+#include "clock.h"
+#include "connpool.hpp"
+
+#define BENCH_REQUESTS      2000
+#define RESPONSE_LENGTH     (sizeof(kResponse) - 1)
+
+static char_t const kRequest[] =
+    "POST /patient/request1 HTTP/1.1\r\n"
+    "Host: 127.0.0.1\r\n"
+    "Content-Length: 0\r\n"
+    "\r\n";
+
+static char_t const kResponse[] =
+    "HTTP/1.1 201 Created\r\n"
+    "Content-Type: application/json\r\n"
+    "Content-Length: 51\r\n"
+    "\r\n"
+    "{\"issue_id\":\"0f8fad5b-d9cb-469f-a165-70867728950e\"}";
+
+static int listen_fd = -1;
+static uint16_t listen_port = 0;
+
+/* Server closes a connection after this many responses, 0 for never. */
+static volatile uint32_t server_close_after = 0;
+
+/*
+ *  Stand-in Server
+ */
+
+static void * serve_connection(void * arg)
+{
+    int fd = (int) (intptr_t) arg;
+    char_t buffer[512];
+    uint32_t served, matched;
+    ssize_t n, i;
+
+    served = matched = 0;
+    while ((n = recv(fd, buffer, sizeof(buffer), 0)) > 0)
+    {
+        /* A request ends with an empty line. */
+        for (i = 0; i < n; i++)
+        {
+            matched = (buffer[i] == "\r\n\r\n"[matched]) ? matched + 1
+                    : (buffer[i] == '\r') ? 1 : 0;
+            if (matched < 4) continue;
+            matched = 0;
+            send(fd, kResponse, RESPONSE_LENGTH, MSG_NOSIGNAL);
+            if (server_close_after && ++served >= server_close_after)
+            {
+                close(fd);
+                return NULL;
+            }
+        }
+    }
+    close(fd);
+    return NULL;
+}
+
+static void * serve(void *)
+{
+    pthread_t thread;
+    int fd;
+
+    while ((fd = accept(listen_fd, NULL, NULL)) >= 0)
+    {
+        pthread_create(&thread, NULL, serve_connection, (void *) (intptr_t) fd);
+        pthread_detach(thread);
+    }
+    return NULL;
+}
+
+static bool_t start_server(void)
+{
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    pthread_t thread;
+
+    listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (listen_fd < 0
+        || bind(listen_fd, (struct sockaddr *) &addr, sizeof(addr))
+        || listen(listen_fd, 128)
+        || getsockname(listen_fd, (struct sockaddr *) &addr, &addr_len))
+    {
+        return false;
+    }
+    listen_port = ntohs(addr.sin_port);
+    return !pthread_create(&thread, NULL, serve, NULL);
+}
+
+/*
+ *  Client
+ */
+
+static bool_t request(NetConn * conn)
+{
+    byte_t buffer[256];
+    uint16_t received;
+    int16_t n;
+
+    if (conn->write((byte_t const *) kRequest, sizeof(kRequest) - 1) < 0)
+    {
+        return false;
+    }
+    for (received = 0; received < RESPONSE_LENGTH; )
+    {
+        n = conn->read(buffer, sizeof(buffer));
+        if (n > 0)
+        {
+            received += n;
+        }
+        else if (!conn->connected())
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static int compare_u32(void const * a, void const * b)
+{
+    uint32_t x = *(uint32_t const *) a, y = *(uint32_t const *) b;
+    return (x > y) - (x < y);
+}
+
+static void bench(kstring_t name, bool_t keep_alive)
+{
+    static uint32_t latencies[BENCH_REQUESTS];
+    ConnPool * pool = ConnPool::get_instance();
+    NetConn * conn;
+    uint32_t i, start, total, sum;
+    char_t report[160];
+
+    sum = 0;
+    total = clock_micros();
+    for (i = 0; i < BENCH_REQUESTS; i++)
+    {
+        start = clock_micros();
+        conn = pool->acquire("127.0.0.1", listen_port);
+        TEST_ASSERT_NOT_NULL(conn);
+        TEST_ASSERT(request(conn));
+        pool->release(conn, keep_alive);
+        latencies[i] = clock_micros() - start;
+        sum += latencies[i];
+    }
+    total = clock_micros() - total;
+
+    qsort(latencies, BENCH_REQUESTS, sizeof(uint32_t), compare_u32);
+    snprintf(report, sizeof(report),
+        "%s: %u req/s, mean %u us, p50 %u us, p99 %u us",
+        name, (uint32_t) (BENCH_REQUESTS * 1000000ULL / total),
+        sum / BENCH_REQUESTS,
+        latencies[BENCH_REQUESTS / 2],
+        latencies[BENCH_REQUESTS * 99 / 100]);
+    TEST_MESSAGE(report);
+}
+
+/*
+ *  Test Cases
+ */
+
+void test_reuses_connection(void)
+{
+    ConnPool * pool = ConnPool::get_instance();
+    NetConn * first, * second;
+    bool_t reused;
+
+    first = pool->acquire("127.0.0.1", listen_port, &reused);
+    TEST_ASSERT_NOT_NULL(first);
+    TEST_ASSERT_FALSE(reused);
+    TEST_ASSERT(request(first));
+    pool->release(first, true);
+
+    second = pool->acquire("127.0.0.1", listen_port, &reused);
+    TEST_ASSERT(second == first);
+    TEST_ASSERT(reused);
+    pool->release(second, false);
+}
+
+void test_reconnects_after_server_close(void)
+{
+    ConnPool * pool = ConnPool::get_instance();
+    NetConn * conn;
+    bool_t reused;
+
+    server_close_after = 1;
+
+    conn = pool->acquire("127.0.0.1", listen_port);
+    TEST_ASSERT(request(conn));
+    pool->release(conn, true);
+    usleep(10000);
+
+    /* The health check notices the close and connects again. */
+    conn = pool->acquire("127.0.0.1", listen_port, &reused);
+    TEST_ASSERT_NOT_NULL(conn);
+    TEST_ASSERT_FALSE(reused);
+    TEST_ASSERT(request(conn));
+    pool->release(conn, false);
+
+    server_close_after = 0;
+}
+
+void test_bench_reuse(void)
+{
+    bench("without reuse", false);
+    bench("with reuse   ", true);
+    ConnPool::get_instance()->drop("127.0.0.1", listen_port);
+}
+
+int main(int argc, char ** argv)
+{
+    if (!start_server()) return 1;
+
+    UNITY_BEGIN();
+
+    RUN_TEST(test_reuses_connection);
+    RUN_TEST(test_reconnects_after_server_close);
+    RUN_TEST(test_bench_reuse);
+
+    return UNITY_END();
+}
+
+#endif /* UNIT_TEST */
@@ -0,0 +1,526 @@
+/*
+ *  Module: Dispatch - Host Test & Benchmark
+ *
+ *  Runs the Dispatcher over the loopback and over emulated networks,
+ *  on the host's virtual clock.  Checks that a failed host is failed
+ *  over, a timeout retried within the budget, the fast transports
+ *  tried only on an alert's first call, a slow attempt hedged, and
+ *  that a seeded network repeats.  Then compares the alert latency
+ *  percentiles of the retry and failover policies.
+ *
+ *  Author: Alex Dale @superoxigen
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for information.
+ */
+
+#ifdef UNIT_TEST
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "unity.h"
+#include "utils.h"
+
+#include "clock.h"
+#include "dispatch.hpp"
+#include "endpoints.hpp"
+#include "fake_transport.hpp"
+#include "scheduler.h"
+#include "transport.h"
+
+#define TEST_TIMEOUT_MS     5000
+#define TEST_BUDGET_MS      10000
+#define TEST_RETRY_MIN_MS   1500
+#define TEST_FAST_MS        1500
+
+#define BENCH_ALERTS        2000
+#define BENCH_SPACING_MS    30000
+#define BENCH_HEDGE_MS      100
+#define BENCH_SEED          42
+
+static fake_profile_t make_profile(uint32_t base_ms, uint32_t spread_ms)
+{
+    fake_profile_t profile;
+
+    memset(&profile, 0, sizeof(profile));
+    profile.distribution = FAKE_LATENCY_UNIFORM;
+    profile.base_ms = base_ms;
+    profile.spread_ms = spread_ms;
+    return profile;
+}
+
+static void make_alert(transport_alert_t * alert, byte_t id)
+{
+    memset(alert, 0, sizeof(transport_alert_t));
+    memset(alert->alert_id, id, UUID_BINARY_LENGTH);
+}
+
+/* Answers that it changed how it sends, then delivers. */
+static uint8_t s_changes;
+
+static transport_handle_t changing_start(
+    void * context, int8_t endpoint, transport_alert_t const * alert, time_ms_t deadline)
+{
+    return 0;
+}
+
+static transport_status_t changing_result(
+    void * context, transport_handle_t handle, byte_t * issue_id)
+{
+    if (s_changes)
+    {
+        s_changes--;
+        return TRANSPORT_RETRY;
+    }
+    memset(issue_id, 0xAA, UUID_BINARY_LENGTH);
+    return TRANSPORT_DELIVERED;
+}
+
+static void changing_cancel(void * context, transport_handle_t handle) {}
+
+static event_mask_t seen_events = 0;
+
+static uint8_t record_events(event_mask_t events, void * arg)
+{
+    seen_events |= events;
+    return TASK_EXIT_OK;
+}
+
+/*
+ *  Test Cases
+ */
+
+void test_loopback(void)
+{
+    Dispatcher dispatcher;
+    transport_alert_t alert;
+
+    dispatcher.init(NULL, TEST_BUDGET_MS, 0);
+    TEST_ASSERT(dispatcher.add(transport_loopback()));
+
+    make_alert(&alert, 0x11);
+    TEST_ASSERT_EQUAL(TRANSPORT_DELIVERED, dispatcher.send_alert(&alert));
+    TEST_ASSERT_EQUAL_MEMORY(alert.alert_id, alert.issue_id, UUID_BINARY_LENGTH);
+    TEST_ASSERT_FALSE(dispatcher.is_pending());
+    TEST_ASSERT_EQUAL(1, dispatcher.stats()->delivered);
+    TEST_ASSERT_EQUAL(1, dispatcher.stats()->by_transport[0]);
+
+    /* A transport that cannot be polled for its result is refused. */
+    transport_t broken = *transport_loopback();
+    broken.result = NULL;
+    TEST_ASSERT_FALSE(dispatcher.add(&broken));
+    TEST_ASSERT_EQUAL(1, dispatcher.count());
+}
+
+void test_latency(void)
+{
+    FakeTransport fake("http", TRANSPORT_FAILOVER, TEST_TIMEOUT_MS);
+    fake_profile_t profile = make_profile(50, 0);
+    Dispatcher dispatcher;
+    Endpoints endpoints;
+    transport_alert_t alert;
+    time_ms_t start;
+
+    endpoints.parse("a");
+    fake.set_profile(-1, &profile);
+    dispatcher.init(&endpoints, TEST_BUDGET_MS, TEST_RETRY_MIN_MS);
+    dispatcher.add(fake.transport());
+
+    make_alert(&alert, 0x22);
+    start = clock_millis();
+    TEST_ASSERT_EQUAL(TRANSPORT_DELIVERED, dispatcher.send_alert(&alert));
+    TEST_ASSERT_EQUAL(50, clock_millis() - start);
+    TEST_ASSERT_EQUAL(start, dispatcher.started());
+    TEST_ASSERT_EQUAL_MEMORY(alert.alert_id, alert.issue_id, UUID_BINARY_LENGTH);
+    TEST_ASSERT_EQUAL(50, endpoints.get(0)->srtt_ms);
+}
+
+void test_failover(void)
+{
+    FakeTransport fake("http", TRANSPORT_FAILOVER, TEST_TIMEOUT_MS);
+    fake_profile_t profile = make_profile(20, 0);
+    Dispatcher dispatcher;
+    Endpoints endpoints;
+    transport_alert_t alert;
+    time_ms_t start;
+
+    endpoints.parse("a,b,c");
+    fake.set_profile(-1, &profile);
+    fake.profile(0)->down = true;
+    fake.profile(1)->error_permille = 1000;
+    dispatcher.init(&endpoints, TEST_BUDGET_MS, TEST_RETRY_MIN_MS);
+    dispatcher.add(fake.transport());
+
+    /* Refused at once, then a server error, then delivered. */
+    make_alert(&alert, 0x33);
+    start = clock_millis();
+    TEST_ASSERT_EQUAL(TRANSPORT_DELIVERED, dispatcher.send_alert(&alert));
+    TEST_ASSERT_EQUAL(40, clock_millis() - start);
+    TEST_ASSERT_EQUAL(1, fake.stats()->refused);
+    TEST_ASSERT_EQUAL(1, fake.stats()->errors);
+    TEST_ASSERT_EQUAL(1, fake.stats()->attempts[2]);
+    TEST_ASSERT_EQUAL(2, dispatcher.stats()->retries);
+    TEST_ASSERT_FALSE(endpoints.is_healthy(0));
+    TEST_ASSERT_FALSE(endpoints.is_healthy(1));
+
+    /* The next goes straight to the one that answered. */
+    make_alert(&alert, 0x34);
+    TEST_ASSERT_EQUAL(TRANSPORT_DELIVERED, dispatcher.send_alert(&alert));
+    TEST_ASSERT_EQUAL(2, fake.stats()->attempts[2]);
+    TEST_ASSERT_EQUAL(1, fake.stats()->attempts[0]);
+}
+
+void test_budget(void)
+{
+    FakeTransport fake("http", TRANSPORT_FAILOVER, TEST_TIMEOUT_MS);
+    fake_profile_t profile = make_profile(20, 0);
+    Dispatcher dispatcher;
+    Endpoints endpoints;
+    transport_alert_t alert;
+    time_ms_t start;
+
+    endpoints.parse("a");
+    profile.loss_permille = 1000;
+    fake.set_profile(-1, &profile);
+    dispatcher.init(&endpoints, TEST_BUDGET_MS, TEST_RETRY_MIN_MS);
+    dispatcher.add(fake.transport());
+
+    /* Two timeouts spend it, with too little left for a third. */
+    make_alert(&alert, 0x44);
+    start = clock_millis();
+    TEST_ASSERT_EQUAL(TRANSPORT_TIMEOUT, dispatcher.send_alert(&alert));
+    TEST_ASSERT_EQUAL(TEST_BUDGET_MS, clock_millis() - start);
+    TEST_ASSERT_EQUAL(2, dispatcher.stats()->attempts);
+    TEST_ASSERT(dispatcher.is_pending());
+
+    /* Called again, the same alert gets a new budget. */
+    fake.profile(0)->loss_permille = 0;
+    TEST_ASSERT_EQUAL(TRANSPORT_DELIVERED, dispatcher.send_alert(&alert));
+    TEST_ASSERT_EQUAL(start + TEST_BUDGET_MS, dispatcher.started());
+    TEST_ASSERT_EQUAL(1, dispatcher.stats()->alerts);
+    TEST_ASSERT_FALSE(dispatcher.is_pending());
+}
+
+void test_fast_first(void)
+{
+    FakeTransport fast("udp", TRANSPORT_FAST, TEST_FAST_MS);
+    FakeTransport slow("http", TRANSPORT_FAILOVER, TEST_TIMEOUT_MS);
+    fake_profile_t lost = make_profile(20, 0);
+    Dispatcher dispatcher;
+    Endpoints endpoints;
+    transport_alert_t alert;
+    time_ms_t start;
+
+    endpoints.parse("a");
+    lost.loss_permille = 1000;
+    fast.set_profile(-1, &lost);
+    slow.set_profile(-1, &lost);
+    dispatcher.init(&endpoints, TEST_BUDGET_MS, TEST_RETRY_MIN_MS);
+    dispatcher.add(fast.transport());
+    dispatcher.add(slow.transport());
+
+    /* The fast path's wait comes out of the same budget. */
+    make_alert(&alert, 0x55);
+    start = clock_millis();
+    TEST_ASSERT_EQUAL(TRANSPORT_TIMEOUT, dispatcher.send_alert(&alert));
+    TEST_ASSERT_EQUAL(TEST_BUDGET_MS, clock_millis() - start);
+    TEST_ASSERT_EQUAL(1, fast.stats()->attempts[0]);
+    TEST_ASSERT_EQUAL(2, slow.stats()->attempts[0]);
+
+    /* Once unanswered, it is not tried again for the alert. */
+    slow.profile(0)->loss_permille = 0;
+    TEST_ASSERT_EQUAL(TRANSPORT_DELIVERED, dispatcher.send_alert(&alert));
+    TEST_ASSERT_EQUAL(1, fast.stats()->attempts[0]);
+    TEST_ASSERT_EQUAL(1, dispatcher.stats()->by_transport[1]);
+
+    /* Only the timeouts over HTTP are blamed on the host, not the fast path's. */
+    TEST_ASSERT_EQUAL(2, endpoints.get(0)->failed);
+}
+
+void test_hedge(void)
+{
+    FakeTransport fake("http", TRANSPORT_FAILOVER | TRANSPORT_HEDGED, TEST_TIMEOUT_MS);
+    fake_profile_t profile = make_profile(80, 0);
+    Dispatcher dispatcher;
+    Endpoints endpoints;
+    transport_alert_t alert;
+    time_ms_t start;
+
+    endpoints.parse("a,b");
+    endpoints.set_hedge(BENCH_HEDGE_MS);
+    fake.set_profile(-1, &profile);
+    fake.profile(0)->base_ms = 2000;
+    dispatcher.init(&endpoints, TEST_BUDGET_MS, TEST_RETRY_MIN_MS);
+    dispatcher.add(fake.transport());
+
+    make_alert(&alert, 0x66);
+    start = clock_millis();
+    TEST_ASSERT_EQUAL(TRANSPORT_DELIVERED, dispatcher.send_alert(&alert));
+    TEST_ASSERT_EQUAL(BENCH_HEDGE_MS + 80, clock_millis() - start);
+    TEST_ASSERT_EQUAL(1, dispatcher.stats()->hedges);
+    TEST_ASSERT_EQUAL(1, dispatcher.stats()->hedges_won);
+    TEST_ASSERT_EQUAL(1, fake.stats()->cancelled);
+
+    /* The slow host was outrun, not failed, and the fast one is next. */
+    TEST_ASSERT(endpoints.is_healthy(0));
+    TEST_ASSERT_EQUAL(BENCH_HEDGE_MS + 80, endpoints.get(0)->srtt_ms);
+    TEST_ASSERT_EQUAL(1, endpoints.pick());
+}
+
+void test_changed(void)
+{
+    transport_t changing = {
+        "changing", TRANSPORT_FAILOVER, TEST_TIMEOUT_MS,
+        changing_start, changing_result, changing_cancel, NULL, NULL
+    };
+    Dispatcher dispatcher;
+    transport_alert_t alert;
+
+    dispatcher.init(NULL, TEST_BUDGET_MS, TEST_RETRY_MIN_MS);
+    dispatcher.add(&changing);
+
+    s_changes = 1;
+    make_alert(&alert, 0x77);
+    TEST_ASSERT_EQUAL(TRANSPORT_DELIVERED, dispatcher.send_alert(&alert));
+    TEST_ASSERT_EQUAL(2, dispatcher.stats()->attempts);
+    TEST_ASSERT_EQUAL_HEX8(0xAA, alert.issue_id[0]);
+
+    /* Only once: a transport that keeps changing is not looped on. */
+    s_changes = 3;
+    make_alert(&alert, 0x78);
+    TEST_ASSERT_EQUAL(TRANSPORT_RETRY, dispatcher.send_alert(&alert));
+    TEST_ASSERT_EQUAL(4, dispatcher.stats()->attempts);
+}
+
+void test_stepped(void)
+{
+    FakeTransport fake("http", TRANSPORT_FAILOVER, TEST_TIMEOUT_MS);
+    fake_profile_t profile = make_profile(50, 0);
+    Dispatcher dispatcher;
+    Endpoints endpoints;
+    transport_alert_t alert;
+    time_ms_t start;
+
+    endpoints.parse("a");
+    fake.set_profile(-1, &profile);
+    dispatcher.init(&endpoints, TEST_BUDGET_MS, TEST_RETRY_MIN_MS);
+    dispatcher.add(fake.transport());
+
+    seen_events = 0;
+    scheduler_init();
+    scheduler_on_event_callback(TASK_PRIORITY_HIGHEST, DISPATCH_EVENT_DONE, record_events, NULL);
+
+    /* Started, and polled without ever waiting on the transport. */
+    make_alert(&alert, 0x88);
+    start = clock_millis();
+    TEST_ASSERT(dispatcher.start(&alert, DISPATCH_EVENT_DONE));
+    TEST_ASSERT_FALSE(dispatcher.start(&alert, DISPATCH_EVENT_DONE));
+    dispatcher.poll();
+    TEST_ASSERT_EQUAL(start, clock_millis());
+    TEST_ASSERT_EQUAL(TRANSPORT_PENDING, dispatcher.result(alert.issue_id));
+
+    /* Its end is signalled, and its result collected once. */
+    while (!seen_events && clock_millis() - start < TEST_BUDGET_MS)
+    {
+        clock_delay(1);
+        dispatcher.poll();
+        scheduler_loop();
+    }
+    TEST_ASSERT_EQUAL(DISPATCH_EVENT_DONE, seen_events);
+    TEST_ASSERT_EQUAL(50, endpoints.get(0)->srtt_ms);
+    TEST_ASSERT_EQUAL(TRANSPORT_DELIVERED, dispatcher.result(alert.issue_id));
+    TEST_ASSERT_EQUAL_MEMORY(alert.alert_id, alert.issue_id, UUID_BINARY_LENGTH);
+    TEST_ASSERT_EQUAL(TRANSPORT_UNAVAILABLE, dispatcher.result(alert.issue_id));
+
+    /* One cancelled in flight abandons the attempt, unsignalled. */
+    seen_events = 0;
+    make_alert(&alert, 0x89);
+    TEST_ASSERT(dispatcher.start(&alert, DISPATCH_EVENT_DONE));
+    dispatcher.poll();
+    dispatcher.cancel();
+    scheduler_loop();
+    TEST_ASSERT_EQUAL(1, fake.stats()->cancelled);
+    TEST_ASSERT_FALSE(dispatcher.is_pending());
+    TEST_ASSERT_FALSE(dispatcher.is_running());
+    TEST_ASSERT_EQUAL(0, seen_events);
+}
+
+/* The latency of each of a run of alerts, over an exponential network with losses. */
+static void run_seeded(uint32_t seed, uint32_t * latencies, uint8_t count)
+{
+    FakeTransport fake("http", TRANSPORT_FAILOVER, TEST_TIMEOUT_MS);
+    fake_profile_t profile = make_profile(30, 40);
+    Dispatcher dispatcher;
+    Endpoints endpoints;
+    transport_alert_t alert;
+    time_ms_t start;
+    uint8_t i;
+
+    endpoints.parse("a,b");
+    profile.distribution = FAKE_LATENCY_EXPONENTIAL;
+    profile.loss_permille = 50;
+    fake.set_profile(-1, &profile);
+    fake.seed(seed);
+    dispatcher.init(&endpoints, TEST_BUDGET_MS, TEST_RETRY_MIN_MS);
+    dispatcher.add(fake.transport());
+
+    for (i = 0; i < count; i++)
+    {
+        make_alert(&alert, i);
+        start = clock_millis();
+        dispatcher.send_alert(&alert);
+        latencies[i] = clock_millis() - start;
+    }
+}
+
+void test_seeded(void)
+{
+    uint32_t first[50], again[50], other[50];
+
+    run_seeded(7, first, 50);
+    run_seeded(7, again, 50);
+    run_seeded(8, other, 50);
+    TEST_ASSERT_EQUAL_MEMORY(first, again, sizeof(first));
+    TEST_ASSERT(memcmp(first, other, sizeof(first)));
+}
+
+/*
+ *  Benchmark
+ *
+ *  Alerts every 30 s of virtual time over three hosts: a fast one
+ *  with a slow tail, losses and errors, which goes dark for a quarter
+ *  of the run, a slower steady one, and a slower still.  Each policy
+ *  gets the same seed.  An alert that is not delivered within its
+ *  budget counts with the whole of it.
+ */
+
+typedef enum {
+    POLICY_SINGLE,          /* The first host only */
+    POLICY_FAILOVER,        /* The fastest healthy host, failing over */
+    POLICY_HEDGED,          /* As above, hedging a slow attempt */
+    POLICY_FAST_HEDGED      /* As above, after an attempt over a fast path */
+} policy_t;
+
+static int compare_latency(void const * a, void const * b)
+{
+    uint32_t x = *(uint32_t const *) a;
+    uint32_t y = *(uint32_t const *) b;
+    return (x > y) - (x < y);
+}
+
+static void bench_run(policy_t policy, uint32_t * latencies, uint32_t * failed, uint32_t * attempts)
+{
+    FakeTransport fast("udp", TRANSPORT_FAST, TEST_FAST_MS);
+    FakeTransport http("http", TRANSPORT_FAILOVER | TRANSPORT_HEDGED, TEST_TIMEOUT_MS);
+    fake_profile_t profile;
+    Dispatcher dispatcher;
+    Endpoints endpoints;
+    transport_alert_t alert;
+    time_ms_t start;
+    uint32_t i;
+
+    endpoints.parse((policy == POLICY_SINGLE) ? "a" : "a,b,c");
+    if (policy >= POLICY_HEDGED)
+    {
+        endpoints.set_hedge(BENCH_HEDGE_MS);
+    }
+
+    profile = make_profile(30, 20);
+    profile.distribution = FAKE_LATENCY_EXPONENTIAL;
+    profile.slow_permille = 30;
+    profile.slow_ms = 1500;
+    profile.loss_permille = 10;
+    profile.error_permille = 10;
+    http.set_profile(0, &profile);
+    profile = make_profile(70, 40);
+    profile.loss_permille = 10;
+    http.set_profile(1, &profile);
+    profile = make_profile(150, 50);
+    http.set_profile(2, &profile);
+    http.seed(BENCH_SEED);
+
+    /* Blocked on some networks, so lost one time in five. */
+    profile = make_profile(20, 10);
+    profile.loss_permille = 200;
+    fast.set_profile(-1, &profile);
+    fast.seed(BENCH_SEED);
+
+    dispatcher.init(&endpoints, TEST_BUDGET_MS, TEST_RETRY_MIN_MS);
+    if (policy == POLICY_FAST_HEDGED)
+    {
+        dispatcher.add(fast.transport());
+    }
+    dispatcher.add(http.transport());
+
+    *failed = 0;
+    for (i = 0; i < BENCH_ALERTS; i++)
+    {
+        if (i == BENCH_ALERTS / 4) http.profile(0)->loss_permille = 1000;
+        if (i == BENCH_ALERTS / 2) http.profile(0)->loss_permille = 10;
+
+        make_alert(&alert, (byte_t) i);
+        start = clock_millis();
+        if (dispatcher.send_alert(&alert) != TRANSPORT_DELIVERED)
+        {
+            (*failed)++;
+            /* Given up on, as the manager would after its tries. */
+            while (dispatcher.is_pending() && dispatcher.send_alert(&alert) != TRANSPORT_DELIVERED
+                && clock_millis() - start < 4 * TEST_BUDGET_MS) {}
+        }
+        latencies[i] = clock_millis() - start;
+        clock_delay(BENCH_SPACING_MS);
+    }
+    *attempts = dispatcher.stats()->attempts + fast.stats()->attempts[0];
+
+    qsort(latencies, BENCH_ALERTS, sizeof(latencies[0]), compare_latency);
+}
+
+void test_bench_policies(void)
+{
+    static kstring_t const names[] = {"single host", "failover", "hedged", "fast path + hedged"};
+    static uint32_t latencies[BENCH_ALERTS];
+    uint32_t p99[4], failed, attempts;
+    char_t report[192];
+    uint8_t p;
+
+    for (p = 0; p < 4; p++)
+    {
+        bench_run((policy_t) p, latencies, &failed, &attempts);
+        p99[p] = latencies[BENCH_ALERTS * 99 / 100];
+
+        snprintf(report, sizeof(report),
+            "%s: p50 %u ms, p90 %u ms, p99 %u ms, p99.9 %u ms, max %u ms, "
+            "%u not delivered first call, %u.%02u attempts per alert",
+            names[p], latencies[BENCH_ALERTS / 2], latencies[BENCH_ALERTS * 9 / 10], p99[p],
+            latencies[BENCH_ALERTS * 999 / 1000], latencies[BENCH_ALERTS - 1], failed,
+            attempts / BENCH_ALERTS, (attempts * 100 / BENCH_ALERTS) % 100);
+        TEST_MESSAGE(report);
+    }
+
+    TEST_ASSERT(p99[POLICY_FAILOVER] <= p99[POLICY_SINGLE]);
+    TEST_ASSERT(p99[POLICY_HEDGED] <= p99[POLICY_FAILOVER]);
+}
+
+int main(int argc, char ** argv)
+{
+    UNITY_BEGIN();
+
+    clock_set_virtual(true);
+
+    RUN_TEST(test_loopback);
+    RUN_TEST(test_latency);
+    RUN_TEST(test_failover);
+    RUN_TEST(test_budget);
+    RUN_TEST(test_fast_first);
+    RUN_TEST(test_hedge);
+    RUN_TEST(test_changed);
+    RUN_TEST(test_stepped);
+    RUN_TEST(test_seeded);
+    RUN_TEST(test_bench_policies);
+
+    return UNITY_END();
+}
+
+#endif /* UNIT_TEST */
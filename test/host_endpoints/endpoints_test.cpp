@@ -0,0 +1,298 @@
+/*
+ *  Module: Endpoints - Host Test & Benchmark
+ *
+ *  Checks the host list is read, that the fastest healthy host is
+ *  picked and a failed one skipped until its backoff is over, and
+ *  when a request is hedged.  Then compares a fixed host with picking
+ *  the fastest, and with hedging too, over simulated hosts.
+ *
+ *  Author: Alex Dale @superoxigen
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for information.
+ */
+
+#ifdef UNIT_TEST
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "unity.h"
+#include "utils.h"
+
+#include "clock.h"
+#include "endpoints.hpp"
+
+#define SIM_REQUESTS        4000
+#define SIM_TIMEOUT_MS      5000
+#define SIM_BUDGET_MS       10000
+#define SIM_RETRY_MIN_MS    1500
+#define SIM_HEDGE_MS        100
+
+/*
+ *  Test Cases
+ */
+
+void test_parse(void)
+{
+    Endpoints endpoints;
+
+    TEST_ASSERT_EQUAL(3, endpoints.parse(" a.example.com, b.example.com:8443 ,c.example.com"));
+    TEST_ASSERT_EQUAL_STRING("a.example.com", endpoints.host(0));
+    TEST_ASSERT_EQUAL_STRING("b.example.com", endpoints.host(1));
+    TEST_ASSERT_EQUAL_STRING("c.example.com", endpoints.host(2));
+    TEST_ASSERT_EQUAL(80, endpoints.port(0, 80));
+    TEST_ASSERT_EQUAL(8443, endpoints.port(1, 80));
+    TEST_ASSERT_NULL(endpoints.host(3));
+
+    /* Bad ports, empty entries and overlong hosts are skipped. */
+    TEST_ASSERT_EQUAL(1, endpoints.parse("a:99999,,b:,c:8x,d:0,"
+        "0123456789012345678901234567890123456789012345678901234567890123456789,e:1"));
+    TEST_ASSERT_EQUAL_STRING("e", endpoints.host(0));
+    TEST_ASSERT_EQUAL(1, endpoints.port(0, 80));
+
+    TEST_ASSERT_EQUAL(ENDPOINTS_MAX, endpoints.parse("a,b,c,d,e,f"));
+    TEST_ASSERT_EQUAL(0, endpoints.parse(NULL));
+    TEST_ASSERT_EQUAL(-1, endpoints.pick());
+}
+
+void test_pick_fastest(void)
+{
+    Endpoints endpoints;
+
+    endpoints.parse("a,b,c");
+
+    /* Untimed hosts go in list order. */
+    TEST_ASSERT_EQUAL(0, endpoints.pick());
+    TEST_ASSERT_EQUAL(1, endpoints.pick(0));
+
+    endpoints.succeeded(0, 200);
+    endpoints.succeeded(1, 50);
+    TEST_ASSERT_EQUAL(1, endpoints.pick());
+    endpoints.succeeded(2, 20);
+    TEST_ASSERT_EQUAL(2, endpoints.pick());
+    TEST_ASSERT_EQUAL(1, endpoints.pick(2));
+
+    /* A host outrun by a hedge is taken to be at least that slow. */
+    endpoints.outrun(2, 10);
+    TEST_ASSERT_EQUAL(20, endpoints.get(2)->srtt_ms);
+    endpoints.outrun(2, 1000);
+    TEST_ASSERT_EQUAL(1, endpoints.pick());
+    TEST_ASSERT_EQUAL(0, endpoints.get(2)->failures);
+}
+
+void test_failover(void)
+{
+    Endpoints endpoints;
+    time_ms_t now;
+    uint8_t i;
+
+    endpoints.parse("a,b");
+    endpoints.succeeded(0, 20);
+    endpoints.succeeded(1, 80);
+
+    endpoints.failed(0);
+    TEST_ASSERT_FALSE(endpoints.is_healthy(0));
+    TEST_ASSERT_EQUAL(1, endpoints.pick());
+
+    /* With none healthy, the one back soonest, but no second. */
+    endpoints.failed(1);
+    endpoints.failed(1);
+    TEST_ASSERT_EQUAL(0, endpoints.pick());
+    TEST_ASSERT_EQUAL(-1, endpoints.pick(0));
+
+    /* The backoff doubles up to its most. */
+    for (i = 0; i < 20; i++) endpoints.failed(0);
+    now = clock_millis();
+    TEST_ASSERT(endpoints.get(0)->down_until - now <= ENDPOINTS_BACKOFF_MAX_MS);
+    TEST_ASSERT(endpoints.get(0)->down_until - now > ENDPOINTS_BACKOFF_MAX_MS - 50);
+    TEST_ASSERT_EQUAL(21, endpoints.get(0)->failed);
+}
+
+void test_recovery(void)
+{
+    Endpoints endpoints;
+
+    endpoints.parse("a,b");
+    endpoints.failed(0);
+    TEST_ASSERT_EQUAL(1, endpoints.pick());
+
+    clock_delay(ENDPOINTS_BACKOFF_MIN_MS + 50);
+    TEST_ASSERT(endpoints.is_healthy(0));
+    TEST_ASSERT_EQUAL(0, endpoints.pick());
+
+    endpoints.succeeded(0, 30);
+    TEST_ASSERT_EQUAL(0, endpoints.get(0)->failures);
+}
+
+void test_hedge_after(void)
+{
+    Endpoints endpoints;
+    uint8_t i;
+
+    endpoints.parse("a,b");
+    TEST_ASSERT_EQUAL(0, endpoints.hedge_after_ms(0));
+
+    endpoints.set_hedge(100);
+    TEST_ASSERT_EQUAL(100, endpoints.hedge_after_ms(0));
+
+    /* Past nearly all its answers: 40 + 4 * 20. */
+    endpoints.succeeded(0, 40);
+    TEST_ASSERT_EQUAL(120, endpoints.hedge_after_ms(0));
+
+    /* Steady answers bring it down to the least set. */
+    for (i = 0; i < 30; i++) endpoints.succeeded(0, 40);
+    TEST_ASSERT_EQUAL(100, endpoints.hedge_after_ms(0));
+}
+
+/*
+ *  Benchmark
+ *
+ *  Each simulated request takes a host's latency, drawn the same for
+ *  every policy, or SIM_TIMEOUT_MS if the host does not answer.  The
+ *  simulation runs far faster than the backoff, so a failed host is
+ *  skipped for the rest of it, as over an outage of some minutes.
+ */
+
+typedef enum {
+    POLICY_FIXED,
+    POLICY_FASTEST,
+    POLICY_HEDGED
+} policy_t;
+
+typedef enum {
+    SCENARIO_OUTAGE,        /* The first host stops answering */
+    SCENARIO_TAIL           /* The first host is fast but at times very slow */
+} scenario_t;
+
+static uint32_t sim_random(uint32_t * state)
+{
+    *state = *state * 1103515245UL + 12345UL;
+    return (*state >> 8) & 0xFFFF;
+}
+
+/* Latency of the host for the request, or SIM_TIMEOUT_MS. */
+static uint32_t sim_latency(scenario_t scenario, uint8_t host, uint32_t request, uint32_t * state)
+{
+    uint32_t r = sim_random(state);
+
+    switch (host)
+    {
+        case 0:
+            if (scenario == SCENARIO_OUTAGE && request >= SIM_REQUESTS / 4) return SIM_TIMEOUT_MS;
+            if (scenario == SCENARIO_TAIL && r % 100 < 5) return 1500 + r % 500;
+            return 40 + r % 20;
+        case 1:
+            return 80 + r % 30;
+        default:
+            return 150 + r % 50;
+    }
+}
+
+/* Sends one request, trying again as Messenger does, and returns how long it took. */
+static uint32_t sim_request(
+    Endpoints * endpoints, policy_t policy, scenario_t scenario,
+    uint32_t request, uint32_t * state)
+{
+    uint32_t total, latency, hedge_latency, hedge_after;
+    int8_t host, hedge;
+
+    total = 0;
+    while (total + SIM_RETRY_MIN_MS <= SIM_BUDGET_MS)
+    {
+        host = (policy == POLICY_FIXED) ? 0 : endpoints->pick();
+        latency = sim_latency(scenario, (uint8_t) host, request, state);
+        hedge_after = (policy == POLICY_HEDGED) ? endpoints->hedge_after_ms(host) : 0;
+
+        hedge = (hedge_after && latency > hedge_after) ? endpoints->pick(host) : -1;
+        if (hedge >= 0)
+        {
+            hedge_latency = sim_latency(scenario, (uint8_t) hedge, request, state);
+            if (hedge_latency < SIM_TIMEOUT_MS && hedge_after + hedge_latency < latency)
+            {
+                endpoints->succeeded(hedge, hedge_latency);
+                endpoints->outrun(host, hedge_after + hedge_latency);
+                return total + hedge_after + hedge_latency;
+            }
+        }
+
+        if (latency < SIM_TIMEOUT_MS)
+        {
+            endpoints->succeeded(host, latency);
+            return total + latency;
+        }
+
+        endpoints->failed(host);
+        if (hedge >= 0) endpoints->failed(hedge);
+        total += SIM_TIMEOUT_MS;
+    }
+    return total;
+}
+
+static int compare_latency(void const * a, void const * b)
+{
+    uint32_t x = *(uint32_t const *) a;
+    uint32_t y = *(uint32_t const *) b;
+    return (x > y) - (x < y);
+}
+
+static void sim_run(scenario_t scenario, policy_t policy, uint32_t * p50, uint32_t * p99)
+{
+    static uint32_t latencies[SIM_REQUESTS];
+    Endpoints endpoints;
+    uint32_t state, i;
+
+    endpoints.parse("a,b,c");
+    endpoints.set_hedge(SIM_HEDGE_MS);
+    state = 42;
+    for (i = 0; i < SIM_REQUESTS; i++)
+    {
+        latencies[i] = sim_request(&endpoints, policy, scenario, i, &state);
+    }
+
+    qsort(latencies, SIM_REQUESTS, sizeof(latencies[0]), compare_latency);
+    *p50 = latencies[SIM_REQUESTS / 2];
+    *p99 = latencies[SIM_REQUESTS * 99 / 100];
+}
+
+void test_bench_policies(void)
+{
+    static kstring_t const scenarios[] = {"outage", "slow tail"};
+    uint32_t p50[3], p99[3];
+    char_t report[192];
+    uint8_t s, p;
+
+    for (s = 0; s < 2; s++)
+    {
+        for (p = 0; p < 3; p++)
+        {
+            sim_run((scenario_t) s, (policy_t) p, &p50[p], &p99[p]);
+        }
+
+        snprintf(report, sizeof(report),
+            "%s: fixed p50 %u ms p99 %u ms, fastest p50 %u ms p99 %u ms, "
+            "hedged p50 %u ms p99 %u ms",
+            scenarios[s], p50[0], p99[0], p50[1], p99[1], p50[2], p99[2]);
+        TEST_MESSAGE(report);
+
+        TEST_ASSERT(p99[1] <= p99[0]);
+        TEST_ASSERT(p99[2] <= p99[1]);
+    }
+}
+
+int main(int argc, char ** argv)
+{
+    UNITY_BEGIN();
+
+    RUN_TEST(test_parse);
+    RUN_TEST(test_pick_fastest);
+    RUN_TEST(test_failover);
+    RUN_TEST(test_recovery);
+    RUN_TEST(test_hedge_after);
+    RUN_TEST(test_bench_policies);
+
+    return UNITY_END();
+}
+
+#endif /* UNIT_TEST */
@@ -0,0 +1,932 @@
+/*
+ *  Module: HTTPer - Host Test, Fuzz & Benchmark
+ *
+ *  Checks the HTTP wire parser on well formed, split and mangled
+ *  responses, and URL encoding through the writer, then runs HTTPer
+ *  against a local stand-in server.
+ *
+ *  Author: Alex Dale @superoxigen
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for information.
+ */
+
+#ifdef UNIT_TEST
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "unity.h"
+#include "utils.h"
+
+#include "clock.h"
+#include "connpool.hpp"
+#include "httper.hpp"
+#include "httpwire.h"
+#include "resolver.hpp"
+#include "scheduler.h"
+#include "smlstr.h"
+
+#define BODY_BUFFER_LENGTH  512
+#define FUZZ_ROUNDS         20000
+#define BENCH_PARSES        200000
+#define BENCH_REQUESTS      2000
+#define SERVER_DELAY_US     50000
+#define DEADLINE_MS         100
+#define SLOW_LOOKUP_US      150000
+
+#define EVENT_HELP_DONE     0x02
+#define EVENT_UPLOAD_DONE   0x04
+
+static char_t const kIssueBody[] =
+    "{\"issue_id\":\"0f8fad5b-d9cb-469f-a165-70867728950e\"}";
+
+static char_t const kLengthResponse[] =
+    "HTTP/1.1 201 Created\r\n"
+    "Content-Type: application/json\r\n"
+    "Content-Length: 51\r\n"
+    "\r\n"
+    "{\"issue_id\":\"0f8fad5b-d9cb-469f-a165-70867728950e\"}";
+
+static char_t const kChunkedResponse[] =
+    "HTTP/1.1 200 OK\r\n"
+    "transfer-encoding: gzip, Chunked\r\n"
+    "Connection: keep-alive\r\n"
+    "\r\n"
+    "d;name=value\r\n"
+    "{\"issue_id\":\"\r\n"
+    "26\r\n"
+    "0f8fad5b-d9cb-469f-a165-70867728950e\"}\r\n"
+    "0\r\n"
+    "Trailer: ignored\r\n"
+    "\r\n";
+
+/* A binary reply: version, type and the 16 bytes of the issue ID. */
+static char_t const kTypedResponse[] =
+    "HTTP/1.1 201 Created\r\n"
+    "Content-Type: Application/Vnd.Pendant.V1; charset=binary\r\n"
+    "Content-Length: 18\r\n"
+    "\r\n"
+    "\x01\x81\x0f\x8f\xad\x5b\xd9\xcb\x46\x9f\xa1\x65\x70\x86\x77\x28\x95\x0e";
+
+static char_t const kUnsupportedResponse[] =
+    "HTTP/1.1 415 Unsupported Media Type\r\n"
+    "Content-Length: 0\r\n"
+    "\r\n";
+
+static char_t const kCloseResponse[] =
+    "HTTP/1.1 100 Continue\r\n"
+    "\r\n"
+    "HTTP/1.0 200 OK\n"
+    "Server: stand-in\n"
+    "\n"
+    "{\"issue_id\":\"0f8fad5b-d9cb-469f-a165-70867728950e\"}";
+
+/*
+ *  Parser Helpers
+ */
+
+typedef struct {
+    char_t data[BODY_BUFFER_LENGTH];
+    uint16_t length;
+    uint16_t limit;
+} body_t;
+
+static bool_t collect(void * context, byte_t const * data, uint16_t length)
+{
+    body_t * body = (body_t *) context;
+
+    if ((body->length + length) > body->limit) return false;
+    memcpy(&body->data[body->length], data, length);
+    body->length += length;
+    body->data[body->length] = 0;
+    return true;
+}
+
+static void init_body(body_t * body)
+{
+    body->length = 0;
+    body->limit = BODY_BUFFER_LENGTH - 1;
+    body->data[0] = 0;
+}
+
+/* Feeds the response in pieces of at most `step` bytes. */
+static httpwire_status_t parse(
+    httpwire_parser_t * parser, body_t * body,
+    byte_t const * data, uint16_t length, uint16_t step, bool_t close)
+{
+    httpwire_status_t status;
+    uint16_t i, n;
+
+    init_body(body);
+    httpwire_parser_init(parser, collect, body);
+
+    status = HTTPWIRE_MORE;
+    for (i = 0; i < length && status == HTTPWIRE_MORE; i += n)
+    {
+        n = ((length - i) < step) ? (length - i) : step;
+        status = httpwire_feed(parser, &data[i], n);
+    }
+    return close ? httpwire_finish(parser) : status;
+}
+
+static httpwire_status_t parse_str(
+    httpwire_parser_t * parser, body_t * body, kstring_t response, uint16_t step)
+{
+    return parse(parser, body, (byte_t const *) response, strlen(response), step, false);
+}
+
+/*
+ *  Stand-in Server
+ */
+
+static int listen_fd = -1;
+static uint16_t listen_port = 0;
+
+/* Response sent to every request, and the last request seen. */
+static kstring_t volatile server_response = kLengthResponse;
+static char_t last_request[1024];
+static uint32_t volatile server_delay_us = 0;
+
+/* Length of a whole request in the buffer, or 0 if incomplete. */
+static uint16_t request_length(char_t const * buffer, uint16_t length)
+{
+    char_t const * end, * content_length;
+    uint16_t header_length;
+
+    end = (char_t const *) memmem(buffer, length, "\r\n\r\n", 4);
+    if (!end) return 0;
+    header_length = (end - buffer) + 4;
+
+    content_length = (char_t const *) memmem(buffer, header_length, "Content-Length: ", 16);
+    if (!content_length) return header_length;
+    header_length += atoi(content_length + 16);
+    return (header_length <= length) ? header_length : 0;
+}
+
+static void * serve_connection(void * arg)
+{
+    int fd = (int) (intptr_t) arg;
+    char_t buffer[2048];
+    uint16_t length, used;
+    ssize_t n;
+
+    length = 0;
+    while ((n = recv(fd, &buffer[length], sizeof(buffer) - length - 1, 0)) > 0)
+    {
+        length += n;
+        while ((used = request_length(buffer, length)) > 0)
+        {
+            memcpy(last_request, buffer, used);
+            last_request[used] = 0;
+            if (server_delay_us) usleep(server_delay_us);
+            send(fd, server_response, strlen(server_response), MSG_NOSIGNAL);
+            memmove(buffer, &buffer[used], length - used);
+            length -= used;
+        }
+    }
+    close(fd);
+    return NULL;
+}
+
+static void * serve(void *)
+{
+    pthread_t thread;
+    int fd;
+
+    while ((fd = accept(listen_fd, NULL, NULL)) >= 0)
+    {
+        pthread_create(&thread, NULL, serve_connection, (void *) (intptr_t) fd);
+        pthread_detach(thread);
+    }
+    return NULL;
+}
+
+static bool_t start_server(void)
+{
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    pthread_t thread;
+
+    listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (listen_fd < 0
+        || bind(listen_fd, (struct sockaddr *) &addr, sizeof(addr))
+        || listen(listen_fd, 128)
+        || getsockname(listen_fd, (struct sockaddr *) &addr, &addr_len))
+    {
+        return false;
+    }
+    listen_port = ntohs(addr.sin_port);
+    return !pthread_create(&thread, NULL, serve, NULL);
+}
+
+/*
+ *  Test Cases - Parser
+ */
+
+void test_parse_content_length(void)
+{
+    httpwire_parser_t parser;
+    body_t body;
+
+    TEST_ASSERT_EQUAL(HTTPWIRE_DONE, parse_str(&parser, &body, kLengthResponse, 1024));
+    TEST_ASSERT_EQUAL(201, parser.code);
+    TEST_ASSERT(parser.keep_alive);
+    TEST_ASSERT_EQUAL_STRING(kIssueBody, body.data);
+}
+
+void test_parse_chunked(void)
+{
+    httpwire_parser_t parser;
+    body_t body;
+    uint16_t step;
+
+    /* Every split of the response gives the same result. */
+    for (step = 1; step <= sizeof(kChunkedResponse); step++)
+    {
+        TEST_ASSERT_EQUAL(HTTPWIRE_DONE, parse_str(&parser, &body, kChunkedResponse, step));
+        TEST_ASSERT_EQUAL(200, parser.code);
+        TEST_ASSERT(parser.chunked);
+        TEST_ASSERT(parser.keep_alive);
+        TEST_ASSERT_EQUAL_STRING(kIssueBody, body.data);
+    }
+}
+
+void test_parse_until_close(void)
+{
+    httpwire_parser_t parser;
+    body_t body;
+
+    /* Skips the interim response, then reads the body until closed. */
+    TEST_ASSERT_EQUAL(HTTPWIRE_MORE, parse_str(&parser, &body, kCloseResponse, 7));
+    TEST_ASSERT_EQUAL(HTTPWIRE_DONE, httpwire_finish(&parser));
+    TEST_ASSERT_EQUAL(200, parser.code);
+    TEST_ASSERT_FALSE(parser.keep_alive);
+    TEST_ASSERT_EQUAL_STRING(kIssueBody, body.data);
+}
+
+void test_parse_no_body(void)
+{
+    httpwire_parser_t parser;
+    body_t body;
+
+    TEST_ASSERT_EQUAL(HTTPWIRE_DONE,
+        parse_str(&parser, &body, "HTTP/1.1 204 No Content\r\nConnection: close\r\n\r\n", 1024));
+    TEST_ASSERT_EQUAL(204, parser.code);
+    TEST_ASSERT_FALSE(parser.keep_alive);
+    TEST_ASSERT_EQUAL(0, body.length);
+
+    /* Trailing data after a complete response spoils the connection. */
+    TEST_ASSERT_EQUAL(HTTPWIRE_DONE,
+        parse_str(&parser, &body, "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nokX", 1024));
+    TEST_ASSERT_EQUAL_STRING("ok", body.data);
+    TEST_ASSERT_FALSE(parser.keep_alive);
+}
+
+void test_parse_errors(void)
+{
+    static char_t long_header[HTTPWIRE_HEADER_MAX + 64];
+    httpwire_parser_t parser;
+    body_t body;
+
+    TEST_ASSERT_EQUAL(HTTPWIRE_ERROR, parse_str(&parser, &body, "HTTP/2 200 OK\r\n\r\n", 64));
+    TEST_ASSERT_EQUAL(HTTPWIRE_ERROR, parse_str(&parser, &body, "HTTP/1.1 20x OK\r\n\r\n", 64));
+    TEST_ASSERT_EQUAL(HTTPWIRE_ERROR,
+        parse_str(&parser, &body, "HTTP/1.1 200 OK\r\nContent-Length: 99999999999\r\n\r\n", 64));
+    TEST_ASSERT_EQUAL(HTTPWIRE_ERROR,
+        parse_str(&parser, &body, "HTTP/1.1 200 OK\r\nContent-Length: 1x\r\n\r\n", 64));
+    TEST_ASSERT_EQUAL(HTTPWIRE_ERROR,
+        parse_str(&parser, &body, "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\nzz\r\n", 64));
+    TEST_ASSERT_EQUAL(HTTPWIRE_ERROR,
+        parse_str(&parser, &body, "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n2\r\nokX", 64));
+
+    /* Truncated bodies are errors once the connection closes. */
+    TEST_ASSERT_EQUAL(HTTPWIRE_MORE,
+        parse_str(&parser, &body, "HTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\nok", 64));
+    TEST_ASSERT_EQUAL(HTTPWIRE_ERROR, httpwire_finish(&parser));
+
+    /* Headers are bounded. */
+    memcpy(long_header, "HTTP/1.1 200 OK\r\nX: ", 20);
+    memset(&long_header[20], 'a', sizeof(long_header) - 21);
+    long_header[sizeof(long_header) - 1] = 0;
+    TEST_ASSERT_EQUAL(HTTPWIRE_ERROR, parse_str(&parser, &body, long_header, 512));
+
+    /* A sink which cannot take the body stops the parse. */
+    init_body(&body);
+    body.limit = 10;
+    httpwire_parser_init(&parser, collect, &body);
+    TEST_ASSERT_EQUAL(HTTPWIRE_SINK_FULL,
+        httpwire_feed(&parser, (byte_t const *) kLengthResponse, sizeof(kLengthResponse) - 1));
+}
+
+/*
+ *  Mangles well formed responses and checks that however the
+ *  result is split, the parser reaches the same end, never
+ *  overrunning anything on the way.
+ */
+void test_fuzz(void)
+{
+    static kstring_t const seeds[] = { kLengthResponse, kChunkedResponse, kCloseResponse };
+    static kstring_t const kAlphabet = "\r\n:;, 0123456789abcdefHTTP/1.chunkedclose-";
+    byte_t input[BODY_BUFFER_LENGTH];
+    httpwire_parser_t whole, split;
+    httpwire_status_t whole_status, split_status;
+    body_t whole_body, split_body;
+    uint16_t length, step, position;
+    uint32_t round, edits, outcomes[4];
+    char_t report[128];
+
+    srand(31);
+    memset(outcomes, 0, sizeof(outcomes));
+
+    for (round = 0; round < FUZZ_ROUNDS; round++)
+    {
+        length = strlen(seeds[round % 3]);
+        memcpy(input, seeds[round % 3], length);
+
+        for (edits = 1 + (rand() % 4); edits > 0; edits--)
+        {
+            position = rand() % length;
+            switch (rand() % 4)
+            {
+                case 0:
+                    input[position] = (byte_t) rand();
+                    break;
+                case 1:
+                    input[position] = kAlphabet[rand() % strlen(kAlphabet)];
+                    break;
+                case 2:
+                    length = position + 1;
+                    break;
+                default:
+                    if (length + 1 < BODY_BUFFER_LENGTH)
+                    {
+                        memmove(&input[position + 1], &input[position], length - position);
+                        input[position] = kAlphabet[rand() % strlen(kAlphabet)];
+                        length++;
+                    }
+                    break;
+            }
+        }
+
+        step = 1 + (rand() % 16);
+        whole_status = parse(&whole, &whole_body, input, length, length, true);
+        split_status = parse(&split, &split_body, input, length, step, true);
+
+        TEST_ASSERT_EQUAL(whole_status, split_status);
+        TEST_ASSERT_EQUAL(whole.code, split.code);
+        TEST_ASSERT_EQUAL(whole_body.length, split_body.length);
+        TEST_ASSERT_EQUAL_MEMORY(whole_body.data, split_body.data, whole_body.length);
+        TEST_ASSERT(whole_body.length <= length);
+        outcomes[whole_status]++;
+    }
+
+    snprintf(report, sizeof(report),
+        "%u inputs: %u incomplete, %u done, %u malformed",
+        FUZZ_ROUNDS, outcomes[HTTPWIRE_MORE], outcomes[HTTPWIRE_DONE], outcomes[HTTPWIRE_ERROR]);
+    TEST_MESSAGE(report);
+}
+
+/* Encoded straight into a buffer smaller than the text, flushed as it fills. */
+void test_write_urlencoded(void)
+{
+    static kstring_t kText = "Bed 3: water & a blanket, 100% \xC3\xA9t\xC3\xA9";
+    char_t expected[BODY_BUFFER_LENGTH];
+    httpwire_writer_t writer;
+    byte_t buffer[5];
+    body_t sent;
+
+    init_body(&sent);
+    httpwire_writer_init(&writer, buffer, sizeof(buffer), collect, &sent);
+    httpwire_write_urlencoded(&writer, kText, SMLURL_FORM);
+    TEST_ASSERT(httpwire_writer_flush(&writer));
+    smlurlenc(expected, kText, SMLURL_FORM, sizeof(expected));
+    TEST_ASSERT_EQUAL_STRING(expected, sent.data);
+    TEST_ASSERT_EQUAL(smlurlenclen(kText, SMLURL_FORM), sent.length);
+
+    /* No buffer can take an escape it is too small for. */
+    init_body(&sent);
+    httpwire_writer_init(&writer, buffer, 2, collect, &sent);
+    httpwire_write_urlencoded(&writer, "a&b", SMLURL_FORM);
+    TEST_ASSERT_FALSE(httpwire_writer_flush(&writer));
+}
+
+/*
+ *  Test Cases - HTTPer
+ */
+
+void test_httper_post(void)
+{
+    char_t port[8], expected[512], payload[128];
+    HTTPer httper("127.0.0.1", listen_port, "/patient/request1");
+
+    server_response = kLengthResponse;
+    httper.push_parameter("device_id", "d-1");
+    httper.push_parameter("request_type_id", "2");
+
+    TEST_ASSERT_EQUAL(HTTPer::STATUS_OK, httper.send_post(payload, sizeof(payload)));
+    TEST_ASSERT_EQUAL_STRING(kIssueBody, payload);
+
+    snprintf(port, sizeof(port), "%u", listen_port);
+    snprintf(expected, sizeof(expected),
+        "POST /patient/request1 HTTP/1.1\r\n"
+        "Host: 127.0.0.1:%s\r\n"
+        "Authorization: Basic dGVzdDp0ZXN0\r\n"
+        "Content-Type: application/x-www-form-urlencoded\r\n"
+        "Content-Length: 31\r\n"
+        "\r\n"
+        "device_id=d-1&request_type_id=2", port);
+    TEST_ASSERT_EQUAL_STRING(expected, last_request);
+}
+
+/* Free text is encoded, and counted encoded in the length. */
+void test_httper_encoded_post(void)
+{
+    HTTPer httper("127.0.0.1", listen_port, "/patient/request1");
+
+    server_response = kLengthResponse;
+    httper.push_parameter("device_id", "d-1");
+    httper.push_parameter("note", "water & a blanket=50%");
+
+    TEST_ASSERT_EQUAL(HTTPer::STATUS_OK, httper.send_post());
+    TEST_ASSERT_NOT_NULL(strstr(last_request,
+        "Content-Length: 46\r\n"
+        "\r\n"
+        "device_id=d-1&note=water+%26+a+blanket%3D50%25"));
+}
+
+void test_httper_rendered_post(void)
+{
+    byte_t request[512];
+    char_t sent[512];
+    uint16_t length;
+    HTTPer httper("127.0.0.1", listen_port, "/patient/request/cancel");
+
+    server_response = kLengthResponse;
+    httper.push_parameter("device_id", "d-1");
+    httper.push_parameter("issue_id", "0f8fad5b-d9cb-469f-a165-70867728950e");
+
+    /* Rendered bytes are exactly those send_post() writes. */
+    TEST_ASSERT_EQUAL(HTTPer::STATUS_OK, httper.send_post());
+    strcpy(sent, last_request);
+    length = httper.render_post(request, sizeof(request));
+    TEST_ASSERT_EQUAL(strlen(sent), length);
+    TEST_ASSERT_EQUAL_MEMORY(sent, request, length);
+
+    TEST_ASSERT_EQUAL(HTTPer::STATUS_OK,
+        httper.send_rendered_post(request, length, NULL, NULL));
+    TEST_ASSERT_EQUAL_STRING(sent, last_request);
+
+    /* Too small a buffer is refused, not overrun. */
+    TEST_ASSERT_EQUAL(0, httper.render_post(request, 64));
+    TEST_ASSERT_EQUAL(HTTPer::STATUS_INTERNAL_ERROR,
+        httper.send_rendered_post(request, 0, NULL, NULL));
+}
+
+void test_httper_header_sets(void)
+{
+    static HTTPer::header_set_t shared;
+    HTTPer::header_set_t full;
+    HTTPer httper("127.0.0.1", listen_port, "/patient/test");
+    uint16_t i;
+
+    memset(&shared, 0, sizeof(shared));
+    TEST_ASSERT(HTTPer::push_header(&shared, "X-Device-Serial", "42"));
+    TEST_ASSERT(httper.add_headers(&shared));
+
+    server_response = kChunkedResponse;
+    TEST_ASSERT_EQUAL(HTTPer::STATUS_OK, httper.send_get());
+    TEST_ASSERT_NOT_NULL(strstr(last_request,
+        "Authorization: Basic dGVzdDp0ZXN0\r\n"
+        "Accept: application/json\r\n"
+        "X-Device-Serial: 42\r\n"
+        "\r\n"));
+
+    /* Capacity is fixed. */
+    memset(&full, 0, sizeof(full));
+    for (i = 0; i < HTTPER_HEADER_MAX; i++)
+    {
+        TEST_ASSERT(HTTPer::push_header(&full, "X", "1"));
+    }
+    TEST_ASSERT_FALSE(HTTPer::push_header(&full, "X", "1"));
+    for (i = 1; i < HTTPER_HEADER_SET_MAX; i++)
+    {
+        TEST_ASSERT(httper.add_headers(&full));
+    }
+    TEST_ASSERT_FALSE(httper.add_headers(&full));
+}
+
+void test_httper_typed_body(void)
+{
+    static byte_t const body[] = {0x01, 0x03, 0xAA, 0xBB};
+    body_t json, typed;
+    HTTPer httper("127.0.0.1", listen_port, "/patient/request1");
+
+    httper.set_body(body, sizeof(body), "application/vnd.pendant.v1");
+    httper.set_typed_sink("application/vnd.pendant.v1", collect, &typed);
+
+    /* The body goes out as it is, under its own type. */
+    init_body(&json);
+    init_body(&typed);
+    server_response = kTypedResponse;
+    TEST_ASSERT_EQUAL(HTTPer::STATUS_OK, httper.send_post(collect, &json));
+    TEST_ASSERT_NOT_NULL(strstr(last_request,
+        "Content-Type: application/vnd.pendant.v1\r\n"
+        "Content-Length: 4\r\n"
+        "\r\n"
+        "\x01\x03\xAA\xBB"));
+    TEST_ASSERT_NULL(strstr(last_request, "x-www-form-urlencoded"));
+
+    /* A response of the type goes to the typed sink, whatever its case. */
+    TEST_ASSERT_EQUAL(0, json.length);
+    TEST_ASSERT_EQUAL(18, typed.length);
+    TEST_ASSERT_EQUAL_MEMORY(&kTypedResponse[sizeof(kTypedResponse) - 19], typed.data, 18);
+
+    /* Any other goes to the usual one. */
+    init_body(&json);
+    init_body(&typed);
+    server_response = kLengthResponse;
+    TEST_ASSERT_EQUAL(HTTPer::STATUS_OK, httper.send_post(collect, &json));
+    TEST_ASSERT_EQUAL_STRING(kIssueBody, json.data);
+    TEST_ASSERT_EQUAL(0, typed.length);
+
+    server_response = kUnsupportedResponse;
+    TEST_ASSERT_EQUAL(HTTPer::STATUS_UNSUPPORTED_MEDIA, httper.send_post());
+}
+
+void test_httper_get_chunked(void)
+{
+    char_t payload[128];
+    HTTPer httper("127.0.0.1", listen_port, "/patient/test");
+
+    server_response = kChunkedResponse;
+    httper.push_parameter("device_id", "d-1");
+
+    TEST_ASSERT_EQUAL(HTTPer::STATUS_OK, httper.send_get(payload, sizeof(payload)));
+    TEST_ASSERT_EQUAL_STRING(kIssueBody, payload);
+    TEST_ASSERT(!strncmp(last_request, "GET /patient/test?device_id=d-1 HTTP/1.1\r\n", 42));
+
+    /* A payload buffer which is too small is reported. */
+    TEST_ASSERT_EQUAL(HTTPer::STATUS_PAYLOAD_TOO_SMALL, httper.send_get(payload, 16));
+
+    server_response = "HTTP/1.1 401 Unauthorized\r\nContent-Length: 4\r\n\r\nnope";
+    TEST_ASSERT_EQUAL(HTTPer::STATUS_BAD_AUTH, httper.send_get(payload, sizeof(payload)));
+    server_response = kLengthResponse;
+}
+
+void test_httper_server_errors(void)
+{
+    char_t payload[128];
+    HTTPer httper("127.0.0.1", listen_port, "/patient/test");
+
+    /* Every 5xx fails the host, so the caller backs off and fails over. */
+    server_response = "HTTP/1.1 502 Bad Gateway\r\nContent-Length: 4\r\n\r\nnope";
+    TEST_ASSERT_EQUAL(HTTPer::STATUS_REMOTE_ERROR, httper.send_get(payload, sizeof(payload)));
+    server_response = "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 4\r\n\r\nbusy";
+    TEST_ASSERT_EQUAL(HTTPer::STATUS_REMOTE_ERROR, httper.send_get(payload, sizeof(payload)));
+    TEST_ASSERT_EQUAL(HTTPer::STATUS_REMOTE_ERROR, httper.send_post());
+    server_response = "HTTP/1.1 504 Gateway Timeout\r\nContent-Length: 4\r\n\r\nslow";
+    TEST_ASSERT_EQUAL(HTTPer::STATUS_REMOTE_ERROR, httper.send_get(payload, sizeof(payload)));
+
+    /* Outside the range is still unknown. */
+    server_response = "HTTP/1.1 404 Not Found\r\nContent-Length: 4\r\n\r\nnope";
+    TEST_ASSERT_EQUAL(HTTPer::STATUS_UNKNOWN, httper.send_get(payload, sizeof(payload)));
+    server_response = kLengthResponse;
+}
+
+/*
+ *  Test Cases - Asynchronous
+ */
+
+static event_mask_t seen_events = 0;
+
+static uint8_t record_events(event_mask_t events, void * arg)
+{
+    seen_events |= events;
+    return TASK_EXIT_OK;
+}
+
+void test_async_in_flight_together(void)
+{
+    body_t help_body, upload_body;
+    HTTPer help("127.0.0.1", listen_port, "/patient/request1");
+    HTTPer upload("127.0.0.1", listen_port, "/device/telemetry");
+    HTTPer::handle_t help_handle, upload_handle;
+    uint32_t start, elapsed, loop_start, loop_time, longest_loop;
+    char_t report[160];
+
+    server_response = kLengthResponse;
+    server_delay_us = SERVER_DELAY_US;
+    help.push_parameter("device_id", "d-1");
+    upload.push_parameter("battery", "87");
+
+    init_body(&help_body);
+    init_body(&upload_body);
+    seen_events = 0;
+
+    /* Polled as it is on the device. */
+    scheduler_init();
+    scheduler_periodic_callback(
+        TASK_PRIORITY_LOWEST, HTTPER_POLL_PERIOD_US, HTTPer::poll_task, NULL);
+    scheduler_on_event_callback(
+        TASK_PRIORITY_HIGHEST, EVENT_HELP_DONE | EVENT_UPLOAD_DONE, record_events, NULL);
+
+    start = clock_micros();
+    help_handle = help.start_post(collect, &help_body, EVENT_HELP_DONE);
+    upload_handle = upload.start_post(collect, &upload_body, EVENT_UPLOAD_DONE);
+    TEST_ASSERT(help_handle >= 0);
+    TEST_ASSERT(upload_handle >= 0);
+    TEST_ASSERT(help_handle != upload_handle);
+    TEST_ASSERT_EQUAL(HTTPer::STATUS_PENDING, HTTPer::async_result(help_handle));
+
+    /* No slot is left for a third. */
+    TEST_ASSERT(help.start_post(NULL, NULL, 0) < 0);
+
+    longest_loop = 0;
+    while (seen_events != (EVENT_HELP_DONE | EVENT_UPLOAD_DONE)
+        && (clock_micros() - start) < 1000000)
+    {
+        loop_start = clock_micros();
+        scheduler_loop();
+        loop_time = clock_micros() - loop_start;
+        if (loop_time > longest_loop) longest_loop = loop_time;
+    }
+    elapsed = clock_micros() - start;
+    server_delay_us = 0;
+
+    TEST_ASSERT_EQUAL(EVENT_HELP_DONE | EVENT_UPLOAD_DONE, seen_events);
+    TEST_ASSERT_EQUAL(HTTPer::STATUS_OK, HTTPer::async_result(help_handle));
+    TEST_ASSERT_EQUAL(HTTPer::STATUS_OK, HTTPer::async_result(upload_handle));
+    TEST_ASSERT_EQUAL_STRING(kIssueBody, help_body.data);
+    TEST_ASSERT_EQUAL_STRING(kIssueBody, upload_body.data);
+
+    /* Both waited on the server at once, and the loop never blocked. */
+    TEST_ASSERT(elapsed < 2 * SERVER_DELAY_US);
+    TEST_ASSERT(longest_loop < SERVER_DELAY_US / 4);
+
+    /* Results are collected once. */
+    TEST_ASSERT_EQUAL(HTTPer::STATUS_INTERNAL_ERROR, HTTPer::async_result(help_handle));
+
+    snprintf(report, sizeof(report),
+        "2 requests against a %u ms server: done in %u ms, longest loop pass %u us",
+        SERVER_DELAY_US / 1000, elapsed / 1000, longest_loop);
+    TEST_MESSAGE(report);
+}
+
+void test_async_cancel(void)
+{
+    HTTPer help("127.0.0.1", listen_port, "/patient/request1");
+    HTTPer::handle_t handle;
+    uint8_t i;
+
+    server_response = kLengthResponse;
+    server_delay_us = SERVER_DELAY_US;
+
+    handle = help.start_post(NULL, NULL, EVENT_HELP_DONE);
+    TEST_ASSERT(handle >= 0);
+    for (i = 0; i < 3; i++)
+    {
+        HTTPer::poll();
+    }
+    TEST_ASSERT_EQUAL(HTTPer::STATUS_PENDING, HTTPer::async_result(handle));
+
+    HTTPer::cancel(handle);
+    TEST_ASSERT_EQUAL(HTTPer::STATUS_INTERNAL_ERROR, HTTPer::async_result(handle));
+    server_delay_us = 0;
+    usleep(2 * SERVER_DELAY_US);
+}
+
+/*
+ *  Test Cases - Deadlines
+ */
+
+static bool_t slow_lookup(kstring_t host, net_addr_t * address, uint32_t * ttl_ms)
+{
+    usleep(SLOW_LOOKUP_US);
+    *address = htonl(INADDR_LOOPBACK);
+    return true;
+}
+
+void test_timeout_receive(void)
+{
+    HTTPer help("127.0.0.1", listen_port, "/patient/request1");
+    HTTPer::handle_t handle;
+    HTTPer::phase_t phase;
+    uint32_t start, elapsed;
+
+    server_response = kLengthResponse;
+    server_delay_us = 4 * DEADLINE_MS * 1000;
+
+    start = clock_millis();
+    help.set_deadline(start + DEADLINE_MS);
+    TEST_ASSERT_EQUAL(HTTPer::STATUS_TIMEOUT, help.send_post());
+    elapsed = clock_millis() - start;
+    TEST_ASSERT_EQUAL(HTTPer::PHASE_RECEIVE, help.timeout_phase());
+    TEST_ASSERT(elapsed >= DEADLINE_MS && elapsed < 2 * DEADLINE_MS);
+
+    /* Asynchronous requests keep to the deadline as well. */
+    help.set_deadline(clock_millis() + DEADLINE_MS);
+    handle = help.start_post(NULL, NULL, 0);
+    TEST_ASSERT(handle >= 0);
+    while (HTTPer::async_result(handle, &phase) == HTTPer::STATUS_PENDING)
+    {
+        HTTPer::poll();
+        usleep(1000);
+    }
+    TEST_ASSERT_EQUAL(HTTPer::PHASE_RECEIVE, phase);
+
+    /* Once the server is quick again, so is the request. */
+    server_delay_us = 0;
+    help.set_deadline(clock_millis() + DEADLINE_MS);
+    TEST_ASSERT_EQUAL(HTTPer::STATUS_OK, help.send_post());
+    TEST_ASSERT_EQUAL(HTTPer::PHASE_NONE, help.timeout_phase());
+
+    /* A deadline already passed is not even tried. */
+    help.set_deadline(clock_millis() - 1);
+    TEST_ASSERT_EQUAL(HTTPer::STATUS_TIMEOUT, help.send_post());
+    help.clear_deadline();
+    TEST_ASSERT_EQUAL(HTTPer::STATUS_OK, help.send_post());
+}
+
+void test_timeout_resolve(void)
+{
+    HTTPer help("slow.test", listen_port, "/patient/request1");
+
+    server_response = kLengthResponse;
+    Resolver::get_instance()->set_lookup(slow_lookup);
+
+    help.set_deadline(clock_millis() + DEADLINE_MS);
+    TEST_ASSERT_EQUAL(HTTPer::STATUS_TIMEOUT, help.send_post());
+    TEST_ASSERT_EQUAL(HTTPer::PHASE_RESOLVE, help.timeout_phase());
+
+    /* The lookup did finish, the next request has it cached. */
+    help.set_deadline(clock_millis() + DEADLINE_MS);
+    TEST_ASSERT_EQUAL(HTTPer::STATUS_OK, help.send_post());
+
+    ConnPool::get_instance()->drop("slow.test", listen_port);
+    Resolver::get_instance()->set_lookup(NULL);
+}
+
+void test_timeout_connect(void)
+{
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    int full_fd, queued_fd;
+    uint32_t start, elapsed;
+    uint16_t port;
+
+    /* A listener which never accepts, its backlog filled. */
+    full_fd = socket(AF_INET, SOCK_STREAM, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    TEST_ASSERT(!bind(full_fd, (struct sockaddr *) &addr, sizeof(addr)));
+    TEST_ASSERT(!listen(full_fd, 0));
+    TEST_ASSERT(!getsockname(full_fd, (struct sockaddr *) &addr, &addr_len));
+    port = ntohs(addr.sin_port);
+    queued_fd = socket(AF_INET, SOCK_STREAM, 0);
+    TEST_ASSERT(!connect(queued_fd, (struct sockaddr *) &addr, sizeof(addr)));
+
+    HTTPer help("127.0.0.1", port, "/patient/request1");
+    start = clock_millis();
+    help.set_deadline(start + DEADLINE_MS);
+    TEST_ASSERT_EQUAL(HTTPer::STATUS_TIMEOUT, help.send_post());
+    elapsed = clock_millis() - start;
+    TEST_ASSERT_EQUAL(HTTPer::PHASE_CONNECT, help.timeout_phase());
+    TEST_ASSERT(elapsed >= DEADLINE_MS && elapsed < 2 * DEADLINE_MS);
+
+    close(queued_fd);
+    close(full_fd);
+}
+
+/*
+ *  Benchmarks
+ */
+
+void test_bench_parse(void)
+{
+    httpwire_parser_t parser;
+    body_t body;
+    uint32_t i, start, elapsed;
+    uint32_t length = sizeof(kChunkedResponse) - 1;
+    char_t report[160];
+
+    start = clock_micros();
+    for (i = 0; i < BENCH_PARSES; i++)
+    {
+        parse_str(&parser, &body, kChunkedResponse, 128);
+    }
+    elapsed = clock_micros() - start;
+    TEST_ASSERT_EQUAL_STRING(kIssueBody, body.data);
+
+    snprintf(report, sizeof(report),
+        "%u byte chunked response: %u ns/parse, %u MB/s, parser state %u bytes",
+        length, (uint32_t) (elapsed * 1000ULL / BENCH_PARSES),
+        (uint32_t) ((uint64_t) length * BENCH_PARSES / elapsed),
+        (uint32_t) sizeof(httpwire_parser_t));
+    TEST_MESSAGE(report);
+}
+
+void test_bench_requests(void)
+{
+    byte_t request[512];
+    char_t payload[128];
+    HTTPer httper("127.0.0.1", listen_port, "/patient/request1");
+    uint16_t length;
+    uint32_t i, start, rendered, built;
+    char_t report[160];
+
+    server_response = kLengthResponse;
+    httper.push_parameter("device_id", "0f8fad5b-d9cb-469f-a165-70867728950e");
+    httper.push_parameter("request_type_id", "2");
+    length = httper.render_post(request, sizeof(request));
+
+    start = clock_micros();
+    for (i = 0; i < BENCH_REQUESTS; i++)
+    {
+        TEST_ASSERT_EQUAL(HTTPer::STATUS_OK, httper.send_post(payload, sizeof(payload)));
+    }
+    built = clock_micros() - start;
+
+    start = clock_micros();
+    for (i = 0; i < BENCH_REQUESTS; i++)
+    {
+        TEST_ASSERT_EQUAL(HTTPer::STATUS_OK,
+            httper.send_rendered_post(request, length, NULL, NULL));
+    }
+    rendered = clock_micros() - start;
+
+    snprintf(report, sizeof(report),
+        "kept-alive POST: %u req/s built per request, %u req/s pre-rendered",
+        (uint32_t) (BENCH_REQUESTS * 1000000ULL / built),
+        (uint32_t) (BENCH_REQUESTS * 1000000ULL / rendered));
+    TEST_MESSAGE(report);
+}
+
+void test_bench_render(void)
+{
+    byte_t request[512];
+    HTTPer httper("127.0.0.1", listen_port, "/patient/request1");
+    uint32_t i, start, elapsed, length;
+    char_t report[128];
+
+    httper.push_parameter("device_id", "0f8fad5b-d9cb-469f-a165-70867728950e");
+    httper.push_parameter("request_type_id", "2");
+
+    length = 0;
+    start = clock_micros();
+    for (i = 0; i < BENCH_PARSES; i++)
+    {
+        length += httper.render_post(request, sizeof(request));
+    }
+    elapsed = clock_micros() - start;
+    TEST_ASSERT(length > 0);
+
+    snprintf(report, sizeof(report),
+        "render %u byte help request: %u ns, skipped per pre-rendered send",
+        length / BENCH_PARSES, (uint32_t) (elapsed * 1000ULL / BENCH_PARSES));
+    TEST_MESSAGE(report);
+}
+
+int main(int argc, char ** argv)
+{
+    if (!start_server()) return 1;
+
+    UNITY_BEGIN();
+
+    RUN_TEST(test_parse_content_length);
+    RUN_TEST(test_parse_chunked);
+    RUN_TEST(test_parse_until_close);
+    RUN_TEST(test_parse_no_body);
+    RUN_TEST(test_parse_errors);
+    RUN_TEST(test_fuzz);
+    RUN_TEST(test_write_urlencoded);
+    RUN_TEST(test_httper_post);
+    RUN_TEST(test_httper_encoded_post);
+    RUN_TEST(test_httper_rendered_post);
+    RUN_TEST(test_httper_header_sets);
+    RUN_TEST(test_httper_typed_body);
+    RUN_TEST(test_httper_get_chunked);
+    RUN_TEST(test_httper_server_errors);
+    RUN_TEST(test_async_in_flight_together);
+    RUN_TEST(test_async_cancel);
+    RUN_TEST(test_timeout_receive);
+    RUN_TEST(test_timeout_resolve);
+    RUN_TEST(test_timeout_connect);
+    RUN_TEST(test_bench_parse);
+    RUN_TEST(test_bench_requests);
+    RUN_TEST(test_bench_render);
+
+    return UNITY_END();
+}
+
+#endif /* UNIT_TEST */
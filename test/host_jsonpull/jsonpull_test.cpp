@@ -0,0 +1,147 @@
+/*
+ *  Module: JSON Pull Parser - Unit Test & Benchmark
+ *
+ *  Author: Alex Dale @superoxigen
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for information.
+ */
+
+#ifdef UNIT_TEST
+
+#include <stdio.h>
+#include <string.h>
+
+#include "unity.h"
+#include "utils.h"
+
+#include "clock.h"
+#include "jsonpull.h"
+#include "uuid.h"
+
+#define BENCH_ITERATIONS 200000
+
+static kstring_t kResponse =
+    "{\"status\": \"created\", \"issue\": {\"id\": 7, \"tags\": [\"a\", \"}\"]},"
+    " \"issue_id\": \"0f8fad5b-d9cb-469f-a165-70867728950e\", \"priority\": 3}";
+
+static jsonpull_status_t parse(kstring_t json, uint16_t chunk, jsonpull_field_t * fields, uint8_t n)
+{
+    jsonpull_t parser;
+    uint16_t i, length, size;
+
+    jsonpull_init(&parser, fields, n);
+    length = strlen(json);
+    for (i = 0; i < length; i += size)
+    {
+        size = (length - i) < chunk ? (length - i) : chunk;
+        jsonpull_feed(&parser, (byte_t const *) &json[i], size);
+    }
+    return jsonpull_status(&parser);
+}
+
+void test_extracts_fields_any_chunking(void)
+{
+    uuid_str_t request_id;
+    char_t priority[4];
+    jsonpull_field_t fields[2] = {
+        {"issue_id", request_id, sizeof(request_id)},
+        {"priority", priority, sizeof(priority)}
+    };
+    uint16_t chunk;
+
+    for (chunk = 1; chunk <= strlen(kResponse); chunk++)
+    {
+        TEST_ASSERT_EQUAL(JSONPULL_DONE, parse(kResponse, chunk, fields, 2));
+        TEST_ASSERT(fields[0].found && fields[1].found);
+        TEST_ASSERT_EQUAL_STRING("0f8fad5b-d9cb-469f-a165-70867728950e", request_id);
+        TEST_ASSERT_EQUAL_STRING("3", priority);
+    }
+}
+
+void test_nested_keys_are_ignored(void)
+{
+    char_t id[8];
+    jsonpull_field_t field = {"id", id, sizeof(id)};
+
+    TEST_ASSERT_EQUAL(JSONPULL_DONE, parse(kResponse, 7, &field, 1));
+    TEST_ASSERT_FALSE(field.found);
+}
+
+void test_escapes(void)
+{
+    char_t value[16];
+    jsonpull_field_t field = {"k\"ey", value, sizeof(value)};
+
+    TEST_ASSERT_EQUAL(JSONPULL_DONE,
+        parse("{\"k\\\"ey\": \"a\\n\\\"b\\u00e9\"}", 3, &field, 1));
+    TEST_ASSERT(field.found);
+    TEST_ASSERT_EQUAL_STRING("a\n\"b?", value);
+}
+
+void test_truncation(void)
+{
+    char_t value[4];
+    jsonpull_field_t field = {"issue_id", value, sizeof(value)};
+
+    TEST_ASSERT_EQUAL(JSONPULL_DONE, parse(kResponse, 16, &field, 1));
+    TEST_ASSERT(field.found);
+    TEST_ASSERT(field.truncated);
+    TEST_ASSERT_EQUAL_STRING("0f8", value);
+}
+
+void test_errors(void)
+{
+    char_t value[8];
+    jsonpull_field_t field = {"a", value, sizeof(value)};
+
+    TEST_ASSERT_EQUAL(JSONPULL_ERROR, parse("[1, 2]", 4, &field, 1));
+    TEST_ASSERT_EQUAL(JSONPULL_ERROR, parse("{\"a\" 1}", 4, &field, 1));
+    TEST_ASSERT_EQUAL(JSONPULL_ERROR, parse("{\"a\": 1} x", 4, &field, 1));
+    TEST_ASSERT_EQUAL(JSONPULL_MORE, parse("{\"a\": \"1", 4, &field, 1));
+    TEST_ASSERT_EQUAL(JSONPULL_DONE, parse(" {} ", 4, &field, 1));
+    TEST_ASSERT_FALSE(field.found);
+}
+
+void test_bench_throughput(void)
+{
+    uuid_str_t request_id;
+    jsonpull_field_t field = {"issue_id", request_id, sizeof(request_id)};
+    jsonpull_t parser;
+    uint32_t i, start, elapsed;
+    uint16_t length;
+    char_t report[128];
+
+    length = strlen(kResponse);
+    start = clock_micros();
+    for (i = 0; i < BENCH_ITERATIONS; i++)
+    {
+        jsonpull_init(&parser, &field, 1);
+        jsonpull_feed(&parser, (byte_t const *) kResponse, length);
+    }
+    elapsed = clock_micros() - start;
+    TEST_ASSERT_EQUAL(JSONPULL_DONE, jsonpull_status(&parser));
+
+    snprintf(report, sizeof(report),
+        "%u byte body: %u ns/parse, %u MB/s, parser state %u bytes",
+        length, (uint32_t) (elapsed * 1000ULL / BENCH_ITERATIONS),
+        (uint32_t) ((uint64_t) length * BENCH_ITERATIONS / elapsed),
+        (uint32_t) sizeof(jsonpull_t));
+    TEST_MESSAGE(report);
+}
+
+int main(int argc, char ** argv)
+{
+    UNITY_BEGIN();
+
+    RUN_TEST(test_extracts_fields_any_chunking);
+    RUN_TEST(test_nested_keys_are_ignored);
+    RUN_TEST(test_escapes);
+    RUN_TEST(test_truncation);
+    RUN_TEST(test_errors);
+    RUN_TEST(test_bench_throughput);
+
+    return UNITY_END();
+}
+
+#endif /* UNIT_TEST */
@@ -0,0 +1,692 @@
+/*
+ *  Module: MQTT - Host Test & Benchmark
+ *
+ *  Runs the client against a local stand-in broker, which keeps the
+ *  session, holds a retained message, and can withhold its
+ *  acknowledgements, ignore pings or trickle its packets out.
+ *
+ *  Author: Alex Dale @superoxigen
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for information.
+ */
+
+#ifdef UNIT_TEST
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "unity.h"
+#include "utils.h"
+
+#include "clock.h"
+#include "mqtt.hpp"
+#include "wiremsg.h"
+
+#define BENCH_PUBLISHES     1000
+#define SETTLE_MS           2000
+
+static kstring_t kClientID = "pendant-7c9e6679";
+static kstring_t kUser = "pendant";
+static kstring_t kPass = "secret";
+static kstring_t kAlertTopic = "pendant/7c9e6679/alert";
+static kstring_t kAckTopic = "pendant/7c9e6679/ack";
+static byte_t const kRetained[] = "retained ack";
+
+/*
+ *  Stand-in Broker
+ */
+
+static int listen_fd = -1;
+static uint16_t broker_port = 0;
+
+/* Behaviour, set by each test. */
+static uint32_t volatile withhold_puback = 0;  /* And close instead */
+static bool_t volatile ignore_pings = false;
+static bool_t volatile ignore_publishes = false; /* Never acknowledge one */
+static bool_t volatile trickle = false;         /* A byte per write */
+static bool_t volatile silent_connack = false;  /* Never answer a CONNECT */
+static bool_t volatile unreadable = false;      /* Answer a publish with ones the client cannot read */
+
+/* What was received. */
+static uint32_t volatile connects = 0;
+static bool_t volatile clean_session = true;
+static uint16_t volatile keepalive_s = 0;
+static bool_t volatile credentials_ok = false;
+static uint32_t volatile publishes = 0;
+static uint32_t volatile duplicates = 0;
+static uint32_t volatile pings = 0;
+static uint32_t volatile client_pubacks = 0;
+static uint16_t volatile last_client_puback = 0;
+static uint32_t volatile subscribes = 0;
+static byte_t published_order[16];
+
+static void reset_broker(void)
+{
+    withhold_puback = 0;
+    ignore_pings = false;
+    ignore_publishes = false;
+    trickle = false;
+    silent_connack = false;
+    unreadable = false;
+    publishes = 0;
+    duplicates = 0;
+    pings = 0;
+    client_pubacks = 0;
+    subscribes = 0;
+    memset(published_order, 0, sizeof(published_order));
+}
+
+static void send_packet(int fd, byte_t const * packet, uint16_t length)
+{
+    uint16_t i;
+
+    if (!trickle)
+    {
+        send(fd, packet, length, MSG_NOSIGNAL);
+        return;
+    }
+    for (i = 0; i < length; i++)
+    {
+        send(fd, &packet[i], 1, MSG_NOSIGNAL);
+        usleep(200);
+    }
+}
+
+static bool_t recv_all(int fd, byte_t * data, uint32_t length)
+{
+    ssize_t n;
+
+    while (length)
+    {
+        n = recv(fd, data, length, 0);
+        if (n <= 0) return false;
+        data += n;
+        length -= n;
+    }
+    return true;
+}
+
+static uint16_t get_u16(byte_t const * data)
+{
+    return (uint16_t) ((data[0] << 8) | data[1]);
+}
+
+/* Whether the client's string at data equals str. */
+static bool_t string_is(byte_t const * data, kstring_t str)
+{
+    return get_u16(data) == strlen(str) && !memcmp(&data[2], str, strlen(str));
+}
+
+static void handle_connect(int fd, byte_t const * body)
+{
+    byte_t connack[4] = {0x20, 0x02, 0x00, 0x00};
+    byte_t const * ptr;
+    byte_t flags;
+
+    /* Protocol name and level, then flags and keep alive. */
+    flags = body[7];
+    clean_session = flags & 0x02;
+    keepalive_s = get_u16(&body[8]);
+    ptr = &body[10];
+    credentials_ok = string_is(ptr, kClientID);
+    ptr += 2 + get_u16(ptr);
+    credentials_ok = credentials_ok && (flags & 0x80) && string_is(ptr, kUser);
+    ptr += 2 + get_u16(ptr);
+    credentials_ok = credentials_ok && (flags & 0x40) && string_is(ptr, kPass);
+
+    /* The session is kept from any earlier connection. */
+    connack[2] = (connects && !clean_session) ? 0x01 : 0x00;
+    connects++;
+    if (silent_connack) return;
+    send_packet(fd, connack, sizeof(connack));
+}
+
+static void handle_subscribe(int fd, byte_t const * body, uint32_t length)
+{
+    byte_t suback[5] = {0x90, 0x03, body[0], body[1], 0x01};
+    byte_t publish[64];
+    uint16_t topic_length, n;
+
+    subscribes++;
+    send_packet(fd, suback, sizeof(suback));
+
+    /* Deliver the retained message on the acknowledgement topic. */
+    topic_length = get_u16(&body[2]);
+    if (topic_length != strlen(kAckTopic) || memcmp(&body[4], kAckTopic, topic_length)) return;
+
+    n = 0;
+    publish[n++] = 0x30 | 0x02 | 0x01;
+    publish[n++] = (byte_t) (2 + topic_length + 2 + sizeof(kRetained) - 1);
+    memcpy(&publish[n], &body[2], 2 + topic_length);
+    n += 2 + topic_length;
+    publish[n++] = 0x12;
+    publish[n++] = 0x34;
+    memcpy(&publish[n], kRetained, sizeof(kRetained) - 1);
+    n += sizeof(kRetained) - 1;
+    send_packet(fd, publish, n);
+}
+
+/*
+ *  A QoS 1 publish too large for the client, then one whose topic
+ *  is said to run far past the end of the packet.
+ */
+static void send_unreadable(int fd)
+{
+    byte_t publish[3 + MQTT_PACKET_MAX + 64];
+    byte_t overrun[] = {0x32, 0x06, 0xFF, 0xFF, 'a', 'c', 'k', 0x01};
+    uint16_t topic_length, length, n;
+
+    topic_length = strlen(kAckTopic);
+    length = sizeof(publish) - 3;
+    n = 0;
+    publish[n++] = 0x30 | 0x02;
+    publish[n++] = 0x80 | (length & 0x7F);
+    publish[n++] = (byte_t) (length >> 7);
+    publish[n++] = 0x00;
+    publish[n++] = (byte_t) topic_length;
+    memcpy(&publish[n], kAckTopic, topic_length);
+    n += topic_length;
+    publish[n++] = 0x56;
+    publish[n++] = 0x78;
+    memset(&publish[n], 'x', sizeof(publish) - n);
+    send_packet(fd, publish, sizeof(publish));
+    send_packet(fd, overrun, sizeof(overrun));
+}
+
+/* Returns false to close the connection. */
+static bool_t handle_publish(int fd, byte_t header, byte_t const * body, uint32_t length)
+{
+    byte_t puback[4] = {0x40, 0x02, 0x00, 0x00};
+    uint16_t offset;
+    uint8_t qos;
+
+    qos = (header >> 1) & 0x03;
+    offset = 2 + get_u16(body) + (qos ? 2 : 0);
+    if (publishes < sizeof(published_order)) published_order[publishes] = body[offset];
+    publishes++;
+    if (header & 0x08) duplicates++;
+    if (unreadable) send_unreadable(fd);
+    if (!qos || ignore_publishes) return true;
+
+    if (withhold_puback)
+    {
+        withhold_puback--;
+        return false;
+    }
+    puback[2] = body[offset - 2];
+    puback[3] = body[offset - 1];
+    send_packet(fd, puback, sizeof(puback));
+    return true;
+}
+
+static void * serve(void *)
+{
+    byte_t pingresp[2] = {0xD0, 0x00};
+    byte_t header, c, body[256];
+    uint32_t length, shift;
+    bool_t open;
+    int fd;
+
+    while ((fd = accept(listen_fd, NULL, NULL)) >= 0)
+    {
+        open = true;
+        while (open && recv_all(fd, &header, 1))
+        {
+            length = 0;
+            shift = 0;
+            do
+            {
+                if (!recv_all(fd, &c, 1)) break;
+                length |= (uint32_t) (c & 0x7F) << shift;
+                shift += 7;
+            } while (c & 0x80);
+            if (length > sizeof(body) || !recv_all(fd, body, length)) break;
+
+            switch (header & 0xF0)
+            {
+                case 0x10:
+                    handle_connect(fd, body);
+                    break;
+                case 0x80:
+                    handle_subscribe(fd, body, length);
+                    break;
+                case 0x30:
+                    open = handle_publish(fd, header, body, length);
+                    break;
+                case 0x40:
+                    client_pubacks++;
+                    last_client_puback = get_u16(body);
+                    break;
+                case 0xC0:
+                    pings++;
+                    if (!ignore_pings) send_packet(fd, pingresp, sizeof(pingresp));
+                    break;
+                case 0xE0:
+                    open = false;
+                    break;
+            }
+        }
+        close(fd);
+    }
+    return NULL;
+}
+
+static bool_t start_broker(void)
+{
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    pthread_t thread;
+
+    listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (listen_fd < 0
+        || bind(listen_fd, (struct sockaddr *) &addr, sizeof(addr))
+        || listen(listen_fd, 4)
+        || getsockname(listen_fd, (struct sockaddr *) &addr, &addr_len))
+    {
+        return false;
+    }
+    broker_port = ntohs(addr.sin_port);
+    return !pthread_create(&thread, NULL, serve, NULL);
+}
+
+/*
+ *  Client Helpers
+ */
+
+static uint32_t volatile acks_received = 0;
+static byte_t ack_payload[MQTT_PACKET_MAX];
+static uint16_t ack_length = 0;
+
+static void on_ack(
+    void * context, kstring_t topic, uint16_t topic_length,
+    byte_t const * payload, uint16_t length)
+{
+    acks_received++;
+    memcpy(ack_payload, payload, length);
+    ack_length = length;
+}
+
+static void configure(uint16_t keepalive_s)
+{
+    MqttClient::get_instance()->configure(
+        "127.0.0.1", broker_port, NULL, kClientID, kUser, kPass, keepalive_s);
+}
+
+/* Starts connecting, and polls until the broker accepts the session. */
+static bool_t connect_client(void)
+{
+    MqttClient * client = MqttClient::get_instance();
+    time_ms_t start;
+
+    if (!client->connect()) return false;
+    start = clock_millis();
+    while (!client->is_connected())
+    {
+        if (clock_millis() - start >= SETTLE_MS) return false;
+        client->poll();
+        usleep(1000);
+    }
+    return true;
+}
+
+/* Polls until the packet is acknowledged, or the time runs out. */
+static bool_t poll_delivered(uint16_t packet_id, uint32_t timeout_ms)
+{
+    MqttClient * client = MqttClient::get_instance();
+    time_ms_t start;
+
+    start = clock_millis();
+    while (!client->is_delivered(packet_id))
+    {
+        if (clock_millis() - start >= timeout_ms) return false;
+        if (!client->wait(10))
+        {
+            client->poll();
+            usleep(1000);
+        }
+    }
+    return true;
+}
+
+static void poll_for(uint32_t ms)
+{
+    MqttClient * client = MqttClient::get_instance();
+    time_ms_t start;
+
+    start = clock_millis();
+    while (clock_millis() - start < ms)
+    {
+        if (!client->wait(10))
+        {
+            client->poll();
+            usleep(1000);
+        }
+    }
+}
+
+/*
+ *  Test Cases
+ */
+
+void test_not_configured(void)
+{
+    MqttClient * client = MqttClient::get_instance();
+    byte_t payload[MQTT_PAYLOAD_MAX + 1];
+
+    TEST_ASSERT_FALSE(client->is_configured());
+    TEST_ASSERT_FALSE(client->connect());
+    TEST_ASSERT_FALSE(client->wait(10));
+
+    /* Refused outright, not queued. */
+    memset(payload, 0, sizeof(payload));
+    TEST_ASSERT_FALSE(client->publish(kAlertTopic, payload, sizeof(payload), 1));
+    TEST_ASSERT_FALSE(client->publish(kAlertTopic, payload, 1, 2));
+    TEST_ASSERT_EQUAL(0, client->queued());
+}
+
+void test_queue_bounded(void)
+{
+    MqttClient * client = MqttClient::get_instance();
+    uint16_t packet_ids[MQTT_QUEUE_LENGTH];
+    byte_t payload;
+    uint8_t i;
+
+    /* Queued while offline, up to the bound. */
+    reset_broker();
+    for (i = 0; i < MQTT_QUEUE_LENGTH; i++)
+    {
+        payload = 'a' + i;
+        TEST_ASSERT(client->publish(kAlertTopic, &payload, 1, 1, false, &packet_ids[i]));
+        TEST_ASSERT(packet_ids[i] != 0);
+        TEST_ASSERT_FALSE(client->is_delivered(packet_ids[i]));
+    }
+    payload = 'z';
+    TEST_ASSERT_FALSE(client->publish(kAlertTopic, &payload, 1, 1));
+    TEST_ASSERT_EQUAL(1, client->stats()->dropped);
+    TEST_ASSERT_EQUAL(MQTT_QUEUE_LENGTH, client->queued());
+
+    /* Sent in the order published once connected, and freed as acknowledged. */
+    configure(MQTT_KEEPALIVE_S);
+    TEST_ASSERT(connect_client());
+    TEST_ASSERT(poll_delivered(packet_ids[MQTT_QUEUE_LENGTH - 1], SETTLE_MS));
+    TEST_ASSERT_EQUAL(0, client->queued());
+    TEST_ASSERT_EQUAL(MQTT_QUEUE_LENGTH, publishes);
+    TEST_ASSERT_EQUAL_MEMORY("abcd", published_order, MQTT_QUEUE_LENGTH);
+    TEST_ASSERT_EQUAL(MQTT_QUEUE_LENGTH, client->stats()->acked);
+}
+
+void test_persistent_session(void)
+{
+    MqttClient * client = MqttClient::get_instance();
+
+    TEST_ASSERT(client->is_connected());
+    TEST_ASSERT_FALSE(clean_session);
+    TEST_ASSERT(credentials_ok);
+    TEST_ASSERT_EQUAL(MQTT_KEEPALIVE_S, keepalive_s);
+    TEST_ASSERT_FALSE(client->session_present());
+
+    /* The broker kept the session across a clean disconnect. */
+    client->disconnect();
+    TEST_ASSERT_FALSE(client->is_connected());
+    poll_for(50);
+    TEST_ASSERT_FALSE(client->is_connected());
+    TEST_ASSERT(connect_client());
+    TEST_ASSERT(client->session_present());
+}
+
+void test_retained_ack(void)
+{
+    MqttClient * client = MqttClient::get_instance();
+    uint32_t pubacks;
+
+    reset_broker();
+    acks_received = 0;
+    TEST_ASSERT(client->subscribe(kAckTopic, on_ack, NULL));
+    poll_for(50);
+    TEST_ASSERT_EQUAL(1, subscribes);
+    TEST_ASSERT_EQUAL(1, acks_received);
+    TEST_ASSERT_EQUAL(sizeof(kRetained) - 1, ack_length);
+    TEST_ASSERT_EQUAL_MEMORY(kRetained, ack_payload, ack_length);
+    TEST_ASSERT_EQUAL(1, client_pubacks);
+
+    /* Subscribed again on reconnecting, which delivers it again. */
+    pubacks = client_pubacks;
+    client->disconnect();
+    TEST_ASSERT(connect_client());
+    poll_for(50);
+    TEST_ASSERT_EQUAL(2, subscribes);
+    TEST_ASSERT_EQUAL(2, acks_received);
+    TEST_ASSERT_EQUAL(pubacks + 1, client_pubacks);
+}
+
+void test_resend_after_drop(void)
+{
+    MqttClient * client = MqttClient::get_instance();
+    uint32_t connected;
+    uint16_t packet_id;
+    byte_t payload = 'r';
+
+    /* The broker closes rather than acknowledge the first copy. */
+    reset_broker();
+    withhold_puback = 1;
+    connected = client->stats()->connects;
+    TEST_ASSERT(client->publish(kAlertTopic, &payload, 1, 1, false, &packet_id));
+    TEST_ASSERT(poll_delivered(packet_id, SETTLE_MS));
+
+    /* Reconnected at once, and the copy is marked a duplicate. */
+    TEST_ASSERT_EQUAL(connected + 1, client->stats()->connects);
+    TEST_ASSERT_EQUAL(2, publishes);
+    TEST_ASSERT_EQUAL(1, duplicates);
+    TEST_ASSERT_EQUAL(1, client->stats()->resent);
+}
+
+void test_discard(void)
+{
+    MqttClient * client = MqttClient::get_instance();
+    uint32_t resent;
+    uint16_t packet_id;
+    byte_t payload = 'd';
+    time_ms_t start;
+
+    /* Sent, but the broker never acknowledges it. */
+    reset_broker();
+    ignore_publishes = true;
+    resent = client->stats()->resent;
+    TEST_ASSERT(client->publish(kAlertTopic, &payload, 1, 1, false, &packet_id));
+    start = clock_millis();
+    while (!publishes && clock_millis() - start < SETTLE_MS)
+    {
+        poll_for(10);
+    }
+    TEST_ASSERT_EQUAL(1, publishes);
+
+    /* Discarded, it is not sent again once reconnected. */
+    TEST_ASSERT(client->discard(packet_id));
+    TEST_ASSERT_EQUAL(0, client->queued());
+    TEST_ASSERT(client->is_delivered(packet_id));
+    client->disconnect();
+    TEST_ASSERT(connect_client());
+    poll_for(50);
+    TEST_ASSERT_EQUAL(1, publishes);
+    TEST_ASSERT_EQUAL(resent, client->stats()->resent);
+
+    TEST_ASSERT_FALSE(client->discard(packet_id));
+    TEST_ASSERT_FALSE(client->discard(0));
+}
+
+void test_qos0(void)
+{
+    MqttClient * client = MqttClient::get_instance();
+    byte_t payload = 't';
+    uint16_t packet_id;
+
+    reset_broker();
+    TEST_ASSERT(client->publish(kAlertTopic, &payload, 1, 0, false, &packet_id));
+    TEST_ASSERT_EQUAL(0, packet_id);
+    TEST_ASSERT_EQUAL(0, client->queued());
+    poll_for(20);
+    TEST_ASSERT_EQUAL(1, publishes);
+}
+
+void test_trickled_packets(void)
+{
+    MqttClient * client = MqttClient::get_instance();
+    uint32_t received;
+
+    /* Every packet the broker sends arrives a byte at a time. */
+    reset_broker();
+    trickle = true;
+    received = acks_received;
+    client->disconnect();
+    TEST_ASSERT(connect_client());
+    poll_for(200);
+    TEST_ASSERT_EQUAL(received + 1, acks_received);
+    TEST_ASSERT_EQUAL_MEMORY(kRetained, ack_payload, ack_length);
+    TEST_ASSERT_EQUAL(1, client_pubacks);
+    trickle = false;
+}
+
+void test_unreadable_packets(void)
+{
+    MqttClient * client = MqttClient::get_instance();
+    uint32_t received;
+    byte_t payload = 'u';
+
+    /* The one too large is skipped but acknowledged, the overrun dropped. */
+    reset_broker();
+    unreadable = true;
+    received = acks_received;
+    TEST_ASSERT(client->publish(kAlertTopic, &payload, 1, 0));
+    poll_for(50);
+    TEST_ASSERT_EQUAL(received, acks_received);
+    TEST_ASSERT_EQUAL(1, client_pubacks);
+    TEST_ASSERT_EQUAL(0x5678, last_client_puback);
+    TEST_ASSERT(client->is_connected());
+}
+
+void test_keep_alive(void)
+{
+    MqttClient * client = MqttClient::get_instance();
+    uint32_t connected;
+
+    /* Pinged once idle for the keep alive. */
+    reset_broker();
+    client->disconnect();
+    configure(1);
+    TEST_ASSERT(connect_client());
+    TEST_ASSERT_EQUAL(1, keepalive_s);
+    poll_for(1300);
+    TEST_ASSERT_EQUAL(1, pings);
+    TEST_ASSERT(client->is_connected());
+
+    /* An unanswered ping gives up on the connection, and reconnects. */
+    ignore_pings = true;
+    connected = client->stats()->connects;
+    poll_for(1700);
+    ignore_pings = false;
+    poll_for(50);
+    TEST_ASSERT(pings >= 2);
+    TEST_ASSERT_EQUAL(connected + 1, client->stats()->connects);
+    TEST_ASSERT(client->is_connected());
+
+    client->disconnect();
+    configure(MQTT_KEEPALIVE_S);
+    TEST_ASSERT(connect_client());
+    poll_for(50);
+}
+
+void test_connect_without_waiting(void)
+{
+    MqttClient * client = MqttClient::get_instance();
+    time_ms_t start;
+    uint8_t i;
+
+    /* Opened on the first poll, and no poll waits for the CONNACK. */
+    reset_broker();
+    silent_connack = true;
+    client->disconnect();
+    TEST_ASSERT(client->connect());
+    TEST_ASSERT_FALSE(client->is_connected());
+    for (i = 0; i < 10; i++)
+    {
+        start = clock_millis();
+        client->poll();
+        TEST_ASSERT(clock_millis() - start < 50);
+        usleep(5000);
+    }
+    TEST_ASSERT_FALSE(client->is_connected());
+
+    silent_connack = false;
+    client->disconnect();
+    TEST_ASSERT(connect_client());
+}
+
+/*
+ *  Benchmarks
+ */
+
+void test_bench_publish_to_ack(void)
+{
+    MqttClient * client = MqttClient::get_instance();
+    byte_t alert[WIREMSG_LENGTH_MAX];
+    wiremsg_t msg;
+    uint32_t i, start, elapsed_us, delivered;
+    uint16_t packet_id, length, wire_length;
+    char_t report[192];
+
+    memset(&msg, 0, sizeof(msg));
+    msg.type = WIREMSG_ALERT;
+    length = wiremsg_encode(&msg, alert, sizeof(alert));
+    wire_length = 2 + 2 + strlen(kAlertTopic) + 2 + length;
+
+    reset_broker();
+    delivered = 0;
+    start = clock_micros();
+    for (i = 0; i < BENCH_PUBLISHES; i++)
+    {
+        client->publish(kAlertTopic, alert, length, 1, false, &packet_id);
+        if (poll_delivered(packet_id, SETTLE_MS)) delivered++;
+    }
+    elapsed_us = clock_micros() - start;
+    TEST_ASSERT_EQUAL(BENCH_PUBLISHES, delivered);
+
+    snprintf(report, sizeof(report),
+        "publish-to-ack: %u us per alert over a kept connection, "
+        "%u bytes on the wire, keep alive 2 bytes per %u s",
+        elapsed_us / BENCH_PUBLISHES, wire_length, MQTT_KEEPALIVE_S);
+    TEST_MESSAGE(report);
+}
+
+int main(int argc, char ** argv)
+{
+    if (!start_broker()) return 1;
+
+    UNITY_BEGIN();
+
+    /* The client is a singleton, so these run in order and build on each other. */
+    RUN_TEST(test_not_configured);
+    RUN_TEST(test_queue_bounded);
+    RUN_TEST(test_persistent_session);
+    RUN_TEST(test_retained_ack);
+    RUN_TEST(test_resend_after_drop);
+    RUN_TEST(test_discard);
+    RUN_TEST(test_qos0);
+    RUN_TEST(test_trickled_packets);
+    RUN_TEST(test_unreadable_packets);
+    RUN_TEST(test_keep_alive);
+    RUN_TEST(test_connect_without_waiting);
+    RUN_TEST(test_bench_publish_to_ack);
+
+    return UNITY_END();
+}
+
+#endif /* UNIT_TEST */
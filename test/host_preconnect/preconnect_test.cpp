@@ -0,0 +1,174 @@
+/*
+ *  Module: Pre-connect - Host Simulation
+ *
+ *  Simulates the manager loop debouncing a help press while a
+ *  connection to the platform is made, with injected handshake
+ *  latency.  Reports how much of the handshake is hidden behind
+ *  the debounce window.
+ *
+ *  Author: Alex Dale @superoxigen
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for information.
+ */
+
+#ifdef UNIT_TEST
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "unity.h"
+#include "utils.h"
+
+#include "netconn.hpp"
+
+/* Manager loop period, scaled down from 200 ms. */
+#define SIM_LOOP_PERIOD_US      20000
+/* Consecutive reads the button needs to accept a press. */
+#define SIM_DEBOUNCE_READS      5
+/* Injected TCP handshake latency. */
+#define SIM_HANDSHAKE_MS        15
+#define SIM_PRESSES             10
+
+static kstring_t kRequest = "POST /patient/request1 HTTP/1.1\r\n\r\n";
+
+static int listen_fd = -1;
+static uint16_t listen_port = 0;
+
+static uint32_t now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t) (ts.tv_sec * 1000000UL + ts.tv_nsec / 1000);
+}
+
+static void sleep_until_us(uint32_t deadline)
+{
+    int32_t remaining = (int32_t) (deadline - now_us());
+    if (remaining > 0) usleep(remaining);
+}
+
+/* The kernel completes handshakes on the listen backlog. */
+static bool_t start_listener(void)
+{
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+
+    listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (listen_fd < 0) return false;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(listen_fd, (struct sockaddr *) &addr, sizeof(addr))) return false;
+    if (listen(listen_fd, 64)) return false;
+    if (getsockname(listen_fd, (struct sockaddr *) &addr, &addr_len)) return false;
+    listen_port = ntohs(addr.sin_port);
+    return true;
+}
+
+static void drain_listener(void)
+{
+    int fd;
+    struct timeval tv = {0, 1000};
+    setsockopt(listen_fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    while ((fd = accept(listen_fd, NULL, NULL)) >= 0) close(fd);
+}
+
+/*
+ *  Runs one press through the simulated manager loop.  Returns
+ *  the time from the press being accepted to the request being
+ *  written, in microseconds.
+ */
+static uint32_t simulate_press(NetConn * conn, bool_t preconnect, bool_t accept_press)
+{
+    uint32_t tick, accepted_at;
+    uint8_t reads;
+
+    tick = now_us();
+    for (reads = 1; reads < SIM_DEBOUNCE_READS; reads++)
+    {
+        /* Button::loop is in READING_STATE. */
+        if (preconnect && !conn->connected())
+        {
+            conn->connect("127.0.0.1", listen_port);
+        }
+        tick += SIM_LOOP_PERIOD_US;
+        sleep_until_us(tick);
+    }
+
+    if (!accept_press)
+    {
+        /* Debounce rejected the press. */
+        conn->stop();
+        return 0;
+    }
+
+    accepted_at = now_us();
+    if (!conn->connected())
+    {
+        conn->connect("127.0.0.1", listen_port);
+    }
+    conn->write((byte_t const *) kRequest, strlen(kRequest));
+    accepted_at = now_us() - accepted_at;
+    conn->stop();
+    return accepted_at;
+}
+
+void test_preconnect_hides_handshake(void)
+{
+    NetConn conn;
+    uint32_t cold_us, warm_us;
+    uint8_t i;
+    char_t report[128];
+
+    NetConn::set_sim_connect_latency(SIM_HANDSHAKE_MS);
+
+    cold_us = warm_us = 0;
+    for (i = 0; i < SIM_PRESSES; i++)
+    {
+        cold_us += simulate_press(&conn, false, true);
+        warm_us += simulate_press(&conn, true, true);
+        drain_listener();
+    }
+    cold_us /= SIM_PRESSES;
+    warm_us /= SIM_PRESSES;
+
+    snprintf(report, sizeof(report),
+        "press->request: cold %u us, pre-connected %u us, hidden %u us",
+        cold_us, warm_us, cold_us - warm_us);
+    TEST_MESSAGE(report);
+
+    TEST_ASSERT(cold_us >= SIM_HANDSHAKE_MS * 1000);
+    TEST_ASSERT(warm_us < cold_us);
+    NetConn::set_sim_connect_latency(0);
+}
+
+void test_rejected_press_drops_connection(void)
+{
+    NetConn conn;
+
+    simulate_press(&conn, true, false);
+    TEST_ASSERT_FALSE(conn.connected());
+    drain_listener();
+}
+
+int main(int argc, char ** argv)
+{
+    if (!start_listener()) return 1;
+
+    UNITY_BEGIN();
+
+    RUN_TEST(test_preconnect_hides_handshake);
+    RUN_TEST(test_rejected_press_drops_connection);
+
+    close(listen_fd);
+    return UNITY_END();
+}
+
+#endif /* UNIT_TEST */
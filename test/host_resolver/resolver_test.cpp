@@ -0,0 +1,146 @@
+/*
+ *  Module: Resolver - Unit Test
+ *
+ *  Author: Alex Dale @superoxigen
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for information.
+ */
+
+#ifdef UNIT_TEST
+
+#include <string.h>
+#include <unistd.h>
+
+#include "unity.h"
+#include "utils.h"
+
+#include "resolver.hpp"
+
+#define TEST_TTL_MS 50
+
+static kstring_t kTestHost = "platform.test";
+
+/*
+ *  Stand-in Resolver
+ */
+
+static uint32_t lookups = 0;
+static bool_t lookup_fails = false;
+static net_addr_t lookup_address = 0x0100007F;
+
+static bool_t stand_in_lookup(kstring_t host, net_addr_t * address, uint32_t * ttl_ms)
+{
+    lookups++;
+    if (lookup_fails || strcmp(host, kTestHost)) return false;
+    *address = lookup_address;
+    *ttl_ms = TEST_TTL_MS;
+    return true;
+}
+
+static Resolver * reset(void)
+{
+    Resolver * resolver = Resolver::get_instance();
+    resolver->set_lookup(stand_in_lookup);
+    lookups = 0;
+    lookup_fails = false;
+    lookup_address = 0x0100007F;
+    return resolver;
+}
+
+/*
+ *  Test Cases
+ */
+
+void test_hit_within_ttl(void)
+{
+    Resolver * resolver = reset();
+    net_addr_t address;
+    uint32_t hits, misses;
+
+    hits = resolver->hits();
+    misses = resolver->misses();
+
+    TEST_ASSERT(resolver->resolve(kTestHost, &address));
+    TEST_ASSERT(resolver->resolve(kTestHost, &address));
+    TEST_ASSERT_EQUAL_UINT32(0x0100007F, address);
+    TEST_ASSERT_EQUAL(1, lookups);
+    TEST_ASSERT_EQUAL(misses + 1, resolver->misses());
+    TEST_ASSERT_EQUAL(hits + 1, resolver->hits());
+}
+
+void test_stale_while_revalidate(void)
+{
+    Resolver * resolver = reset();
+    net_addr_t address;
+
+    TEST_ASSERT(resolver->prewarm(kTestHost));
+    usleep((TEST_TTL_MS + 10) * 1000);
+
+    /* Stale answer is served without a lookup. */
+    lookup_address = 0x0200007F;
+    TEST_ASSERT(resolver->resolve(kTestHost, &address));
+    TEST_ASSERT_EQUAL_UINT32(0x0100007F, address);
+    TEST_ASSERT_EQUAL(1, lookups);
+
+    /* Background revalidation picks up the new address. */
+    resolver->refresh();
+    TEST_ASSERT_EQUAL(2, lookups);
+    TEST_ASSERT(resolver->resolve(kTestHost, &address));
+    TEST_ASSERT_EQUAL_UINT32(0x0200007F, address);
+}
+
+void test_failed_revalidation_keeps_stale(void)
+{
+    Resolver * resolver = reset();
+    net_addr_t address;
+
+    TEST_ASSERT(resolver->prewarm(kTestHost));
+    usleep((TEST_TTL_MS + 10) * 1000);
+    TEST_ASSERT(resolver->resolve(kTestHost, &address));
+
+    lookup_fails = true;
+    resolver->refresh();
+    TEST_ASSERT(resolver->resolve(kTestHost, &address));
+    TEST_ASSERT_EQUAL_UINT32(0x0100007F, address);
+}
+
+void test_negative_cache(void)
+{
+    Resolver * resolver = reset();
+    net_addr_t address;
+    uint32_t negative_hits;
+
+    negative_hits = resolver->negative_hits();
+    lookup_fails = true;
+    TEST_ASSERT_FALSE(resolver->resolve(kTestHost, &address));
+    TEST_ASSERT_FALSE(resolver->resolve(kTestHost, &address));
+    TEST_ASSERT_EQUAL(1, lookups);
+    TEST_ASSERT_EQUAL(negative_hits + 1, resolver->negative_hits());
+}
+
+void test_invalidate(void)
+{
+    Resolver * resolver = reset();
+    net_addr_t address;
+
+    TEST_ASSERT(resolver->resolve(kTestHost, &address));
+    resolver->invalidate(kTestHost);
+    TEST_ASSERT(resolver->resolve(kTestHost, &address));
+    TEST_ASSERT_EQUAL(2, lookups);
+}
+
+int main(int argc, char ** argv)
+{
+    UNITY_BEGIN();
+
+    RUN_TEST(test_hit_within_ttl);
+    RUN_TEST(test_stale_while_revalidate);
+    RUN_TEST(test_failed_revalidation_keeps_stale);
+    RUN_TEST(test_negative_cache);
+    RUN_TEST(test_invalidate);
+
+    return UNITY_END();
+}
+
+#endif /* UNIT_TEST */
@@ -0,0 +1,818 @@
+/*
+ *  Module: smlstr (Small String) - Host Test & Benchmark
+ *
+ *  Checks the word at a time copy and concatenation against the
+ *  byte loops they replace, for every alignment of each side, every
+ *  length around the word boundaries and every buffer length, down
+ *  to the byte left after the terminator.  Then times both, and
+ *  libc, for strings from 8 bytes to 1 KB.
+ *
+ *  Decimal, hex and fixed point formatting must write what snprintf()
+ *  does, cut to each length, and scanning must take exactly the
+ *  decimals that fit 32 bits; both are timed against the division
+ *  loops they replace and libc.
+ *
+ *  URL encoding is checked against a character at a time reference,
+ *  whole, cut short and in chunks, over random text, and decoding
+ *  must undo it, in place too, and refuse broken escapes; both are
+ *  timed on IDs and on free text.
+ *
+ *  Author: Alex Dale @superoxigen
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for information.
+ */
+
+#ifdef UNIT_TEST
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "unity.h"
+#include "utils.h"
+
+#include "bufstr.hpp"
+#include "clock.h"
+#include "smlstr.h"
+
+#define SWEEP_LENGTH        40
+#define GUARD               0x5A
+#define BENCH_BUFFER        1040
+#define BENCH_BYTES         (4UL * 1024 * 1024)
+#define FUZZ_CASES          200000
+#define FUZZ_SEED           0x9E3779B9
+#define BENCH_NUMBERS       1024
+#define BENCH_ROUNDS        500
+#define URL_TEXT            96
+#define URL_ENCODED         (3 * URL_TEXT + 1)
+#define URL_BENCH_CALLS     200000
+
+/*
+ *  Reference
+ */
+
+static uint16_t ref_strcpy(string_t dest, kstring_t src, uint16_t len)
+{
+    uint16_t required = 0;
+
+    while (*src && len > 0 && required < (len-1))
+    {
+        *dest++ = *src++;
+        required++;
+    }
+    while (*src)
+    {
+        src++;
+        required++;
+    }
+    if (len > 0)
+    {
+        *dest = 0;
+    }
+    return required;
+}
+
+static uint16_t ref_strcat(string_t dest, kstring_t src, uint16_t len)
+{
+    uint16_t required = 0;
+
+    while (*dest && required < (len-1))
+    {
+        dest++;
+        required++;
+    }
+    return required + ref_strcpy(dest, src, len - required);
+}
+
+/* What strlcpy() does, from libc's own kernels. */
+static uint16_t libc_strcpy(string_t dest, kstring_t src, uint16_t len)
+{
+    size_t length = strlen(src);
+    size_t copied = (length < len) ? length : len - 1;
+
+    memcpy(dest, src, copied);
+    dest[copied] = 0;
+    return (uint16_t) length;
+}
+
+static uint16_t libc_strcat(string_t dest, kstring_t src, uint16_t len)
+{
+    size_t end = strnlen(dest, len - 1);
+
+    return (uint16_t) (end + libc_strcpy(&dest[end], src, (uint16_t) (len - end)));
+}
+
+/* The formatting and scanning this replaced, a division a digit. */
+static uint16_t ref_uintfmt(string_t dest, uint32_t val, uint16_t len)
+{
+    uint16_t required = 0, i;
+    uint32_t rest;
+    string_t dptr;
+
+    for (rest = val; rest; rest /= 10) required++;
+    if (!required) required = 1;
+
+    if (len == 0) return required;
+    if (required < len)
+    {
+        dptr = &dest[required];
+    }
+    else
+    {
+        dptr = &dest[len-1];
+        for (i = 0; i <= (required-len); i++) val = val / 10;
+    }
+    *dptr-- = 0;
+    while (dest <= dptr)
+    {
+        *dptr-- = (char_t) ('0' + val % 10);
+        val = val / 10;
+    }
+    return required;
+}
+
+static uint32_t ref_uintscan(kstring_t src)
+{
+    uint32_t value = 0;
+
+    if (!*src || *src == '-') return 0;
+    while (*src >= '0' && *src <= '9')
+    {
+        value = value * 10 + (uint32_t) (*src++ - '0');
+    }
+    return *src ? 0 : value;
+}
+
+/* What a number is, by libc: only digits, and no more than 32 bits. */
+static uint32_t libc_uintscan(kstring_t src)
+{
+    unsigned long long value;
+    char * end;
+
+    if (*src < '0' || *src > '9') return 0;
+    value = strtoull(src, &end, 10);
+    return (*end || value > UINT32_MAX) ? 0 : (uint32_t) value;
+}
+
+/* One character at a time, by the rules of each mode. */
+static uint16_t ref_urlenc(string_t dest, kstring_t src, smlurl_mode_t mode)
+{
+    static kstring_t kHex = "0123456789ABCDEF";
+    kstring_t safe = (mode == SMLURL_FORM) ? "*-._" : "-._~";
+    uint16_t n = 0;
+    byte_t c;
+
+    for (; *src; src++)
+    {
+        c = (byte_t) *src;
+        if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')
+            || strchr(safe, c))
+        {
+            dest[n++] = (char_t) c;
+        }
+        else if (c == ' ' && mode == SMLURL_FORM)
+        {
+            dest[n++] = '+';
+        }
+        else
+        {
+            dest[n++] = '%';
+            dest[n++] = kHex[c >> 4];
+            dest[n++] = kHex[c & 0x0F];
+        }
+    }
+    dest[n] = 0;
+    return n;
+}
+
+typedef uint16_t (*strfn_t)(string_t dest, kstring_t src, uint16_t len);
+
+/*
+ *  Test Cases
+ */
+
+static char_t s_source[SWEEP_LENGTH + 8];
+static char_t s_expected[SWEEP_LENGTH + 16];
+static char_t s_actual[SWEEP_LENGTH + 16];
+
+/* A string of `length` at `offset`, with characters that are all high or all low. */
+static kstring_t sweep_source(uint8_t offset, uint8_t length)
+{
+    uint8_t i;
+
+    memset(s_source, 'z', sizeof(s_source));
+    for (i = 0; i < length; i++)
+    {
+        s_source[offset + i] = (i & 1) ? (char_t) (0x80 | i) : (char_t) ('A' + i);
+    }
+    s_source[offset + length] = 0;
+    return &s_source[offset];
+}
+
+void test_copy_sweep(void)
+{
+    uint8_t src_at, dest_at, length, len;
+    kstring_t src;
+
+    for (src_at = 0; src_at < 4; src_at++)
+        for (dest_at = 0; dest_at < 4; dest_at++)
+            for (length = 0; length < SWEEP_LENGTH; length++)
+                for (len = 0; len < SWEEP_LENGTH + 4; len++)
+                {
+                    src = sweep_source(src_at, length);
+                    memset(s_expected, GUARD, sizeof(s_expected));
+                    memset(s_actual, GUARD, sizeof(s_actual));
+                    TEST_ASSERT_EQUAL(ref_strcpy(&s_expected[dest_at], src, len),
+                        smlstrcpy(&s_actual[dest_at], src, len));
+                    TEST_ASSERT_EQUAL_MEMORY(s_expected, s_actual, sizeof(s_actual));
+                }
+}
+
+void test_cat_sweep(void)
+{
+    uint8_t src_at, dest_at, head, length, len;
+    kstring_t src;
+
+    for (src_at = 0; src_at < 4; src_at++)
+        for (dest_at = 0; dest_at < 4; dest_at++)
+            for (head = 0; head < 12; head++)
+                for (length = 0; length < SWEEP_LENGTH - 12; length++)
+                    for (len = 0; len < SWEEP_LENGTH + 4; len++)
+                    {
+                        src = sweep_source(src_at, length);
+                        memset(s_expected, GUARD, sizeof(s_expected));
+                        memset(s_expected + dest_at, 'h', head);
+                        s_expected[dest_at + head] = 0;
+                        memcpy(s_actual, s_expected, sizeof(s_actual));
+                        TEST_ASSERT_EQUAL(ref_strcat(&s_expected[dest_at], src, len),
+                            smlstrcat(&s_actual[dest_at], src, len));
+                        TEST_ASSERT_EQUAL_MEMORY(s_expected, s_actual, sizeof(s_actual));
+                    }
+}
+
+/* A destination with no terminator in its length is cut to fit. */
+void test_cat_unterminated(void)
+{
+    char_t dest[12];
+
+    memset(dest, 'x', sizeof(dest));
+    TEST_ASSERT_EQUAL(7 + 3, smlstrcat(dest, "abc", 8));
+    TEST_ASSERT_EQUAL_STRING("xxxxxxx", dest);
+    TEST_ASSERT_EQUAL('x', dest[8]);
+}
+
+void test_null_and_empty(void)
+{
+    char_t dest[8] = "keep";
+
+    TEST_ASSERT_EQUAL(0, smlstrcpy(NULL, "abc", 4));
+    TEST_ASSERT_EQUAL(0, smlstrcpy(dest, NULL, 4));
+    TEST_ASSERT_EQUAL(0, smlstrcat(dest, NULL, 4));
+    TEST_ASSERT_EQUAL(3, smlstrcpy(dest, "abc", 0));
+    TEST_ASSERT_EQUAL_STRING("keep", dest);
+    TEST_ASSERT_EQUAL(3, smlstrcat(dest, "abc", 0));
+    TEST_ASSERT_EQUAL_STRING("keep", dest);
+    TEST_ASSERT_EQUAL(3, smlstrcpy(dest, "abc", 1));
+    TEST_ASSERT_EQUAL_STRING("", dest);
+}
+
+static uint32_t s_state = FUZZ_SEED;
+
+static uint32_t next_random(void)
+{
+    s_state ^= s_state << 13;
+    s_state ^= s_state >> 17;
+    s_state ^= s_state << 5;
+    return s_state;
+}
+
+/* Numbers of every length, and those either side of each power of ten. */
+static uint32_t random_number(uint32_t i)
+{
+    static uint32_t const edges[] = {
+        0, 1, 9, 10, 11, 99, 100, 101, 999, 1000, 9999, 10000, 43698, 43699,
+        99999, 100000, 999999, 1000000, 9999999, 10000000, 99999999,
+        100000000, 999999999, 1000000000, 2147483647, 2147483648UL,
+        4294967294UL, 4294967295UL
+    };
+
+    if (i < sizeof(edges) / sizeof(edges[0])) return edges[i];
+    return next_random() >> (next_random() % 32);
+}
+
+void test_uint_format(void)
+{
+    char_t expected[16], actual[16];
+    uint32_t i, value;
+    uint16_t len;
+
+    for (i = 0; i < FUZZ_CASES; i++)
+    {
+        value = random_number(i);
+        for (len = 0; len < 13; len++)
+        {
+            memset(expected, GUARD, sizeof(expected));
+            memset(actual, GUARD, sizeof(actual));
+            TEST_ASSERT_EQUAL(snprintf(expected, len, "%u", value),
+                smluintfmt(actual, value, len));
+            TEST_ASSERT_EQUAL_MEMORY(expected, actual, sizeof(actual));
+        }
+    }
+}
+
+void test_int_format(void)
+{
+    static int32_t const edges[] = { INT32_MIN, INT32_MIN + 1, -1000000000, -10, -9, -1 };
+    char_t expected[16], actual[16];
+    uint32_t i;
+    int32_t value;
+    uint16_t len;
+
+    for (i = 0; i < FUZZ_CASES; i++)
+    {
+        value = (i < sizeof(edges) / sizeof(edges[0])) ? edges[i] : (int32_t) random_number(i);
+        for (len = 0; len < 14; len++)
+        {
+            memset(expected, GUARD, sizeof(expected));
+            memset(actual, GUARD, sizeof(actual));
+            TEST_ASSERT_EQUAL(snprintf(expected, len, "%d", value),
+                smlintfmt(actual, value, len));
+            TEST_ASSERT_EQUAL_MEMORY(expected, actual, sizeof(actual));
+        }
+    }
+}
+
+void test_hex_format(void)
+{
+    char_t expected[16], actual[16];
+    uint32_t i, value;
+    uint8_t width;
+    uint16_t len;
+
+    for (i = 0; i < FUZZ_CASES / 10; i++)
+    {
+        value = random_number(i);
+        for (width = 0; width < 9; width++)
+            for (len = 0; len < 11; len++)
+            {
+                memset(expected, GUARD, sizeof(expected));
+                memset(actual, GUARD, sizeof(actual));
+                TEST_ASSERT_EQUAL(snprintf(expected, len, "%0*X", width, value),
+                    smlhexfmt(actual, value, width, len));
+                TEST_ASSERT_EQUAL_MEMORY(expected, actual, sizeof(actual));
+            }
+    }
+
+    /* No more than eight, whatever is asked. */
+    TEST_ASSERT_EQUAL(8, smlhexfmt(actual, 0xAB, 12, sizeof(actual)));
+    TEST_ASSERT_EQUAL_STRING("000000AB", actual);
+}
+
+/* The reference splits the magnitude, as the value may be the most negative. */
+static int ref_fixfmt(char_t * dest, int32_t value, uint8_t places, uint16_t len)
+{
+    static uint32_t const kScales[] = {
+        1UL, 10UL, 100UL, 1000UL, 10000UL, 100000UL,
+        1000000UL, 10000000UL, 100000000UL, 1000000000UL
+    };
+    uint32_t magnitude = (value < 0) ? 0UL - (uint32_t) value : (uint32_t) value;
+
+    if (!places)
+    {
+        return snprintf(dest, len, "%d", (int) value);
+    }
+    return snprintf(dest, len, "%s%u.%0*u", (value < 0) ? "-" : "",
+        (unsigned) (magnitude / kScales[places]), (int) places,
+        (unsigned) (magnitude % kScales[places]));
+}
+
+void test_fixed_format(void)
+{
+    char_t expected[16], actual[16];
+    uint32_t i;
+    int32_t value;
+    uint8_t places;
+    uint16_t len;
+
+    for (i = 0; i < FUZZ_CASES / 10; i++)
+    {
+        value = (int32_t) random_number(i);
+        if (i & 1) value = -value;
+        for (places = 0; places < 10; places++)
+            for (len = 0; len < 15; len++)
+            {
+                memset(expected, GUARD, sizeof(expected));
+                memset(actual, GUARD, sizeof(actual));
+                TEST_ASSERT_EQUAL(ref_fixfmt(expected, value, places, len),
+                    smlfixfmt(actual, value, places, len));
+                TEST_ASSERT_EQUAL_MEMORY(expected, actual, sizeof(actual));
+            }
+    }
+
+    TEST_ASSERT_EQUAL(6, smlfixfmt(actual, -1234, 2, sizeof(actual)));
+    TEST_ASSERT_EQUAL_STRING("-12.34", actual);
+    TEST_ASSERT_EQUAL(6, smlfixfmt(actual, -5, 3, sizeof(actual)));
+    TEST_ASSERT_EQUAL_STRING("-0.005", actual);
+    TEST_ASSERT_EQUAL(12, smlfixfmt(actual, INT32_MIN, 1, sizeof(actual)));
+    TEST_ASSERT_EQUAL_STRING("-214748364.8", actual);
+
+    /* No more than nine places, whatever is asked. */
+    TEST_ASSERT_EQUAL(11, smlfixfmt(actual, 7, 12, sizeof(actual)));
+    TEST_ASSERT_EQUAL_STRING("0.000000007", actual);
+}
+
+void test_uint_scan(void)
+{
+    static char_t const faults[] = "-+ .:/a\x80";
+    char_t text[24];
+    uint32_t i, value;
+    uint8_t length, at;
+
+    for (i = 0; i < FUZZ_CASES; i++)
+    {
+        value = random_number(i);
+        switch (next_random() % 6)
+        {
+            case 0:
+                /* Leading zeros. */
+                length = (uint8_t) snprintf(text, sizeof(text), "%0*u",
+                    (int) (next_random() % 16), value);
+                break;
+            case 1:
+                /* Too big, by up to a digit. */
+                length = (uint8_t) snprintf(text, sizeof(text), "%llu",
+                    (unsigned long long) value * (next_random() % 20 + 1));
+                break;
+            default:
+                length = (uint8_t) snprintf(text, sizeof(text), "%u", value);
+                break;
+        }
+        if (next_random() % 3 == 0)
+        {
+            at = (uint8_t) (next_random() % (length + 1));
+            text[at] = (at == length) ? 'z' : faults[next_random() % (sizeof(faults) - 1)];
+            text[length + 1] = 0;
+        }
+        TEST_ASSERT_EQUAL(libc_uintscan(text), smluintscan(text));
+    }
+
+    TEST_ASSERT_EQUAL(0, smluintscan(NULL));
+    TEST_ASSERT_EQUAL(0, smluintscan(""));
+    TEST_ASSERT_EQUAL(0, smluintscan("0"));
+    TEST_ASSERT_EQUAL(0, smluintscan("4294967296"));
+    TEST_ASSERT_EQUAL(4294967295UL, smluintscan("0004294967295"));
+    TEST_ASSERT_EQUAL(8080, smluintscan("8080"));
+    TEST_ASSERT_EQUAL(-123, smlintscan("-123"));
+
+    /* Out of the signed range, as smluintscan(). */
+    TEST_ASSERT_EQUAL(INT32_MAX, smlintscan("2147483647"));
+    TEST_ASSERT_EQUAL(INT32_MIN, smlintscan("-2147483648"));
+    TEST_ASSERT_EQUAL(0, smlintscan("2147483648"));
+    TEST_ASSERT_EQUAL(0, smlintscan("-2147483649"));
+    TEST_ASSERT_EQUAL(0, smlintscan("3000000000"));
+    TEST_ASSERT_EQUAL(0, smlintscan("-3000000000"));
+    TEST_ASSERT_EQUAL(0, smlintscan("4294967295"));
+    TEST_ASSERT_EQUAL(0, smlintscan("-4294967295"));
+    TEST_ASSERT_EQUAL(0, smlintscan("-"));
+    TEST_ASSERT_EQUAL(0, smlintscan("-0"));
+}
+
+/* Mostly letters and digits, as real values are, with anything else between. */
+static uint8_t random_text(char_t * text, uint8_t offset)
+{
+    static kstring_t kCommon = "abcXYZ0189-._~* +%&=/";
+    uint8_t length = (uint8_t) (next_random() % (URL_TEXT - 4)), i;
+
+    for (i = 0; i < length; i++)
+    {
+        switch (next_random() % 4)
+        {
+            case 0:
+                text[offset + i] = (char_t) (next_random() % 255 + 1);
+                break;
+            case 1:
+                text[offset + i] = kCommon[next_random() % strlen(kCommon)];
+                break;
+            default:
+                text[offset + i] = (char_t) ('a' + next_random() % 26);
+                break;
+        }
+    }
+    text[offset + length] = 0;
+    return length;
+}
+
+void test_url_encode(void)
+{
+    char_t storage[URL_TEXT + 4], expected[URL_ENCODED], actual[URL_ENCODED + 1];
+    uint16_t required, written, len, chunk;
+    smlurl_mode_t mode;
+    kstring_t text, rest;
+    uint32_t i;
+
+    for (i = 0; i < FUZZ_CASES / 4; i++)
+    {
+        mode = (i & 1) ? SMLURL_FORM : SMLURL_PERCENT;
+        random_text(storage, (uint8_t) (i % 4));
+        text = &storage[i % 4];
+        required = ref_urlenc(expected, text, mode);
+
+        TEST_ASSERT_EQUAL(required, smlurlenclen(text, mode));
+        TEST_ASSERT_EQUAL(required, smlurlenc(actual, text, mode, sizeof(actual)));
+        TEST_ASSERT_EQUAL_STRING(expected, actual);
+
+        /* Cut short, at the last whole escape. */
+        len = (uint16_t) (next_random() % (required + 2));
+        memset(actual, GUARD, sizeof(actual));
+        TEST_ASSERT_EQUAL(required, smlurlenc(actual, text, mode, len));
+        if (len)
+        {
+            written = (uint16_t) strlen(actual);
+            TEST_ASSERT(written < len && written + 3 > len - 1 - (written == required));
+            TEST_ASSERT_EQUAL_MEMORY(expected, actual, written);
+            TEST_ASSERT(expected[written] != '%' || written + 3 > len - 1);
+        }
+        TEST_ASSERT_EQUAL(GUARD, (byte_t) actual[len]);
+
+        /* In chunks, as into a writer that is sent as it fills. */
+        rest = text;
+        written = 0;
+        while (*rest)
+        {
+            chunk = 3 + (uint16_t) (next_random() % 8);
+            written += smlurlencpart(&actual[written], &rest, mode, chunk);
+        }
+        actual[written] = 0;
+        TEST_ASSERT_EQUAL_STRING(expected, actual);
+    }
+}
+
+void test_url_decode(void)
+{
+    char_t storage[URL_TEXT + 4], encoded[URL_ENCODED + 4], decoded[URL_TEXT + 1];
+    uint16_t length, encoded_length;
+    smlurl_mode_t mode;
+    uint32_t i;
+
+    for (i = 0; i < FUZZ_CASES / 4; i++)
+    {
+        mode = (i & 1) ? SMLURL_FORM : SMLURL_PERCENT;
+        length = random_text(storage, 0);
+        encoded_length = ref_urlenc(&encoded[i % 4], storage, mode);
+
+        TEST_ASSERT_EQUAL(length,
+            smlurldec(decoded, &encoded[i % 4], encoded_length, mode, sizeof(decoded)));
+        TEST_ASSERT_EQUAL_STRING(storage, decoded);
+
+        /* In place, with no terminator on what it reads. */
+        encoded[i % 4 + encoded_length] = 'z';
+        TEST_ASSERT_EQUAL(length, smlurldec(&encoded[i % 4], &encoded[i % 4], encoded_length,
+            mode, (uint16_t) (sizeof(encoded) - i % 4)));
+        TEST_ASSERT_EQUAL_STRING(storage, &encoded[i % 4]);
+
+        /* One short has no room for the terminator. */
+        if (length)
+        {
+            encoded_length = ref_urlenc(encoded, storage, mode);
+            TEST_ASSERT_EQUAL(0, smlurldec(decoded, encoded, encoded_length, mode, length));
+        }
+    }
+
+    TEST_ASSERT_EQUAL(4, smlurldec(decoded, "a+b%2f", 6, SMLURL_FORM, sizeof(decoded)));
+    TEST_ASSERT_EQUAL_STRING("a b/", decoded);
+    TEST_ASSERT_EQUAL(3, smlurldec(decoded, "a+b", 3, SMLURL_PERCENT, sizeof(decoded)));
+    TEST_ASSERT_EQUAL_STRING("a+b", decoded);
+    TEST_ASSERT_EQUAL(0, smlurldec(decoded, "%", 1, SMLURL_FORM, sizeof(decoded)));
+    TEST_ASSERT_EQUAL(0, smlurldec(decoded, "ab%4", 4, SMLURL_FORM, sizeof(decoded)));
+    TEST_ASSERT_EQUAL(0, smlurldec(decoded, "%4g", 3, SMLURL_FORM, sizeof(decoded)));
+    TEST_ASSERT_EQUAL(0, smlurldec(decoded, "%g4", 3, SMLURL_FORM, sizeof(decoded)));
+}
+
+void test_bufstr_urlencoded(void)
+{
+    char_t buffer[16];
+    BufStr str(buffer, sizeof(buffer));
+
+    TEST_ASSERT(str.push_str("q="));
+    TEST_ASSERT(str.push_urlencoded("a b&c", SMLURL_FORM));
+    TEST_ASSERT_EQUAL_STRING("q=a+b%26c", buffer);
+
+    /* What does not fit is left out whole, not as half an escape. */
+    TEST_ASSERT_FALSE(str.push_urlencoded("xyz//", SMLURL_PERCENT));
+    TEST_ASSERT_EQUAL_STRING("q=a+b%26cxyz%2F", buffer);
+    TEST_ASSERT_EQUAL(15, str.length());
+}
+
+/*
+ *  Benchmark
+ */
+
+static char_t s_bench_source[BENCH_BUFFER];
+static char_t s_bench_dest[BENCH_BUFFER];
+static volatile uint32_t s_sink;
+
+/* Nanoseconds for each call, over about the same bytes for each size. */
+static uint32_t bench(strfn_t fn, bool_t cat, uint16_t size)
+{
+    uint32_t calls = BENCH_BYTES / size, i, sink = 0;
+    kstring_t src = &s_bench_source[1];
+    time_us_t started;
+
+    memset(s_bench_source, 'a', sizeof(s_bench_source));
+    s_bench_source[1 + size] = 0;
+    memset(s_bench_dest, 'b', 8);
+
+    started = clock_micros();
+    for (i = 0; i < calls; i++)
+    {
+        /* Cat adds to eight characters, so each call is the same. */
+        s_bench_dest[8] = 0;
+        sink += fn(cat ? s_bench_dest : &s_bench_dest[2], src, BENCH_BUFFER - 4);
+    }
+    s_sink = sink;
+    return (uint32_t) ((uint64_t) (clock_micros() - started) * 1000 / calls);
+}
+
+void test_bench(void)
+{
+    static uint16_t const sizes[] = { 8, 16, 32, 64, 128, 256, 1024 };
+    uint32_t old_ns, new_ns, libc_ns;
+    char_t report[96];
+    uint8_t i, cat;
+
+    for (cat = 0; cat < 2; cat++)
+    {
+        TEST_MESSAGE(cat ? "smlstrcat   bytes  loop ns  word ns  libc ns"
+                         : "smlstrcpy   bytes  loop ns  word ns  libc ns");
+        for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+        {
+            old_ns = bench(cat ? ref_strcat : ref_strcpy, cat, sizes[i]);
+            new_ns = bench(cat ? smlstrcat : smlstrcpy, cat, sizes[i]);
+            libc_ns = bench(cat ? libc_strcat : libc_strcpy, cat, sizes[i]);
+            snprintf(report, sizeof(report), "           %5u  %7u  %7u  %7u",
+                sizes[i], old_ns, new_ns, libc_ns);
+            TEST_MESSAGE(report);
+
+            if (sizes[i] >= 128) TEST_ASSERT(new_ns < old_ns);
+        }
+    }
+}
+
+static uint32_t s_numbers[BENCH_NUMBERS];
+static char_t s_texts[BENCH_NUMBERS][12];
+
+typedef uint16_t (*fmtfn_t)(string_t dest, uint32_t val, uint16_t len);
+typedef uint32_t (*scanfn_t)(kstring_t src);
+
+static uint16_t libc_uintfmt(string_t dest, uint32_t val, uint16_t len)
+{
+    return (uint16_t) snprintf(dest, len, "%u", val);
+}
+
+static uint32_t bench_format(fmtfn_t fn)
+{
+    char_t text[12];
+    uint32_t i, r, sink = 0;
+    time_us_t started = clock_micros();
+
+    for (r = 0; r < BENCH_ROUNDS; r++)
+        for (i = 0; i < BENCH_NUMBERS; i++)
+        {
+            sink += fn(text, s_numbers[i], sizeof(text)) + text[0];
+        }
+    s_sink = sink;
+    return (uint32_t) ((uint64_t) (clock_micros() - started) * 1000
+        / ((uint64_t) BENCH_NUMBERS * BENCH_ROUNDS));
+}
+
+static uint32_t bench_scan(scanfn_t fn)
+{
+    uint32_t i, r, sink = 0;
+    time_us_t started = clock_micros();
+
+    for (r = 0; r < BENCH_ROUNDS; r++)
+        for (i = 0; i < BENCH_NUMBERS; i++)
+        {
+            sink += fn(s_texts[i]);
+        }
+    s_sink = sink;
+    return (uint32_t) ((uint64_t) (clock_micros() - started) * 1000
+        / ((uint64_t) BENCH_NUMBERS * BENCH_ROUNDS));
+}
+
+/* The best of three, as the host is shared. */
+static uint32_t bench_url(uint8_t which, kstring_t text, char_t * out, char_t * decoded)
+{
+    uint32_t i, sink = 0, ns, best = UINT32_MAX;
+    uint16_t length = (uint16_t) strlen(out);
+    time_us_t started;
+    uint8_t round;
+
+    for (round = 0; round < 3; round++)
+    {
+        started = clock_micros();
+        for (i = 0; i < URL_BENCH_CALLS; i++)
+        {
+            switch (which)
+            {
+                case 0:
+                    sink += ref_urlenc(out, text, SMLURL_FORM);
+                    break;
+                case 1:
+                    sink += smlurlenc(out, text, SMLURL_FORM, URL_ENCODED);
+                    break;
+                default:
+                    sink += smlurldec(decoded, out, length, SMLURL_FORM, URL_TEXT);
+                    break;
+            }
+        }
+        ns = (uint32_t) ((uint64_t) (clock_micros() - started) * 1000 / URL_BENCH_CALLS);
+        if (ns < best) best = ns;
+    }
+    s_sink = sink;
+    return best;
+}
+
+/* A form's values: IDs, all letters, digits and dashes, and free text. */
+void test_bench_url(void)
+{
+    static kstring_t const kTexts[] = {
+        "0f8fad5b-d9cb-469f-a165-70867728950e",
+        "Room 12, bed 3: patient asked for water & a blanket (again).",
+        "RoomTwelveBedThreePatientAskedForWaterAndABlanketAgain00"
+    };
+    static kstring_t const kNames[] = { "id", "text", "alnum" };
+    char_t out[URL_ENCODED], decoded[URL_TEXT];
+    uint32_t ref_ns, new_ns, dec_ns, i;
+    char_t report[96];
+
+    TEST_MESSAGE("  url      bytes  loop ns  word ns  decode ns");
+    for (i = 0; i < sizeof(kTexts) / sizeof(kTexts[0]); i++)
+    {
+        out[0] = 0;
+        ref_ns = bench_url(0, kTexts[i], out, decoded);
+        new_ns = bench_url(1, kTexts[i], out, decoded);
+        dec_ns = bench_url(2, kTexts[i], out, decoded);
+
+        snprintf(report, sizeof(report), "  %-6s   %5u  %7u  %7u  %9u",
+            kNames[i], (unsigned) strlen(kTexts[i]), ref_ns, new_ns, dec_ns);
+        TEST_MESSAGE(report);
+    }
+}
+
+/*
+ *  Ports, line numbers and telemetry counts: a spread from one digit
+ *  to ten.  The host's compiler already turns a division by ten into
+ *  a multiply, so this shows only the halved steps; the ESP8266 calls
+ *  out for each division.
+ */
+void test_bench_numbers(void)
+{
+    uint32_t ns[6], i;
+    char_t report[96];
+
+    for (i = 0; i < BENCH_NUMBERS; i++)
+    {
+        s_numbers[i] = next_random() >> (next_random() % 32);
+        snprintf(s_texts[i], sizeof(s_texts[i]), "%u", s_numbers[i]);
+    }
+
+    ns[0] = bench_format(ref_uintfmt);
+    ns[1] = bench_format(smluintfmt);
+    ns[2] = bench_format(libc_uintfmt);
+    ns[3] = bench_scan(ref_uintscan);
+    ns[4] = bench_scan(smluintscan);
+    ns[5] = bench_scan(libc_uintscan);
+
+    TEST_MESSAGE("            loop ns  pairs ns  libc ns");
+    snprintf(report, sizeof(report), "  format    %7u  %8u  %7u", ns[0], ns[1], ns[2]);
+    TEST_MESSAGE(report);
+    snprintf(report, sizeof(report), "  scan      %7u  %8u  %7u", ns[3], ns[4], ns[5]);
+    TEST_MESSAGE(report);
+}
+
+int main(int argc, char ** argv)
+{
+    UNITY_BEGIN();
+
+    RUN_TEST(test_copy_sweep);
+    RUN_TEST(test_cat_sweep);
+    RUN_TEST(test_cat_unterminated);
+    RUN_TEST(test_null_and_empty);
+    RUN_TEST(test_uint_format);
+    RUN_TEST(test_int_format);
+    RUN_TEST(test_hex_format);
+    RUN_TEST(test_fixed_format);
+    RUN_TEST(test_uint_scan);
+    RUN_TEST(test_url_encode);
+    RUN_TEST(test_url_decode);
+    RUN_TEST(test_bufstr_urlencoded);
+    RUN_TEST(test_bench);
+    RUN_TEST(test_bench_numbers);
+    RUN_TEST(test_bench_url);
+
+    return UNITY_END();
+}
+
+#endif /* UNIT_TEST */
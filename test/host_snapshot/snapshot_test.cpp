@@ -0,0 +1,156 @@
+/*
+ *  Module: Snapshot - Unit Test
+ *
+ *  Author: Alex Dale @superoxigen
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for information.
+ */
+
+#ifdef UNIT_TEST
+
+#include <stdio.h>
+#include <string.h>
+
+#include "unity.h"
+#include "utils.h"
+
+#include "alertmgr.hpp"
+#include "rtcmem.h"
+#include "snapshot.h"
+#include "uuid.h"
+
+static kstring_t kTestRequestID = "0f8fad5b-d9cb-469f-a165-70867728950e";
+
+/*
+ *  Test Interfaces
+ */
+
+class TestIndicator {
+public:
+    uint8_t power_ons;
+    bool_t flashing;
+
+    TestIndicator(): power_ons(0), flashing(false) {}
+
+    void power_on(void) { power_ons++; }
+    void alert_on(void) { flashing = false; }
+    void alert_off(void) { flashing = false; }
+    void alert_flash(void) { flashing = true; }
+};
+
+class TestMessenger {
+public:
+    transport_status_t request_help(uuid_ref_t request_id) {
+        return uuid_to_binary(kTestRequestID, request_id)
+            ? TRANSPORT_DELIVERED : TRANSPORT_UNAVAILABLE;
+    }
+    bool_t cancel_help(uuid_kref_t request_id) { return true; }
+};
+
+typedef AlertManager<TestIndicator, TestMessenger> TestAlertManager;
+template<>
+TestAlertManager TestAlertManager::s_instance = TestAlertManager();
+
+static TestIndicator indicator;
+static TestMessenger messenger;
+
+/*
+ *  Test Cases
+ */
+
+void test_seal_and_validate(void)
+{
+    snapshot_t snapshot;
+
+    snapshot_init(&snapshot);
+    snapshot.mode = 1;
+    snapshot_seal(&snapshot);
+    TEST_ASSERT(snapshot_is_valid(&snapshot));
+
+    /* Any flipped bit must be caught. */
+    snapshot.enabled_mode ^= 0x04;
+    TEST_ASSERT_FALSE(snapshot_is_valid(&snapshot));
+}
+
+void test_rejects_other_version(void)
+{
+    snapshot_t snapshot;
+
+    snapshot_init(&snapshot);
+    snapshot_seal(&snapshot);
+    snapshot.version = SNAPSHOT_VERSION + 1;
+    TEST_ASSERT_FALSE(snapshot_is_valid(&snapshot));
+}
+
+void test_save_load_round_trip(void)
+{
+    snapshot_t saved, loaded;
+
+    snapshot_init(&saved);
+    saved.mode = 1;
+    saved.send_attempts = 2;
+    TEST_ASSERT(uuid_to_binary(kTestRequestID, saved.request_id));
+    TEST_ASSERT(snapshot_save(&saved));
+
+    TEST_ASSERT(snapshot_load(&loaded));
+    TEST_ASSERT_EQUAL_MEMORY(&saved, &loaded, sizeof(snapshot_t));
+
+    TEST_ASSERT(snapshot_clear());
+    TEST_ASSERT_FALSE(snapshot_load(&loaded));
+}
+
+void test_resume_mid_alert(void)
+{
+    TestAlertManager * manager = TestAlertManager::get_instance();
+    snapshot_t snapshot;
+    uuid_t request_id;
+
+    manager->set_indicator_interface(&indicator);
+    manager->set_messenger_interface(&messenger);
+
+    /* Alert sent and awaiting acknowledgement. */
+    manager->enable();
+    manager->help_button_push();
+    manager->try_send();
+    TEST_ASSERT(manager->is_sent());
+
+    snapshot_init(&snapshot);
+    manager->save_snapshot(&snapshot);
+    TEST_ASSERT(snapshot_save(&snapshot));
+
+    /* Reset */
+    manager->hard_reset();
+    indicator = TestIndicator();
+    TEST_ASSERT(manager->is_disabled());
+
+    TEST_ASSERT(snapshot_load(&snapshot));
+    TEST_ASSERT(manager->resume(&snapshot));
+    TEST_ASSERT(manager->is_sent());
+    TEST_ASSERT(indicator.power_ons == 1);
+    TEST_ASSERT(indicator.flashing);
+    TEST_ASSERT(uuid_to_binary(kTestRequestID, request_id));
+    TEST_ASSERT(uuid_equal(request_id, manager->get_request_id()));
+
+    /* Only a disabled manager resumes. */
+    TEST_ASSERT_FALSE(manager->resume(&snapshot));
+
+    manager->hard_reset();
+    snapshot_clear();
+}
+
+int main(int argc, char ** argv)
+{
+    remove(RTCMEM_SHIM_FILE);
+
+    UNITY_BEGIN();
+
+    RUN_TEST(test_seal_and_validate);
+    RUN_TEST(test_rejects_other_version);
+    RUN_TEST(test_save_load_round_trip);
+    RUN_TEST(test_resume_mid_alert);
+
+    return UNITY_END();
+}
+
+#endif /* UNIT_TEST */
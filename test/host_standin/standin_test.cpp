@@ -0,0 +1,435 @@
+/*
+ *  Module: Stand-in Server - Host Test & Benchmark
+ *
+ *  Sends the stand-in the pendant's requests, rendered by HTTPer as
+ *  the Messenger renders them, and checks its answers: a help request
+ *  keeps its issue ID or is issued one, in JSON or binary, cancels
+ *  and tests are answered, and pipelined requests on one connection
+ *  are each answered in order.  Then loads it with the load generator
+ *  and reports its throughput and tail latency, on kept alive and on
+ *  new connections.
+ *
+ *  Author: Alex Dale @superoxigen
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for information.
+ */
+
+#ifdef UNIT_TEST
+
+#include <netinet/in.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "unity.h"
+#include "utils.h"
+
+#include "httper.hpp"
+#include "httpwire.h"
+#include "loadgen.h"
+#include "standin.hpp"
+#include "uuid.h"
+#include "wiremsg.h"
+
+#define TEST_HOST           "127.0.0.1"
+#define TEST_THREADS        4
+#define TEST_REQUEST_LENGTH 512
+
+#define BENCH_REQUESTS      20000
+#define BENCH_TIMEOUT_MS    5000
+
+static kstring_t kDevice = "5a5c1d0e-8c4b-4d43-9f1e-0a6b8c2d4e6f";
+static kstring_t kIssue = "0f1e2d3c-4b5a-4978-8695-a4b3c2d1e0f9";
+static kstring_t kZero = "00000000-0000-0000-0000-000000000000";
+static kstring_t kAccepts = "application/vnd.pendant.v1, application/json";
+
+static StandinServer s_server;
+static HTTPer::header_set_t s_accept;
+
+static bool_t start_server(bool_t binary)
+{
+    standin_config_t config;
+
+    /* In case a failed test left it running. */
+    s_server.stop();
+
+    memset(&config, 0, sizeof(config));
+    config.threads = TEST_THREADS;
+    config.binary = binary;
+    return s_server.start(&config);
+}
+
+/* Renders the form help request, as the Messenger does, or as older firmware did. */
+static uint16_t render_help(byte_t * request, kstring_t issue_id, bool_t accept=true)
+{
+    HTTPer help(TEST_HOST, s_server.port(), "/patient/request1");
+
+    if (accept)
+    {
+        help.add_headers(&s_accept);
+    }
+    help.push_parameter("device_id", kDevice);
+    help.push_parameter("request_type_id", "1");
+    help.push_parameter("issue_id", issue_id);
+    return help.render_post(request, TEST_REQUEST_LENGTH);
+}
+
+/* Renders a binary request of the type, as the Messenger does. */
+static uint16_t render_binary(byte_t * request, kstring_t path, uint8_t type, kstring_t issue_id)
+{
+    HTTPer client(TEST_HOST, s_server.port(), path);
+    byte_t body[WIREMSG_LENGTH_MAX];
+    wiremsg_t msg;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.type = type;
+    msg.request_type = 1;
+    uuid_to_binary(kDevice, msg.device_id);
+    uuid_to_binary(issue_id, msg.issue_id);
+
+    client.add_headers(&s_accept);
+    client.set_body(body, wiremsg_encode(&msg, body, sizeof(body)), kWiremsgMediaType);
+    return client.render_post(request, TEST_REQUEST_LENGTH);
+}
+
+typedef struct {
+    byte_t data[256];
+    uint16_t length;
+} body_t;
+
+static bool_t take_body(void * context, byte_t const * data, uint16_t length)
+{
+    body_t * body = (body_t *) context;
+
+    if (body->length + length > sizeof(body->data)) return false;
+    memcpy(&body->data[body->length], data, length);
+    body->length += length;
+    return true;
+}
+
+static int connect_server(void)
+{
+    struct sockaddr_in addr;
+    int fd;
+
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(s_server.port());
+    if (fd >= 0 && connect(fd, (struct sockaddr *) &addr, sizeof(addr)))
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* Reads one response from the connection.  Returns its code, or -1. */
+static int16_t read_response(int fd, body_t * body)
+{
+    httpwire_parser_t parser;
+    httpwire_status_t status;
+    byte_t byte;
+
+    memset(body, 0, sizeof(*body));
+    httpwire_parser_init(&parser, take_body, body);
+
+    /* A byte at a time, so the next response is left unread. */
+    status = HTTPWIRE_MORE;
+    while (status == HTTPWIRE_MORE && recv(fd, &byte, 1, 0) == 1)
+    {
+        status = httpwire_feed(&parser, &byte, 1);
+    }
+    return (status == HTTPWIRE_DONE) ? parser.code : -1;
+}
+
+/* Sends the request on a new connection and reads its response. */
+static int16_t exchange(byte_t const * request, uint16_t length, body_t * body)
+{
+    int16_t code;
+    int fd;
+
+    fd = connect_server();
+    if (fd < 0) return -1;
+    code = (send(fd, request, length, 0) == length) ? read_response(fd, body) : -1;
+    close(fd);
+    return code;
+}
+
+static int16_t exchange_str(kstring_t request, body_t * body)
+{
+    return exchange((byte_t const *) request, strlen(request), body);
+}
+
+/*
+ *  Test Cases
+ */
+
+void test_help_issued(void)
+{
+    byte_t request[TEST_REQUEST_LENGTH];
+    standin_stats_t stats;
+    wiremsg_t reply;
+    body_t body;
+    uint16_t length;
+
+    TEST_ASSERT(start_server(true));
+    length = render_help(request, kZero, false);
+    TEST_ASSERT(length > 0);
+
+    /* Without an ID of its own, the request is issued a new one, in JSON unless binary is accepted. */
+    TEST_ASSERT_EQUAL(201, exchange(request, length, &body));
+    TEST_ASSERT_EQUAL(13 + UUID_BUFFER_LENGTH - 1 + 2, body.length);
+    TEST_ASSERT_EQUAL_MEMORY("{\"issue_id\":\"", body.data, 13);
+    TEST_ASSERT(memcmp(&body.data[13], kZero, UUID_BUFFER_LENGTH - 1));
+    TEST_ASSERT_EQUAL_HEX8('4', body.data[13 + 14]);
+
+    /* With one, it is kept. */
+    length = render_help(request, kIssue, false);
+    TEST_ASSERT_EQUAL(201, exchange(request, length, &body));
+    TEST_ASSERT_EQUAL_MEMORY(kIssue, &body.data[13], UUID_BUFFER_LENGTH - 1);
+
+    length = render_help(request, kZero);
+    TEST_ASSERT_EQUAL(201, exchange(request, length, &body));
+    TEST_ASSERT(wiremsg_decode(&reply, body.data, body.length));
+    TEST_ASSERT_EQUAL(WIREMSG_HELP_REPLY, reply.type);
+
+    s_server.stop();
+    s_server.read_stats(&stats);
+    TEST_ASSERT_EQUAL(3, stats.requests[STANDIN_HELP]);
+    TEST_ASSERT_EQUAL(2, stats.issued);
+    TEST_ASSERT_EQUAL(0, stats.bad_requests);
+}
+
+void test_help_binary(void)
+{
+    byte_t request[TEST_REQUEST_LENGTH];
+    byte_t issue_id[UUID_BINARY_LENGTH];
+    standin_stats_t stats;
+    wiremsg_t reply;
+    body_t body;
+    uint16_t length;
+
+    TEST_ASSERT(start_server(true));
+
+    length = render_binary(request, "/patient/request1", WIREMSG_HELP, kIssue);
+    TEST_ASSERT_EQUAL(201, exchange(request, length, &body));
+    TEST_ASSERT(wiremsg_decode(&reply, body.data, body.length));
+    TEST_ASSERT_EQUAL(WIREMSG_HELP_REPLY, reply.type);
+    uuid_to_binary(kIssue, issue_id);
+    TEST_ASSERT_EQUAL_MEMORY(issue_id, reply.issue_id, UUID_BINARY_LENGTH);
+
+    /* A cancel is not a help request. */
+    length = render_binary(request, "/patient/request1", WIREMSG_CANCEL, kIssue);
+    TEST_ASSERT_EQUAL(400, exchange(request, length, &body));
+
+    s_server.stop();
+    s_server.read_stats(&stats);
+    TEST_ASSERT_EQUAL(2, stats.binary);
+    TEST_ASSERT_EQUAL(0, stats.issued);
+    TEST_ASSERT_EQUAL(1, stats.bad_requests);
+}
+
+/* The Messenger's own calls are answered as the platform does. */
+void test_httper(void)
+{
+    char_t payload[128];
+
+    TEST_ASSERT(start_server(true));
+
+    HTTPer help(TEST_HOST, s_server.port(), "/patient/request1");
+    help.push_parameter("device_id", kDevice);
+    help.push_parameter("request_type_id", "1");
+    help.push_parameter("issue_id", kIssue);
+    TEST_ASSERT_EQUAL(HTTPer::STATUS_OK, help.send_post(payload, sizeof(payload)));
+    TEST_ASSERT(strstr(payload, kIssue) != NULL);
+
+    HTTPer cancel(TEST_HOST, s_server.port(), "/patient/request/cancel");
+    cancel.push_parameter("device_id", kDevice);
+    cancel.push_parameter("issue_id", kIssue);
+    TEST_ASSERT_EQUAL(HTTPer::STATUS_OK, cancel.send_post());
+
+    HTTPer test(TEST_HOST, s_server.port(), "/patient/test");
+    test.push_parameter("device_id", kDevice);
+    TEST_ASSERT_EQUAL(HTTPer::STATUS_OK, test.send_get());
+
+    HTTPer incomplete(TEST_HOST, s_server.port(), "/patient/request/cancel");
+    incomplete.push_parameter("device_id", kDevice);
+    TEST_ASSERT_EQUAL(HTTPer::STATUS_BAD_REQUEST, incomplete.send_post());
+
+    s_server.stop();
+}
+
+void test_refused(void)
+{
+    byte_t request[TEST_REQUEST_LENGTH];
+    body_t body;
+    uint16_t length;
+
+    /* A platform that only speaks the form. */
+    TEST_ASSERT(start_server(false));
+
+    TEST_ASSERT_EQUAL(404, exchange_str("GET /patient HTTP/1.1\r\nHost: x\r\n\r\n", &body));
+    TEST_ASSERT_EQUAL(405, exchange_str("GET /patient/request1 HTTP/1.1\r\n\r\n", &body));
+    TEST_ASSERT_EQUAL(400, exchange_str("BREW /patient/test HTTP/1.1\r\n\r\n", &body));
+    length = render_binary(request, "/patient/request1", WIREMSG_HELP, kIssue);
+    TEST_ASSERT_EQUAL(415, exchange(request, length, &body));
+
+    /* Which is still answered in the form. */
+    length = render_help(request, kIssue);
+    TEST_ASSERT_EQUAL(201, exchange(request, length, &body));
+    TEST_ASSERT_EQUAL_MEMORY(kIssue, &body.data[13], UUID_BUFFER_LENGTH - 1);
+
+    s_server.stop();
+}
+
+/* Requests sent together on one connection are each answered, in order. */
+void test_pipelined(void)
+{
+    byte_t request[3 * TEST_REQUEST_LENGTH];
+    standin_stats_t stats;
+    body_t body;
+    uint16_t length;
+    int fd;
+
+    TEST_ASSERT(start_server(true));
+
+    length = render_help(request, kIssue);
+    length += render_binary(&request[length], "/patient/request/cancel", WIREMSG_CANCEL, kIssue);
+    memcpy(&request[length], "GET /nowhere HTTP/1.1\r\n\r\n", 25);
+    length += 25;
+
+    fd = connect_server();
+    TEST_ASSERT(fd >= 0);
+    TEST_ASSERT_EQUAL(length, send(fd, request, length, 0));
+    TEST_ASSERT_EQUAL(201, read_response(fd, &body));
+    TEST_ASSERT_EQUAL(200, read_response(fd, &body));
+    TEST_ASSERT_EQUAL(404, read_response(fd, &body));
+    close(fd);
+
+    s_server.stop();
+    s_server.read_stats(&stats);
+    TEST_ASSERT_EQUAL(1, stats.connections);
+    TEST_ASSERT_EQUAL(1, stats.requests[STANDIN_HELP]);
+    TEST_ASSERT_EQUAL(1, stats.requests[STANDIN_CANCEL]);
+    TEST_ASSERT_EQUAL(1, stats.requests[STANDIN_OTHER]);
+}
+
+void test_latency_buckets(void)
+{
+    standin_stats_t stats;
+    uint32_t latency, floor;
+    uint8_t bucket;
+
+    for (latency = 0; latency < 10000000; latency = latency * 9 / 8 + 1)
+    {
+        bucket = StandinServer::latency_bucket(latency);
+        floor = StandinServer::latency_floor(bucket);
+        TEST_ASSERT(floor <= latency);
+        TEST_ASSERT(latency - floor <= floor / 8);
+        TEST_ASSERT(StandinServer::latency_bucket(floor) == bucket);
+    }
+    TEST_ASSERT(StandinServer::latency_bucket(UINT32_MAX) < STANDIN_LATENCY_BUCKETS);
+
+    memset(&stats, 0, sizeof(stats));
+    stats.latency[StandinServer::latency_bucket(100)] = 99;
+    stats.latency[StandinServer::latency_bucket(5000)] = 1;
+    TEST_ASSERT_EQUAL(StandinServer::latency_floor(StandinServer::latency_bucket(100)),
+        StandinServer::percentile_us(&stats, 990));
+    TEST_ASSERT_EQUAL(StandinServer::latency_floor(StandinServer::latency_bucket(5000)),
+        StandinServer::percentile_us(&stats, 999));
+}
+
+/*
+ *  Benchmark
+ */
+
+static void bench(kstring_t name, byte_t const * request, uint16_t length,
+    uint16_t concurrency, bool_t reconnect)
+{
+    loadgen_config_t config;
+    loadgen_result_t result;
+    standin_stats_t stats;
+    char_t report[256];
+
+    TEST_ASSERT(start_server(true));
+
+    memset(&config, 0, sizeof(config));
+    config.host = TEST_HOST;
+    config.port = s_server.port();
+    config.request = request;
+    config.length = length;
+    config.concurrency = concurrency;
+    config.requests = BENCH_REQUESTS;
+    config.reconnect = reconnect;
+    config.timeout_ms = BENCH_TIMEOUT_MS;
+    TEST_ASSERT(loadgen_run(&config, &result));
+
+    s_server.stop();
+    s_server.read_stats(&stats);
+
+    snprintf(report, sizeof(report),
+        "%-6s %-9s x%-3u %7u/s  p50 %5uus  p90 %5uus  p99 %5uus  p99.9 %6uus  max %6uus"
+        "  (server p99 %uus)",
+        name, reconnect ? "reconnect" : "kept", concurrency, result.per_second,
+        result.p50_us, result.p90_us, result.p99_us, result.p999_us, result.max_us,
+        StandinServer::percentile_us(&stats, 990));
+    TEST_MESSAGE(report);
+
+    TEST_ASSERT_EQUAL(BENCH_REQUESTS, result.answered);
+    TEST_ASSERT_EQUAL(0, result.failed);
+    TEST_ASSERT_EQUAL(BENCH_REQUESTS, stats.requests[STANDIN_HELP] + stats.requests[STANDIN_TEST]);
+    TEST_ASSERT_EQUAL(reconnect ? BENCH_REQUESTS : concurrency, stats.connections);
+}
+
+void test_bench_throughput(void)
+{
+    static uint16_t const concurrency[] = { 1, 4, 16 };
+    byte_t form[TEST_REQUEST_LENGTH];
+    byte_t binary[TEST_REQUEST_LENGTH];
+    byte_t test[TEST_REQUEST_LENGTH];
+    uint16_t form_length, binary_length, test_length;
+    uint8_t i;
+
+    form_length = render_help(form, kZero);
+    binary_length = render_binary(binary, "/patient/request1", WIREMSG_HELP, kZero);
+    {
+        HTTPer client(TEST_HOST, s_server.port(), "/patient/test");
+        client.push_parameter("device_id", kDevice);
+        test_length = client.render_get(test, TEST_REQUEST_LENGTH);
+    }
+    TEST_ASSERT(form_length && binary_length && test_length);
+
+    for (i = 0; i < sizeof(concurrency) / sizeof(concurrency[0]); i++)
+    {
+        bench("form", form, form_length, concurrency[i], false);
+        bench("binary", binary, binary_length, concurrency[i], false);
+    }
+    bench("test", test, test_length, 4, false);
+    for (i = 0; i < sizeof(concurrency) / sizeof(concurrency[0]); i++)
+    {
+        bench("binary", binary, binary_length, concurrency[i], true);
+    }
+}
+
+int main(int argc, char ** argv)
+{
+    UNITY_BEGIN();
+
+    HTTPer::push_header(&s_accept, "Accept", kAccepts);
+
+    RUN_TEST(test_help_issued);
+    RUN_TEST(test_help_binary);
+    RUN_TEST(test_httper);
+    RUN_TEST(test_refused);
+    RUN_TEST(test_pipelined);
+    RUN_TEST(test_latency_buckets);
+    RUN_TEST(test_bench_throughput);
+
+    return UNITY_END();
+}
+
+#endif /* UNIT_TEST */
@@ -0,0 +1,248 @@
+/*
+ *  Module: Telemetry - Host Test & Benchmark
+ *
+ *  Checks the sample ring drops the oldest when full, the latency
+ *  histogram's buckets, the heartbeat's layout, and that only what a
+ *  heartbeat carried is taken out once it is sent.  Then compares
+ *  one heartbeat with a request per metric.
+ *
+ *  Author: Alex Dale @superoxigen
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for information.
+ */
+
+#ifdef UNIT_TEST
+
+#include <stdio.h>
+#include <string.h>
+
+#include "unity.h"
+#include "utils.h"
+
+#include "clock.h"
+#include "httper.hpp"
+#include "telemetry.h"
+#include "wiremsg.h"
+
+#define BENCH_ROUNDS    100000
+#define BENCH_METRICS   5
+
+static kstring_t kDeviceID = "7c9e6679-7425-40de-944b-e07fc1f90ae7";
+
+static uint16_t get16(byte_t const * ptr)
+{
+    return (uint16_t) ((ptr[0] << 8) | ptr[1]);
+}
+
+static void fill(telemetry_t * telemetry, uint8_t samples, uint32_t uptime_s)
+{
+    scheduler_stats_t stats;
+    uint8_t i;
+
+    for (i = 0; i < samples; i++)
+    {
+        stats.tasks_run = 100 + i;
+        stats.tasks_failed = 0;
+        stats.longest_task_us = 1500;
+        telemetry_sample(telemetry, uptime_s + i * 60, -60 - i, 40000, &stats);
+    }
+}
+
+/*
+ *  Test Cases
+ */
+
+void test_ring(void)
+{
+    telemetry_t telemetry;
+    telemetry_mark_t mark;
+    byte_t buffer[TELEMETRY_LENGTH_MAX];
+    byte_t device_id[UUID_BINARY_LENGTH];
+    uint16_t length;
+
+    memset(device_id, 0, sizeof(device_id));
+    telemetry_init(&telemetry);
+    fill(&telemetry, TELEMETRY_SAMPLES + 4, 0);
+    TEST_ASSERT_EQUAL(TELEMETRY_SAMPLES, telemetry.count);
+    TEST_ASSERT_EQUAL(4, telemetry.dropped);
+
+    /* Oldest first: the fifth taken, 16 minutes old. */
+    length = telemetry_encode(&telemetry, device_id, (TELEMETRY_SAMPLES + 4) * 60,
+        buffer, sizeof(buffer), &mark);
+    TEST_ASSERT_EQUAL(TELEMETRY_LENGTH_MAX, length);
+    TEST_ASSERT_EQUAL(4, get16(&buffer[TELEMETRY_HEADER_LENGTH - 3]));
+    TEST_ASSERT_EQUAL(TELEMETRY_SAMPLES, buffer[TELEMETRY_HEADER_LENGTH - 1]);
+    TEST_ASSERT_EQUAL(TELEMETRY_SAMPLES * 60, get16(&buffer[TELEMETRY_HEADER_LENGTH]));
+    TEST_ASSERT_EQUAL(-64, (int8_t) buffer[TELEMETRY_HEADER_LENGTH + 2]);
+    TEST_ASSERT_EQUAL(104, get16(&buffer[TELEMETRY_HEADER_LENGTH + 5]));
+    TEST_ASSERT_EQUAL(60, get16(&buffer[length - TELEMETRY_SAMPLE_LENGTH]));
+}
+
+void test_saturation(void)
+{
+    telemetry_t telemetry;
+    scheduler_stats_t stats;
+
+    telemetry_init(&telemetry);
+    stats.tasks_run = 1000000;
+    stats.tasks_failed = 300;
+    stats.longest_task_us = 100000000;
+    telemetry_sample(&telemetry, 0, -90, 1000000, &stats);
+
+    TEST_ASSERT_EQUAL(UINT16_MAX, telemetry.samples[0].free_heap);
+    TEST_ASSERT_EQUAL(UINT16_MAX, telemetry.samples[0].tasks_run);
+    TEST_ASSERT_EQUAL(UINT16_MAX, telemetry.samples[0].longest_task_ms);
+    TEST_ASSERT_EQUAL(UINT8_MAX, telemetry.samples[0].tasks_failed);
+}
+
+void test_histogram(void)
+{
+    telemetry_t telemetry;
+
+    TEST_ASSERT_EQUAL(0, telemetry_bucket(0));
+    TEST_ASSERT_EQUAL(0, telemetry_bucket(63));
+    TEST_ASSERT_EQUAL(1, telemetry_bucket(64));
+    TEST_ASSERT_EQUAL(2, telemetry_bucket(200));
+    TEST_ASSERT_EQUAL(6, telemetry_bucket(4095));
+    TEST_ASSERT_EQUAL(7, telemetry_bucket(4096));
+    TEST_ASSERT_EQUAL(7, telemetry_bucket(UINT32_MAX));
+
+    telemetry_init(&telemetry);
+    telemetry_alert(&telemetry, 30, true);
+    telemetry_alert(&telemetry, 1200, true);
+    telemetry_alert(&telemetry, 9000, false);
+    TEST_ASSERT_EQUAL(2, telemetry.alerts);
+    TEST_ASSERT_EQUAL(1, telemetry.failed_alerts);
+    TEST_ASSERT_EQUAL(1, telemetry.latency[0]);
+    TEST_ASSERT_EQUAL(1, telemetry.latency[5]);
+}
+
+void test_layout(void)
+{
+    telemetry_t telemetry;
+    telemetry_mark_t mark;
+    byte_t buffer[TELEMETRY_LENGTH_MAX];
+    byte_t device_id[UUID_BINARY_LENGTH];
+    uint16_t length;
+
+    uuid_to_binary(kDeviceID, device_id);
+    telemetry_init(&telemetry);
+    telemetry_alert(&telemetry, 100, true);
+    fill(&telemetry, 2, 1000);
+
+    length = telemetry_encode(&telemetry, device_id, 0x01020304, buffer, sizeof(buffer), &mark);
+    TEST_ASSERT_EQUAL(TELEMETRY_HEADER_LENGTH + 2 * TELEMETRY_SAMPLE_LENGTH, length);
+    TEST_ASSERT_EQUAL(WIREMSG_VERSION, buffer[0]);
+    TEST_ASSERT_EQUAL(WIREMSG_HEARTBEAT, buffer[1]);
+    TEST_ASSERT_EQUAL_MEMORY(device_id, &buffer[2], UUID_BINARY_LENGTH);
+    TEST_ASSERT_EQUAL_HEX8(0x01, buffer[18]);
+    TEST_ASSERT_EQUAL_HEX8(0x04, buffer[21]);
+    TEST_ASSERT_EQUAL(1, get16(&buffer[22]));
+    TEST_ASSERT_EQUAL(0, get16(&buffer[24]));
+    TEST_ASSERT_EQUAL(1, get16(&buffer[26 + 2]));
+
+    /* Too small a buffer is refused, not overrun. */
+    TEST_ASSERT_EQUAL(0, telemetry_encode(&telemetry, device_id, 0, buffer, length - 1, &mark));
+
+    /* Its length is its own, so the fixed messages refuse it. */
+    TEST_ASSERT_EQUAL(0, wiremsg_length(WIREMSG_HEARTBEAT));
+}
+
+void test_sent(void)
+{
+    telemetry_t telemetry;
+    telemetry_mark_t mark;
+    byte_t buffer[TELEMETRY_LENGTH_MAX];
+    byte_t device_id[UUID_BINARY_LENGTH];
+
+    memset(device_id, 0, sizeof(device_id));
+    telemetry_init(&telemetry);
+    fill(&telemetry, 5, 0);
+    telemetry_alert(&telemetry, 100, true);
+    telemetry_encode(&telemetry, device_id, 300, buffer, sizeof(buffer), &mark);
+
+    /* Came in while the heartbeat was in flight, so kept. */
+    fill(&telemetry, 2, 300);
+    telemetry_alert(&telemetry, 100, true);
+    telemetry_alert(&telemetry, 100, false);
+
+    telemetry_sent(&telemetry, &mark);
+    TEST_ASSERT_EQUAL(2, telemetry.count);
+    TEST_ASSERT_EQUAL(300, telemetry.samples[(telemetry.head + TELEMETRY_SAMPLES - 2)
+        % TELEMETRY_SAMPLES].uptime_s);
+    TEST_ASSERT_EQUAL(1, telemetry.alerts);
+    TEST_ASSERT_EQUAL(1, telemetry.failed_alerts);
+    TEST_ASSERT_EQUAL(1, telemetry.latency[telemetry_bucket(100)]);
+
+    /* The ring wrapped under a heartbeat in flight: only the newer are kept. */
+    telemetry_encode(&telemetry, device_id, 400, buffer, sizeof(buffer), &mark);
+    fill(&telemetry, TELEMETRY_SAMPLES + 3, 400);
+    telemetry_sent(&telemetry, &mark);
+    TEST_ASSERT_EQUAL(TELEMETRY_SAMPLES, telemetry.count);
+    TEST_ASSERT_EQUAL(5, telemetry.dropped);
+}
+
+/*
+ *  Benchmark
+ */
+
+void test_bench_batching(void)
+{
+    telemetry_t telemetry;
+    telemetry_mark_t mark;
+    byte_t body[TELEMETRY_LENGTH_MAX];
+    byte_t request[512];
+    byte_t device_id[UUID_BINARY_LENGTH];
+    HTTPer heartbeat("127.0.0.1", 80, "/patient/heartbeat");
+    HTTPer metric("127.0.0.1", 80, "/patient/metric");
+    uint32_t i, start, encode_ns, batched, separate;
+    uint16_t length, body_length;
+    char_t report[192];
+
+    uuid_to_binary(kDeviceID, device_id);
+    telemetry_init(&telemetry);
+    fill(&telemetry, TELEMETRY_SAMPLES, 0);
+
+    start = clock_micros();
+    for (i = 0; i < BENCH_ROUNDS; i++)
+    {
+        body_length = telemetry_encode(&telemetry, device_id, 960, body, sizeof(body), &mark);
+    }
+    encode_ns = (uint32_t) ((clock_micros() - start) * 1000ULL / BENCH_ROUNDS);
+
+    heartbeat.set_body(body, body_length, kWiremsgMediaType);
+    batched = heartbeat.render_post(request, sizeof(request));
+    TEST_ASSERT(batched > 0);
+
+    /* The same, as a form request for each metric of each sample. */
+    metric.push_parameter("device_id", kDeviceID);
+    metric.push_parameter("metric", "longest_task_ms");
+    metric.push_parameter("value", "-60");
+    length = metric.render_post(request, sizeof(request));
+    TEST_ASSERT(length > 0);
+    separate = (uint32_t) length * BENCH_METRICS * TELEMETRY_SAMPLES;
+
+    snprintf(report, sizeof(report),
+        "heartbeat of %u samples: 1 request of %u bytes (body %u, encoded in %u ns), "
+        "per metric: %u requests of %u bytes",
+        TELEMETRY_SAMPLES, batched, body_length, encode_ns,
+        BENCH_METRICS * TELEMETRY_SAMPLES, separate);
+    TEST_MESSAGE(report);
+}
+
+int main(int argc, char ** argv)
+{
+    UNITY_BEGIN();
+
+    RUN_TEST(test_ring);
+    RUN_TEST(test_saturation);
+    RUN_TEST(test_histogram);
+    RUN_TEST(test_layout);
+    RUN_TEST(test_sent);
+    RUN_TEST(test_bench_batching);
+
+    return UNITY_END();
+}
+
+#endif /* UNIT_TEST */
@@ -0,0 +1,395 @@
+/*
+ *  Module: TLS - Host Test & Benchmark
+ *
+ *  Secures connections to a local TLS stand-in server, checking
+ *  the pinned key and resuming the session saved in (shimmed) RTC
+ *  memory.  Compares full handshakes to resumed ones.
+ *
+ *  Author: Alex Dale @superoxigen
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for information.
+ */
+
+#ifdef UNIT_TEST
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <openssl/ec.h>
+#include <openssl/evp.h>
+#include <openssl/ssl.h>
+#include <openssl/x509.h>
+
+#include "unity.h"
+#include "utils.h"
+
+#include "connpool.hpp"
+#include "httper.hpp"
+#include "netconn.hpp"
+#include "rtcmem.h"
+#include "tlssession.h"
+
+#define BENCH_HANDSHAKES    50
+#define KEY_BUFFER_LENGTH   256
+
+static char_t const kIssueBody[] =
+    "{\"issue_id\":\"0f8fad5b-d9cb-469f-a165-70867728950e\"}";
+
+static char_t const kResponse[] =
+    "HTTP/1.1 201 Created\r\n"
+    "Content-Type: application/json\r\n"
+    "Content-Length: 51\r\n"
+    "\r\n"
+    "{\"issue_id\":\"0f8fad5b-d9cb-469f-a165-70867728950e\"}";
+
+static int listen_fd = -1;
+static uint16_t listen_port = 0;
+static SSL_CTX * server_context = NULL;
+
+/* The server's key, and one it does not have. */
+static byte_t server_key[KEY_BUFFER_LENGTH];
+static byte_t other_key[KEY_BUFFER_LENGTH];
+static netconn_tls_t pinned;
+static netconn_tls_t mispinned;
+
+/*
+ *  Stand-in Server
+ */
+
+static EVP_PKEY * generate_key(byte_t * der, uint16_t * der_length)
+{
+    EVP_PKEY_CTX * context;
+    EVP_PKEY * key;
+    byte_t * ptr;
+
+    key = NULL;
+    context = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, NULL);
+    EVP_PKEY_keygen_init(context);
+    EVP_PKEY_CTX_set_ec_paramgen_curve_nid(context, NID_X9_62_prime256v1);
+    EVP_PKEY_keygen(context, &key);
+    EVP_PKEY_CTX_free(context);
+
+    ptr = der;
+    *der_length = (uint16_t) i2d_PUBKEY(key, &ptr);
+    return key;
+}
+
+static X509 * self_sign(EVP_PKEY * key)
+{
+    X509 * certificate;
+
+    certificate = X509_new();
+    ASN1_INTEGER_set(X509_get_serialNumber(certificate), 1);
+    X509_gmtime_adj(X509_getm_notBefore(certificate), 0);
+    X509_gmtime_adj(X509_getm_notAfter(certificate), 3600);
+    X509_NAME_add_entry_by_txt(X509_get_subject_name(certificate), "CN",
+        MBSTRING_ASC, (byte_t const *) "platform.test", -1, -1, 0);
+    X509_set_issuer_name(certificate, X509_get_subject_name(certificate));
+    X509_set_pubkey(certificate, key);
+    X509_sign(certificate, key, EVP_sha256());
+    return certificate;
+}
+
+static void * serve_connection(void * arg)
+{
+    SSL * ssl = (SSL *) arg;
+    char_t buffer[512];
+    uint32_t matched;
+    int n, i;
+
+    if (SSL_accept(ssl) == 1)
+    {
+        matched = 0;
+        while ((n = SSL_read(ssl, buffer, sizeof(buffer))) > 0)
+        {
+            /* A request ends with an empty line. */
+            for (i = 0; i < n; i++)
+            {
+                matched = (buffer[i] == "\r\n\r\n"[matched]) ? matched + 1
+                        : (buffer[i] == '\r') ? 1 : 0;
+                if (matched < 4) continue;
+                matched = 0;
+                SSL_write(ssl, kResponse, sizeof(kResponse) - 1);
+            }
+        }
+    }
+    /* Shut down cleanly, or the session is dropped from the cache. */
+    SSL_shutdown(ssl);
+    close(SSL_get_fd(ssl));
+    SSL_free(ssl);
+    return NULL;
+}
+
+static void * serve(void *)
+{
+    pthread_t thread;
+    SSL * ssl;
+    int fd;
+
+    while ((fd = accept(listen_fd, NULL, NULL)) >= 0)
+    {
+        ssl = SSL_new(server_context);
+        SSL_set_fd(ssl, fd);
+        pthread_create(&thread, NULL, serve_connection, ssl);
+        pthread_detach(thread);
+    }
+    return NULL;
+}
+
+static bool_t start_server(void)
+{
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    pthread_t thread;
+    EVP_PKEY * key;
+    EVP_PKEY * other;
+    X509 * certificate;
+
+    key = generate_key(server_key, &pinned.key_length);
+    other = generate_key(other_key, &mispinned.key_length);
+    certificate = self_sign(key);
+    pinned.host = mispinned.host = "127.0.0.1";
+    pinned.key = server_key;
+    mispinned.key = other_key;
+    EVP_PKEY_free(other);
+
+    /* Resumes by session ID, as the device does. */
+    server_context = SSL_CTX_new(TLS_server_method());
+    SSL_CTX_use_certificate(server_context, certificate);
+    SSL_CTX_use_PrivateKey(server_context, key);
+    SSL_CTX_set_options(server_context, SSL_OP_NO_TICKET);
+    SSL_CTX_set_session_id_context(server_context, (byte_t const *) "stand-in", 8);
+    X509_free(certificate);
+    EVP_PKEY_free(key);
+
+    listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (listen_fd < 0
+        || bind(listen_fd, (struct sockaddr *) &addr, sizeof(addr))
+        || listen(listen_fd, 128)
+        || getsockname(listen_fd, (struct sockaddr *) &addr, &addr_len))
+    {
+        return false;
+    }
+    listen_port = ntohs(addr.sin_port);
+    return !pthread_create(&thread, NULL, serve, NULL);
+}
+
+/*
+ *  Test Cases
+ */
+
+void test_full_then_resumed(void)
+{
+    netconn_tls_stats_t before;
+    tlssession_t saved;
+    NetConn conn;
+
+    tlssession_clear();
+    before = *NetConn::tls_stats();
+
+    TEST_ASSERT(conn.connect(htonl(INADDR_LOOPBACK), listen_port, 1000, &pinned));
+    TEST_ASSERT(conn.is_secure());
+    TEST_ASSERT_EQUAL(before.full + 1, NetConn::tls_stats()->full);
+    conn.stop();
+
+    /* The session went to RTC memory, where it outlives deep sleep. */
+    TEST_ASSERT(tlssession_load("127.0.0.1", listen_port, &saved));
+    TEST_ASSERT_FALSE(tlssession_load("other.test", listen_port, &saved));
+    TEST_ASSERT_FALSE(tlssession_load("127.0.0.1", listen_port + 1, &saved));
+    TEST_ASSERT(rtcmem_read(RTCMEM_SLOT_TLS_SESSION, &saved, sizeof(saved)));
+    TEST_ASSERT_EQUAL(TLSSESSION_MAGIC, saved.magic);
+
+    TEST_ASSERT(conn.connect(htonl(INADDR_LOOPBACK), listen_port, 1000, &pinned));
+    TEST_ASSERT_EQUAL(before.full + 1, NetConn::tls_stats()->full);
+    TEST_ASSERT_EQUAL(before.resumed + 1, NetConn::tls_stats()->resumed);
+    conn.stop();
+
+    /* Without it, the handshake is a full one again. */
+    tlssession_clear();
+    TEST_ASSERT(conn.connect(htonl(INADDR_LOOPBACK), listen_port, 1000, &pinned));
+    TEST_ASSERT_EQUAL(before.full + 2, NetConn::tls_stats()->full);
+    conn.stop();
+}
+
+/* Made up sessions, to fill the slots. */
+static void make_session(tlssession_t * session, byte_t id)
+{
+    memset(session, 0, sizeof(tlssession_t));
+    memset(session->id, id, TLSSESSION_ID_MAX);
+    session->id_length = TLSSESSION_ID_MAX;
+    session->version = TLS1_2_VERSION;
+}
+
+void test_session_per_server(void)
+{
+    tlssession_t session, loaded;
+
+    tlssession_clear();
+
+    /* The HTTPS host and the broker on it keep their own sessions. */
+    make_session(&session, 1);
+    TEST_ASSERT(tlssession_save("platform.test", 443, &session));
+    make_session(&session, 2);
+    TEST_ASSERT(tlssession_save("platform.test", 8883, &session));
+    TEST_ASSERT(tlssession_load("platform.test", 443, &loaded));
+    TEST_ASSERT_EQUAL(1, loaded.id[0]);
+    TEST_ASSERT(tlssession_load("platform.test", 8883, &loaded));
+    TEST_ASSERT_EQUAL(2, loaded.id[0]);
+
+    /* A new session replaces the server's own. */
+    make_session(&session, 3);
+    TEST_ASSERT(tlssession_save("platform.test", 443, &session));
+    make_session(&session, 4);
+    TEST_ASSERT(tlssession_save("backup.test", 443, &session));
+    TEST_ASSERT(tlssession_load("platform.test", 443, &loaded));
+    TEST_ASSERT_EQUAL(3, loaded.id[0]);
+    TEST_ASSERT(tlssession_load("platform.test", 8883, &loaded));
+
+    /* Past the slots, the one saved longest ago gives way. */
+    make_session(&session, 5);
+    TEST_ASSERT(tlssession_save("other.test", 443, &session));
+    TEST_ASSERT_FALSE(tlssession_load("platform.test", 8883, &loaded));
+    TEST_ASSERT(tlssession_load("platform.test", 443, &loaded));
+    TEST_ASSERT(tlssession_load("backup.test", 443, &loaded));
+    TEST_ASSERT(tlssession_load("other.test", 443, &loaded));
+
+    /* Forgetting one server leaves the others. */
+    TEST_ASSERT(tlssession_forget("backup.test", 443));
+    TEST_ASSERT_FALSE(tlssession_load("backup.test", 443, &loaded));
+    TEST_ASSERT(tlssession_load("platform.test", 443, &loaded));
+
+    tlssession_clear();
+    TEST_ASSERT_FALSE(tlssession_load("platform.test", 443, &loaded));
+}
+
+void test_pin_mismatch(void)
+{
+    netconn_tls_stats_t before;
+    tlssession_t saved;
+    NetConn conn;
+
+    tlssession_clear();
+    before = *NetConn::tls_stats();
+
+    TEST_ASSERT_FALSE(conn.connect(htonl(INADDR_LOOPBACK), listen_port, 1000, &mispinned));
+    TEST_ASSERT_FALSE(conn.is_secure());
+    TEST_ASSERT_EQUAL(before.pin_failures + 1, NetConn::tls_stats()->pin_failures);
+    TEST_ASSERT_EQUAL(before.failed + 1, NetConn::tls_stats()->failed);
+
+    /* Nothing from an untrusted server is kept. */
+    TEST_ASSERT_FALSE(tlssession_load("127.0.0.1", listen_port, &saved));
+}
+
+void test_https_post(void)
+{
+    char_t payload[128];
+    HTTPer httper("127.0.0.1", listen_port, "/patient/request1");
+    uint32_t reused;
+
+    httper.set_tls(&pinned);
+    httper.push_parameter("device_id", "d-1");
+
+    TEST_ASSERT_EQUAL(HTTPer::STATUS_OK, httper.send_post(payload, sizeof(payload)));
+    TEST_ASSERT_EQUAL_STRING(kIssueBody, payload);
+
+    /* The secured connection is kept alive, and only reused for TLS. */
+    reused = ConnPool::get_instance()->reused_count();
+    TEST_ASSERT_EQUAL(HTTPer::STATUS_OK, httper.send_post(payload, sizeof(payload)));
+    TEST_ASSERT_EQUAL(reused + 1, ConnPool::get_instance()->reused_count());
+    TEST_ASSERT_FALSE(ConnPool::get_instance()->has_idle("127.0.0.1", listen_port));
+    TEST_ASSERT(ConnPool::get_instance()->has_idle("127.0.0.1", listen_port, &pinned));
+
+    ConnPool::get_instance()->drop("127.0.0.1", listen_port);
+}
+
+void test_tls_room(void)
+{
+    NetConn first, second, refused;
+
+    TEST_ASSERT_EQUAL(0, NetConn::tls_open());
+    TEST_ASSERT(NetConn::tls_room());
+
+    TEST_ASSERT(first.connect(htonl(INADDR_LOOPBACK), listen_port, 1000, &pinned));
+    TEST_ASSERT(second.connect(htonl(INADDR_LOOPBACK), listen_port, 1000, &pinned));
+    TEST_ASSERT_EQUAL(2, NetConn::tls_open());
+    TEST_ASSERT_FALSE(NetConn::tls_room());
+
+    /* Only a secured connection counts, once. */
+    tlssession_clear();
+    TEST_ASSERT_FALSE(refused.connect(htonl(INADDR_LOOPBACK), listen_port, 1000, &mispinned));
+    TEST_ASSERT_EQUAL(2, NetConn::tls_open());
+    second.stop();
+    second.stop();
+    TEST_ASSERT_EQUAL(1, NetConn::tls_open());
+    TEST_ASSERT(NetConn::tls_room());
+
+    first.stop();
+    TEST_ASSERT_EQUAL(0, NetConn::tls_open());
+}
+
+/*
+ *  Benchmarks
+ */
+
+void test_bench_handshakes(void)
+{
+    netconn_tls_stats_t before, full;
+    uint32_t full_ms, resumed_ms;
+    NetConn conn;
+    char_t report[160];
+    uint16_t i;
+
+    before = *NetConn::tls_stats();
+    for (i = 0; i < BENCH_HANDSHAKES; i++)
+    {
+        tlssession_clear();
+        TEST_ASSERT(conn.connect(htonl(INADDR_LOOPBACK), listen_port, 1000, &pinned));
+        conn.stop();
+    }
+    full = *NetConn::tls_stats();
+    for (i = 0; i < BENCH_HANDSHAKES; i++)
+    {
+        TEST_ASSERT(conn.connect(htonl(INADDR_LOOPBACK), listen_port, 1000, &pinned));
+        conn.stop();
+    }
+
+    TEST_ASSERT_EQUAL(before.full + BENCH_HANDSHAKES, full.full);
+    TEST_ASSERT_EQUAL(full.resumed + BENCH_HANDSHAKES, NetConn::tls_stats()->resumed);
+
+    full_ms = full.full_ms - before.full_ms;
+    resumed_ms = NetConn::tls_stats()->resumed_ms - full.resumed_ms;
+    snprintf(report, sizeof(report),
+        "%u handshakes each: full %u ms total, resumed %u ms total",
+        BENCH_HANDSHAKES, full_ms, resumed_ms);
+    TEST_MESSAGE(report);
+}
+
+int main(int argc, char ** argv)
+{
+    /* Server threads may still be shutting down when main() returns. */
+    OPENSSL_init_ssl(OPENSSL_INIT_NO_ATEXIT, NULL);
+    if (!start_server()) return 1;
+
+    UNITY_BEGIN();
+
+    RUN_TEST(test_full_then_resumed);
+    RUN_TEST(test_session_per_server);
+    RUN_TEST(test_pin_mismatch);
+    RUN_TEST(test_https_post);
+    RUN_TEST(test_tls_room);
+    RUN_TEST(test_bench_handshakes);
+
+    tlssession_clear();
+    return UNITY_END();
+}
+
+#endif /* UNIT_TEST */
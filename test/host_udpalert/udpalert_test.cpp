@@ -0,0 +1,455 @@
+/*
+ *  Module: UdpAlert - Host Test & Benchmark
+ *
+ *  Sends alerts to a local stand-in platform which acknowledges
+ *  them, drops some, delays them or forges its acknowledgements.
+ *
+ *  Author: Alex Dale @superoxigen
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for information.
+ */
+
+#ifdef UNIT_TEST
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "unity.h"
+#include "utils.h"
+
+#include "clock.h"
+#include "hwrng.h"
+#include "siphash.h"
+#include "udpalert.hpp"
+#include "uuid.h"
+#include "wiremsg.h"
+
+#define BENCH_ALERTS        1000
+#define BENCH_LOSS_ALERTS   100
+#define BENCH_LOSS_PERCENT  20
+#define SERVER_DELAY_US     30000
+#define SHORT_BUDGET_MS     200
+
+static kstring_t kDeviceID = "7c9e6679-7425-40de-944b-e07fc1f90ae7";
+static kstring_t kIssueID = "0f8fad5b-d9cb-469f-a165-70867728950e";
+
+static byte_t const kKey[SIPHASH_KEY_LENGTH] = {
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+    0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f
+};
+
+/*
+ *  Stand-in Platform
+ */
+
+static int server_fd = -1;
+static uint16_t server_port = 0;
+
+/* Behaviour, set by each test. */
+static uint32_t volatile drop_next = 0;
+static uint32_t volatile loss_percent = 0;
+static uint32_t volatile delay_us = 0;
+static bool_t volatile forge = false;
+static bool_t volatile wrong_alert = false;
+static bool_t volatile silent = false;
+
+/* What was received. */
+static uint32_t volatile received = 0;
+static uint32_t volatile bad_tags = 0;
+static uint8_t volatile last_attempt = 0;
+static byte_t last_alert_id[UUID_BINARY_LENGTH];
+static bool_t volatile alert_id_changed = false;
+
+static void reset_server(void)
+{
+    drop_next = 0;
+    loss_percent = 0;
+    delay_us = 0;
+    forge = false;
+    wrong_alert = false;
+    silent = false;
+    received = 0;
+    bad_tags = 0;
+    alert_id_changed = false;
+    memset(last_alert_id, 0, sizeof(last_alert_id));
+}
+
+static void * serve(void *)
+{
+    byte_t datagram[64];
+    struct sockaddr_in from;
+    socklen_t from_length;
+    uint16_t alert_length, length;
+    wiremsg_t msg, ack;
+    ssize_t n;
+
+    alert_length = wiremsg_length(WIREMSG_ALERT);
+    while (true)
+    {
+        from_length = sizeof(from);
+        n = recvfrom(server_fd, datagram, sizeof(datagram), 0,
+            (struct sockaddr *) &from, &from_length);
+        if (n < 0) break;
+
+        if (n != alert_length + SIPHASH_TAG_LENGTH
+            || !siphash_verify(kKey, datagram, alert_length, &datagram[alert_length])
+            || !wiremsg_decode(&msg, datagram, alert_length))
+        {
+            bad_tags++;
+            continue;
+        }
+
+        if (received && memcmp(last_alert_id, msg.alert_id, UUID_BINARY_LENGTH))
+        {
+            alert_id_changed = true;
+        }
+        memcpy(last_alert_id, msg.alert_id, UUID_BINARY_LENGTH);
+        last_attempt = msg.attempt;
+        received++;
+
+        if (drop_next)
+        {
+            drop_next--;
+            continue;
+        }
+        if (loss_percent && (uint32_t) (rand() % 100) < loss_percent) continue;
+        if (silent) continue;
+        if (delay_us) usleep(delay_us);
+
+        memset(&ack, 0, sizeof(ack));
+        ack.type = WIREMSG_ALERT_ACK;
+        memcpy(ack.alert_id, msg.alert_id, UUID_BINARY_LENGTH);
+        if (wrong_alert) ack.alert_id[0] ^= 0x01;
+        ack.attempt = msg.attempt;
+        uuid_to_binary(kIssueID, ack.issue_id);
+        length = wiremsg_encode(&ack, datagram, sizeof(datagram));
+        siphash_tag(kKey, datagram, length, &datagram[length]);
+        if (forge) datagram[length] ^= 0x01;
+
+        sendto(server_fd, datagram, length + SIPHASH_TAG_LENGTH, 0,
+            (struct sockaddr *) &from, from_length);
+    }
+    return NULL;
+}
+
+static bool_t start_server(void)
+{
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    pthread_t thread;
+
+    server_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (server_fd < 0
+        || bind(server_fd, (struct sockaddr *) &addr, sizeof(addr))
+        || getsockname(server_fd, (struct sockaddr *) &addr, &addr_len))
+    {
+        return false;
+    }
+    server_port = ntohs(addr.sin_port);
+    return !pthread_create(&thread, NULL, serve, NULL);
+}
+
+/* Whether the ID is the one the stand-in acknowledges with. */
+static bool_t is_issue(uuid_kref_t issue_id)
+{
+    uuid_t expected;
+
+    return uuid_to_binary(kIssueID, expected) && uuid_equal(expected, issue_id);
+}
+
+/*
+ *  Test Cases
+ */
+
+void test_siphash_vectors(void)
+{
+    byte_t message[15];
+    byte_t tag[SIPHASH_TAG_LENGTH];
+    uint8_t i;
+
+    /* From the SipHash paper and reference implementation. */
+    for (i = 0; i < sizeof(message); i++) message[i] = i;
+    TEST_ASSERT(siphash24(kKey, message, 15) == 0xa129ca6149be45e5ULL);
+    TEST_ASSERT(siphash24(kKey, message, 0) == 0x726fdb47dd0e0e31ULL);
+    TEST_ASSERT(siphash24(kKey, message, 8) == 0x93f5f5799a932462ULL);
+
+    siphash_tag(kKey, message, 15, tag);
+    TEST_ASSERT_EQUAL_HEX8(0xe5, tag[0]);
+    TEST_ASSERT(siphash_verify(kKey, message, 15, tag));
+    tag[7] ^= 0x80;
+    TEST_ASSERT_FALSE(siphash_verify(kKey, message, 15, tag));
+}
+
+void test_not_configured(void)
+{
+    UdpAlert alert;
+    byte_t alert_id[UUID_BINARY_LENGTH];
+    uuid_t issue_id;
+
+    hwrng_uuid(alert_id);
+    TEST_ASSERT_FALSE(alert.is_configured());
+    TEST_ASSERT_FALSE(alert.send_help("127.0.0.1", alert_id, issue_id));
+    TEST_ASSERT_FALSE(alert.init(kKey, server_port, "not-a-uuid", 1));
+    TEST_ASSERT_FALSE(alert.init(kKey, 0, kDeviceID, 1));
+}
+
+void test_random_alert_id(void)
+{
+    byte_t first[UUID_BINARY_LENGTH], second[UUID_BINARY_LENGTH];
+    uuid_str_t uuid;
+
+    hwrng_uuid(first);
+    hwrng_uuid(second);
+    TEST_ASSERT(memcmp(first, second, UUID_BINARY_LENGTH));
+
+    uuid_from_binary(uuid, first);
+    TEST_ASSERT(uuid_is_uuid(uuid));
+    TEST_ASSERT_EQUAL('4', uuid[14]);
+    TEST_ASSERT(strchr("89ab", uuid[19]) != NULL);
+}
+
+void test_ack_first_try(void)
+{
+    UdpAlert alert;
+    byte_t alert_id[UUID_BINARY_LENGTH];
+    uuid_t issue_id;
+
+    reset_server();
+    TEST_ASSERT(alert.init(kKey, server_port, kDeviceID, 1));
+    hwrng_uuid(alert_id);
+
+    TEST_ASSERT(alert.send_help("127.0.0.1", alert_id, issue_id));
+    TEST_ASSERT(is_issue(issue_id));
+    TEST_ASSERT_EQUAL(1, received);
+    TEST_ASSERT_EQUAL(0, bad_tags);
+    TEST_ASSERT_EQUAL(1, alert.stats()->sent);
+    TEST_ASSERT_EQUAL(0, alert.stats()->retransmits);
+    TEST_ASSERT_EQUAL(1, alert.stats()->acked);
+    TEST_ASSERT(alert.stats()->last_rtt_us > 0);
+
+    /* A loopback round trip brings the timeout down to its floor. */
+    TEST_ASSERT_EQUAL(UDPALERT_RTO_MIN_MS, alert.rto());
+}
+
+void test_retransmit_on_loss(void)
+{
+    UdpAlert alert;
+    byte_t alert_id[UUID_BINARY_LENGTH];
+    uuid_t issue_id;
+
+    reset_server();
+    drop_next = 2;
+    TEST_ASSERT(alert.init(kKey, server_port, kDeviceID, 1));
+    hwrng_uuid(alert_id);
+
+    TEST_ASSERT(alert.send_help("127.0.0.1", alert_id, issue_id));
+    TEST_ASSERT(is_issue(issue_id));
+
+    /* Every copy is the same alert; the third got through. */
+    TEST_ASSERT_EQUAL(3, received);
+    TEST_ASSERT_FALSE(alert_id_changed);
+    TEST_ASSERT_EQUAL(2, last_attempt);
+    TEST_ASSERT_EQUAL(2, alert.stats()->retransmits);
+
+    /* The echoed attempt times the copy which got through, not the first. */
+    TEST_ASSERT(alert.stats()->last_rtt_us < UDPALERT_RTO_INITIAL_MS * 1000UL);
+}
+
+void test_forged_ack_rejected(void)
+{
+    UdpAlert alert;
+    byte_t alert_id[UUID_BINARY_LENGTH];
+    uuid_t issue_id;
+    time_ms_t start, elapsed;
+
+    reset_server();
+    forge = true;
+    TEST_ASSERT(alert.init(kKey, server_port, kDeviceID, 1));
+    hwrng_uuid(alert_id);
+
+    start = clock_millis();
+    TEST_ASSERT_FALSE(alert.send_help("127.0.0.1", alert_id, issue_id, SHORT_BUDGET_MS));
+    elapsed = clock_millis() - start;
+
+    /* Left for HTTP once the budget is spent, and not much later. */
+    TEST_ASSERT(elapsed >= SHORT_BUDGET_MS);
+    TEST_ASSERT(elapsed < SHORT_BUDGET_MS + 50);
+    TEST_ASSERT(alert.stats()->rejected >= 1);
+    TEST_ASSERT_EQUAL(1, alert.stats()->unacked);
+    TEST_ASSERT_EQUAL(0, alert.stats()->acked);
+
+    /* The unanswered timeout is kept, backed off. */
+    TEST_ASSERT_EQUAL(UDPALERT_RTO_INITIAL_MS * 2, alert.rto());
+}
+
+void test_other_alert_rejected(void)
+{
+    UdpAlert alert;
+    byte_t alert_id[UUID_BINARY_LENGTH];
+    uuid_t issue_id;
+
+    reset_server();
+    TEST_ASSERT(alert.init(kKey, server_port, kDeviceID, 1));
+    hwrng_uuid(alert_id);
+
+    /* Properly tagged, but for another alert. */
+    wrong_alert = true;
+    TEST_ASSERT_FALSE(alert.send_help("127.0.0.1", alert_id, issue_id, SHORT_BUDGET_MS));
+    TEST_ASSERT_EQUAL(alert.stats()->sent, alert.stats()->rejected);
+
+    wrong_alert = false;
+    TEST_ASSERT(alert.send_help("127.0.0.1", alert_id, issue_id));
+    TEST_ASSERT_EQUAL(1, alert.stats()->acked);
+}
+
+void test_polled(void)
+{
+    UdpAlert alert;
+    byte_t alert_id[UUID_BINARY_LENGTH];
+    uuid_t issue_id;
+    udpalert_status_t status;
+    time_ms_t start;
+    uint32_t polls;
+
+    reset_server();
+    delay_us = SERVER_DELAY_US;
+    TEST_ASSERT(alert.init(kKey, server_port, kDeviceID, 1));
+    hwrng_uuid(alert_id);
+
+    /* Sent on the first poll, and no poll waits for the acknowledgement. */
+    TEST_ASSERT(alert.start_help("127.0.0.1", alert_id));
+    polls = 0;
+    do
+    {
+        start = clock_millis();
+        status = alert.poll_help(issue_id);
+        TEST_ASSERT(clock_millis() - start < 5);
+        polls++;
+        usleep(1000);
+    } while (status == UDPALERT_PENDING);
+    TEST_ASSERT_EQUAL(UDPALERT_ACKED, status);
+    TEST_ASSERT(is_issue(issue_id));
+    TEST_ASSERT(polls > 1);
+    TEST_ASSERT_EQUAL(1, alert.stats()->acked);
+
+    /* One abandoned is not polled on. */
+    TEST_ASSERT(alert.start_help("127.0.0.1", alert_id));
+    alert.cancel_help();
+    TEST_ASSERT_EQUAL(UDPALERT_UNACKED, alert.poll_help(issue_id));
+    delay_us = 0;
+}
+
+void test_rto_adapts(void)
+{
+    UdpAlert alert;
+    byte_t alert_id[UUID_BINARY_LENGTH];
+    uuid_t issue_id;
+    uint32_t retransmits;
+    uint8_t i;
+    char_t report[128];
+
+    reset_server();
+    TEST_ASSERT(alert.init(kKey, server_port, kDeviceID, 1));
+
+    /* Fast at first, then the platform slows to 30 ms. */
+    hwrng_uuid(alert_id);
+    TEST_ASSERT(alert.send_help("127.0.0.1", alert_id, issue_id));
+    TEST_ASSERT_EQUAL(UDPALERT_RTO_MIN_MS, alert.rto());
+
+    delay_us = SERVER_DELAY_US;
+    for (i = 0; i < 10; i++)
+    {
+        hwrng_uuid(alert_id);
+        TEST_ASSERT(alert.send_help("127.0.0.1", alert_id, issue_id));
+    }
+    TEST_ASSERT(alert.srtt_us() > SERVER_DELAY_US * 8 / 10);
+    TEST_ASSERT(alert.rto() > SERVER_DELAY_US / 1000);
+
+    /* Having adapted, it no longer sends needless copies. */
+    retransmits = alert.stats()->retransmits;
+    hwrng_uuid(alert_id);
+    TEST_ASSERT(alert.send_help("127.0.0.1", alert_id, issue_id));
+    TEST_ASSERT_EQUAL(retransmits, alert.stats()->retransmits);
+
+    snprintf(report, sizeof(report),
+        "30 ms platform: srtt %u us, rto %u ms, %u needless copies while adapting",
+        alert.srtt_us(), alert.rto(), retransmits);
+    TEST_MESSAGE(report);
+}
+
+/*
+ *  Benchmarks
+ */
+
+void test_bench_press_to_ack(void)
+{
+    UdpAlert alert;
+    byte_t alert_id[UUID_BINARY_LENGTH];
+    uuid_t issue_id;
+    uint32_t i, start, clean_us, lossy_us, acked;
+    char_t report[192];
+
+    reset_server();
+    TEST_ASSERT(alert.init(kKey, server_port, kDeviceID, 1));
+
+    start = clock_micros();
+    for (i = 0; i < BENCH_ALERTS; i++)
+    {
+        hwrng_uuid(alert_id);
+        alert.send_help("127.0.0.1", alert_id, issue_id);
+    }
+    clean_us = clock_micros() - start;
+    TEST_ASSERT_EQUAL(BENCH_ALERTS, alert.stats()->acked);
+
+    srand(1);
+    loss_percent = BENCH_LOSS_PERCENT;
+    acked = alert.stats()->acked;
+    start = clock_micros();
+    for (i = 0; i < BENCH_LOSS_ALERTS; i++)
+    {
+        hwrng_uuid(alert_id);
+        alert.send_help("127.0.0.1", alert_id, issue_id);
+    }
+    lossy_us = clock_micros() - start;
+    acked = alert.stats()->acked - acked;
+    loss_percent = 0;
+
+    snprintf(report, sizeof(report),
+        "press-to-ack: %u us clean; %u us mean at %u%% loss, "
+        "%u/%u acked, %u copies resent",
+        clean_us / BENCH_ALERTS, lossy_us / BENCH_LOSS_ALERTS, BENCH_LOSS_PERCENT,
+        acked, BENCH_LOSS_ALERTS, alert.stats()->retransmits);
+    TEST_MESSAGE(report);
+}
+
+int main(int argc, char ** argv)
+{
+    if (!start_server()) return 1;
+
+    UNITY_BEGIN();
+
+    RUN_TEST(test_siphash_vectors);
+    RUN_TEST(test_not_configured);
+    RUN_TEST(test_random_alert_id);
+    RUN_TEST(test_ack_first_try);
+    RUN_TEST(test_retransmit_on_loss);
+    RUN_TEST(test_forged_ack_rejected);
+    RUN_TEST(test_other_alert_rejected);
+    RUN_TEST(test_polled);
+    RUN_TEST(test_rto_adapts);
+    RUN_TEST(test_bench_press_to_ack);
+
+    return UNITY_END();
+}
+
+#endif /* UNIT_TEST */
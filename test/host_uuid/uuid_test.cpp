@@ -0,0 +1,463 @@
+/*
+ *  Module: UUID - Host Test & Benchmark
+ *
+ *  Checks the word at a time reading and the table driven writing of
+ *  UUID text against a plain, character at a time reference, over
+ *  a million valid and mutated IDs from a seeded generator, and that
+ *  only hex digits are taken.  Then times each against the
+ *  reference, and equality of the binary form against comparing text.
+ *  Version 7 IDs must each sort after the last, as bytes and as text,
+ *  even when the clock steps back, and be random ones while it is
+ *  not set.
+ *
+ *  Author: Alex Dale @superoxigen
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for information.
+ */
+
+#ifdef UNIT_TEST
+
+#include <stdio.h>
+#include <string.h>
+
+#include "unity.h"
+#include "utils.h"
+
+#include "clock.h"
+#include "hwrng.h"
+#include "uuid.h"
+
+#define FUZZ_CASES          1000000
+#define FUZZ_SEED           0x2545F491
+#define BENCH_IDS           1024
+#define BENCH_ROUNDS        2000
+#define V7_IDS              100000
+
+static kstring_t kIssueID = "0f8fad5b-d9cb-469f-a165-70867728950e";
+
+static uint32_t s_state = FUZZ_SEED;
+
+static uint32_t next_random(void)
+{
+    s_state ^= s_state << 13;
+    s_state ^= s_state >> 17;
+    s_state ^= s_state << 5;
+    return s_state;
+}
+
+/*
+ *  Reference
+ */
+
+static int8_t ref_hex_value(char_t c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+static bool_t ref_to_binary(kstring_t text, byte_t * binary)
+{
+    static uint8_t const groups[] = { 8, 4, 4, 4, 12 };
+    int8_t high, low;
+    uint8_t g, i, n;
+
+    n = 0;
+    for (g = 0; g < sizeof(groups); g++)
+    {
+        if (g && *text++ != '-') return false;
+        for (i = 0; i < groups[g]; i += 2)
+        {
+            high = ref_hex_value(*text++);
+            if (high < 0) return false;
+            low = ref_hex_value(*text++);
+            if (low < 0) return false;
+            binary[n++] = (byte_t) ((high << 4) | low);
+        }
+    }
+    return !*text;
+}
+
+static void ref_from_binary(char_t * text, byte_t const * binary)
+{
+    static char_t const digits[] = "0123456789abcdef";
+    uint8_t i;
+
+    for (i = 0; i < UUID_BINARY_LENGTH; i++)
+    {
+        if (i == 4 || i == 6 || i == 8 || i == 10) *text++ = '-';
+        *text++ = digits[binary[i] >> 4];
+        *text++ = digits[binary[i] & 0x0F];
+    }
+    *text = '\0';
+}
+
+static void random_id(byte_t * id)
+{
+    uint8_t i;
+
+    for (i = 0; i < UUID_BINARY_LENGTH; i++)
+    {
+        id[i] = (byte_t) next_random();
+    }
+}
+
+/* A character most likely to be mistaken for, or next to, a digit. */
+static char_t random_char(void)
+{
+    static char_t const near[] = "/09:@AFGaf`gzZ-\x7f";
+
+    switch (next_random() % 3)
+    {
+        case 0:
+            return near[next_random() % (sizeof(near) - 1)];
+        case 1:
+            /* With the high bit, over a digit or letter. */
+            return (char_t) (near[next_random() % (sizeof(near) - 1)] | 0x80);
+        default:
+            return (char_t) (next_random() % 255 + 1);
+    }
+}
+
+/* The text of an ID, in mixed case, with up to three faults. */
+static void random_text(char_t * text)
+{
+    byte_t id[UUID_BINARY_LENGTH];
+    uint8_t faults, i, at;
+
+    random_id(id);
+    ref_from_binary(text, id);
+    for (i = 0; i < UUID_BUFFER_LENGTH - 1; i++)
+    {
+        if (text[i] >= 'a' && (next_random() & 1)) text[i] -= 'a' - 'A';
+    }
+
+    faults = next_random() % 4;
+    for (i = 0; i < faults; i++)
+    {
+        at = next_random() % (UUID_BUFFER_LENGTH - 1);
+        switch (next_random() % 8)
+        {
+            case 0:
+                text[at] = '\0';
+                break;
+            case 1:
+                /* One too long. */
+                text[UUID_BUFFER_LENGTH - 1] = random_char();
+                text[UUID_BUFFER_LENGTH] = '\0';
+                break;
+            default:
+                text[at] = random_char();
+                break;
+        }
+    }
+}
+
+/*
+ *  Test Cases
+ */
+
+void test_fuzz_against_reference(void)
+{
+    char_t text[UUID_BUFFER_LENGTH + 1];
+    byte_t expected[UUID_BINARY_LENGTH], actual[UUID_BINARY_LENGTH];
+    uint32_t i, valid;
+    bool_t ok;
+
+    valid = 0;
+    for (i = 0; i < FUZZ_CASES; i++)
+    {
+        random_text(text);
+        ok = ref_to_binary(text, expected);
+        TEST_ASSERT_EQUAL(ok, uuid_to_binary(text, actual));
+        TEST_ASSERT_EQUAL(ok, uuid_is_uuid(text));
+        if (ok)
+        {
+            TEST_ASSERT_EQUAL_MEMORY(expected, actual, UUID_BINARY_LENGTH);
+            valid++;
+        }
+    }
+
+    /* Enough of each to mean something. */
+    TEST_ASSERT(valid > FUZZ_CASES / 5 && valid < FUZZ_CASES * 4 / 5);
+}
+
+void test_format_against_reference(void)
+{
+    char_t expected[UUID_BUFFER_LENGTH], actual[UUID_BUFFER_LENGTH];
+    byte_t id[UUID_BINARY_LENGTH], back[UUID_BINARY_LENGTH];
+    uint32_t i;
+
+    for (i = 0; i < FUZZ_CASES / 4; i++)
+    {
+        random_id(id);
+        ref_from_binary(expected, id);
+        uuid_from_binary(actual, id);
+        TEST_ASSERT_EQUAL_STRING(expected, actual);
+        TEST_ASSERT(uuid_to_binary(actual, back));
+        TEST_ASSERT_EQUAL_MEMORY(id, back, UUID_BINARY_LENGTH);
+    }
+}
+
+void test_only_hex(void)
+{
+    char_t text[UUID_BUFFER_LENGTH];
+    byte_t id[UUID_BINARY_LENGTH];
+    uint16_t c;
+
+    for (c = 1; c < 256; c++)
+    {
+        strcpy(text, kIssueID);
+        text[35] = (char_t) c;
+        TEST_ASSERT_EQUAL(ref_hex_value((char_t) c) >= 0, uuid_is_uuid(text));
+    }
+    TEST_ASSERT_FALSE(uuid_is_uuid("0f8fad5b-d9cb-469f-a165-70867728950g"));
+    TEST_ASSERT_FALSE(uuid_is_uuid("0f8fad5bxd9cb-469f-a165-70867728950e"));
+    TEST_ASSERT_FALSE(uuid_is_uuid(""));
+    TEST_ASSERT_FALSE(uuid_is_uuid(NULL));
+    TEST_ASSERT_FALSE(uuid_to_binary(kIssueID, NULL));
+    TEST_ASSERT(uuid_to_binary(kIssueID, id));
+    TEST_ASSERT_EQUAL_HEX8(0x0f, id[0]);
+    TEST_ASSERT_EQUAL_HEX8(0x0e, id[15]);
+}
+
+void test_zero_and_equal(void)
+{
+    uuid_t a, b;
+    uint8_t i;
+
+    uuid_set_zero(a);
+    TEST_ASSERT(uuid_is_zero(a));
+    TEST_ASSERT(uuid_to_binary(kZeroUUID, b));
+    TEST_ASSERT(uuid_equal(a, b));
+    TEST_ASSERT_FALSE(uuid_is_zero(NULL));
+
+    TEST_ASSERT(uuid_to_binary(kIssueID, a));
+    TEST_ASSERT_FALSE(uuid_is_zero(a));
+    for (i = 0; i < UUID_BINARY_LENGTH; i++)
+    {
+        memcpy(b, a, sizeof(b));
+        TEST_ASSERT(uuid_equal(a, b));
+        b[i] ^= 0x01;
+        TEST_ASSERT_FALSE(uuid_equal(a, b));
+        uuid_set_zero(b);
+        b[i] = 0x80;
+        TEST_ASSERT_FALSE(uuid_is_zero(b));
+    }
+    TEST_ASSERT_FALSE(uuid_equal(a, NULL));
+}
+
+static uint64_t v7_millis(byte_t const * id)
+{
+    uint64_t millis = 0;
+    uint8_t i;
+
+    for (i = 0; i < 6; i++)
+    {
+        millis = (millis << 8) | id[i];
+    }
+    return millis;
+}
+
+void test_v7_ordered(void)
+{
+    uuid_t last, id;
+    uuid_str_t last_text, text;
+    uint64_t before, after;
+    uint32_t i;
+
+    before = clock_unix_millis();
+    uuid_v7(last);
+    uuid_from_binary(last_text, last);
+    for (i = 0; i < V7_IDS; i++)
+    {
+        uuid_v7(id);
+        TEST_ASSERT_EQUAL_HEX8(0x70, id[6] & 0xF0);
+        TEST_ASSERT_EQUAL_HEX8(0x80, id[8] & 0xC0);
+        TEST_ASSERT(memcmp(last, id, sizeof(id)) < 0);
+
+        uuid_from_binary(text, id);
+        TEST_ASSERT(strcmp(last_text, text) < 0);
+        memcpy(last, id, sizeof(id));
+        memcpy(last_text, text, sizeof(text));
+    }
+    after = clock_unix_millis();
+
+    /* Borrowing a millisecond may run ahead, but only by what was counted out. */
+    TEST_ASSERT(v7_millis(id) >= before);
+    TEST_ASSERT(v7_millis(id) <= after + V7_IDS / 0x0E00);
+}
+
+void test_v7_clock_back(void)
+{
+    uuid_t first, id;
+    uint64_t now;
+
+    now = clock_unix_millis();
+    uuid_v7(first);
+
+    /* As when the device is told a time behind its own. */
+    clock_set_unix_millis(now - 60000);
+    uuid_v7(id);
+    TEST_ASSERT(memcmp(first, id, sizeof(id)) < 0);
+    TEST_ASSERT(v7_millis(id) >= v7_millis(first));
+
+    clock_set_unix_millis(now + 60000);
+    uuid_v7(id);
+    TEST_ASSERT(v7_millis(id) >= now + 60000);
+    clock_set_unix_millis(clock_unix_millis() - 60000);
+}
+
+/* An uptime is no time to order by, so an unset clock gives random IDs. */
+void test_v7_unset_clock(void)
+{
+    uuid_t last, id;
+    uint64_t now;
+
+    now = clock_unix_millis();
+    uuid_v7(last);
+
+    clock_set_unix_millis(0);
+    TEST_ASSERT_FALSE(clock_unix_is_set());
+    uuid_v7(id);
+    TEST_ASSERT_EQUAL_HEX8(0x40, id[6] & 0xF0);
+    TEST_ASSERT_EQUAL_HEX8(0x80, id[8] & 0xC0);
+
+    /* Once set, ordered again, after those made before. */
+    clock_set_unix_millis(now);
+    TEST_ASSERT(clock_unix_is_set());
+    uuid_v7(id);
+    TEST_ASSERT_EQUAL_HEX8(0x70, id[6] & 0xF0);
+    TEST_ASSERT(memcmp(last, id, sizeof(id)) < 0);
+}
+
+/*
+ *  Benchmark
+ */
+
+static char_t s_texts[BENCH_IDS][UUID_BUFFER_LENGTH];
+static byte_t s_ids[BENCH_IDS][UUID_BINARY_LENGTH];
+static volatile uint32_t s_sink;
+
+/* Nanoseconds for each of the calls the rounds make. */
+static uint32_t per_call_ns(time_us_t started)
+{
+    return (uint32_t) ((uint64_t) (clock_micros() - started) * 1000
+        / ((uint64_t) BENCH_IDS * BENCH_ROUNDS));
+}
+
+void test_bench(void)
+{
+    byte_t id[UUID_BINARY_LENGTH];
+    char_t text[UUID_BUFFER_LENGTH];
+    uint32_t ns[8], sink, i, r;
+    time_us_t started;
+    char_t report[128];
+
+    for (i = 0; i < BENCH_IDS; i++)
+    {
+        random_id(s_ids[i]);
+        ref_from_binary(s_texts[i], s_ids[i]);
+    }
+
+    sink = 0;
+    started = clock_micros();
+    for (r = 0; r < BENCH_ROUNDS; r++)
+        for (i = 0; i < BENCH_IDS; i++) sink += ref_to_binary(s_texts[i], id) + id[r & 15];
+    ns[0] = per_call_ns(started);
+
+    started = clock_micros();
+    for (r = 0; r < BENCH_ROUNDS; r++)
+        for (i = 0; i < BENCH_IDS; i++) sink += uuid_to_binary(s_texts[i], id) + id[r & 15];
+    ns[1] = per_call_ns(started);
+
+    started = clock_micros();
+    for (r = 0; r < BENCH_ROUNDS; r++)
+        for (i = 0; i < BENCH_IDS; i++)
+        {
+            ref_from_binary(text, s_ids[(i + r) % BENCH_IDS]);
+            sink += text[r % 36];
+        }
+    ns[2] = per_call_ns(started);
+
+    started = clock_micros();
+    for (r = 0; r < BENCH_ROUNDS; r++)
+        for (i = 0; i < BENCH_IDS; i++)
+        {
+            uuid_from_binary(text, s_ids[(i + r) % BENCH_IDS]);
+            sink += text[r % 36];
+        }
+    ns[3] = per_call_ns(started);
+
+    /* Equal IDs, as an alert is matched against its own, the worst case for text. */
+    started = clock_micros();
+    for (r = 0; r < BENCH_ROUNDS; r++)
+        for (i = 0; i < BENCH_IDS; i++)
+        {
+            sink += !strncmp(s_texts[i], s_texts[(i + (r & 1)) % BENCH_IDS], UUID_BUFFER_LENGTH);
+        }
+    ns[4] = per_call_ns(started);
+
+    started = clock_micros();
+    for (r = 0; r < BENCH_ROUNDS; r++)
+        for (i = 0; i < BENCH_IDS; i++)
+        {
+            sink += uuid_equal(s_ids[i], s_ids[(i + (r & 1)) % BENCH_IDS]);
+        }
+    ns[5] = per_call_ns(started);
+
+    started = clock_micros();
+    for (r = 0; r < BENCH_ROUNDS / 8; r++)
+        for (i = 0; i < BENCH_IDS; i++)
+        {
+            hwrng_uuid(id);
+            sink += id[r & 15];
+        }
+    ns[6] = per_call_ns(started) * 8;
+
+    started = clock_micros();
+    for (r = 0; r < BENCH_ROUNDS / 8; r++)
+        for (i = 0; i < BENCH_IDS; i++)
+        {
+            uuid_v7(id);
+            sink += id[r & 15];
+        }
+    ns[7] = per_call_ns(started) * 8;
+    s_sink = sink;
+
+    snprintf(report, sizeof(report), "parse   reference %3u ns   word at a time %3u ns",
+        ns[0], ns[1]);
+    TEST_MESSAGE(report);
+    snprintf(report, sizeof(report), "format  reference %3u ns   pair table     %3u ns",
+        ns[2], ns[3]);
+    TEST_MESSAGE(report);
+    snprintf(report, sizeof(report), "equal   text      %3u ns   binary         %3u ns",
+        ns[4], ns[5]);
+    TEST_MESSAGE(report);
+    snprintf(report, sizeof(report), "make    random    %3u ns   version 7      %3u ns",
+        ns[6], ns[7]);
+    TEST_MESSAGE(report);
+
+    TEST_ASSERT(ns[1] <= ns[0]);
+    TEST_ASSERT(ns[3] <= ns[2]);
+}
+
+int main(int argc, char ** argv)
+{
+    UNITY_BEGIN();
+
+    RUN_TEST(test_fuzz_against_reference);
+    RUN_TEST(test_format_against_reference);
+    RUN_TEST(test_only_hex);
+    RUN_TEST(test_zero_and_equal);
+    RUN_TEST(test_v7_ordered);
+    RUN_TEST(test_v7_clock_back);
+    RUN_TEST(test_v7_unset_clock);
+    RUN_TEST(test_bench);
+
+    return UNITY_END();
+}
+
+#endif /* UNIT_TEST */
@@ -0,0 +1,274 @@
+/*
+ *  Module: Wire Message - Host Test & Benchmark
+ *
+ *  Checks the binary messages round trip and that malformed ones are
+ *  refused, then compares them with the form and JSON encoding on
+ *  size and time.
+ *
+ *  Author: Alex Dale @superoxigen
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for information.
+ */
+
+#ifdef UNIT_TEST
+
+#include <stdio.h>
+#include <string.h>
+
+#include "unity.h"
+#include "utils.h"
+
+#include "clock.h"
+#include "httper.hpp"
+#include "jsonpull.h"
+#include "uuid.h"
+#include "wiremsg.h"
+
+#define BENCH_ROUNDS    200000
+
+static kstring_t kDeviceID = "7c9e6679-7425-40de-944b-e07fc1f90ae7";
+static kstring_t kIssueID = "0f8fad5b-d9cb-469f-a165-70867728950e";
+static kstring_t kAlertID = "16fd2706-8baf-433b-82eb-8c7fada847da";
+
+static char_t const kIssueBody[] =
+    "{\"issue_id\":\"0f8fad5b-d9cb-469f-a165-70867728950e\"}";
+
+/*
+ *  Test Cases
+ */
+
+void test_uuid_binary(void)
+{
+    byte_t binary[UUID_BINARY_LENGTH];
+    uuid_str_t uuid;
+
+    TEST_ASSERT(uuid_to_binary(kIssueID, binary));
+    TEST_ASSERT_EQUAL_HEX8(0x0F, binary[0]);
+    TEST_ASSERT_EQUAL_HEX8(0x0E, binary[15]);
+    uuid_from_binary(uuid, binary);
+    TEST_ASSERT_EQUAL_STRING(kIssueID, uuid);
+
+    TEST_ASSERT(uuid_to_binary("0F8FAD5B-D9CB-469F-A165-70867728950E", binary));
+    uuid_from_binary(uuid, binary);
+    TEST_ASSERT_EQUAL_STRING(kIssueID, uuid);
+
+    TEST_ASSERT_FALSE(uuid_to_binary("0f8fad5b-d9cb-469f-a165-70867728950g", binary));
+    TEST_ASSERT_FALSE(uuid_to_binary("0f8fad5b-d9cb-469f-a165-70867728950", binary));
+    TEST_ASSERT_FALSE(uuid_to_binary(NULL, binary));
+}
+
+void test_round_trip(void)
+{
+    static uint8_t const types[] = {
+        WIREMSG_HELP, WIREMSG_CANCEL, WIREMSG_TEST, WIREMSG_ALERT,
+        WIREMSG_HELP_REPLY, WIREMSG_ALERT_ACK};
+    static uint16_t const lengths[] = {36, 34, 18, 37, 18, 35};
+    byte_t buffer[WIREMSG_LENGTH_MAX];
+    wiremsg_t msg, decoded;
+    uint8_t i;
+
+    for (i = 0; i < sizeof(types); i++)
+    {
+        memset(&msg, 0, sizeof(msg));
+        msg.type = types[i];
+        if (msg.type < WIREMSG_HELP_REPLY) uuid_to_binary(kDeviceID, msg.device_id);
+        if (msg.type == WIREMSG_HELP || msg.type == WIREMSG_ALERT) msg.request_type = 0x1234;
+        if (msg.type == WIREMSG_ALERT || msg.type == WIREMSG_ALERT_ACK)
+        {
+            uuid_to_binary(kAlertID, msg.alert_id);
+            msg.attempt = 3;
+        }
+        if (msg.type == WIREMSG_HELP || msg.type == WIREMSG_CANCEL
+            || msg.type == WIREMSG_HELP_REPLY || msg.type == WIREMSG_ALERT_ACK)
+        {
+            uuid_to_binary(kIssueID, msg.issue_id);
+        }
+
+        TEST_ASSERT_EQUAL(lengths[i], wiremsg_encode(&msg, buffer, sizeof(buffer)));
+        TEST_ASSERT_EQUAL(WIREMSG_VERSION, buffer[0]);
+        TEST_ASSERT_EQUAL(types[i], buffer[1]);
+        TEST_ASSERT(wiremsg_decode(&decoded, buffer, lengths[i]));
+        TEST_ASSERT_EQUAL_MEMORY(&msg, &decoded, sizeof(msg));
+
+        /* Too small a buffer is refused, not overrun. */
+        TEST_ASSERT_EQUAL(0, wiremsg_encode(&msg, buffer, lengths[i] - 1));
+    }
+
+    /* Request type is big endian. */
+    memset(&msg, 0, sizeof(msg));
+    msg.type = WIREMSG_HELP;
+    msg.request_type = 0x1234;
+    wiremsg_encode(&msg, buffer, sizeof(buffer));
+    TEST_ASSERT_EQUAL_HEX8(0x12, buffer[18]);
+    TEST_ASSERT_EQUAL_HEX8(0x34, buffer[19]);
+}
+
+void test_malformed(void)
+{
+    byte_t buffer[WIREMSG_LENGTH_MAX];
+    wiremsg_t msg;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.type = WIREMSG_HELP_REPLY;
+    uuid_to_binary(kIssueID, msg.issue_id);
+    wiremsg_encode(&msg, buffer, sizeof(buffer));
+
+    TEST_ASSERT_FALSE(wiremsg_decode(&msg, buffer, 17));
+    TEST_ASSERT_FALSE(wiremsg_decode(&msg, buffer, 19));
+    TEST_ASSERT_FALSE(wiremsg_decode(&msg, buffer, 1));
+    buffer[0] = WIREMSG_VERSION + 1;
+    TEST_ASSERT_FALSE(wiremsg_decode(&msg, buffer, 18));
+    buffer[0] = WIREMSG_VERSION;
+    buffer[1] = 0x7F;
+    TEST_ASSERT_FALSE(wiremsg_decode(&msg, buffer, 18));
+
+    msg.type = 0x7F;
+    TEST_ASSERT_EQUAL(0, wiremsg_encode(&msg, buffer, sizeof(buffer)));
+}
+
+void test_reader(void)
+{
+    byte_t buffer[WIREMSG_LENGTH_MAX + 1];
+    wiremsg_reader_t reader;
+    wiremsg_t msg;
+    uuid_str_t uuid;
+    uint16_t i, length;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.type = WIREMSG_HELP_REPLY;
+    uuid_to_binary(kIssueID, msg.issue_id);
+    length = wiremsg_encode(&msg, buffer, sizeof(buffer));
+
+    /* A byte at a time, as a chunked response may deliver it. */
+    wiremsg_reader_init(&reader);
+    for (i = 0; i < length; i++)
+    {
+        TEST_ASSERT(wiremsg_reader_feed(&reader, &buffer[i], 1));
+    }
+    memset(&msg, 0, sizeof(msg));
+    TEST_ASSERT(wiremsg_reader_decode(&reader, &msg));
+    TEST_ASSERT_EQUAL(WIREMSG_HELP_REPLY, msg.type);
+    uuid_from_binary(uuid, msg.issue_id);
+    TEST_ASSERT_EQUAL_STRING(kIssueID, uuid);
+
+    /* More than any message can be is refused, and stays refused. */
+    wiremsg_reader_init(&reader);
+    TEST_ASSERT(wiremsg_reader_feed(&reader, buffer, WIREMSG_LENGTH_MAX));
+    TEST_ASSERT_FALSE(wiremsg_reader_feed(&reader, buffer, 1));
+    TEST_ASSERT_FALSE(wiremsg_reader_feed(&reader, buffer, 0));
+    TEST_ASSERT_FALSE(wiremsg_reader_decode(&reader, &msg));
+}
+
+/*
+ *  Benchmarks
+ */
+
+void test_bench_request(void)
+{
+    byte_t body[WIREMSG_LENGTH_MAX];
+    byte_t request[512];
+    HTTPer form("127.0.0.1", 80, "/patient/request1");
+    HTTPer binary("127.0.0.1", 80, "/patient/request1");
+    wiremsg_t msg;
+    uint32_t i, start, form_ns, binary_ns;
+    uint16_t form_length, binary_length, body_length;
+    char_t report[192];
+
+    /* The whole request, built from the device's strings each time. */
+    form.push_parameter("device_id", kDeviceID);
+    form.push_parameter("request_type_id", "2");
+    form.push_parameter("issue_id", kIssueID);
+    start = clock_micros();
+    for (i = 0; i < BENCH_ROUNDS; i++)
+    {
+        form_length = form.render_post(request, sizeof(request));
+    }
+    form_ns = (uint32_t) ((clock_micros() - start) * 1000ULL / BENCH_ROUNDS);
+
+    memset(&msg, 0, sizeof(msg));
+    msg.type = WIREMSG_HELP;
+    msg.request_type = 2;
+    start = clock_micros();
+    for (i = 0; i < BENCH_ROUNDS; i++)
+    {
+        uuid_to_binary(kDeviceID, msg.device_id);
+        uuid_to_binary(kIssueID, msg.issue_id);
+        body_length = wiremsg_encode(&msg, body, sizeof(body));
+        binary.set_body(body, body_length, kWiremsgMediaType);
+        binary_length = binary.render_post(request, sizeof(request));
+    }
+    binary_ns = (uint32_t) ((clock_micros() - start) * 1000ULL / BENCH_ROUNDS);
+    TEST_ASSERT(form_length > 0);
+    TEST_ASSERT(binary_length > 0);
+
+    snprintf(report, sizeof(report),
+        "help request: form %u bytes (body %u) in %u ns, binary %u bytes (body %u) in %u ns",
+        form_length, (uint32_t) (sizeof("device_id=&request_type_id=2&issue_id=") - 1
+            + strlen(kDeviceID) + strlen(kIssueID)),
+        form_ns, binary_length, body_length, binary_ns);
+    TEST_MESSAGE(report);
+}
+
+void test_bench_reply(void)
+{
+    byte_t reply[WIREMSG_LENGTH_MAX];
+    wiremsg_reader_t reader;
+    wiremsg_t msg;
+    jsonpull_t parser;
+    jsonpull_field_t field;
+    uuid_str_t json_id, binary_id;
+    uint32_t i, start, json_ns, binary_ns;
+    uint16_t length;
+    char_t report[160];
+
+    start = clock_micros();
+    for (i = 0; i < BENCH_ROUNDS; i++)
+    {
+        field.key = "issue_id";
+        field.value = json_id;
+        field.length = UUID_BUFFER_LENGTH;
+        jsonpull_init(&parser, &field, 1);
+        jsonpull_feed(&parser, (byte_t const *) kIssueBody, sizeof(kIssueBody) - 1);
+    }
+    json_ns = (uint32_t) ((clock_micros() - start) * 1000ULL / BENCH_ROUNDS);
+    TEST_ASSERT_EQUAL(JSONPULL_DONE, jsonpull_status(&parser));
+    TEST_ASSERT(uuid_is_uuid(json_id));
+
+    memset(&msg, 0, sizeof(msg));
+    msg.type = WIREMSG_HELP_REPLY;
+    uuid_to_binary(kIssueID, msg.issue_id);
+    length = wiremsg_encode(&msg, reply, sizeof(reply));
+
+    start = clock_micros();
+    for (i = 0; i < BENCH_ROUNDS; i++)
+    {
+        wiremsg_reader_init(&reader);
+        wiremsg_reader_feed(&reader, reply, length);
+        wiremsg_reader_decode(&reader, &msg);
+        uuid_from_binary(binary_id, msg.issue_id);
+    }
+    binary_ns = (uint32_t) ((clock_micros() - start) * 1000ULL / BENCH_ROUNDS);
+    TEST_ASSERT_EQUAL_STRING(json_id, binary_id);
+
+    snprintf(report, sizeof(report),
+        "help reply: JSON %u bytes in %u ns, binary %u bytes in %u ns",
+        (uint32_t) (sizeof(kIssueBody) - 1), json_ns, length, binary_ns);
+    TEST_MESSAGE(report);
+}
+
+int main(int argc, char ** argv)
+{
+    UNITY_BEGIN();
+
+    RUN_TEST(test_uuid_binary);
+    RUN_TEST(test_round_trip);
+    RUN_TEST(test_malformed);
+    RUN_TEST(test_reader);
+    RUN_TEST(test_bench_request);
+    RUN_TEST(test_bench_reply);
+
+    return UNITY_END();
+}
+
+#endif /* UNIT_TEST */
@@ -0,0 +1,165 @@
+/*
+ *  Module: Stand-in Tool
+ *
+ *  Runs the stand-in platform, for a pendant or the firmware on the
+ *  host to be pointed at, or loads one with the pendant's requests:
+ *
+ *      standin serve [port] [threads] [delay_us] [form]
+ *      standin load <host> <port> <help|binary|cancel|test>
+ *          [concurrency] [requests] [reconnect]
+ *
+ *  A server stops on a newline, and prints what it answered.  The
+ *  requests are rendered by HTTPer, as the Messenger renders them,
+ *  with the device's own ID.  Built on the host, with the sources of
+ *  the native environment in platformio.ini, by:
+ *
+ *      scripts/build_standin.sh [output]
+ *
+ *  Author: Alex Dale @superoxigen
+ *
+ *  Copyright (c) 2018 Alex Dale
+ *  See LICENSE for information.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "httper.hpp"
+#include "konstants.h"
+#include "loadgen.h"
+#include "standin.hpp"
+#include "uuid.h"
+#include "wiremsg.h"
+
+#define TOOL_REQUEST_LENGTH     512
+#define TOOL_TIMEOUT_MS         5000
+
+static kstring_t kZero = "00000000-0000-0000-0000-000000000000";
+
+static int serve(int argc, char ** argv)
+{
+    StandinServer server;
+    standin_config_t config;
+    standin_stats_t stats;
+    char line[16];
+
+    memset(&config, 0, sizeof(config));
+    config.port = (argc > 2) ? (uint16_t) atoi(argv[2]) : 8080;
+    config.threads = (argc > 3) ? (uint8_t) atoi(argv[3]) : 4;
+    config.delay_us = (argc > 4) ? (uint32_t) atoi(argv[4]) : 0;
+    config.binary = !(argc > 5 && !strcmp(argv[5], "form"));
+
+    if (!server.start(&config))
+    {
+        fprintf(stderr, "Failed to start on port %u\n", config.port);
+        return 1;
+    }
+    printf("Listening on port %u, with %u threads\n", server.port(), config.threads);
+    fgets(line, sizeof(line), stdin);
+    server.stop();
+
+    server.read_stats(&stats);
+    printf("help %llu, cancel %llu, test %llu, heartbeat %llu, other %llu\n",
+        (unsigned long long) stats.requests[STANDIN_HELP],
+        (unsigned long long) stats.requests[STANDIN_CANCEL],
+        (unsigned long long) stats.requests[STANDIN_TEST],
+        (unsigned long long) stats.requests[STANDIN_HEARTBEAT],
+        (unsigned long long) stats.requests[STANDIN_OTHER]);
+    printf("issued %llu, binary %llu, bad %llu, connections %llu\n",
+        (unsigned long long) stats.issued, (unsigned long long) stats.binary,
+        (unsigned long long) stats.bad_requests, (unsigned long long) stats.connections);
+    printf("p50 %uus, p90 %uus, p99 %uus, p99.9 %uus\n",
+        StandinServer::percentile_us(&stats, 500), StandinServer::percentile_us(&stats, 900),
+        StandinServer::percentile_us(&stats, 990), StandinServer::percentile_us(&stats, 999));
+    return 0;
+}
+
+/* Renders the request as the Messenger does, with no issue ID, so each is issued one. */
+static uint16_t render(kstring_t host, uint16_t port, kstring_t kind, byte_t * request)
+{
+    static HTTPer::header_set_t accept;
+    byte_t body[WIREMSG_LENGTH_MAX];
+    wiremsg_t msg;
+
+    HTTPer::push_header(&accept, "Accept", "application/vnd.pendant.v1, application/json");
+
+    if (!strcmp(kind, "test"))
+    {
+        HTTPer client(host, port, "/patient/test");
+        client.push_parameter("device_id", kDeviceUUID);
+        return client.render_get(request, TOOL_REQUEST_LENGTH);
+    }
+
+    HTTPer client(host, port, strcmp(kind, "cancel") ? "/patient/request1" : "/patient/request/cancel");
+    client.add_headers(&accept);
+    if (!strcmp(kind, "binary"))
+    {
+        memset(&msg, 0, sizeof(msg));
+        msg.type = WIREMSG_HELP;
+        msg.request_type = (uint16_t) atoi(kHelpRequestType);
+        uuid_to_binary(kDeviceUUID, msg.device_id);
+        client.set_body(body, wiremsg_encode(&msg, body, sizeof(body)), kWiremsgMediaType);
+        return client.render_post(request, TOOL_REQUEST_LENGTH);
+    }
+
+    client.push_parameter("device_id", kDeviceUUID);
+    if (!strcmp(kind, "help"))
+    {
+        client.push_parameter("request_type_id", kHelpRequestType);
+        client.push_parameter("issue_id", kZero);
+    }
+    else
+    {
+        /* A cancel must name an issue. */
+        client.push_parameter("issue_id", kDeviceUUID);
+    }
+    return client.render_post(request, TOOL_REQUEST_LENGTH);
+}
+
+static int load(int argc, char ** argv)
+{
+    byte_t request[TOOL_REQUEST_LENGTH];
+    loadgen_config_t config;
+    loadgen_result_t result;
+
+    if (argc < 5)
+    {
+        fprintf(stderr, "standin load <host> <port> <help|binary|cancel|test> "
+            "[concurrency] [requests] [reconnect]\n");
+        return 1;
+    }
+
+    memset(&config, 0, sizeof(config));
+    config.host = argv[2];
+    config.port = (uint16_t) atoi(argv[3]);
+    config.request = request;
+    config.length = render(config.host, config.port, argv[4], request);
+    config.concurrency = (argc > 5) ? (uint16_t) atoi(argv[5]) : 1;
+    config.requests = (argc > 6) ? (uint32_t) atoi(argv[6]) : 10000;
+    config.reconnect = argc > 7 && !strcmp(argv[7], "reconnect");
+    config.timeout_ms = TOOL_TIMEOUT_MS;
+
+    if (!loadgen_run(&config, &result))
+    {
+        fprintf(stderr, "Failed to load %s:%u\n", config.host, config.port);
+        return 1;
+    }
+    printf("%u answered, %u rejected, %u failed, %u connects in %ums: %u/s\n",
+        result.answered, result.rejected, result.failed, result.connects,
+        result.elapsed_ms, result.per_second);
+    printf("p50 %uus, p90 %uus, p99 %uus, p99.9 %uus, max %uus\n",
+        result.p50_us, result.p90_us, result.p99_us, result.p999_us, result.max_us);
+    return result.failed ? 1 : 0;
+}
+
+int main(int argc, char ** argv)
+{
+    if (argc > 1 && !strcmp(argv[1], "serve")) return serve(argc, argv);
+    if (argc > 1 && !strcmp(argv[1], "load")) return load(argc, argv);
+
+    fprintf(stderr, "standin serve [port] [threads] [delay_us] [form]\n");
+    fprintf(stderr, "standin load <host> <port> <help|binary|cancel|test> "
+        "[concurrency] [requests] [reconnect]\n");
+    return 1;
+}